@@ -0,0 +1,541 @@
+// =============================================
+// bench.cpp
+// ---------------------------------------------
+// vfs_bench: runs the registered benchmarks
+// Handles:
+//   - Timing (BenchState) and iteration calibration
+//   - Repetitions: median, spread, rates, image I/O
+//   - The result table and its JSON form
+//   - Comparing two JSON results (--compare)
+// =============================================
+
+#include "bench.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+constexpr uint64_t BENCH_SEED = 0x5eed0f5eedULL;  // Every random stream derives from it
+constexpr long long MAX_ITERATIONS = 1000000000;  // Calibration stops growing here
+
+struct BenchResult {
+    std::string name;
+    long long iterations = 0;
+    double medianNs = 0;          // Per iteration, over the repetitions
+    double minNs = 0;
+    double maxNs = 0;
+    double cv = 0;                // Standard deviation / mean
+    double itemsPerSecond = 0;
+    double bytesPerSecond = 0;
+    double readsPerOp = 0;        // Image reads per iteration (metrics build)
+    double writesPerOp = 0;
+    std::string skipped;
+};
+
+std::string formatTime(double ns) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(2);
+    if (ns < 1e3) text << ns << " ns";
+    else if (ns < 1e6) text << ns / 1e3 << " us";
+    else if (ns < 1e9) text << ns / 1e6 << " ms";
+    else text << ns / 1e9 << " s";
+    return text.str();
+}
+
+std::string formatRate(const BenchResult& result) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1);
+    if (result.bytesPerSecond > 0) text << result.bytesPerSecond / (1024.0 * 1024.0) << " MB/s";
+    else if (result.itemsPerSecond >= 1e6) text << result.itemsPerSecond / 1e6 << "M items/s";
+    else if (result.itemsPerSecond > 0) text << result.itemsPerSecond / 1e3 << "k items/s";
+    return text.str();
+}
+
+std::string compilerName() {
+#if defined(__clang__)
+    return std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    return std::string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+// Value of "key": in one line of a result file (0 if absent)
+double jsonNumber(const std::string& line, const std::string& key) {
+    size_t pos = line.find("\"" + key + "\":");
+    if (pos == std::string::npos) return 0;
+    return std::strtod(line.c_str() + pos + key.size() + 3, nullptr);
+}
+
+std::string jsonText(const std::string& line, const std::string& key) {
+    size_t pos = line.find("\"" + key + "\":\"");
+    if (pos == std::string::npos) return "";
+    pos += key.size() + 4;
+    return line.substr(pos, line.find('"', pos) - pos);
+}
+
+} // namespace
+
+// -------------------------------------------------
+// BenchState
+// -------------------------------------------------
+// The clock runs from the first keepRunning() call
+// until the loop ends, minus paused stretches. Image
+// reads and writes are counted over the same span.
+// -------------------------------------------------
+bool BenchState::keepRunning() {
+    if (!started_) {
+        started_ = true;
+        resumeTiming();
+    }
+    if (done_ < iterations_) {
+        ++done_;
+        return true;
+    }
+    pauseTiming();
+    return false;
+}
+
+void BenchState::pauseTiming() {
+    if (!timing_) return;
+    elapsed_ += Clock::now() - resumed_;
+    io_[0] += Metrics::instance().value(Counter::ImageReads) - ioStart_[0];
+    io_[1] += Metrics::instance().value(Counter::ImageWrites) - ioStart_[1];
+    timing_ = false;
+}
+
+void BenchState::resumeTiming() {
+    if (timing_) return;
+    ioStart_[0] = Metrics::instance().value(Counter::ImageReads);
+    ioStart_[1] = Metrics::instance().value(Counter::ImageWrites);
+    timing_ = true;
+    resumed_ = Clock::now();
+}
+
+Benchmark* Benchmark::add(const std::string& name, BenchFunction function) {
+    registry().push_back(std::unique_ptr<Benchmark>(new Benchmark(name, function)));
+    return registry().back().get();
+}
+
+std::vector<std::unique_ptr<Benchmark>>& Benchmark::registry() {
+    static std::vector<std::unique_ptr<Benchmark>> benchmarks;
+    return benchmarks;
+}
+
+BenchOptions& BenchOptions::get() {
+    static BenchOptions options;
+    return options;
+}
+
+// -------------------------------------------------
+// BenchImage
+// -------------------------------------------------
+BenchImage::BenchImage(int sizeMB) : path_(benchPath("bench.dat")) {
+    std::error_code ignored;
+    std::filesystem::remove(path_, ignored);
+
+    const BenchOptions& options = BenchOptions::get();
+    fs_ = std::make_unique<FileSystem>(path_, options.useMmap);
+    session_.out = &nullStream();
+    fs_->attachSession(session_);
+    ok_ = fs_->format(sizeMB, options.clusterSize) == Status::Ok;
+}
+
+BenchImage::~BenchImage() {
+    fs_->detachSession(session_);
+    fs_.reset();
+    std::error_code ignored;
+    std::filesystem::remove(path_, ignored);
+}
+
+std::mt19937_64 benchRandom(uint64_t stream) {
+    return std::mt19937_64(BENCH_SEED ^ (stream * 0x9e3779b97f4a7c15ULL));
+}
+
+std::string benchPath(const std::string& name) {
+    return (std::filesystem::path(BenchOptions::get().directory) / name).string();
+}
+
+bool writeHostFile(const std::string& path, long long size, uint64_t stream) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+
+    std::mt19937_64 random = benchRandom(stream);
+    std::vector<uint64_t> words(128 * 1024);
+    for (long long written = 0; written < size;) {
+        for (uint64_t& word : words) word = random();
+        const long long chunk = std::min<long long>(size - written, static_cast<long long>(words.size() * sizeof(uint64_t)));
+        file.write(reinterpret_cast<const char*>(words.data()), chunk);
+        written += chunk;
+    }
+    return static_cast<bool>(file);
+}
+
+std::ostream& nullStream() {
+    static std::ostream stream(nullptr);
+    return stream;
+}
+
+// -------------------------------------------------
+// BenchRunner
+// -------------------------------------------------
+// Calibration doubles the work (or scales it by the
+// measured time) until one run takes minTime, then
+// the benchmark is repeated with that iteration
+// count. Benchmarks with fixed iterations skip the
+// calibration. The median of the repetitions is
+// the reported time.
+// -------------------------------------------------
+class BenchRunner {
+public:
+    BenchRunner(double minTime, int repetitions) : minTime_(minTime), repetitions_(repetitions) {}
+
+    BenchResult run(const Benchmark& benchmark, const std::string& name, long long arg) {
+        BenchResult result;
+        result.name = name;
+
+        // --- STEP 1: Calibrate the iteration count ---
+        long long iterations = benchmark.fixedIterations();
+        if (iterations <= 0) {
+            iterations = 1;
+            while (true) {
+                BenchState state = runOnce(benchmark, iterations, arg);
+                if (!state.skipped_.empty()) {
+                    result.skipped = state.skipped_;
+                    return result;
+                }
+                const double seconds = std::chrono::duration<double>(state.elapsed_).count();
+                if (seconds >= minTime_ || iterations >= MAX_ITERATIONS) break;
+                const double scale = seconds <= minTime_ / 10 ? 10.0 : minTime_ * 1.4 / seconds;
+                iterations = std::min(MAX_ITERATIONS, std::max(iterations + 1, static_cast<long long>(iterations * scale)));
+            }
+        }
+        result.iterations = iterations;
+
+        // --- STEP 2: Repetitions ---
+        std::vector<double> perOp;
+        std::vector<BenchState> runs;
+        for (int i = 0; i < repetitions_; ++i) {
+            runs.push_back(runOnce(benchmark, iterations, arg));
+            if (!runs.back().skipped_.empty()) {
+                result.skipped = runs.back().skipped_;
+                return result;
+            }
+            perOp.push_back(std::chrono::duration<double, std::nano>(runs.back().elapsed_).count() / iterations);
+        }
+
+        // --- STEP 3: Summary ---
+        std::vector<double> sorted = perOp;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t middle = sorted.size() / 2;
+        result.medianNs = sorted.size() % 2 == 1 ? sorted[middle] : (sorted[middle - 1] + sorted[middle]) / 2;
+        result.minNs = sorted.front();
+        result.maxNs = sorted.back();
+
+        double mean = 0;
+        for (double value : perOp) mean += value;
+        mean /= perOp.size();
+        double variance = 0;
+        for (double value : perOp) variance += (value - mean) * (value - mean);
+        result.cv = mean > 0 ? std::sqrt(variance / perOp.size()) / mean : 0;
+
+        const BenchState& last = runs.back();
+        if (result.medianNs > 0) {
+            result.itemsPerSecond = static_cast<double>(last.items_) / iterations * 1e9 / result.medianNs;
+            result.bytesPerSecond = static_cast<double>(last.bytes_) / iterations * 1e9 / result.medianNs;
+        }
+        result.readsPerOp = static_cast<double>(last.io_[0]) / iterations;
+        result.writesPerOp = static_cast<double>(last.io_[1]) / iterations;
+        return result;
+    }
+
+private:
+    static BenchState runOnce(const Benchmark& benchmark, long long iterations, long long arg) {
+        BenchState state(iterations, arg);
+        benchmark.function()(state);
+        state.pauseTiming();
+        return state;
+    }
+
+    double minTime_;
+    int repetitions_;
+};
+
+namespace {
+
+void printHeader() {
+    std::cout << std::left << std::setw(32) << "Benchmark" << std::right << std::setw(12) << "Time"
+              << std::setw(12) << "Iterations" << std::setw(8) << "CV%" << std::setw(10) << "Reads/op"
+              << std::setw(11) << "Writes/op" << std::setw(18) << "Rate" << "\n"
+              << std::string(103, '-') << "\n";
+}
+
+void printResult(const BenchResult& result) {
+    std::cout << std::left << std::setw(32) << result.name << std::right;
+    if (!result.skipped.empty()) {
+        std::cout << "  skipped: " << result.skipped << "\n";
+        return;
+    }
+    std::cout << std::setw(12) << formatTime(result.medianNs) << std::setw(12) << result.iterations
+              << std::fixed << std::setprecision(1) << std::setw(8) << result.cv * 100
+              << std::setprecision(2) << std::setw(10) << result.readsPerOp << std::setw(11) << result.writesPerOp
+              << std::setw(18) << formatRate(result) << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+// One benchmark per line, so --compare can read it back line by line
+bool writeJson(const std::string& path, const std::vector<BenchResult>& results, double minTime, int repetitions) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) return false;
+
+    const BenchOptions& options = BenchOptions::get();
+    char date[32] = {};
+    std::time_t now = std::time(nullptr);
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &local);
+#ifdef NDEBUG
+    const char* build = "release";
+#else
+    const char* build = "debug";
+#endif
+
+    file << "{\n\"context\":{\"date\":\"" << date << "\",\"compiler\":\"" << compilerName()
+         << "\",\"build\":\"" << build << "\",\"metrics\":" << (Metrics::compiledIn() ? "true" : "false")
+         << ",\"mmap\":" << (options.useMmap ? "true" : "false") << ",\"cluster_size\":" << options.clusterSize
+         << ",\"min_time\":" << minTime << ",\"repetitions\":" << repetitions
+         << ",\"threads\":" << std::thread::hardware_concurrency() << "},\n\"benchmarks\":[";
+    bool first = true;
+    for (const BenchResult& result : results) {
+        if (!result.skipped.empty()) continue;
+        file << (first ? "\n" : ",\n") << std::setprecision(10) << "{\"name\":\"" << result.name
+             << "\",\"iterations\":" << result.iterations << ",\"median_ns\":" << result.medianNs
+             << ",\"min_ns\":" << result.minNs << ",\"max_ns\":" << result.maxNs << ",\"cv\":" << result.cv
+             << ",\"items_per_second\":" << result.itemsPerSecond << ",\"bytes_per_second\":" << result.bytesPerSecond
+             << ",\"reads_per_op\":" << result.readsPerOp << ",\"writes_per_op\":" << result.writesPerOp << "}";
+        first = false;
+    }
+    file << "\n]\n}\n";
+    return static_cast<bool>(file);
+}
+
+// name -> result line of a JSON file written by writeJson
+bool readJson(const std::string& path, std::vector<std::string>& order, std::map<std::string, std::string>& lines) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::string name = jsonText(line, "name");
+        if (name.empty()) continue;
+        if (lines.count(name) == 0) order.push_back(name);
+        lines[name] = line;
+    }
+    return true;
+}
+
+// Same iteration count: the I/O per iteration is
+// exact, any increase counts. Otherwise the first
+// iterations (cold caches) weigh differently, and
+// only a change beyond the threshold counts.
+bool moreIo(const std::string& base, const std::string& line, const std::string& key, double threshold) {
+    const double before = jsonNumber(base, key);
+    const double after = jsonNumber(line, key);
+    if (jsonNumber(base, "iterations") == jsonNumber(line, "iterations")) return after > before + 1e-9;
+    return after > before * (1 + threshold / 100) + 0.01;
+}
+
+// -------------------------------------------------
+// compareResults
+// -------------------------------------------------
+// Lines up two result files by benchmark name. A
+// benchmark regressed if its median grew by more
+// than `threshold` percent and even its fastest new
+// run is slower than the slowest old one (a larger
+// change inside the spread is marked "noise?"), or
+// if it now does more image I/O per iteration (see
+// moreIo). Returns the exit code: 1 if anything
+// regressed.
+// -------------------------------------------------
+int compareResults(const std::string& basePath, const std::string& newPath, double threshold) {
+    std::vector<std::string> baseOrder, newOrder;
+    std::map<std::string, std::string> baseLines, newLines;
+    if (!readJson(basePath, baseOrder, baseLines) || !readJson(newPath, newOrder, newLines)) {
+        std::cerr << "Cannot read result files\n";
+        return 2;
+    }
+
+    std::cout << std::left << std::setw(32) << "Benchmark" << std::right << std::setw(12) << "Base"
+              << std::setw(12) << "New" << std::setw(10) << "Change" << "  Note\n" << std::string(80, '-') << "\n";
+    int regressions = 0;
+    for (const std::string& name : newOrder) {
+        const std::string& line = newLines[name];
+        std::cout << std::left << std::setw(32) << name << std::right;
+        if (baseLines.count(name) == 0) {
+            std::cout << std::setw(12) << "-" << std::setw(12) << formatTime(jsonNumber(line, "median_ns")) << "  new\n";
+            continue;
+        }
+
+        const std::string& base = baseLines[name];
+        const double before = jsonNumber(base, "median_ns");
+        const double after = jsonNumber(line, "median_ns");
+        const double change = before > 0 ? (after - before) / before * 100 : 0;
+        std::string note;
+        if (change > threshold) note = jsonNumber(line, "min_ns") > jsonNumber(base, "max_ns") ? "REGRESSION" : "noise?";
+        else if (change < -threshold) note = "faster";
+        if (moreIo(base, line, "reads_per_op", threshold) || moreIo(base, line, "writes_per_op", threshold)) {
+            note += note.empty() ? "MORE I/O" : ", MORE I/O";
+        }
+        if (note.find("REGRESSION") != std::string::npos || note.find("MORE I/O") != std::string::npos) ++regressions;
+
+        std::cout << std::setw(12) << formatTime(before) << std::setw(12) << formatTime(after)
+                  << std::setw(9) << std::showpos << std::fixed << std::setprecision(1) << change << "%"
+                  << std::noshowpos << (note.empty() ? "" : "  " + note) << "\n";
+        std::cout.unsetf(std::ios::floatfield);
+    }
+    for (const std::string& name : baseOrder) {
+        if (newLines.count(name) == 0) std::cout << std::left << std::setw(32) << name << "  missing in new results\n";
+    }
+
+    std::cout << "\n" << regressions << " regression(s) (threshold " << std::fixed << std::setprecision(1)
+              << threshold << "%)\n";
+    return regressions > 0 ? 1 : 0;
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "       " << program << " --compare BASE.json NEW.json [--threshold PCT]\n"
+              << "Options:\n"
+              << "  --filter REGEX     run only benchmarks whose name matches\n"
+              << "  --list             print the benchmark names and exit\n"
+              << "  --min-time SEC     calibrate microbenchmarks to at least SEC per run (default 0.2)\n"
+              << "  --repetitions N    runs per benchmark, the median is reported (default 5)\n"
+              << "  --json FILE        also write the results as JSON\n"
+              << "  --dir DIR          where images and host files are created (default: temp directory)\n"
+              << "  --script FILE      recorded script replayed by the load workloads\n"
+              << "  --cluster BYTES    cluster size of the images (default 1024)\n"
+              << "  --mmap             use the memory-mapped image backend\n";
+}
+
+bool parseCount(const std::string& text, double& value) {
+    try {
+        size_t used = 0;
+        value = std::stod(text, &used);
+        return used == text.size() && value >= 0;
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions& options = BenchOptions::get();
+    std::string filter, jsonPath, compareBase, compareNew, directory;
+    double minTime = 0.2, threshold = 10.0, number = 0;
+    int repetitions = 5;
+    bool list = false;
+
+    // --- STEP 1: Options ---
+    for (int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (flag == "--list") list = true;
+        else if (flag == "--mmap") options.useMmap = true;
+        else if (flag == "--filter" && hasValue) filter = argv[++i];
+        else if (flag == "--json" && hasValue) jsonPath = argv[++i];
+        else if (flag == "--dir" && hasValue) directory = argv[++i];
+        else if (flag == "--script" && hasValue) options.script = argv[++i];
+        else if (flag == "--min-time" && hasValue && parseCount(argv[i + 1], number)) { minTime = number; ++i; }
+        else if (flag == "--threshold" && hasValue && parseCount(argv[i + 1], number)) { threshold = number; ++i; }
+        else if (flag == "--repetitions" && hasValue && parseCount(argv[i + 1], number) && number >= 1) {
+            repetitions = static_cast<int>(number);
+            ++i;
+        }
+        else if (flag == "--cluster" && hasValue && parseCount(argv[i + 1], number)) {
+            options.clusterSize = static_cast<int>(number);
+            ++i;
+        }
+        else if (flag == "--compare" && i + 2 < argc) {
+            compareBase = argv[++i];
+            compareNew = argv[++i];
+        }
+        else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (!compareBase.empty()) return compareResults(compareBase, compareNew, threshold);
+
+    std::regex pattern;
+    try {
+        pattern = std::regex(filter.empty() ? ".*" : filter);
+    }
+    catch (const std::regex_error&) {
+        std::cerr << "Invalid filter: " << filter << "\n";
+        return 2;
+    }
+
+    // --- STEP 2: Expand arguments into named runs ---
+    std::vector<std::pair<const Benchmark*, long long>> runs;
+    std::vector<std::string> names;
+    for (const auto& benchmark : Benchmark::registry()) {
+        std::vector<long long> args = benchmark->args();
+        const bool hasArgs = !args.empty();
+        if (!hasArgs) args.push_back(0);
+        for (long long arg : args) {
+            std::string name = benchmark->name() + (hasArgs ? "/" + std::to_string(arg) : "");
+            if (!std::regex_search(name, pattern)) continue;
+            runs.emplace_back(benchmark.get(), arg);
+            names.push_back(name);
+        }
+    }
+    if (list) {
+        for (const std::string& name : names) std::cout << name << "\n";
+        return 0;
+    }
+
+    // --- STEP 3: Bench directory ---
+    std::error_code error;
+    std::filesystem::path root = directory.empty() ? std::filesystem::temp_directory_path(error) : std::filesystem::path(directory);
+    options.directory = (root / "vfs_bench_data").string();
+    std::filesystem::create_directories(options.directory, error);
+    if (error) {
+        std::cerr << "Cannot create " << options.directory << "\n";
+        return 2;
+    }
+
+    // --- STEP 4: Run ---
+    std::cout << "vfs_bench: " << compilerName() << ", metrics " << (Metrics::compiledIn() ? "on" : "off")
+              << ", cluster " << options.clusterSize << " B" << (options.useMmap ? ", mmap" : "") << "\n\n";
+    printHeader();
+    BenchRunner runner(minTime, repetitions);
+    std::vector<BenchResult> results;
+    for (size_t i = 0; i < runs.size(); ++i) {
+        results.push_back(runner.run(*runs[i].first, names[i], runs[i].second));
+        printResult(results.back());
+    }
+
+    std::filesystem::remove_all(options.directory, error);
+    if (!jsonPath.empty() && !writeJson(jsonPath, results, minTime, repetitions)) {
+        std::cerr << "Cannot write " << jsonPath << "\n";
+        return 2;
+    }
+    return 0;
+}
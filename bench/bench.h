@@ -0,0 +1,142 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/filesystem.h"
+
+// =============================================
+// bench.h
+// ---------------------------------------------
+// Defines the benchmark harness of vfs_bench, a
+// small runner in the style of Google Benchmark:
+//   - Benchmark: a named function registered with
+//     VFS_BENCHMARK, optionally run once per
+//     argument (entry count, size in MB, ...)
+//   - BenchState: handed to the function; its
+//     keepRunning() loop is the timed part, setup
+//     before the loop (or between pauseTiming and
+//     resumeTiming) is not timed
+//   - BenchImage: a freshly formatted image in the
+//     bench directory, removed again afterwards
+//
+// Microbenchmarks (micro.cpp) repeat a primitive
+// until the run takes --min-time; workloads
+// (workloads.cpp) run a whole scenario once per
+// repetition. Every run starts on a new image and
+// all data comes from fixed seeds, so two builds
+// run exactly the same operations.
+// =============================================
+
+class BenchState {
+public:
+    BenchState(long long iterations, long long arg) : iterations_(iterations), arg_(arg) {}
+
+    // ------------------------------------------
+    // Timed loop
+    // ------------------------------------------
+    // while (state.keepRunning()) { ...one operation... }
+    bool keepRunning();
+    void pauseTiming();                            // Exclude what follows (setup, cleanup)
+    void resumeTiming();
+
+    long long arg() const { return arg_; }         // Argument of this run (0 if none)
+    long long iterations() const { return iterations_; }
+
+    // ------------------------------------------
+    // Reported rates (per second of timed run)
+    // ------------------------------------------
+    void setItemsProcessed(long long items) { items_ = items; }
+    void setBytesProcessed(long long bytes) { bytes_ = bytes; }
+    void skip(const std::string& reason) { skipped_ = reason; } // Report instead of timing (e.g. missing input)
+
+private:
+    friend class BenchRunner;
+    using Clock = std::chrono::steady_clock;
+
+    long long iterations_;
+    long long arg_;
+    long long done_ = 0;
+    bool started_ = false;
+    bool timing_ = false;
+    Clock::time_point resumed_;
+    Clock::duration elapsed_{};
+    uint64_t ioStart_[2] = {};                     // Image reads/writes at resumeTiming
+    uint64_t io_[2] = {};                          // Image reads/writes while timed
+    long long items_ = 0;
+    long long bytes_ = 0;
+    std::string skipped_;
+};
+
+using BenchFunction = void (*)(BenchState&);
+
+class Benchmark {
+public:
+    // Registers a benchmark; chain arg() and iterations() on the result
+    static Benchmark* add(const std::string& name, BenchFunction function);
+    static std::vector<std::unique_ptr<Benchmark>>& registry();
+
+    Benchmark* arg(long long value) { args_.push_back(value); return this; }   // One run per value ("name/value")
+    Benchmark* iterations(long long count) { fixedIterations_ = count; return this; } // No calibration
+
+    const std::string& name() const { return name_; }
+    BenchFunction function() const { return function_; }
+    const std::vector<long long>& args() const { return args_; }
+    long long fixedIterations() const { return fixedIterations_; }
+
+private:
+    Benchmark(std::string name, BenchFunction function) : name_(std::move(name)), function_(function) {}
+
+    std::string name_;
+    BenchFunction function_;
+    std::vector<long long> args_;
+    long long fixedIterations_ = 0;                // 0 = grow until --min-time
+};
+
+#define VFS_BENCH_CONCAT2(a, b) a##b
+#define VFS_BENCH_CONCAT(a, b) VFS_BENCH_CONCAT2(a, b)
+#define VFS_BENCHMARK(name, function) \
+    static Benchmark* const VFS_BENCH_CONCAT(vfsBenchmark_, __LINE__) = Benchmark::add(name, function)
+
+// Options shared by every benchmark (set from the command line)
+struct BenchOptions {
+    std::string directory;                         // Images and host files go here
+    std::string script;                            // Recorded script for the load workload ("" = generated)
+    int clusterSize = FileSystem::DEFAULT_CLUSTER_SIZE;
+    bool useMmap = false;
+
+    static BenchOptions& get();
+};
+
+// -------------------------------------------------
+// BenchImage
+// -------------------------------------------------
+// A formatted image used by one run. Output of the
+// commands is discarded (errors still reach stderr)
+// and the image file is deleted by the destructor.
+// -------------------------------------------------
+class BenchImage {
+public:
+    explicit BenchImage(int sizeMB);
+    ~BenchImage();
+    BenchImage(const BenchImage&) = delete;
+    BenchImage& operator=(const BenchImage&) = delete;
+
+    FileSystem& fs() { return *fs_; }
+    bool ok() const { return ok_; }
+
+private:
+    std::string path_;
+    std::unique_ptr<FileSystem> fs_;
+    Session session_;
+    bool ok_ = false;
+};
+
+// Deterministic data: mt19937_64 output is fixed by the standard
+std::mt19937_64 benchRandom(uint64_t stream);
+std::string benchPath(const std::string& name);   // File in the bench directory
+bool writeHostFile(const std::string& path, long long size, uint64_t stream); // Random content, false on error
+std::ostream& nullStream();                        // Discards everything
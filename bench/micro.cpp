@@ -0,0 +1,214 @@
+// =============================================
+// micro.cpp
+// ---------------------------------------------
+// Microbenchmarks of the core primitives
+// Handles:
+//   - Inode reads and writes (cached and uncached)
+//   - Single, batch and contiguous block allocation
+//   - Directory lookups at several entry counts
+// =============================================
+
+#include "bench.h"
+
+// -------------------------------------------------
+// FileSystemBench
+// -------------------------------------------------
+// The primitives are private to FileSystem; this
+// friend exposes exactly the ones measured here.
+// They are called without the command locks, which
+// is safe because vfs_bench runs one thread.
+// -------------------------------------------------
+class FileSystemBench {
+public:
+    static Inode readInode(FileSystem& fs, int inodeId) { return fs.readInode(inodeId); }
+    static void writeInode(FileSystem& fs, int inodeId, const Inode& inode) { fs.writeInode(inodeId, inode); }
+    static int allocateBlock(FileSystem& fs, int nearInode) { return fs.allocateFreeDataBlock(nearInode); }
+    static std::vector<int> allocateBlocks(FileSystem& fs, int count, int nearInode) {
+        return fs.allocateFreeDataBlocks(count, nearInode);
+    }
+    static std::vector<int> allocateRun(FileSystem& fs, int count, int nearInode) {
+        return fs.allocateContiguousBlocks(count, nearInode);
+    }
+    static void freeBlock(FileSystem& fs, int blockId) { fs.freeDataBlock(blockId); }
+    static int findDirEntry(FileSystem& fs, const Inode& dir, const std::string& name) {
+        return fs.findDirEntry(dir, name);
+    }
+    static int lookup(FileSystem& fs, int dirInodeId, const std::string& name) { return fs.lookup(dirInodeId, name); }
+    static int resolvePath(FileSystem& fs, const std::string& path) { return fs.resolvePath(path); }
+};
+
+namespace {
+
+constexpr int IMAGE_MB = 64;            // 16384 inodes, about 60000 data blocks of 1 KB
+constexpr int INODE_WORKING_SET = 128;  // Inodes cycled through by the inode benchmarks
+constexpr size_t FREE_EVERY = 1024;     // alloc/block frees its blocks after this many
+
+volatile long long sink;                // Keeps results alive
+
+// Creates dir/<prefix>0 .. dir/<prefix>N-1 and returns the directory inode
+int makeEntries(FileSystem& fs, const std::string& dir, const std::string& prefix, int count,
+                std::vector<std::string>& names) {
+    fs.mkdir(dir);
+    names.clear();
+    for (int i = 0; i < count; ++i) {
+        names.push_back(prefix + std::to_string(i));
+        fs.touch(dir + "/" + names.back());
+    }
+    return FileSystemBench::resolvePath(fs, dir);
+}
+
+// Visiting order 0..n-1, shuffled the same way on every platform
+std::vector<size_t> shuffledOrder(size_t n, uint64_t stream) {
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i) order[i] = i;
+    std::mt19937_64 random = benchRandom(stream);
+    for (size_t i = n; i > 1; --i) std::swap(order[i - 1], order[random() % i]);
+    return order;
+}
+
+// Inodes of INODE_WORKING_SET fresh files
+std::vector<int> makeInodes(FileSystem& fs) {
+    std::vector<std::string> names;
+    const int dir = makeEntries(fs, "d", "f", INODE_WORKING_SET, names);
+    std::vector<int> inodes;
+    for (const std::string& name : names) inodes.push_back(FileSystemBench::lookup(fs, dir, name));
+    return inodes;
+}
+
+// -------------------------------------------------
+// inode/read/N, inode/write/N
+// -------------------------------------------------
+// N is the inode cache capacity: 0 sends every call
+// to the inode table, 256 holds the whole working
+// set (reads are hits, writes stay dirty).
+// -------------------------------------------------
+void inodeRead(BenchState& state) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+    const std::vector<int> inodes = makeInodes(fs);
+    fs.setInodeCacheCapacity(static_cast<size_t>(state.arg()));
+
+    size_t next = 0;
+    while (state.keepRunning()) {
+        sink = FileSystemBench::readInode(fs, inodes[next]).file_size;
+        next = (next + 1) % inodes.size();
+    }
+    state.setItemsProcessed(state.iterations());
+}
+
+void inodeWrite(BenchState& state) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+    const std::vector<int> inodes = makeInodes(fs);
+    fs.setInodeCacheCapacity(static_cast<size_t>(state.arg()));
+    std::vector<Inode> contents;
+    for (int inodeId : inodes) contents.push_back(FileSystemBench::readInode(fs, inodeId));
+
+    size_t next = 0;
+    while (state.keepRunning()) {
+        FileSystemBench::writeInode(fs, inodes[next], contents[next]);
+        next = (next + 1) % inodes.size();
+    }
+    state.setItemsProcessed(state.iterations());
+}
+
+// -------------------------------------------------
+// alloc/block, alloc/batch/N, alloc/run/N
+// -------------------------------------------------
+// Allocation near the root, as for a file in it.
+// The blocks are freed again (untimed) so the
+// bitmap never fills up.
+// -------------------------------------------------
+void allocBlock(BenchState& state) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+
+    std::vector<int> blocks;
+    while (state.keepRunning()) {
+        blocks.push_back(FileSystemBench::allocateBlock(fs, 0));
+        if (blocks.size() < FREE_EVERY) continue;
+        state.pauseTiming();
+        for (int blockId : blocks) FileSystemBench::freeBlock(fs, blockId);
+        blocks.clear();
+        state.resumeTiming();
+    }
+    state.setItemsProcessed(state.iterations());
+}
+
+void allocMany(BenchState& state, bool contiguous) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+    const int count = static_cast<int>(state.arg());
+
+    while (state.keepRunning()) {
+        std::vector<int> blocks = contiguous ? FileSystemBench::allocateRun(fs, count, 0)
+                                             : FileSystemBench::allocateBlocks(fs, count, 0);
+        state.pauseTiming();
+        for (int blockId : blocks) FileSystemBench::freeBlock(fs, blockId);
+        state.resumeTiming();
+    }
+    state.setItemsProcessed(state.iterations() * count);
+}
+
+void allocBatch(BenchState& state) {
+    allocMany(state, false);
+}
+
+void allocRun(BenchState& state) {
+    allocMany(state, true);
+}
+
+// -------------------------------------------------
+// dir/find/N, dir/lookup/N
+// -------------------------------------------------
+// Existing names of a directory with N entries in
+// shuffled order. dir/find searches the directory
+// itself (linear scan or hash index), dir/lookup
+// goes through the dentry cache.
+// -------------------------------------------------
+void dirFind(BenchState& state) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+    std::vector<std::string> names;
+    const int dirId = makeEntries(fs, "d", "e", static_cast<int>(state.arg()), names);
+    const Inode dir = FileSystemBench::readInode(fs, dirId);
+    const std::vector<size_t> order = shuffledOrder(names.size(), 1);
+
+    size_t next = 0;
+    while (state.keepRunning()) {
+        sink = FileSystemBench::findDirEntry(fs, dir, names[order[next]]);
+        next = (next + 1) % order.size();
+    }
+    state.setItemsProcessed(state.iterations());
+}
+
+void dirLookup(BenchState& state) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+    std::vector<std::string> names;
+    const int dirId = makeEntries(fs, "d", "e", static_cast<int>(state.arg()), names);
+    const std::vector<size_t> order = shuffledOrder(names.size(), 1);
+
+    size_t next = 0;
+    while (state.keepRunning()) {
+        sink = FileSystemBench::lookup(fs, dirId, names[order[next]]);
+        next = (next + 1) % order.size();
+    }
+    state.setItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+VFS_BENCHMARK("inode/read", inodeRead)->arg(0)->arg(256);
+VFS_BENCHMARK("inode/write", inodeWrite)->arg(0)->arg(256);
+VFS_BENCHMARK("alloc/block", allocBlock);
+VFS_BENCHMARK("alloc/batch", allocBatch)->arg(8)->arg(64)->arg(512);
+VFS_BENCHMARK("alloc/run", allocRun)->arg(8)->arg(64)->arg(512);
+VFS_BENCHMARK("dir/find", dirFind)->arg(16)->arg(256)->arg(4096);
+VFS_BENCHMARK("dir/lookup", dirLookup)->arg(16)->arg(256)->arg(4096);
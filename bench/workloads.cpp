@@ -0,0 +1,275 @@
+// =============================================
+// workloads.cpp
+// ---------------------------------------------
+// End-to-end workloads through the public commands
+// Handles:
+//   - Mass touch, large incp / outcp, cp churn
+//   - Deep cd / pwd walks
+//   - load replay of a recorded (or generated) script
+// =============================================
+
+#include "bench.h"
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+constexpr int IMAGE_MB = 64;            // Room for every workload but incp/outcp
+constexpr int CHURN_SOURCES = 32;       // cp churn: files copied from
+constexpr int CHURN_SLOTS = 64;         // cp churn: names copied to (replaced when taken)
+constexpr int SCRIPT_LINES = 4000;      // Length of the generated load script
+
+// Runs one command as the shell does: in its own journal transaction
+template <typename Command>
+void journaled(FileSystem& fs, Command command) {
+    fs.beginTransaction();
+    command();
+    fs.commitTransaction();
+}
+
+// Host file of `sizeBytes` random bytes, written once per bench run
+std::string hostInput(long long sizeBytes, uint64_t stream) {
+    const std::string path = benchPath("in_" + std::to_string(sizeBytes) + "_" + std::to_string(stream) + ".bin");
+    std::error_code error;
+    if (std::filesystem::file_size(path, error) == static_cast<uintmax_t>(sizeBytes)) return path;
+    return writeHostFile(path, sizeBytes, stream) ? path : "";
+}
+
+std::string randomText(std::mt19937_64& random, int length) {
+    std::string text;
+    for (int i = 0; i < length; ++i) text += static_cast<char>('a' + random() % 26);
+    return text;
+}
+
+// -------------------------------------------------
+// generateScript
+// -------------------------------------------------
+// A mixed script over eight directories: creates,
+// writes, reads, copies, renames, removes, listings
+// and byte-range I/O. A model of the tree keeps
+// every line valid. No `info`, so load --parallel
+// really runs it in parallel.
+// -------------------------------------------------
+bool generateScript(const std::string& path) {
+    std::ofstream script(path, std::ios::trunc);
+    if (!script.is_open()) return false;
+
+    std::mt19937_64 random = benchRandom(100);
+    std::vector<std::vector<std::string>> files(8);
+    int created = 0;
+    for (size_t d = 0; d < files.size(); ++d) script << "mkdir s" << d << "\n";
+
+    for (int line = 0; line < SCRIPT_LINES; ++line) {
+        const size_t d = random() % files.size();
+        std::vector<std::string>& names = files[d];
+        const std::string dir = "s" + std::to_string(d) + "/";
+        const int op = static_cast<int>(random() % 100);
+
+        if (names.empty() || op < 20) {
+            names.push_back("f" + std::to_string(created++));
+            script << "touch " << dir << names.back() << "\n";
+            continue;
+        }
+        const size_t pick = random() % names.size();
+        const std::string file = dir + names[pick];
+        if (op < 40) {
+            script << "write " << file << " " << randomText(random, 8 + static_cast<int>(random() % 2000)) << "\n";
+        } else if (op < 55) {
+            script << "cat " << file << "\n";
+        } else if (op < 63) {
+            names.push_back("f" + std::to_string(created++));
+            script << "cp " << file << " " << dir << names.back() << "\n";
+        } else if (op < 69) {
+            const size_t target = random() % files.size();
+            files[target].push_back("f" + std::to_string(created++));
+            script << "mv " << file << " s" << target << "/" << files[target].back() << "\n";
+            names.erase(names.begin() + static_cast<long>(pick));
+        } else if (op < 77) {
+            script << "rm " << file << "\n";
+            names.erase(names.begin() + static_cast<long>(pick));
+        } else if (op < 83) {
+            script << "ls s" << d << "\n";
+        } else if (op < 92) {
+            script << "pwrite " << file << " " << random() % 4096 << " " << randomText(random, 1 + static_cast<int>(random() % 64)) << "\n";
+        } else {
+            script << "pread " << file << " 0 64\n";
+        }
+    }
+    return static_cast<bool>(script);
+}
+
+// -------------------------------------------------
+// workload/touch/N
+// -------------------------------------------------
+// N empty files created in one directory, then sync
+// (every workload ends with one, so deferred writes
+// are paid for inside the timed part).
+// -------------------------------------------------
+void massTouch(BenchState& state) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+    journaled(fs, [&] { fs.mkdir("t"); });
+
+    const int count = static_cast<int>(state.arg());
+    while (state.keepRunning()) {
+        for (int i = 0; i < count; ++i) journaled(fs, [&] { fs.touch("t/f" + std::to_string(i)); });
+        fs.sync();
+    }
+    state.setItemsProcessed(count);
+}
+
+// -------------------------------------------------
+// workload/incp/MB, workload/outcp/MB
+// -------------------------------------------------
+// One file of MB megabytes of random data imported
+// into (or exported from) an image twice its size.
+// -------------------------------------------------
+void largeIncp(BenchState& state) {
+    const long long bytes = state.arg() << 20;
+    const std::string input = hostInput(bytes, 1);
+    if (input.empty()) return state.skip("cannot write host file");
+    BenchImage image(static_cast<int>(2 * state.arg() + 16));
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+
+    while (state.keepRunning()) {
+        journaled(fs, [&] { fs.incp(input, "big"); });
+        fs.sync();
+    }
+    state.setBytesProcessed(bytes);
+}
+
+void largeOutcp(BenchState& state) {
+    const long long bytes = state.arg() << 20;
+    const std::string input = hostInput(bytes, 1);
+    if (input.empty()) return state.skip("cannot write host file");
+    BenchImage image(static_cast<int>(2 * state.arg() + 16));
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+    journaled(fs, [&] { fs.incp(input, "big"); });
+    fs.sync();
+
+    const std::string output = benchPath("out.bin");
+    while (state.keepRunning()) {
+        journaled(fs, [&] { fs.outcp("big", output); });
+    }
+    std::error_code ignored;
+    std::filesystem::remove(output, ignored);
+    state.setBytesProcessed(bytes);
+}
+
+// -------------------------------------------------
+// workload/cp/N
+// -------------------------------------------------
+// N copies of random sources (1..64 KB) to random
+// slot names; a taken slot is removed first, so
+// blocks are freed and reused all the time.
+// -------------------------------------------------
+void cpChurn(BenchState& state) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+
+    std::mt19937_64 random = benchRandom(2);
+    for (int i = 0; i < CHURN_SOURCES; ++i) {
+        const std::string input = hostInput(1024 + static_cast<long long>(random() % (63 * 1024)), 10 + i);
+        if (input.empty()) return state.skip("cannot write host file");
+        journaled(fs, [&] { fs.incp(input, "s" + std::to_string(i)); });
+    }
+    fs.sync();
+
+    const int count = static_cast<int>(state.arg());
+    std::vector<bool> taken(CHURN_SLOTS, false);
+    while (state.keepRunning()) {
+        for (int i = 0; i < count; ++i) {
+            const std::string source = "s" + std::to_string(random() % CHURN_SOURCES);
+            const size_t slot = random() % CHURN_SLOTS;
+            const std::string target = "c" + std::to_string(slot);
+            journaled(fs, [&] {
+                if (taken[slot]) fs.rm(target);
+                fs.cp(source, target);
+            });
+            taken[slot] = true;
+        }
+        fs.sync();
+    }
+    state.setItemsProcessed(count);
+}
+
+// -------------------------------------------------
+// workload/cd/D
+// -------------------------------------------------
+// One iteration walks a chain of D directories down
+// and back up with a pwd at every level (what the
+// shell prompt does). Read-only, so it is repeated
+// until --min-time like a microbenchmark.
+// -------------------------------------------------
+void deepCd(BenchState& state) {
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+
+    const int depth = static_cast<int>(state.arg());
+    for (int i = 0; i < depth; ++i) {
+        journaled(fs, [&] {
+            fs.mkdir("d" + std::to_string(i));
+            fs.cd("d" + std::to_string(i));
+        });
+    }
+    fs.cd("/");
+
+    while (state.keepRunning()) {
+        for (int i = 0; i < depth; ++i) {
+            fs.cd("d" + std::to_string(i));
+            fs.pwd();
+        }
+        for (int i = 0; i < depth; ++i) {
+            fs.cd("..");
+            fs.pwd();
+        }
+    }
+    state.setItemsProcessed(state.iterations() * depth * 2);
+}
+
+// -------------------------------------------------
+// workload/load/P
+// -------------------------------------------------
+// Replays the --script file (or the generated one)
+// with load (P = 0) or load --parallel (P = 1).
+// Paths in a recorded script are relative to the
+// working directory of vfs_bench.
+// -------------------------------------------------
+void loadReplay(BenchState& state) {
+    std::string script = BenchOptions::get().script;
+    if (script.empty()) {
+        script = benchPath("script.txt");
+        std::error_code error;
+        if (!std::filesystem::exists(script, error) && !generateScript(script)) {
+            return state.skip("cannot write script");
+        }
+    }
+    std::ifstream lines(script);
+    if (!lines.is_open()) return state.skip("cannot read " + script);
+    long long count = 0;
+    for (std::string line; std::getline(lines, line);) count += line.empty() ? 0 : 1;
+
+    BenchImage image(IMAGE_MB);
+    if (!image.ok()) return state.skip("format failed");
+    FileSystem& fs = image.fs();
+
+    while (state.keepRunning()) {
+        fs.load(script, state.arg() != 0);
+        fs.sync();
+    }
+    state.setItemsProcessed(count);
+}
+
+} // namespace
+
+VFS_BENCHMARK("workload/touch", massTouch)->arg(1000)->arg(4000)->iterations(1);
+VFS_BENCHMARK("workload/incp", largeIncp)->arg(1)->arg(16)->arg(64)->iterations(1);
+VFS_BENCHMARK("workload/outcp", largeOutcp)->arg(1)->arg(16)->arg(64)->iterations(1);
+VFS_BENCHMARK("workload/cp", cpChurn)->arg(500)->iterations(1);
+VFS_BENCHMARK("workload/cd", deepCd)->arg(16)->arg(64);
+VFS_BENCHMARK("workload/load", loadReplay)->arg(0)->arg(1)->iterations(1);
@@ -0,0 +1,117 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// =============================================
+// api_types.h
+// ---------------------------------------------
+// Defines what the programmatic API of FileSystem
+// returns instead of printing:
+//   - Status: the outcome of a call, one value per
+//     message the shell prints for it
+//   - DirEntry, FileStat, FsStat, FsckReport:
+//     listings, metadata and check results as
+//     plain values
+// The shell commands (ls, info, statfs, ...) are
+// formatters over these (see filesystem_shell.cpp).
+// =============================================
+
+// ---------------- Status ----------------
+enum class Status {
+    Ok,
+    FileNotFound,   // No such file (or a directory where a file is expected)
+    PathNotFound,   // No such directory on the way, or not a directory
+    Exists,         // The new name is taken
+    InvalidName,    // Empty, too long, contains '/', or "." / ".."
+    InvalidInput,   // Bad argument (negative offset, move into own subtree, ...)
+    NotEmpty,       // rmdir of a directory with entries
+    IsDirectory,    // File content asked of a directory
+    NoSpace,        // Out of inodes or blocks, or past the largest file size
+    IoError,        // Reading or writing the image failed
+    Corrupt         // fsck found problems it did not repair
+};
+
+// Message the shell prints for a status ("OK", "FILE NOT FOUND", ...);
+// I/O errors keep the "PATH NOT FOUND" the shell has always printed for them
+inline const char* statusText(Status status) {
+    switch (status) {
+    case Status::Ok:           return "OK";
+    case Status::FileNotFound: return "FILE NOT FOUND";
+    case Status::PathNotFound: return "PATH NOT FOUND";
+    case Status::Exists:       return "EXIST";
+    case Status::InvalidName:  return "INVALID NAME";
+    case Status::InvalidInput: return "INVALID INPUT";
+    case Status::NotEmpty:     return "NOT EMPTY";
+    case Status::IsDirectory:  return "IS DIRECTORY";
+    case Status::NoSpace:      return "NO SPACE";
+    case Status::IoError:      return "PATH NOT FOUND";
+    case Status::Corrupt:      return "CORRUPT";
+    }
+    return "INVALID INPUT";
+}
+
+// ---------------- DirEntry ----------------
+// One entry of a directory listing ("." and ".." included).
+struct DirEntry {
+    std::string name;
+    int inode = -1;
+    bool isDirectory = false;
+};
+
+// ---------------- FileStat ----------------
+// Metadata of a file or directory.
+struct FileStat {
+    int inode = -1;
+    bool isDirectory = false;
+    long long size = 0;               // Logical size in bytes (directory: its entries)
+    int references = 0;               // Directory entries naming it
+    bool compressed = false;          // Stored in compressed chunks (directory: new items will be)
+    bool inlined = false;             // Content kept in the inode (no blocks below)
+    long long compressedBytes = 0;    // Bytes of the blocks a compressed file occupies (0 otherwise)
+    std::vector<int> directBlocks;    // Mapped direct pointers, in order
+    std::vector<int> indirectBlocks;  // indirect1, then indirect2, if mapped
+};
+
+// ---------------- FsStat ----------------
+// Usage of the whole image.
+struct FsStat {
+    long long diskSize = 0;           // Bytes
+    int clusterSize = 0;              // Bytes per data block
+    int totalInodes = 0;
+    int usedInodes = 0;
+    int totalBlocks = 0;              // Data blocks
+    int usedBlocks = 0;
+    int directories = 0;
+    bool checksums = false;           // Metadata is checksummed (CRC32C)
+    bool dataChecksums = false;       // File data too
+    size_t badBlocks = 0;             // Blocks whose checksum failed
+};
+
+// ---------------- FsckReport ----------------
+// What a consistency check found. Damage to the tree itself (bad
+// inodes and entries, unreadable directories, inode table blocks
+// failing their checksum, cross-linked blocks) is only reported;
+// bitmap problems are repaired on request by rewriting both
+// bitmaps, as long as the tree is intact.
+struct FsckReport {
+    int directories = 0;              // Reachable from the root (root included)
+    int files = 0;                    // Reachable from the root
+    int blocks = 0;                   // Data blocks in use (content, directories, pointer blocks, metadata)
+    int badInodes = 0;                // Invalid fields, pointers out of range or unreadable pointer blocks
+    int badEntries = 0;               // Entries naming no valid inode, one already named, or a wrong ".."
+    int unreadableDirectories = 0;
+    int badChecksums = 0;             // Inode table blocks failing their checksum (checked anyway)
+    int crossLinkedBlocks = 0;        // More owners than the block's share count allows
+    int shareMismatches = 0;          // Share count above the owners found
+    int orphanedInodes = 0;           // Marked used, not reachable from the root
+    int unmarkedInodes = 0;           // Reachable, marked free
+    int leakedBlocks = 0;             // Marked used, owned by nothing reachable
+    int unmarkedBlocks = 0;           // In use, marked free
+    bool repaired = false;            // The bitmaps were rewritten
+    std::vector<std::string> problems; // The first problems found, one line each
+
+    int treeErrors() const { return badInodes + badEntries + unreadableDirectories + badChecksums + crossLinkedBlocks; }
+    int bitmapErrors() const { return orphanedInodes + unmarkedInodes + leakedBlocks + unmarkedBlocks; }
+    int remainingErrors() const { return treeErrors() + shareMismatches + (repaired ? 0 : bitmapErrors()); }
+};
@@ -0,0 +1,473 @@
+// =============================================
+// bitmap.cpp
+// ---------------------------------------------
+// Resident allocation bitmap
+// Handles:
+//   - Loading a bitmap from the image once
+//   - Word-at-a-time free-bit search (next-fit)
+//   - Best-fit contiguous runs via a free-extent index,
+//     updated in place as bits change
+//   - Popcount-based usage statistics
+//   - Word-wise comparison with a reference (fsck)
+//   - Writing back only the dirty pages
+//   - Held bits: free on disk, not yet reusable
+// =============================================
+
+#include "bitmap.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include "metrics.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+// Index of the lowest set bit of a non-zero word
+inline int lowestSetBit(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long idx = 0;
+    uint32_t low = static_cast<uint32_t>(word);
+    if (low != 0) {
+        _BitScanForward(&idx, low);
+        return static_cast<int>(idx);
+    }
+    _BitScanForward(&idx, static_cast<uint32_t>(word >> 32));
+    return static_cast<int>(idx) + 32;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// Number of set bits in a word
+inline int popcount(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt(static_cast<uint32_t>(word)) +
+                            __popcnt(static_cast<uint32_t>(word >> 32)));
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+} // namespace
+
+// -------------------------------------------------
+// load
+// -------------------------------------------------
+// Reads the whole bitmap from the image in one go.
+// Bits past `bitCount` (or past the end of the
+// on-disk bitmap: padding of the last word) are kept
+// set so that they are never handed out.
+// -------------------------------------------------
+bool Bitmap::load(BlockDevice& device, long long offset, int sizeBytes, int bitCount) {
+    reset();
+    if (sizeBytes <= 0) return false;
+    if (bitCount < 0 || bitCount > sizeBytes * 8) bitCount = sizeBytes * 8;
+
+    const size_t wordCount = (static_cast<size_t>(sizeBytes) + 7) / 8;
+    words_.assign(wordCount, ~0ULL);
+    std::memset(words_.data(), 0, static_cast<size_t>(sizeBytes));
+    if (!device.readAt(offset, words_.data(), static_cast<size_t>(sizeBytes))) {
+        reset();
+        return false;
+    }
+
+    offset_ = offset;
+    sizeBytes_ = sizeBytes;
+    bitCount_ = bitCount;
+    for (size_t bit = static_cast<size_t>(bitCount_); bit < static_cast<size_t>(sizeBytes) * 8; ++bit) {
+        words_[bit / 64] |= 1ULL << (bit % 64);
+    }
+    dirtyPages_.assign((sizeBytes + PAGE_BYTES - 1) / PAGE_BYTES, false);
+
+    for (uint64_t word : words_) used_ += popcount(word);
+    used_ -= static_cast<int>(wordCount * 64) - bitCount_; // padding bits
+    return true;
+}
+
+// -------------------------------------------------
+// flush
+// -------------------------------------------------
+// Writes every page modified since the last flush.
+// Adjacent dirty pages are merged into one write.
+// Held bits in them are written as clear.
+// -------------------------------------------------
+bool Bitmap::flush(BlockDevice& device) {
+    const char* bytes = reinterpret_cast<const char*>(words_.data());
+    const int pageCount = static_cast<int>(dirtyPages_.size());
+    std::vector<char> masked;
+    bool ok = true;
+
+    for (int page = 0; page < pageCount; ++page) {
+        if (!dirtyPages_[page]) continue;
+
+        int last = page;
+        while (last + 1 < pageCount && dirtyPages_[last + 1]) ++last;
+
+        int begin = page * PAGE_BYTES;
+        int end = std::min(sizeBytes_, (last + 1) * PAGE_BYTES);
+        const char* out = bytes + begin;
+        auto held = held_.lower_bound(begin * 8);
+        if (held != held_.end() && *held < end * 8) {
+            masked.assign(out, bytes + end);
+            for (; held != held_.end() && *held < end * 8; ++held) {
+                masked[*held / 8 - begin] &= static_cast<char>(~(1 << (*held % 8)));
+            }
+            out = masked.data();
+        }
+        ok = device.writeAt(offset_ + begin, out, static_cast<size_t>(end - begin)) && ok;
+
+        for (int p = page; p <= last; ++p) dirtyPages_[p] = false;
+        page = last;
+    }
+    return ok;
+}
+
+void Bitmap::reset() {
+    words_.clear();
+    dirtyPages_.clear();
+    offset_ = 0;
+    sizeBytes_ = 0;
+    bitCount_ = 0;
+    used_ = 0;
+    cursor_ = 0;
+    held_.clear();
+    freeBySize_.clear();
+    freeByStart_.clear();
+    indexValid_ = false;
+}
+
+// -------------------------------------------------
+// allocate
+// -------------------------------------------------
+// Next-fit search: starts at the word where the last
+// allocation happened and wraps around once. Full
+// words are skipped with a single comparison. Bits
+// at or above `limit` (if given) count as used.
+// -------------------------------------------------
+int Bitmap::allocate(int limit) {
+    VFS_COUNT(BitmapScans);
+    if (limit < 0 || limit > bitCount_) limit = bitCount_;
+    const size_t wordCount = (static_cast<size_t>(limit) + 63) / 64;
+    for (size_t n = 0; n < wordCount; ++n) {
+        size_t w = (cursor_ + n) % wordCount;
+        uint64_t word = words_[w];
+        int tail = limit - static_cast<int>(w * 64);
+        if (tail < 64) word |= ~0ULL << tail;
+        if (word == ~0ULL) continue;
+
+        int bit = static_cast<int>(w * 64) + lowestSetBit(~word);
+        set(bit);
+        cursor_ = w;
+        return bit;
+    }
+    return -1;
+}
+
+// -------------------------------------------------
+// allocateRun
+// -------------------------------------------------
+// Allocates `count` bits, preferring one contiguous run.
+// Best-fit: the shortest free extent that can hold all
+// of them is used. If no extent is long enough, the
+// longest extents are taken until the request is met
+// (fewest fragments). All-or-nothing: returns an empty
+// list if fewer than `count` bits are free.
+// -------------------------------------------------
+std::vector<Bitmap::Extent> Bitmap::allocateRun(int count) {
+    VFS_COUNT(BitmapScans);
+    std::vector<Extent> runs;
+    if (count <= 0 || bitCount_ - used_ < count) return runs;
+    if (!indexValid_) rebuildIndex();
+
+    int remaining = count;
+    while (remaining > 0 && !freeBySize_.empty()) {
+        auto it = freeBySize_.lower_bound(remaining);
+        if (it == freeBySize_.end()) --it; // nothing fits - take the longest
+
+        const Extent free{ it->second, it->first };
+        const int take = std::min(remaining, free.length);
+        setRange(free.start, take);
+        indexTake(free.start, take);
+        runs.push_back({ free.start, take });
+        remaining -= take;
+    }
+    return runs;
+}
+
+// -------------------------------------------------
+// allocateIn / allocateRunIn
+// -------------------------------------------------
+// The same searches limited to the bits [first,
+// last) of one block group: the lowest clear bit,
+// or the shortest free run that holds `count` bits.
+// Only the words of the range are scanned.
+// -------------------------------------------------
+int Bitmap::allocateIn(int first, int last) {
+    VFS_COUNT(BitmapScans);
+    last = std::min(last, bitCount_);
+    int bit = findNext(std::max(first, 0), false);
+    if (bit >= last) return -1;
+    set(bit);
+    return bit;
+}
+
+bool Bitmap::allocateRunIn(int count, int first, int last, Extent& run) {
+    VFS_COUNT(BitmapScans);
+    last = std::min(last, bitCount_);
+    Extent best{ -1, 0 };
+    int start = findNext(std::max(first, 0), false);
+    while (start < last) {
+        int end = std::min(findNext(start, true), last);
+        int length = end - start;
+        if (length >= count && (best.start < 0 || length < best.length)) {
+            best = { start, length };
+            if (length == count) break;
+        }
+        start = end < last ? findNext(end, false) : last;
+    }
+    if (best.start < 0) return false;
+
+    setRange(best.start, count);
+    if (indexValid_) indexTake(best.start, count);
+    run = { best.start, count };
+    return true;
+}
+
+int Bitmap::usedIn(int first, int last) const {
+    first = std::max(first, 0);
+    last = std::min(last, bitCount_);
+    int count = 0;
+    for (int bit = first; bit < last; ) {
+        if (bit % 64 == 0 && bit + 64 <= last) {
+            count += popcount(words_[bit / 64]);
+            bit += 64;
+        } else {
+            count += test(bit) ? 1 : 0;
+            ++bit;
+        }
+    }
+    return count;
+}
+
+bool Bitmap::test(int bit) const {
+    if (bit < 0 || bit >= bitCount_) return false;
+    return (words_[bit / 64] >> (bit % 64)) & 1ULL;
+}
+
+void Bitmap::set(int bit) {
+    if (bit < 0 || bit >= bitCount_) return;
+    if (!held_.empty() && held_.erase(bit) != 0) markDirty(bit); // Taken back: written as set again
+    if (test(bit)) return;
+    words_[bit / 64] |= 1ULL << (bit % 64);
+    ++used_;
+    markDirty(bit);
+    if (indexValid_) indexTake(bit, 1);
+}
+
+void Bitmap::clear(int bit) {
+    if (bit < 0 || bit >= bitCount_ || !test(bit)) return;
+    if (!held_.empty()) held_.erase(bit);
+    words_[bit / 64] &= ~(1ULL << (bit % 64));
+    --used_;
+    markDirty(bit);
+    if (indexValid_) indexRelease(bit);
+}
+
+// -------------------------------------------------
+// hold / releaseHeld
+// -------------------------------------------------
+// A held bit goes out as clear with its page but
+// still counts as used here, so it is not handed
+// out again. releaseHeld frees them all; their
+// pages already say so on disk, but are marked
+// dirty in case they were not written since.
+// -------------------------------------------------
+void Bitmap::hold(int bit) {
+    if (!test(bit)) return;
+    held_.insert(bit);
+    markDirty(bit);
+}
+
+void Bitmap::releaseHeld() {
+    for (int bit : held_) {
+        words_[bit / 64] &= ~(1ULL << (bit % 64));
+        --used_;
+        markDirty(bit);
+        if (indexValid_) indexRelease(bit);
+    }
+    held_.clear();
+}
+
+void Bitmap::markDirty(int bit) {
+    dirtyPages_[(bit / 8) / PAGE_BYTES] = true;
+}
+
+// -------------------------------------------------
+// findNext
+// -------------------------------------------------
+// Returns the first bit at or after `from` whose value
+// equals `wantSet`, or capacity() if there is none.
+// Whole words that can't match are skipped at once.
+// -------------------------------------------------
+int Bitmap::findNext(int from, bool wantSet) const {
+    if (from >= bitCount_) return bitCount_;
+
+    size_t w = static_cast<size_t>(from) / 64;
+    uint64_t word = wantSet ? words_[w] : ~words_[w];
+    word &= ~0ULL << (from % 64);
+
+    while (word == 0) {
+        if (++w >= words_.size()) return bitCount_;
+        word = wantSet ? words_[w] : ~words_[w];
+    }
+    return std::min(bitCount_, static_cast<int>(w * 64) + lowestSetBit(word));
+}
+
+int Bitmap::longestRun() {
+    if (!indexValid_) rebuildIndex();
+    return freeBySize_.empty() ? 0 : freeBySize_.rbegin()->first;
+}
+
+// -------------------------------------------------
+// diff
+// -------------------------------------------------
+// Compares with a reference bitmap a word at a time:
+// AND-NOT in both directions, popcount to size the
+// lists, then only the differing bits are visited.
+// Both passes are plain word loops the compiler
+// vectorizes; a consistent bitmap costs one pass.
+// Missing reference words count as clear; bits past
+// capacity() are ignored. Held bits are compared as
+// they are on disk (clear).
+// -------------------------------------------------
+void Bitmap::diff(const std::vector<uint64_t>& reference, std::vector<int>& extra, std::vector<int>& missing) const {
+    extra.clear();
+    missing.clear();
+    const size_t wordCount = (static_cast<size_t>(bitCount_) + 63) / 64;
+    std::vector<uint64_t> onDisk;
+    if (!held_.empty()) {
+        onDisk.assign(words_.begin(), words_.begin() + static_cast<std::ptrdiff_t>(wordCount));
+        for (int bit : held_) onDisk[bit / 64] &= ~(1ULL << (bit % 64));
+    }
+    const std::vector<uint64_t>& words = held_.empty() ? words_ : onDisk;
+    auto compare = [this, &reference, &words](size_t w, uint64_t& onlyHere, uint64_t& onlyThere) {
+        const uint64_t ref = w < reference.size() ? reference[w] : 0;
+        uint64_t mask = ~0ULL;
+        if ((w + 1) * 64 > static_cast<size_t>(bitCount_)) mask >>= (w + 1) * 64 - bitCount_;
+        onlyHere = words[w] & ~ref & mask;
+        onlyThere = ref & ~words[w] & mask;
+    };
+
+    // --- Count first, so each list is allocated once ---
+    size_t extraCount = 0, missingCount = 0;
+    for (size_t w = 0; w < wordCount; ++w) {
+        uint64_t onlyHere = 0, onlyThere = 0;
+        compare(w, onlyHere, onlyThere);
+        extraCount += popcount(onlyHere);
+        missingCount += popcount(onlyThere);
+    }
+    if (extraCount + missingCount == 0) return;
+    extra.reserve(extraCount);
+    missing.reserve(missingCount);
+
+    // --- Collect the differing bits ---
+    auto collect = [](uint64_t word, size_t w, std::vector<int>& bits) {
+        while (word != 0) {
+            bits.push_back(static_cast<int>(w * 64) + lowestSetBit(word));
+            word &= word - 1;
+        }
+    };
+    for (size_t w = 0; w < wordCount; ++w) {
+        uint64_t onlyHere = 0, onlyThere = 0;
+        compare(w, onlyHere, onlyThere);
+        collect(onlyHere, w, extra);
+        collect(onlyThere, w, missing);
+    }
+}
+
+// -------------------------------------------------
+// rebuildIndex
+// -------------------------------------------------
+// Collects every run of clear bits into the index.
+// Only needed once per load: from then on set,
+// clear and the run allocators keep it current.
+// -------------------------------------------------
+void Bitmap::rebuildIndex() {
+    freeBySize_.clear();
+    freeByStart_.clear();
+    int start = findNext(0, false);
+    while (start < bitCount_) {
+        int end = findNext(start, true);
+        indexAdd(start, end - start);
+        start = findNext(end, false);
+    }
+    indexValid_ = true;
+}
+
+// -------------------------------------------------
+// Index maintenance
+// -------------------------------------------------
+// Each extent is in both maps: freeBySize_ answers
+// best-fit queries, freeByStart_ finds the extent
+// around a bit and its neighbours. A change of one
+// bit or run touches at most three extents.
+// -------------------------------------------------
+void Bitmap::indexAdd(int start, int length) {
+    freeByStart_.emplace(start, length);
+    freeBySize_.emplace(length, start);
+}
+
+void Bitmap::indexRemove(std::map<int, int>::iterator extent) {
+    auto sized = freeBySize_.equal_range(extent->second);
+    for (auto it = sized.first; it != sized.second; ++it) {
+        if (it->second == extent->first) {
+            freeBySize_.erase(it);
+            break;
+        }
+    }
+    freeByStart_.erase(extent);
+}
+
+void Bitmap::indexTake(int start, int length) {
+    auto extent = freeByStart_.upper_bound(start);
+    if (extent == freeByStart_.begin()) return;
+    --extent;
+    const int first = extent->first;
+    const int end = first + extent->second;
+    if (start + length > end) return; // not inside one free extent
+
+    indexRemove(extent);
+    if (start > first) indexAdd(first, start - first);
+    if (start + length < end) indexAdd(start + length, end - start - length);
+}
+
+void Bitmap::indexRelease(int bit) {
+    int start = bit;
+    int length = 1;
+    auto next = freeByStart_.lower_bound(bit);
+    if (next != freeByStart_.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == bit) {
+            start = previous->first;
+            length += previous->second;
+            indexRemove(previous);
+        }
+    }
+    if (next != freeByStart_.end() && next->first == bit + 1) {
+        length += next->second;
+        indexRemove(next);
+    }
+    indexAdd(start, length);
+}
+
+void Bitmap::setRange(int start, int length) {
+    for (int bit = start; bit < start + length; ++bit) {
+        words_[bit / 64] |= 1ULL << (bit % 64);
+        markDirty(bit);
+    }
+    used_ += length;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+#include "block_device.h"
+
+// =============================================
+// bitmap.h
+// ---------------------------------------------
+// Defines the Bitmap class, an in-memory copy of
+// an on-disk allocation bitmap (inodes or data
+// blocks). Bits are kept in 64-bit words so that
+// free-bit search and counting work a word at a
+// time; only the pages touched since the last
+// flush are written back to the image.
+//
+// On-disk layout: bit i lives in byte i / 8 at
+// position i % 8 (LSB first). Loading the bytes
+// into little-endian words keeps that numbering.
+//
+// A held bit is free on disk but stays set in
+// memory, so nothing allocates it: the journal
+// holds freed blocks back until the free is
+// checkpointed.
+// =============================================
+class Bitmap {
+public:
+    static constexpr int PAGE_BYTES = 512;        // Write-back granularity
+
+    // A run of consecutive bits [start, start + length)
+    struct Extent {
+        int start;
+        int length;
+    };
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    bool load(BlockDevice& device, long long offset, int sizeBytes, int bitCount = -1); // Read bitmap (first bitCount bits in use)
+    bool flush(BlockDevice& device);              // Write dirty pages back to the image
+    void reset();                                 // Forget the cached bitmap
+
+    // ------------------------------------------
+    // Bit operations
+    // ------------------------------------------
+    int allocate(int limit = -1);                 // Find a clear bit below limit (next-fit), set it, return index or -1
+    std::vector<Extent> allocateRun(int count);   // Best-fit contiguous allocation of count bits
+    int allocateIn(int first, int last);          // Lowest clear bit in [first, last), set it, return index or -1
+    bool allocateRunIn(int count, int first, int last, Extent& run); // Best-fit run inside [first, last)
+    bool test(int bit) const;                     // True if bit is set
+    void set(int bit);                            // Mark bit as used
+    void clear(int bit);                          // Mark bit as free
+    void hold(int bit);                           // Write a set bit out as free, keep it set in memory
+    void releaseHeld();                           // Held bits become free in memory too
+
+    // ------------------------------------------
+    // Statistics
+    // ------------------------------------------
+    int capacity() const { return bitCount_; }    // Number of bits tracked
+    int used() const { return used_; }            // Number of set bits (held ones included)
+    int heldCount() const { return static_cast<int>(held_.size()); } // Bits held back
+    int usedIn(int first, int last) const;        // Set bits in [first, last)
+    int longestRun();                             // Length of the longest run of clear bits
+    // Bits that differ from `reference` (same numbering, 64 per word), held
+    // bits counted as clear: set here but clear there (extra), clear here
+    // but set there (missing)
+    void diff(const std::vector<uint64_t>& reference, std::vector<int>& extra, std::vector<int>& missing) const;
+
+private:
+    void markDirty(int bit);                      // Flag the page containing bit
+    int findNext(int from, bool wantSet) const;   // First bit >= from with the given value
+    void rebuildIndex();                          // Rebuild the free-extent index from words_
+    void setRange(int start, int length);         // Set a run of clear bits
+    void indexAdd(int start, int length);         // Record a free extent in both maps
+    void indexRemove(std::map<int, int>::iterator extent); // Drop a free extent from both maps
+    void indexTake(int start, int length);        // Bits of one free extent became used: split it
+    void indexRelease(int bit);                   // A bit became free: merge with its neighbours
+
+    std::vector<uint64_t> words_;   // Bitmap contents, 64 bits per word
+    std::vector<bool> dirtyPages_;  // One flag per PAGE_BYTES of the on-disk bitmap
+    long long offset_ = 0;          // Byte offset of the bitmap in the image
+    int sizeBytes_ = 0;             // On-disk size of the bitmap
+    int bitCount_ = 0;              // Bits tracked (at most sizeBytes_ * 8)
+    int used_ = 0;                  // Cached popcount of words_
+    size_t cursor_ = 0;             // Next-fit search start (word index)
+    std::set<int> held_;            // Set bits written out as clear
+
+    std::multimap<int, int> freeBySize_; // Free-extent index: length -> start
+    std::map<int, int> freeByStart_;     // The same extents: start -> length
+    bool indexValid_ = false;       // Built on first use, then kept up to date
+};
@@ -0,0 +1,545 @@
+// =============================================
+// block_device.cpp
+// ---------------------------------------------
+// Persistent image handle
+// Handles:
+//   - Opening and closing the image once per mount
+//   - Positioned reads and writes (pread/pwrite)
+//   - Optional memory-mapped backend (mmap / MapViewOfFile)
+//   - Flushing written data to the host disk (msync / fsync)
+//   - Readahead hints (posix_fadvise / madvise)
+//   - Batched I/O through the submission queue
+//   - Staging metadata writes for the journal
+//   - Verifying and reporting blocks to the checksum table
+// =============================================
+
+#include "block_device.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "checksum_table.h"
+#include "crc32c.h"
+#include "metrics.h"
+
+// -------------------------------------------------
+// open
+// -------------------------------------------------
+// Opens an existing image for reading and writing.
+// Any previously opened image is closed first.
+// With `mapped`, the whole image is mapped into memory.
+// Returns false if the image does not exist or
+// cannot be mapped.
+// -------------------------------------------------
+bool BlockDevice::open(const std::string& path, bool mapped) {
+    close();
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    handle_ = h;
+#else
+    fd_ = ::open(path.c_str(), O_RDWR);
+    if (fd_ < 0) return false;
+#endif
+    if (mapped && !mapImage()) {
+        close();
+        return false;
+    }
+    queue_ = std::make_unique<IoQueue>([this](const IoRequest& request) { return transfer(request); });
+    return true;
+}
+
+// -------------------------------------------------
+// mapImage / unmapImage
+// -------------------------------------------------
+// Maps the entire opened image read/write and shared,
+// so stores into the mapping land in the image file.
+// -------------------------------------------------
+bool BlockDevice::mapImage() {
+#ifdef _WIN32
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(static_cast<HANDLE>(handle_), &size) || size.QuadPart == 0) return false;
+    HANDLE mapping = CreateFileMappingA(static_cast<HANDLE>(handle_), nullptr,
+        PAGE_READWRITE, 0, 0, nullptr);
+    if (mapping == nullptr) return false;
+    void* base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (base == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+    mapping_ = mapping;
+    map_ = static_cast<char*>(base);
+    mapSize_ = static_cast<size_t>(size.QuadPart);
+#else
+    struct stat st{};
+    if (::fstat(fd_, &st) != 0 || st.st_size == 0) return false;
+    void* base = ::mmap(nullptr, static_cast<size_t>(st.st_size),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED) return false;
+    map_ = static_cast<char*>(base);
+    mapSize_ = static_cast<size_t>(st.st_size);
+#endif
+    return true;
+}
+
+void BlockDevice::unmapImage() {
+    if (map_ == nullptr) return;
+#ifdef _WIN32
+    UnmapViewOfFile(map_);
+    CloseHandle(static_cast<HANDLE>(mapping_));
+    mapping_ = nullptr;
+#else
+    ::munmap(map_, mapSize_);
+#endif
+    map_ = nullptr;
+    mapSize_ = 0;
+}
+
+// -------------------------------------------------
+// close
+// -------------------------------------------------
+// Releases the image handle.
+// -------------------------------------------------
+void BlockDevice::close() {
+    queue_.reset();
+    checksums_ = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(stageLock_);
+        staging_ = false;
+        staged_.clear();
+        tx_.clear();
+    }
+    unmapImage();
+#ifdef _WIN32
+    if (handle_ != nullptr) {
+        CloseHandle(static_cast<HANDLE>(handle_));
+        handle_ = nullptr;
+    }
+#else
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+#endif
+}
+
+bool BlockDevice::isOpen() const {
+#ifdef _WIN32
+    return handle_ != nullptr;
+#else
+    return fd_ >= 0;
+#endif
+}
+
+// -------------------------------------------------
+// readAt / readThrough
+// -------------------------------------------------
+// Read exactly `length` bytes starting at `offset`.
+// Short reads are retried; reading past the end of
+// the image fails. readAt returns staged bytes in
+// place of the image's and fails on a checksum
+// mismatch, unless the caller (fsck) takes a list
+// of the mismatching units instead; readThrough
+// reads the image only.
+// -------------------------------------------------
+bool BlockDevice::readAt(long long offset, void* buffer, size_t length) {
+    if (!readThrough(offset, buffer, length)) return false;
+
+    // Staged bytes are newer than the image
+    {
+        std::lock_guard<std::mutex> guard(stageLock_);
+        overlayStaged(offset, buffer, length);
+    }
+    return verify(offset, buffer, length);
+}
+
+bool BlockDevice::readAt(long long offset, void* buffer, size_t length, std::vector<long long>& badUnits) {
+    if (!readThrough(offset, buffer, length)) return false;
+    {
+        std::lock_guard<std::mutex> guard(stageLock_);
+        overlayStaged(offset, buffer, length);
+    }
+    return verify(offset, buffer, length, &badUnits);
+}
+
+bool BlockDevice::readThrough(long long offset, void* buffer, size_t length) {
+    if (!isOpen()) return false;
+    VFS_COUNT(ImageReads);
+    VFS_COUNT_N(BytesRead, length);
+    if (isMapped()) {
+        const char* src = mapped(offset, length);
+        if (src == nullptr) return false;
+        std::memcpy(buffer, src, length);
+        return true;
+    }
+    char* dst = static_cast<char*>(buffer);
+
+    while (length > 0) {
+#ifdef _WIN32
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFULL);
+        ov.OffsetHigh = static_cast<DWORD>(static_cast<unsigned long long>(offset) >> 32);
+        DWORD chunk = length > 0x40000000 ? 0x40000000 : static_cast<DWORD>(length);
+        DWORD got = 0;
+        if (!ReadFile(static_cast<HANDLE>(handle_), dst, chunk, &got, &ov) || got == 0)
+            return false;
+#else
+        ssize_t got = ::pread(fd_, dst, length, static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+#endif
+        dst += got;
+        offset += got;
+        length -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+void BlockDevice::overlayStaged(long long offset, void* buffer, size_t length) const {
+    if (staged_.empty()) return;
+    const long long end = offset + static_cast<long long>(length);
+    auto it = staged_.upper_bound(offset);
+    if (it != staged_.begin()) --it;
+    for (; it != staged_.end() && it->first < end; ++it) {
+        long long from = std::max(offset, it->first);
+        long long to = std::min(end, it->first + static_cast<long long>(it->second.size()));
+        if (from >= to) continue;
+        std::memcpy(static_cast<char*>(buffer) + (from - offset),
+            it->second.data() + (from - it->first), static_cast<size_t>(to - from));
+    }
+}
+
+// -------------------------------------------------
+// writeAt / writeData / writeThrough
+// -------------------------------------------------
+// Write exactly `length` bytes starting at `offset`.
+// writeAt stages the bytes while staging is on.
+// writeData stages only over already staged bytes,
+// so they aren't hidden by an older staged copy.
+// writeThrough always writes to the image.
+// -------------------------------------------------
+bool BlockDevice::writeAt(long long offset, const void* buffer, size_t length) {
+    if (!isOpen()) return false;
+    if (checksums_ != nullptr) checksums_->noteWrite(offset, length, false);
+    {
+        std::lock_guard<std::mutex> guard(stageLock_);
+        if (staging_) {
+            if (offset < 0) return false;
+            merge(staged_, offset, static_cast<const char*>(buffer), length);
+            merge(tx_, offset, static_cast<const char*>(buffer), length);
+            return true;
+        }
+    }
+    return writeThrough(offset, buffer, length);
+}
+
+bool BlockDevice::writeData(long long offset, const void* buffer, size_t length) {
+    if (!isOpen()) return false;
+    if (checksums_ != nullptr) checksums_->noteWrite(offset, length, true);
+    {
+        std::lock_guard<std::mutex> guard(stageLock_);
+        if (staging_ && overlapsStaged(offset, length)) {
+            merge(staged_, offset, static_cast<const char*>(buffer), length);
+            merge(tx_, offset, static_cast<const char*>(buffer), length);
+            return true;
+        }
+    }
+    return writeThrough(offset, buffer, length);
+}
+
+bool BlockDevice::writeThrough(long long offset, const void* buffer, size_t length) {
+    if (!isOpen()) return false;
+    VFS_COUNT(ImageWrites);
+    VFS_COUNT_N(BytesWritten, length);
+    if (isMapped()) {
+        char* dst = mapped(offset, length);
+        if (dst == nullptr) return false;
+        std::memcpy(dst, buffer, length);
+        return true;
+    }
+    const char* src = static_cast<const char*>(buffer);
+
+    while (length > 0) {
+#ifdef _WIN32
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFULL);
+        ov.OffsetHigh = static_cast<DWORD>(static_cast<unsigned long long>(offset) >> 32);
+        DWORD chunk = length > 0x40000000 ? 0x40000000 : static_cast<DWORD>(length);
+        DWORD put = 0;
+        if (!WriteFile(static_cast<HANDLE>(handle_), src, chunk, &put, &ov) || put == 0)
+            return false;
+#else
+        ssize_t put = ::pwrite(fd_, src, length, static_cast<off_t>(offset));
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return false;
+#endif
+        src += put;
+        offset += put;
+        length -= static_cast<size_t>(put);
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// Staging
+// -------------------------------------------------
+// takeTransaction hands the journal what was written
+// since its last call (one transaction). applyStaged
+// writes every extent not yet written home and
+// switches staging off; readers keep seeing the
+// staged bytes until they are on the image.
+// -------------------------------------------------
+void BlockDevice::beginStaging() {
+    std::lock_guard<std::mutex> guard(stageLock_);
+    staging_ = true;
+}
+
+bool BlockDevice::staging() const {
+    std::lock_guard<std::mutex> guard(stageLock_);
+    return staging_;
+}
+
+bool BlockDevice::hasStaged() const {
+    std::lock_guard<std::mutex> guard(stageLock_);
+    return !staged_.empty();
+}
+
+BlockDevice::Extents BlockDevice::takeTransaction() {
+    std::lock_guard<std::mutex> guard(stageLock_);
+    Extents tx;
+    tx.swap(tx_);
+    return tx;
+}
+
+// All extents go out as one batch
+bool BlockDevice::applyStaged() {
+    std::lock_guard<std::mutex> guard(stageLock_);
+    std::vector<IoRequest> batch;
+    batch.reserve(staged_.size());
+    for (auto& extent : staged_) {
+        batch.push_back({ extent.first, extent.second.data(), extent.second.size(), true });
+    }
+    bool ok = true;
+    if (!batch.empty()) {
+        if (isMapped() || !queue_) {
+            for (const IoRequest& request : batch) ok = transfer(request) && ok;
+        } else {
+            ok = queue_->run(batch);
+        }
+    }
+    staged_.clear();
+    tx_.clear();
+    staging_ = false;
+    return ok;
+}
+
+// -------------------------------------------------
+// submit
+// -------------------------------------------------
+// Issues a batch of requests: reads return staged
+// bytes like readAt, writes over staged bytes are
+// staged like writeData. Everything else goes to
+// the IoQueue at once (on a mapping, where each
+// request is a memcpy, one after the other).
+// Returns false if any request failed.
+// -------------------------------------------------
+bool BlockDevice::submit(std::vector<IoRequest>& batch) {
+    if (!isOpen()) return false;
+
+    // --- STEP 1: Writes over staged bytes stay staged ---
+    std::vector<IoRequest> direct;
+    direct.reserve(batch.size());
+    {
+        std::lock_guard<std::mutex> guard(stageLock_);
+        for (const IoRequest& request : batch) {
+            if (request.write && checksums_ != nullptr) checksums_->noteWrite(request.offset, request.length, true);
+            if (request.write && staging_ && overlapsStaged(request.offset, request.length)) {
+                merge(staged_, request.offset, request.buffer, request.length);
+                merge(tx_, request.offset, request.buffer, request.length);
+                continue;
+            }
+            direct.push_back(request);
+        }
+    }
+
+    // --- STEP 2: Issue the rest ---
+    bool ok = true;
+    if (isMapped() || !queue_) {
+        for (const IoRequest& request : direct) ok = transfer(request) && ok;
+    } else {
+        ok = queue_->run(direct);
+    }
+
+    // --- STEP 3: Staged bytes are newer than the image ---
+    {
+        std::lock_guard<std::mutex> guard(stageLock_);
+        for (const IoRequest& request : direct) {
+            if (!request.write) overlayStaged(request.offset, request.buffer, request.length);
+        }
+    }
+    for (const IoRequest& request : direct) {
+        if (!request.write && ok) ok = verify(request.offset, request.buffer, request.length);
+    }
+    return ok;
+}
+
+bool BlockDevice::transfer(const IoRequest& request) {
+    return request.write ? writeThrough(request.offset, request.buffer, request.length)
+                         : readThrough(request.offset, request.buffer, request.length);
+}
+
+// -------------------------------------------------
+// verify
+// -------------------------------------------------
+// Checks each unit of a read that the checksum
+// table has not verified yet. A unit the read
+// covers whole is summed from `bytes`; one it only
+// touches is read whole first (staged bytes
+// included), which happens once per unit. With
+// badUnits, a mismatch is listed and the check
+// goes on.
+// -------------------------------------------------
+bool BlockDevice::verify(long long offset, const void* bytes, size_t length, std::vector<long long>* badUnits) {
+    if (checksums_ == nullptr) return true;
+    const std::vector<long long> units = checksums_->unchecked(offset, length);
+    if (units.empty()) return true;
+
+    const long long unitSize = checksums_->unitSize();
+    const long long end = offset + static_cast<long long>(length);
+    std::vector<char> whole;
+    for (long long unit : units) {
+        const long long start = unit * unitSize;
+        uint32_t crc = 0;
+        if (start >= offset && start + unitSize <= end) {
+            crc = crc32c(static_cast<const char*>(bytes) + (start - offset), static_cast<size_t>(unitSize));
+        } else {
+            whole.resize(static_cast<size_t>(unitSize));
+            if (!readThrough(start, whole.data(), whole.size())) return false;
+            {
+                std::lock_guard<std::mutex> guard(stageLock_);
+                overlayStaged(start, whole.data(), whole.size());
+            }
+            crc = crc32c(whole.data(), whole.size());
+        }
+        if (checksums_->confirm(unit, crc)) continue;
+        if (badUnits == nullptr) return false;
+        badUnits->push_back(unit);
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// merge
+// -------------------------------------------------
+// Adds a write to a set of extents. Overlapping and
+// touching extents are combined, newest bytes win.
+// -------------------------------------------------
+void BlockDevice::merge(Extents& extents, long long offset, const char* data, size_t length) {
+    if (length == 0) return;
+    const long long end = offset + static_cast<long long>(length);
+
+    auto first = extents.upper_bound(offset);
+    if (first != extents.begin()) {
+        auto prev = std::prev(first);
+        if (prev->first + static_cast<long long>(prev->second.size()) >= offset) first = prev;
+    }
+
+    // Common case: the write lands inside one extent
+    if (first != extents.end() && first->first <= offset &&
+        first->first + static_cast<long long>(first->second.size()) >= end) {
+        std::memcpy(first->second.data() + (offset - first->first), data, length);
+        return;
+    }
+
+    long long start = offset;
+    long long stop = end;
+    auto last = first;
+    for (; last != extents.end() && last->first <= end; ++last) {
+        start = std::min(start, last->first);
+        stop = std::max(stop, last->first + static_cast<long long>(last->second.size()));
+    }
+
+    std::vector<char> bytes;
+    if (first != last && first->first == start) bytes.swap(first->second);
+    bytes.resize(static_cast<size_t>(stop - start));
+    for (auto it = first; it != last; ++it) {
+        if (it->second.empty()) continue;
+        std::memcpy(bytes.data() + (it->first - start), it->second.data(), it->second.size());
+    }
+    std::memcpy(bytes.data() + (offset - start), data, length);
+
+    extents.erase(first, last);
+    extents.emplace(start, std::move(bytes));
+}
+
+bool BlockDevice::overlapsStaged(long long offset, size_t length) const {
+    const long long end = offset + static_cast<long long>(length);
+    auto it = staged_.upper_bound(offset);
+    if (it != staged_.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + static_cast<long long>(prev->second.size()) > offset) return true;
+    }
+    return it != staged_.end() && it->first < end;
+}
+
+char* BlockDevice::mapped(long long offset, size_t length) {
+    if (map_ == nullptr || offset < 0 || static_cast<size_t>(offset) + length > mapSize_) {
+        return nullptr;
+    }
+    return map_ + offset;
+}
+
+// -------------------------------------------------
+// flush
+// -------------------------------------------------
+// Forces written data out to the host disk.
+// Dirty pages of a mapped image are written back
+// first (msync / FlushViewOfFile).
+// -------------------------------------------------
+bool BlockDevice::flush() {
+    if (!isOpen()) return false;
+#ifdef _WIN32
+    if (isMapped() && !FlushViewOfFile(map_, 0)) return false;
+    return FlushFileBuffers(static_cast<HANDLE>(handle_)) != 0;
+#else
+    if (isMapped() && ::msync(map_, mapSize_, MS_SYNC) != 0) return false;
+    return ::fsync(fd_) == 0;
+#endif
+}
+
+// -------------------------------------------------
+// prefetch
+// -------------------------------------------------
+// Asks the host to start loading a range that will
+// be read soon (posix_fadvise WILLNEED on the file,
+// madvise WILLNEED on a mapping) and returns at
+// once. Only a hint: nothing fails if it is
+// ignored. Win32 has no such hint for a plain
+// handle, so there it does nothing.
+// -------------------------------------------------
+void BlockDevice::prefetch(long long offset, size_t length) {
+    if (!isOpen() || offset < 0 || length == 0) return;
+#ifndef _WIN32
+    if (isMapped()) {
+        if (mapped(offset, length) == nullptr) return;
+        const long long page = ::sysconf(_SC_PAGESIZE);
+        const long long start = offset / page * page;
+        ::madvise(map_ + start, static_cast<size_t>(offset - start) + length, MADV_WILLNEED);
+        return;
+    }
+    ::posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "io_queue.h"
+
+class ChecksumTable;
+
+// =============================================
+// block_device.h
+// ---------------------------------------------
+// Defines the BlockDevice class, a thin wrapper
+// around the filesystem image file. The image is
+// opened once and kept open; all access goes
+// through positioned reads and writes
+// (pread/pwrite style), so no seek state is shared
+// between callers.
+//
+// Optionally the whole image is memory-mapped;
+// readAt/writeAt then become memcpy and view()
+// hands out pointers straight into the mapping.
+//
+// While staging is on, writeAt does not touch the
+// image: the bytes are kept as extents in memory
+// (later reads see them) until the journal takes
+// them, logs them and writes them home with
+// writeThrough. File data uses writeData, which
+// only stages when it overlaps staged bytes.
+//
+// Batches of reads and writes go through submit():
+// an IoQueue coalesces them and keeps several in
+// flight at once. Writing the staged extents home
+// (checkpoint) is such a batch too.
+//
+// With a ChecksumTable attached, every write is
+// reported to it and reads check the units the
+// table has not verified yet: a read that hits
+// a checksum mismatch fails.
+//
+// Positioned I/O may be issued from any thread;
+// the staging state has its own mutex.
+// =============================================
+class BlockDevice {
+public:
+    BlockDevice() = default;
+    ~BlockDevice() { close(); }
+
+    BlockDevice(const BlockDevice&) = delete;
+    BlockDevice& operator=(const BlockDevice&) = delete;
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    bool open(const std::string& path, bool mapped = false); // Open an existing image for read/write
+    void close();                                      // Close the image (no-op if closed)
+    bool isOpen() const;                               // True if an image is attached
+    bool isMapped() const { return map_ != nullptr; }  // True if the image is memory-mapped
+
+    // ------------------------------------------
+    // Positioned I/O
+    // ------------------------------------------
+    bool readAt(long long offset, void* buffer, size_t length);        // Read exactly length bytes
+    // Same, but units failing their checksum are listed in badUnits instead of failing the read
+    bool readAt(long long offset, void* buffer, size_t length, std::vector<long long>& badUnits);
+    bool writeAt(long long offset, const void* buffer, size_t length); // Write exactly length bytes
+    bool writeData(long long offset, const void* buffer, size_t length);   // Unstaged unless it overlaps staged bytes
+    bool writeThrough(long long offset, const void* buffer, size_t length); // Always straight to the image
+    bool flush();                                      // Push written data to stable storage
+    void prefetch(long long offset, size_t length);    // Hint: this range is read soon (async, may be ignored)
+    bool submit(std::vector<IoRequest>& batch);        // Reads as readAt, writes as writeData, all at once
+    void attachChecksums(ChecksumTable* table) { checksums_ = table; } // Verify reads, report writes (nullptr = off)
+
+    // ------------------------------------------
+    // Staging (used by the journal)
+    // ------------------------------------------
+    using Extents = std::map<long long, std::vector<char>>; // Offset -> bytes, non-overlapping
+
+    void beginStaging();                               // Hold back writeAt from now on
+    bool staging() const;                              // True while writes are held back
+    Extents takeTransaction();                         // Extents written since the last call
+    bool applyStaged();                                // Write everything held back home; ends staging
+    static void merge(Extents& extents, long long offset, const char* data, size_t length); // Add a write, newest bytes win
+
+    // Pointer to `count` objects of T at `offset` inside the mapping,
+    // or nullptr if the image isn't mapped, the range is out of bounds,
+    // staged bytes have not reached the image yet or a checksum fails.
+    template <typename T>
+    T* view(long long offset, size_t count = 1) {
+        if (hasStaged()) return nullptr;
+        char* at = mapped(offset, count * sizeof(T));
+        if (at == nullptr || !verify(offset, at, count * sizeof(T))) return nullptr;
+        return reinterpret_cast<T*>(at);
+    }
+
+private:
+    bool readThrough(long long offset, void* buffer, size_t length); // Image only, staged bytes ignored
+    void overlayStaged(long long offset, void* buffer, size_t length) const; // Caller holds stageLock_
+    bool transfer(const IoRequest& request);           // readThrough / writeThrough of one request
+    // Check the unverified units of bytes read (badUnits: list mismatches, go on)
+    bool verify(long long offset, const void* bytes, size_t length, std::vector<long long>* badUnits = nullptr);
+    bool mapImage();                                   // Map the opened image into memory
+    void unmapImage();                                 // Drop the mapping (if any)
+    char* mapped(long long offset, size_t length);     // Raw pointer into the mapping or nullptr
+    bool overlapsStaged(long long offset, size_t length) const; // Caller holds stageLock_
+    bool hasStaged() const;
+
+    bool staging_ = false;      // writeAt goes to staged_/tx_ instead of the image
+    Extents staged_;            // Bytes not yet written home (read back by readAt)
+    Extents tx_;                // Bytes staged since the last takeTransaction
+    mutable std::mutex stageLock_; // Guards staging_, staged_ and tx_
+    std::unique_ptr<IoQueue> queue_; // Batch submission (while an image is open)
+    ChecksumTable* checksums_ = nullptr; // Block checksums (owned by the filesystem)
+
+    char* map_ = nullptr;       // Base address of the mapping (nullptr in stream mode)
+    size_t mapSize_ = 0;        // Length of the mapping in bytes
+#ifdef _WIN32
+    void* handle_ = nullptr;    // Win32 HANDLE of the image
+    void* mapping_ = nullptr;   // Win32 file-mapping object HANDLE
+#else
+    int fd_ = -1;               // POSIX file descriptor of the image
+#endif
+};
@@ -0,0 +1,184 @@
+// =============================================
+// block_map.cpp
+// ---------------------------------------------
+// Logical -> physical block translation
+// Handles:
+//   - Resolving direct, indirect and double-indirect
+//     block pointers
+//   - Range queries over a file's blocks
+//   - Caching indirect pointer blocks (LRU)
+// =============================================
+
+#include "block_map.h"
+#include <algorithm>
+#include <limits>
+#include "metrics.h"
+
+void BlockMap::attach(long long dataStart, int clusterSize, bool doubleIndirect) {
+    reset();
+    std::lock_guard<std::mutex> guard(lock_);
+    dataStart_ = dataStart;
+    clusterSize_ = clusterSize;
+    pointersPerBlock_ = clusterSize / static_cast<int>(sizeof(int32_t));
+    doubleIndirect_ = doubleIndirect;
+}
+
+void BlockMap::reset() {
+    std::lock_guard<std::mutex> guard(lock_);
+    lru_.clear();
+    index_.clear();
+}
+
+void BlockMap::invalidate(int blockId) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = index_.find(blockId);
+    if (it == index_.end()) return;
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+int BlockMap::maxBlocks() const {
+    long long second = doubleIndirect_ ? static_cast<long long>(pointersPerBlock_) * pointersPerBlock_
+                                       : pointersPerBlock_;
+    return static_cast<int>(std::min<long long>(DIRECT_COUNT + pointersPerBlock_ + second,
+                                                std::numeric_limits<int32_t>::max()));
+}
+
+// indirect1, indirect2 and (double-indirect) one child per P blocks past them
+int BlockMap::pointerBlocksFor(int blocks) const {
+    int beyond = blocks - DIRECT_COUNT;
+    if (beyond <= 0) return 0;
+    if (beyond <= pointersPerBlock_) return 1;
+    if (!doubleIndirect_) return 2;
+    beyond -= pointersPerBlock_;
+    return 2 + (beyond + pointersPerBlock_ - 1) / pointersPerBlock_;
+}
+
+int BlockMap::blocksFor(long long bytes, int clusterSize) {
+    if (bytes <= 0 || clusterSize <= 0) return 0;
+    return static_cast<int>((bytes + clusterSize - 1) / clusterSize);
+}
+
+// -------------------------------------------------
+// resolve
+// -------------------------------------------------
+// Returns the physical block holding logical block
+// `logical` of the file, 0 if it isn't mapped or
+// UNREADABLE if a pointer block on the way failed.
+// A double-indirect block costs one extra (usually
+// cached) pointer block. An inline file maps none.
+// -------------------------------------------------
+int BlockMap::resolve(BlockDevice& device, const Inode& inode, int logical) {
+    std::lock_guard<std::mutex> guard(lock_);
+    return resolveLocked(device, inode, logical);
+}
+
+int BlockMap::resolveLocked(BlockDevice& device, const Inode& inode, int logical) {
+    if (logical < 0 || logical >= maxBlocks() || (inode.flags & INODE_INLINE) != 0) return 0;
+
+    const int32_t direct[DIRECT_COUNT] = { inode.direct1, inode.direct2, inode.direct3,
+                                           inode.direct4, inode.direct5 };
+    if (logical < DIRECT_COUNT) {
+        return direct[logical] > 0 ? direct[logical] : 0;
+    }
+
+    int slot = logical - DIRECT_COUNT;
+    int indirect = inode.indirect1;
+    if (slot >= pointersPerBlock_) {
+        slot -= pointersPerBlock_;
+        indirect = inode.indirect2;
+        if (doubleIndirect_ && indirect > 0) {
+            const int32_t* root = loadPointers(device, indirect);
+            if (root == nullptr) return UNREADABLE;
+            indirect = root[slot / pointersPerBlock_];
+        }
+    }
+    if (indirect <= 0) return 0;
+
+    const int32_t* ptrs = loadPointers(device, indirect);
+    if (ptrs == nullptr) return UNREADABLE;
+
+    int32_t ptr = ptrs[slot % pointersPerBlock_];
+    return ptr > 0 ? ptr : 0;
+}
+
+// -------------------------------------------------
+// range
+// -------------------------------------------------
+// Resolves `count` consecutive logical blocks starting
+// at `first`. Unmapped blocks are returned as 0, so
+// the result always has `count` entries.
+// -------------------------------------------------
+std::vector<int> BlockMap::range(BlockDevice& device, const Inode& inode, int first, int count) {
+    std::vector<int> blocks;
+    if (count <= 0) return blocks;
+    blocks.reserve(count);
+
+    std::lock_guard<std::mutex> guard(lock_);
+    for (int logical = first; logical < first + count; ++logical) {
+        blocks.push_back(resolveLocked(device, inode, logical));
+    }
+    return blocks;
+}
+
+// -------------------------------------------------
+// pointerBlocks
+// -------------------------------------------------
+// Returns the indirect blocks used by the file itself
+// (metadata, not file data): indirect1, indirect2 and,
+// if double-indirect, its children in slot order.
+// An inline file has none (its fields hold data).
+// -------------------------------------------------
+std::vector<int> BlockMap::pointerBlocks(BlockDevice& device, const Inode& inode) {
+    std::vector<int> blocks;
+    if ((inode.flags & INODE_INLINE) != 0) return blocks;
+    if (inode.indirect1 > 0) blocks.push_back(inode.indirect1);
+    if (inode.indirect2 <= 0) return blocks;
+    blocks.push_back(inode.indirect2);
+
+    if (doubleIndirect_) {
+        std::lock_guard<std::mutex> guard(lock_);
+        const int32_t* root = loadPointers(device, inode.indirect2);
+        for (int i = 0; root != nullptr && i < pointersPerBlock_; ++i) {
+            if (root[i] > 0) blocks.push_back(root[i]);
+        }
+    }
+    return blocks;
+}
+
+int BlockMap::pointerAt(BlockDevice& device, int blockId, int slot) {
+    if (blockId <= 0 || slot < 0 || slot >= pointersPerBlock_) return 0;
+    std::lock_guard<std::mutex> guard(lock_);
+    const int32_t* ptrs = loadPointers(device, blockId);
+    return ptrs != nullptr && ptrs[slot] > 0 ? ptrs[slot] : 0;
+}
+
+// -------------------------------------------------
+// loadPointers
+// -------------------------------------------------
+// Returns the pointers stored in a pointer block,
+// reading the whole block at once on a cache miss.
+// -------------------------------------------------
+const int32_t* BlockMap::loadPointers(BlockDevice& device, int blockId) {
+    auto it = index_.find(blockId);
+    if (it != index_.end()) {
+        VFS_COUNT(PointerCacheHits);
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->ptrs.data();
+    }
+    VFS_COUNT(PointerCacheMisses);
+
+    Entry entry{ blockId, std::vector<int32_t>(pointersPerBlock_, 0) };
+    long long offset = dataStart_ + static_cast<long long>(blockId) * clusterSize_;
+    if (!device.readAt(offset, entry.ptrs.data(), pointersPerBlock_ * sizeof(int32_t))) {
+        return nullptr;
+    }
+
+    if (lru_.size() >= CACHE_CAPACITY) {
+        index_.erase(lru_.back().blockId);
+        lru_.pop_back();
+    }
+    lru_.push_front(std::move(entry));
+    index_[blockId] = lru_.begin();
+    return lru_.front().ptrs.data();
+}
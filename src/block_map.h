@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "structures.h"
+#include "block_device.h"
+
+// =============================================
+// block_map.h
+// ---------------------------------------------
+// Defines the BlockMap class, which translates
+// logical block indexes of a file into physical
+// data blocks:
+//
+//   0 .. 4          direct1 .. direct5
+//   5 .. P+4        entries of the indirect1 block
+//   P+5 .. 2P+4     entries of the indirect2 block
+//
+// where P = cluster size / 4 pointers fit in one
+// block (256 with 1 KB clusters, 16384 with 64 KB).
+// On format 4 images indirect2 is double-indirect:
+// its entries point at up to P more pointer blocks,
+// so logical blocks P+5 .. P*P+P+4 take two lookups
+// (64 MB files with 1 KB clusters, 2 GB - the limit
+// of file_size - from 4 KB on).
+// Directories stop at logical block P+4: their
+// indirect2 holds the root of the hash index.
+//
+// A physical block of 0 means "not mapped" (block 0
+// belongs to the root directory and is never file
+// data). A block behind a pointer block that
+// cannot be read (I/O error, checksum mismatch)
+// resolves to UNREADABLE instead, so it is not
+// mistaken for a hole. Pointer blocks are read with a single
+// one-block read and kept in a small LRU cache; writeBlock
+// invalidates a cached copy whenever its block is
+// rewritten. The cache is shared by all threads and
+// guarded by one mutex; lookups return values, not
+// pointers into it.
+// =============================================
+class BlockMap {
+public:
+    static constexpr int DIRECT_COUNT = 5;                    // direct1 .. direct5
+    static constexpr int INDIRECT_COUNT = 2;                  // indirect1, indirect2
+    static constexpr size_t CACHE_CAPACITY = 64;              // Pointer blocks kept resident
+    static constexpr int UNREADABLE = -1;                     // Resolved through a pointer block that failed to read
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    void attach(long long dataStart, int clusterSize, bool doubleIndirect); // Bind to a data area (drops the cache)
+    void reset();                                             // Forget every cached pointer block
+    void invalidate(int blockId);                             // Drop a cached pointer block
+
+    int pointersPerBlock() const { return pointersPerBlock_; } // int32 pointers per block
+    bool doubleIndirect() const { return doubleIndirect_; }  // indirect2 points at pointer blocks
+    int maxBlocks() const;                                    // Largest file, in blocks
+    int pointerBlocksFor(int blocks) const;                   // Pointer blocks a file of `blocks` needs
+
+    // ------------------------------------------
+    // Lookups
+    // ------------------------------------------
+    int resolve(BlockDevice& device, const Inode& inode, int logical);  // Physical block, 0 or UNREADABLE
+    std::vector<int> range(BlockDevice& device, const Inode& inode, int first, int count); // Blocks first..first+count-1
+    std::vector<int> pointerBlocks(BlockDevice& device, const Inode& inode); // indirect1, indirect2, then its children
+    int pointerAt(BlockDevice& device, int blockId, int slot); // Entry of a pointer block (cached)
+
+    static int blocksFor(long long bytes, int clusterSize);   // Blocks needed to hold `bytes`
+
+private:
+    struct Entry {
+        int blockId;
+        std::vector<int32_t> ptrs;
+    };
+    using EntryList = std::list<Entry>;
+
+    const int32_t* loadPointers(BlockDevice& device, int blockId); // Cached pointer block or nullptr (lock held)
+    int resolveLocked(BlockDevice& device, const Inode& inode, int logical); // resolve with lock_ held
+
+    EntryList lru_;                                           // Front = most recently used
+    std::unordered_map<int, EntryList::iterator> index_;      // Block ID -> entry
+    long long dataStart_ = 0;                                 // Byte offset of the data area
+    int clusterSize_ = 0;                                     // Bytes per data block
+    int pointersPerBlock_ = 0;                                // clusterSize_ / sizeof(int32_t)
+    bool doubleIndirect_ = false;                             // Format 4 addressing
+    std::mutex lock_;                                         // Guards the cache
+};
@@ -0,0 +1,218 @@
+// =============================================
+// checksum_table.cpp
+// ---------------------------------------------
+// Block checksums (CRC32C per cluster)
+// Handles:
+//   - Loading the table from the image once
+//   - Tracking written units and verifying read ones
+//   - Re-summing written units at commit
+//   - Writing back only the changed entries
+// =============================================
+
+#include "checksum_table.h"
+#include <algorithm>
+#include "crc32c.h"
+
+namespace {
+
+constexpr size_t MAX_RUN_BYTES = 256 * 1024; // Largest read while re-summing
+
+} // namespace
+
+bool ChecksumTable::load(BlockDevice& device, long long offset, long long unitCount, int unitSize, bool coversData) {
+    reset();
+    if (unitCount <= 0 || unitSize <= 0) return false;
+
+    std::vector<uint32_t> sums(static_cast<size_t>(unitCount), NONE);
+    if (!device.readAt(offset, sums.data(), sums.size() * sizeof(uint32_t))) return false;
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    sums_.swap(sums);
+    verified_.assign(sums_.size(), 0);
+    offset_ = offset;
+    ownFirst_ = offset / unitSize;
+    ownEnd_ = (offset + static_cast<long long>(sums_.size() * sizeof(uint32_t)) + unitSize - 1) / unitSize;
+    unitSize_ = unitSize;
+    coversData_ = coversData;
+    return true;
+}
+
+// -------------------------------------------------
+// flush
+// -------------------------------------------------
+// Writes every entry changed since the last flush.
+// Adjacent entries are merged into one write; a
+// commit touching a few blocks logs a few entries,
+// not whole pages. The entries are copied first:
+// the write comes back through noteWrite, which
+// takes the lock.
+// -------------------------------------------------
+bool ChecksumTable::flush(BlockDevice& device) {
+    std::vector<std::pair<long long, std::vector<uint32_t>>> writes;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (auto it = changed_.begin(); it != changed_.end(); ) {
+            const long long first = *it;
+            std::vector<uint32_t> run;
+            while (it != changed_.end() && *it == first + static_cast<long long>(run.size())) {
+                run.push_back(sums_[*it]);
+                ++it;
+            }
+            writes.emplace_back(offset_ + first * static_cast<long long>(sizeof(uint32_t)), std::move(run));
+        }
+        changed_.clear();
+    }
+
+    bool ok = true;
+    for (const auto& write : writes) {
+        ok = device.writeAt(write.first, write.second.data(), write.second.size() * sizeof(uint32_t)) && ok;
+    }
+    return ok;
+}
+
+void ChecksumTable::reset() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    sums_.clear();
+    verified_.clear();
+    changed_.clear();
+    written_.clear();
+    bad_.clear();
+    offset_ = 0;
+    ownFirst_ = ownEnd_ = 0;
+    unitSize_ = 0;
+    coversData_ = false;
+}
+
+// -------------------------------------------------
+// noteWrite
+// -------------------------------------------------
+// Metadata and checksummed data are queued for
+// update(); other file data loses its checksum
+// right away (the entry would be stale).
+// -------------------------------------------------
+void ChecksumTable::noteWrite(long long offset, size_t length, bool data) {
+    if (length == 0) return;
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (unitSize_ == 0) return;
+    const long long first = offset / unitSize_;
+    const long long end = std::min<long long>((offset + static_cast<long long>(length) + unitSize_ - 1) / unitSize_,
+                                              static_cast<long long>(sums_.size()));
+
+    const bool summed = !data || coversData_;
+    if (summed) ++generation_;
+    for (long long unit = first; unit < end; ++unit) {
+        if (unit >= ownFirst_ && unit < ownEnd_) continue;
+        if (summed) {
+            written_[unit] = generation_;
+        } else if (sums_[unit] != NONE) {
+            setEntry(unit, NONE);
+            bad_.erase(unit);
+        }
+    }
+}
+
+// Units with a checksum that were neither verified
+// nor written since mount
+std::vector<long long> ChecksumTable::unchecked(long long offset, size_t length) {
+    std::vector<long long> units;
+    if (length == 0) return units;
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (unitSize_ == 0) return units;
+    const long long first = offset / unitSize_;
+    const long long end = std::min<long long>((offset + static_cast<long long>(length) + unitSize_ - 1) / unitSize_,
+                                              static_cast<long long>(sums_.size()));
+
+    for (long long unit = first; unit < end; ++unit) {
+        if (sums_[unit] == NONE || verified_[unit]) continue;
+        if (written_.count(unit) != 0) continue;
+        units.push_back(unit);
+    }
+    return units;
+}
+
+bool ChecksumTable::confirm(long long unit, uint32_t crc) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (unit < 0 || unit >= static_cast<long long>(sums_.size())) return true;
+    if (written_.count(unit) != 0 || sums_[unit] == NONE) return true; // Rewritten meanwhile
+    if (sums_[unit] != seal(crc)) {
+        bad_.insert(unit);
+        return false;
+    }
+    verified_[unit] = 1;
+    bad_.erase(unit);
+    return true;
+}
+
+// -------------------------------------------------
+// update
+// -------------------------------------------------
+// Reads every unit written since the last update
+// (adjacent ones together) and stores its new
+// CRC, then writes the changed entries. A unit
+// written again while this runs keeps waiting for
+// the next update.
+// -------------------------------------------------
+bool ChecksumTable::update(BlockDevice& device) {
+    std::map<long long, uint64_t> written;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (unitSize_ == 0) return true;
+        written = written_;
+    }
+
+    // --- STEP 1: Sum the written units, run by run ---
+    const size_t maxUnits = std::max<size_t>(1, MAX_RUN_BYTES / static_cast<size_t>(unitSize_));
+    std::vector<std::pair<long long, uint32_t>> sums;
+    sums.reserve(written.size());
+    std::vector<char> run;
+    bool ok = true;
+
+    auto it = written.begin();
+    while (it != written.end()) {
+        const long long first = it->first;
+        size_t count = 1;
+        auto next = std::next(it);
+        while (next != written.end() && next->first == first + static_cast<long long>(count) && count < maxUnits) {
+            ++count;
+            ++next;
+        }
+
+        run.resize(count * static_cast<size_t>(unitSize_));
+        if (device.readAt(first * unitSize_, run.data(), run.size())) {
+            for (size_t i = 0; i < count; ++i) {
+                sums.emplace_back(first + static_cast<long long>(i),
+                                  crc32c(run.data() + i * unitSize_, static_cast<size_t>(unitSize_)));
+            }
+        } else {
+            ok = false;
+        }
+        it = next;
+    }
+
+    // --- STEP 2: Store the sums of units not written again ---
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (const auto& sum : sums) {
+            auto entry = written_.find(sum.first);
+            if (entry == written_.end() || entry->second != written[sum.first]) continue;
+            written_.erase(entry);
+            setEntry(sum.first, seal(sum.second));
+            verified_[sum.first] = 1;
+            bad_.erase(sum.first);
+        }
+    }
+
+    // --- STEP 3: Write the changed entries ---
+    return flush(device) && ok;
+}
+
+size_t ChecksumTable::mismatches() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return bad_.size();
+}
+
+void ChecksumTable::setEntry(long long unit, uint32_t value) {
+    if (sums_[unit] == value) return;
+    sums_[unit] = value;
+    changed_.insert(unit);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "block_device.h"
+
+// =============================================
+// checksum_table.h
+// ---------------------------------------------
+// Defines the ChecksumTable class, an in-memory
+// copy of the on-disk block checksums.
+//
+// The image is cut into units of one cluster
+// (the data area starts on a cluster boundary,
+// so every data block is one unit and the
+// superblock and bitmaps fill the units before
+// it). Each unit has a CRC32C entry; 0 means the
+// unit is not checksummed. Metadata (superblock,
+// bitmaps, inode table, directory and pointer
+// blocks) always is; file data only with
+// `coversData`, otherwise writing data drops the
+// entry. The journal and the table itself are
+// never checksummed.
+//
+// The BlockDevice reports every write and asks
+// which units of a read still need checking:
+// a unit is verified once, the first time it is
+// read after mount. Written units are only
+// re-summed by update() at commit, so their
+// entries go into the same journal record as
+// the writes; until then they are not checked.
+// Only the entries changed since the last flush
+// are written back, so a commit logs a few bytes
+// per block it touched.
+// =============================================
+class ChecksumTable {
+public:
+    static constexpr uint32_t NONE = 0;           // Entry of a unit without a checksum
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    // Reads the entries of unitCount units from the table at `offset`
+    bool load(BlockDevice& device, long long offset, long long unitCount, int unitSize, bool coversData);
+    bool flush(BlockDevice& device);              // Write changed entries back to the image
+    void reset();                                 // Forget the cached table
+    bool attached() const { return unitSize_ != 0; } // True if the image has a table
+
+    // ------------------------------------------
+    // Tracking (called by the BlockDevice)
+    // ------------------------------------------
+    void noteWrite(long long offset, size_t length, bool data); // Bytes written (data: file data)
+    std::vector<long long> unchecked(long long offset, size_t length); // Units of a read not verified yet
+    bool confirm(long long unit, uint32_t crc);   // Compare a unit's CRC; false (and counted) on mismatch
+
+    // ------------------------------------------
+    // Sealing
+    // ------------------------------------------
+    bool update(BlockDevice& device);             // Re-sum written units, write their entries back
+
+    int unitSize() const { return unitSize_; }    // Bytes per unit (the cluster size)
+    bool coversData() const { return coversData_; } // File data is checksummed too
+    size_t mismatches() const;                    // Units that failed and were not rewritten since
+
+private:
+    static uint32_t seal(uint32_t crc) { return crc != NONE ? crc : ~NONE; } // Keep NONE free
+    void setEntry(long long unit, uint32_t value); // Store an entry, queue it for flush (mutex_ held)
+
+    std::vector<uint32_t> sums_;    // Entry per unit
+    std::vector<uint8_t> verified_; // 1 once a unit matched (or was summed) since mount
+    std::set<long long> changed_;   // Units whose entry changed since the last flush
+    std::map<long long, uint64_t> written_; // Units to re-sum -> generation of their last write
+    std::set<long long> bad_;       // Units that failed verification
+    uint64_t generation_ = 0;       // Counts writes (tells a unit rewritten during update)
+    long long offset_ = 0;          // Byte offset of the table in the image
+    long long ownFirst_ = 0;        // Units the table itself occupies [ownFirst_, ownEnd_)
+    long long ownEnd_ = 0;
+    int unitSize_ = 0;              // Bytes per unit (0 = detached)
+    bool coversData_ = false;       // File data is checksummed too
+    mutable std::mutex mutex_;      // Guards everything above (reads and writes come from any thread)
+};
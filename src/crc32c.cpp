@@ -0,0 +1,127 @@
+// =============================================
+// crc32c.cpp
+// ---------------------------------------------
+// CRC-32C kernels
+// Handles:
+//   - Hardware CRC (SSE4.2 crc32 / ARMv8 crc32c)
+//   - Portable slicing-by-8 fallback
+//   - Picking a kernel once per process
+// =============================================
+
+#include "crc32c.h"
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CRC32C_X86 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace {
+
+constexpr uint32_t POLY = 0x82F63B78; // Castagnoli, reflected
+
+// -------------------------------------------------
+// Software kernel (slicing-by-8)
+// -------------------------------------------------
+// Eight tables let the loop consume eight bytes per
+// step instead of one.
+// -------------------------------------------------
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+Tables makeTables() {
+    Tables t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (crc & 1 ? POLY : 0);
+        t[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+    }
+    return t;
+}
+
+uint32_t crcSoftware(const unsigned char* p, size_t length, uint32_t crc) {
+    static const Tables t = makeTables();
+    while (length >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc; // little-endian hosts only, as the on-disk format
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+// -------------------------------------------------
+// Hardware kernels
+// -------------------------------------------------
+#if CRC32C_X86
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+uint32_t crcHardware(const unsigned char* p, size_t length, uint32_t crc) {
+    uint64_t c = crc;
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        length -= 8;
+    }
+    uint32_t c32 = static_cast<uint32_t>(c);
+    while (length-- > 0) c32 = _mm_crc32_u8(c32, *p++);
+    return c32;
+}
+
+bool hasHardware() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#elif CRC32C_ARM
+uint32_t crcHardware(const unsigned char* p, size_t length, uint32_t crc) {
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        length -= 8;
+    }
+    while (length-- > 0) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+
+bool hasHardware() { return true; }
+#endif
+
+using Kernel = uint32_t (*)(const unsigned char*, size_t, uint32_t);
+
+Kernel pickKernel() {
+#if CRC32C_X86 || CRC32C_ARM
+    if (hasHardware()) return crcHardware;
+#endif
+    return crcSoftware;
+}
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc) {
+    static const Kernel kernel = pickKernel();
+    return ~kernel(static_cast<const unsigned char*>(data), length, ~crc);
+}
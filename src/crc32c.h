@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// =============================================
+// crc32c.h
+// ---------------------------------------------
+// CRC-32C (Castagnoli), the checksum of the block
+// checksum table. The CPU's CRC instructions are
+// used where present (SSE4.2 on x86-64, the CRC32
+// extension on ARMv8), chosen once at run time;
+// otherwise a slicing-by-8 table does the work.
+// =============================================
+
+// Continues `crc` (0 to start) over `length` bytes
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
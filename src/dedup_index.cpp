@@ -0,0 +1,139 @@
+// =============================================
+// dedup_index.cpp
+// ---------------------------------------------
+// Deduplication index (block hash -> block)
+// Handles:
+//   - Loading the index from the image once
+//   - Bucket lookups, inserts and evictions
+//   - Dropping entries of freed blocks
+//   - Writing back only the dirty pages
+// =============================================
+
+#include "dedup_index.h"
+#include <algorithm>
+
+namespace {
+
+constexpr size_t ENTRIES_PER_PAGE = DedupIndex::PAGE_BYTES / sizeof(DedupEntry);
+
+} // namespace
+
+// About one entry per two data blocks (buckets rounded down to a power of two)
+int DedupIndex::bucketsFor(int dataBlocks) {
+    const int wanted = std::max(MIN_BUCKETS, dataBlocks / (2 * DEDUP_BUCKET_SLOTS));
+    int buckets = MIN_BUCKETS;
+    while (buckets * 2 <= wanted && buckets < MAX_BUCKETS) buckets *= 2;
+    return buckets;
+}
+
+bool DedupIndex::load(BlockDevice& device, long long offset, int bucketCount) {
+    reset();
+    if (bucketCount <= 0 || (bucketCount & (bucketCount - 1)) != 0) return false;
+
+    entries_.assign(static_cast<size_t>(bucketCount) * DEDUP_BUCKET_SLOTS, DedupEntry{});
+    if (!device.readAt(offset, entries_.data(), entries_.size() * sizeof(DedupEntry))) {
+        reset();
+        return false;
+    }
+
+    for (size_t slot = 0; slot < entries_.size(); ++slot) {
+        if (entries_[slot].block > 0) slotOf_[entries_[slot].block] = slot;
+    }
+    offset_ = offset;
+    dirtyPages_.assign((entries_.size() + ENTRIES_PER_PAGE - 1) / ENTRIES_PER_PAGE, false);
+    return true;
+}
+
+// -------------------------------------------------
+// flush
+// -------------------------------------------------
+// Writes every page modified since the last flush.
+// Adjacent dirty pages are merged into one write.
+// -------------------------------------------------
+bool DedupIndex::flush(BlockDevice& device) {
+    const size_t pageCount = dirtyPages_.size();
+    bool ok = true;
+
+    for (size_t page = 0; page < pageCount; ++page) {
+        if (!dirtyPages_[page]) continue;
+
+        size_t last = page;
+        while (last + 1 < pageCount && dirtyPages_[last + 1]) ++last;
+
+        const size_t begin = page * ENTRIES_PER_PAGE;
+        const size_t end = std::min(entries_.size(), (last + 1) * ENTRIES_PER_PAGE);
+        ok = device.writeAt(offset_ + static_cast<long long>(begin * sizeof(DedupEntry)), entries_.data() + begin,
+                            (end - begin) * sizeof(DedupEntry)) && ok;
+
+        for (size_t p = page; p <= last; ++p) dirtyPages_[p] = false;
+        page = last;
+    }
+    return ok;
+}
+
+void DedupIndex::reset() {
+    entries_.clear();
+    slotOf_.clear();
+    dirtyPages_.clear();
+    offset_ = 0;
+}
+
+int DedupIndex::find(uint64_t hash) const {
+    if (entries_.empty()) return 0;
+    const size_t bucket = (hash & (entries_.size() / DEDUP_BUCKET_SLOTS - 1)) * DEDUP_BUCKET_SLOTS;
+    for (size_t slot = bucket; slot < bucket + DEDUP_BUCKET_SLOTS; ++slot) {
+        if (entries_[slot].block > 0 && entries_[slot].hash == hash) return entries_[slot].block;
+    }
+    return 0;
+}
+
+// -------------------------------------------------
+// insert
+// -------------------------------------------------
+// Takes the entry already holding the hash, else
+// a free one; in a full bucket the top bits of
+// the hash pick the entry to evict.
+// -------------------------------------------------
+void DedupIndex::insert(uint64_t hash, int blockId) {
+    if (entries_.empty() || blockId <= 0) return;
+    forget(blockId);
+
+    const size_t bucket = (hash & (entries_.size() / DEDUP_BUCKET_SLOTS - 1)) * DEDUP_BUCKET_SLOTS;
+    size_t target = bucket + static_cast<size_t>(hash >> 62) % DEDUP_BUCKET_SLOTS;
+    bool found = false;
+    for (size_t slot = bucket; slot < bucket + DEDUP_BUCKET_SLOTS && !found; ++slot) {
+        if (entries_[slot].block > 0 && entries_[slot].hash == hash) {
+            target = slot;
+            found = true;
+        }
+    }
+    for (size_t slot = bucket; slot < bucket + DEDUP_BUCKET_SLOTS && !found; ++slot) {
+        if (entries_[slot].block <= 0) {
+            target = slot;
+            found = true;
+        }
+    }
+
+    clearSlot(target);
+    entries_[target].hash = hash;
+    entries_[target].block = blockId;
+    slotOf_[blockId] = target;
+    markDirty(target);
+}
+
+void DedupIndex::forget(int blockId) {
+    auto it = slotOf_.find(blockId);
+    if (it == slotOf_.end()) return;
+    clearSlot(it->second);
+}
+
+void DedupIndex::clearSlot(size_t slot) {
+    if (entries_[slot].block <= 0) return;
+    slotOf_.erase(entries_[slot].block);
+    entries_[slot] = DedupEntry{};
+    markDirty(slot);
+}
+
+void DedupIndex::markDirty(size_t slot) {
+    dirtyPages_[slot / ENTRIES_PER_PAGE] = true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "structures.h"
+#include "block_device.h"
+
+// =============================================
+// dedup_index.h
+// ---------------------------------------------
+// Defines the DedupIndex class, an in-memory copy
+// of the on-disk deduplication index: the XXH64
+// of whole file data blocks mapped to the block
+// holding those bytes.
+//
+// The index is a fixed-size hash table of
+// buckets (DedupEntry x DEDUP_BUCKET_SLOTS); a
+// full bucket evicts one of its entries, so it
+// remembers the most recent blocks rather than
+// all of them. An entry is only a hint: a match
+// is confirmed by comparing bytes before a block
+// is shared. It is dropped when its block is
+// freed or rewritten in place, so it never names
+// a block that isn't file data.
+// Like RefcountTable, only the pages touched
+// since the last flush are written back.
+// =============================================
+class DedupIndex {
+public:
+    static constexpr int PAGE_BYTES = 512;        // Write-back granularity
+    static constexpr int MIN_BUCKETS = 64;        // Smallest index
+    static constexpr int MAX_BUCKETS = 1 << 18;   // Largest index (16 MB, 1M entries)
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    static int bucketsFor(int dataBlocks);        // Index size for a data area (a power of two)
+    bool load(BlockDevice& device, long long offset, int bucketCount); // Read index from the image
+    bool flush(BlockDevice& device);              // Write dirty pages back to the image
+    void reset();                                 // Forget the cached index
+    bool attached() const { return !entries_.empty(); } // True if the image has an index
+
+    // ------------------------------------------
+    // Lookups and updates
+    // ------------------------------------------
+    int find(uint64_t hash) const;                // Block last indexed with this hash (0 = none)
+    void insert(uint64_t hash, int blockId);      // Remember a block (replaces an older one of the hash)
+    void forget(int blockId);                     // Drop the entry of a block, if any
+
+    size_t size() const { return slotOf_.size(); } // Blocks indexed
+
+private:
+    void clearSlot(size_t slot);                  // Free one entry
+    void markDirty(size_t slot);                  // Flag the page containing the entry
+
+    std::vector<DedupEntry> entries_;             // Bucket after bucket
+    std::unordered_map<int, size_t> slotOf_;      // Block -> its entry (for forget)
+    std::vector<bool> dirtyPages_;                // One flag per PAGE_BYTES of the on-disk index
+    long long offset_ = 0;                        // Byte offset of the index in the image
+};
@@ -0,0 +1,114 @@
+// =============================================
+// dentry_cache.cpp
+// ---------------------------------------------
+// Name lookup cache
+// Handles:
+//   - Caching (parent, name) -> inode results (LRU)
+//   - Negative entries for names that don't exist
+//   - Reverse lookups (inode -> parent, name) for pwd
+// =============================================
+
+#include "dentry_cache.h"
+#include <iterator>
+#include "metrics.h"
+
+void DentryCache::reset() {
+    std::lock_guard<std::mutex> guard(lock_);
+    lru_.clear();
+    index_.clear();
+    byChild_.clear();
+}
+
+// -------------------------------------------------
+// forgetDirectory
+// -------------------------------------------------
+// Called when a directory is removed: its inode may
+// be reused, so nothing cached under it (including
+// "." and "..") may survive.
+// -------------------------------------------------
+void DentryCache::forgetDirectory(int dirInodeId) {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (auto it = lru_.begin(); it != lru_.end(); ) {
+        auto next = std::next(it);
+        if (it->key.parent == dirInodeId || it->inode == dirInodeId) {
+            erase(it);
+        }
+        it = next;
+    }
+}
+
+bool DentryCache::lookup(int parentId, const std::string& name, int& inodeId) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = index_.find(Key{ parentId, name });
+    if (it == index_.end()) {
+        VFS_COUNT(DentryMisses);
+        return false;
+    }
+
+    VFS_COUNT(DentryHits);
+    lru_.splice(lru_.begin(), lru_, it->second);
+    inodeId = it->second->inode;
+    return true;
+}
+
+// -------------------------------------------------
+// insert
+// -------------------------------------------------
+// Records the inode a name refers to, replacing any
+// older value (a positive entry turns negative when
+// the name is removed, and back when it is reused).
+// -------------------------------------------------
+void DentryCache::insert(int parentId, const std::string& name, int inodeId) {
+    std::lock_guard<std::mutex> guard(lock_);
+    Key key{ parentId, name };
+    auto found = index_.find(key);
+    if (found != index_.end()) {
+        auto it = found->second;
+        unlink(it);
+        it->inode = inodeId;
+        link(it);
+        lru_.splice(lru_.begin(), lru_, it);
+        return;
+    }
+
+    if (lru_.size() >= DEFAULT_CAPACITY) {
+        erase(std::prev(lru_.end()));
+    }
+    lru_.push_front(Entry{ std::move(key), inodeId });
+    index_[lru_.front().key] = lru_.begin();
+    link(lru_.begin());
+}
+
+bool DentryCache::parentOf(int inodeId, int& parentId, std::string& name) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = byChild_.find(inodeId);
+    if (it == byChild_.end()) return false;
+
+    parentId = it->second->key.parent;
+    name = it->second->key.name;
+    return true;
+}
+
+size_t DentryCache::size() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return lru_.size();
+}
+
+void DentryCache::link(EntryList::iterator it) {
+    const std::string& name = it->key.name;
+    if (it->inode == NEGATIVE || name == "." || name == "..") return;
+    byChild_[it->inode] = it;
+}
+
+void DentryCache::unlink(EntryList::iterator it) {
+    auto child = byChild_.find(it->inode);
+    if (child != byChild_.end() && child->second == it) {
+        byChild_.erase(child);
+    }
+}
+
+void DentryCache::erase(EntryList::iterator it) {
+    unlink(it);
+    index_.erase(it->key);
+    lru_.erase(it);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// =============================================
+// dentry_cache.h
+// ---------------------------------------------
+// Defines the DentryCache class, an in-memory
+// cache of name lookups keyed by (parent inode,
+// name). Entries are kept in LRU order.
+//
+// A lookup that found nothing is cached as a
+// negative entry (NEGATIVE), so repeated misses
+// (EXIST checks before every create) don't scan
+// the directory again. The directory entry layer
+// keeps the cache current: every added, removed
+// or renamed entry overwrites its cached value.
+//
+// Positive entries also answer the reverse
+// question "which name does this inode have in
+// which directory", so pwd can walk up parent
+// chains without reading the ancestors.
+//
+// Thread-safe: every method takes one internal
+// mutex. Callers keep a lookup result stable by
+// holding the directory's inode lock.
+// =============================================
+class DentryCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1024;  // Names kept resident
+    static constexpr int NEGATIVE = -1;               // Cached "no such entry"
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    void reset();                                 // Forget every entry
+    void forgetDirectory(int dirInodeId);         // Drop entries inside and naming a directory
+
+    // ------------------------------------------
+    // Lookups
+    // ------------------------------------------
+    bool lookup(int parentId, const std::string& name, int& inodeId);  // True on a hit (inodeId may be NEGATIVE)
+    void insert(int parentId, const std::string& name, int inodeId);   // Record a result (NEGATIVE = miss)
+    bool parentOf(int inodeId, int& parentId, std::string& name) const; // Reverse lookup of a positive entry
+
+    size_t size() const;                          // Currently resident entries
+
+private:
+    struct Key {
+        int parent;
+        std::string name;
+        bool operator==(const Key& other) const { return parent == other.parent && name == other.name; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<std::string>()(key.name) * 31u + static_cast<size_t>(key.parent);
+        }
+    };
+    struct Entry {
+        Key key;
+        int inode;
+    };
+    using EntryList = std::list<Entry>;
+
+    void link(EntryList::iterator it);            // Register a positive entry for parentOf
+    void unlink(EntryList::iterator it);          // Undo link() if it points at this entry
+    void erase(EntryList::iterator it);           // Remove an entry completely
+
+    EntryList lru_;                               // Front = most recently used
+    std::unordered_map<Key, EntryList::iterator, KeyHash> index_; // (parent, name) -> entry
+    std::unordered_map<int, EntryList::iterator> byChild_;        // Inode -> entry naming it
+    mutable std::mutex lock_;                     // Guards everything above
+};
@@ -3,7 +3,25 @@
 #include <vector>
 #include <fstream>
 #include <iostream>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
 #include "structures.h"
+#include "block_device.h"
+#include "bitmap.h"
+#include "inode_cache.h"
+#include "block_map.h"
+#include "refcount_table.h"
+#include "dedup_index.h"
+#include "checksum_table.h"
+#include "dentry_cache.h"
+#include "journal.h"
+#include "inode_locks.h"
+#include "metrics.h"
+#include "session.h"
+#include "script_plan.h"
 
 // =============================================
 // filesystem.h
@@ -12,87 +30,434 @@
 // all functionality of the virtual filesystem,
 // including directory and file operations,
 // metadata management, and data persistence.
+//
+// Operations come in two layers: the programmatic
+// API returns a Status and the data asked for
+// (listings, contents, FileStat), the shell
+// commands print that the way the shell always has.
+//
+// One FileSystem can serve many sessions (clients)
+// from many threads. Each session has its own
+// working directory; the rest is shared:
+//   - fsLock_     shared by every command, exclusive for format
+//   - renameLock_ serializes mv (keeps ancestry stable for the subtree check)
+//   - locks_      reader/writer lock per inode, taken per command
+//   - allocLock_  bitmaps, share counts, dedup index, freed-block set
+//                 and the directory count
+//   - caches, block device staging and journal lock internally
+// The superblock and the layout are only written by
+// format (under fsLock_ exclusively) and are read
+// without locking.
 // =============================================
 class FileSystem {
 public:
     // ------------------------------------------
     // Core lifecycle
     // ------------------------------------------
-    explicit FileSystem(std::string filename) : filename_(std::move(filename)) {}
+    // useMmap: map the whole image into memory instead of positioned reads/writes
+    explicit FileSystem(std::string filename, bool useMmap = false)
+        : filename_(std::move(filename)), useMmap_(useMmap) { mount(); }
 
-    // Formats a new virtual filesystem (creates all metadata structures)
-    bool format(int sizeMB);
+    // Writes back cached inodes before the image is closed
+    ~FileSystem();
+
+    // Sets how many inodes the write-back cache keeps (0 = no caching)
+    void setInodeCacheCapacity(size_t capacity);
+
+    // ------------------------------------------
+    // Sessions
+    // ------------------------------------------
+    // Without a bound session a thread uses the shell session.
+    void attachSession(Session& session);                      // Register (cwd = root) and bind to this thread
+    void detachSession(Session& session);                      // Unregister (unbinds it from this thread)
+    void useSession(Session* session);                         // Bind to this thread (nullptr = shell session)
+
+    // Formats a new virtual filesystem (creates all metadata structures);
+    // clusterSize: 1, 4, 16 or 64 KB (in bytes); metadata is checksummed,
+    // file data too with dataChecksums. InvalidInput for a bad size,
+    // NoSpace if the metadata doesn't fit, IoError if the image can't be
+    // created. Prints only diagnostics (mkfs is the shell command)
+    Status format(int sizeMB, int clusterSize = DEFAULT_CLUSTER_SIZE, bool dataChecksums = false);
+
+    // Flushes all pending changes (cached inodes, journal checkpoint, msync/fsync)
+    Status sync();
+
+    // ------------------------------------------
+    // Transactions (metadata journal)
+    // ------------------------------------------
+    // Each shell command runs between beginTransaction and
+    // commitTransaction; its metadata updates are logged as one
+    // record. Commands of concurrent sessions that overlap are
+    // logged together by the last one to commit.
+    // No-ops on images without a journal.
+    void beginTransaction();
+    void commitTransaction();
+    void setGroupCommit(bool enabled);                         // Batch commits (checkpoint when disabled)
+
+    // ------------------------------------------
+    // Programmatic API
+    // ------------------------------------------
+    // Every VFS path argument may be absolute ("/a/b")
+    // or relative to the current directory ("a/b", "../c").
+    // The calls return a Status and fill in their results
+    // instead of printing; only diagnostics ("[core] Error:
+    // ...") still go to the session's error stream. Like a
+    // shell command, each call is best wrapped in a
+    // transaction of its own.
+    Status makeDirectory(const std::string& path);
+    Status removeDirectory(const std::string& path);           // Must be empty
+    Status listDirectory(const std::string& path, std::vector<DirEntry>& entries); // "" = current directory
+    Status changeDirectory(const std::string& path);
+    Status currentDirectory(std::string& path);                // Absolute path (IoError: cut short)
+    Status createFile(const std::string& path);                // Empty
+    Status readFile(const std::string& path, std::vector<char>& content);
+    Status writeFile(const std::string& path, const char* data, long long length); // Replace the content
+    // At most `length` bytes from `offset` (none at or past the end)
+    Status readAt(const std::string& path, long long offset, long long length, std::vector<char>& data);
+    Status writeAt(const std::string& path, long long offset, const char* data, long long length); // In place, may grow
+    Status resizeFile(const std::string& path, long long size, bool extendOnly = false); // Growing adds a hole
+    Status removeFile(const std::string& path);
+    Status stat(const std::string& path, FileStat& result);
+    Status setCompression(const std::string& path, bool enable); // Recodes a file's content
+    Status copyFile(const std::string& source, const std::string& destination, bool reflink = false);
+    Status rename(const std::string& source, const std::string& destination); // Into an existing directory, or to a new name
+    Status concatenate(const std::string& first, const std::string& second, const std::string& result);
+    Status append(const std::string& target, const std::string& source);
+    Status importFile(const std::string& hostPath, const std::string& vfsPath);
+    Status exportFile(const std::string& vfsPath, const std::string& hostPath);
+    Status statFilesystem(FsStat& result);
+    // Checks the image against itself (see filesystem_fsck.cpp); repair
+    // rewrites the bitmaps if only they are wrong. IoError if unreadable.
+    Status checkFilesystem(FsckReport& report, bool repair = false);
+    Status flush();                                            // What sync does
 
     // ------------------------------------------
-    // Directory operations
+    // Directory operations (shell commands)
     // ------------------------------------------
-    void mkdir(const std::string& name);                       // Create new directory
-    void ls(const std::string& name = "");                     // List directory contents
-    void cd(const std::string& name);                          // Change current directory
-    void pwd();                                                // Print current working path
-    void rmdir(const std::string& name);                       // Remove empty directory
+    // The shell commands print their result ("OK", the
+    // listing, ...) or the error message to the session's
+    // streams, and return the status as well.
+    Status mkdir(const std::string& path);                     // Create new directory
+    Status ls(const std::string& path = "");                   // List directory contents
+    Status cd(const std::string& path);                        // Change current directory
+    Status pwd();                                              // Print current working path
+    Status rmdir(const std::string& path);                     // Remove empty directory
 
     // ------------------------------------------
-    // File operations
+    // File operations (shell commands)
     // ------------------------------------------
-    void touch(const std::string& name);                       // Create new empty file
-    void cat(const std::string& name);                         // Display file content
-    void write(const std::string& name, const std::string& content); // Overwrite file
-    void rm(const std::string& name);                          // Delete file
-    void info(const std::string& name);                        // Show file/directory details
-    void statfs();                                             // Show overall filesystem stats
+    Status touch(const std::string& path);                     // Create new empty file
+    Status cat(const std::string& path);                       // Display file content
+    Status write(const std::string& path, const std::string& content); // Overwrite file
+    Status pread(const std::string& path, long long offset, long long length); // Display a byte range
+    Status pwrite(const std::string& path, long long offset, const std::string& data); // Write a byte range in place
+    Status truncate(const std::string& path, long long size, bool extendOnly = false); // Set the size (growing adds a hole)
+    Status rm(const std::string& path);                        // Delete file
+    Status info(const std::string& path);                      // Show file/directory details
+    // Sets (enable) or clears a file's compression flag and recodes its
+    // content; on a directory, what items created in it later get
+    Status compress(const std::string& path, bool enable = true);
+    Status statfs();                                           // Show overall filesystem stats
+    Status fsck(bool repair = false);                          // Check consistency (repair: fix the bitmaps)
+    Status mkfs(int sizeMB, int clusterSize = DEFAULT_CLUSTER_SIZE, bool dataChecksums = false); // format, then print the status
+    // Counters and command latencies (see Metrics): report ("" or "--json"),
+    // "reset", "trace" on/off, or "dump" the trace events to host file `arg`
+    Status stats(const std::string& action, const std::string& arg = "");
+    // "on": new file data shares blocks with identical ones already
+    // stored, "off": stop; empty mode: report the state
+    Status dedup(const std::string& mode);
+    // Moves fragmented files and directories into contiguous runs, one item
+    // per transaction; rateKBps > 0 limits the data moved per second
+    Status defrag(long long rateKBps = 0);
 
     // ------------------------------------------
     // File manipulation (copy / move / concat)
     // ------------------------------------------
-    void cp(const std::string& source, const std::string& destination);      // Copy file inside VFS
-    void mv(const std::string& source, const std::string& destination);      // Move or rename file
-    void xcp(const std::string& first, const std::string& second, const std::string& result); // Concatenate two files
-    void add(const std::string& target, const std::string& source);          // Append file content
+    Status cp(const std::string& source, const std::string& destination, bool reflink = false); // Copy file inside VFS (reflink: share blocks, copy on write)
+    Status mv(const std::string& source, const std::string& destination);    // Move or rename file
+    Status xcp(const std::string& first, const std::string& second, const std::string& result); // Concatenate two files
+    Status add(const std::string& target, const std::string& source);        // Append file content
 
     // ------------------------------------------
     // Host integration
     // ------------------------------------------
-    void incp(const std::string& sourceHostPath, const std::string& destVfsPath); // Import file from host
-    void outcp(const std::string& sourceVfsPath, const std::string& destHostPath); // Export file to host
-    void load(const std::string& hostFilePath);                                   // Execute commands from a script file
+    Status incp(const std::string& sourceHostPath, const std::string& destVfsPath); // Import file from host
+    Status outcp(const std::string& sourceVfsPath, const std::string& destHostPath); // Export file to host
+    // parallel: independent commands run at once on a thread pool;
+    // the output is the same as in a sequential run
+    Status load(const std::string& hostFilePath, bool parallel = false);          // Execute commands from a script file
+
+    static constexpr int DEFAULT_CLUSTER_SIZE = 1024;           // 1 KB per data block
 
 private:
+    friend class FileSystemBench;                               // Microbenchmarks of the primitives (bench/micro.cpp)
+
     // ------------------------------------------
     // Filesystem constants
     // ------------------------------------------
-    static constexpr int CLUSTER_SIZE = 1024;                   // 1 KB per data block
-    static constexpr int INODE_BITMAP_SIZE = 2048;              // 2048 B => 16384 inodes (16 MB inode table)
-    static constexpr int DATA_BITMAP_SIZE = 16384;              // 16384 B => 131072 data blocks (~128 MB)
-    static constexpr int INODE_TABLE_SIZE = 65536;              // 64 KB reserved for inode table
+    static constexpr int FORMAT_VERSION = 4;                    // Written by format (see Superblock)
+    static constexpr int BLOCKS_PER_GROUP = 8192;               // Data blocks per block group (1 KB of bitmap)
+    static constexpr int MAX_CLUSTER_SIZE = 64 * 1024;          // Clusters are 1, 4, 16 or 64 KB
+    static constexpr int BYTES_PER_INODE = 4096;                // One inode per 4 KB of disk
+    static constexpr int MIN_INODES = 64;                       // Smallest inode table
+    static constexpr int MAX_INODES = 1 << 20;                  // Largest inode table (40 MB)
+    static constexpr int MAX_DATA_BLOCKS = 1 << 30;             // Keeps block IDs and bit counts in int
     static constexpr long long BYTES_PER_MB = 1024LL * 1024LL;  // Bytes in one MB
     static constexpr int MAX_NAME_LENGTH = 11;                  // 11 chars (8+3 format)
+    static constexpr int STREAM_CHUNK_SIZE = 256 * 1024;        // 256 KB buffer for streamed copies
+    static constexpr int JOURNAL_BYTES = 256 * 1024;            // 256 KB journal (at most 1/8 of the data area)
+    static constexpr int COMPRESS_CHUNK_SIZE = 64 * 1024;       // Compressed files are coded in 64 KB chunks
+
+    // ------------------------------------------
+    // Layout
+    // ------------------------------------------
+    // Where the regions of the mounted image are, taken
+    // from its superblock: format 1 images have fixed
+    // 1 KB-cluster regions and 32-bit offsets, format 2
+    // records sizes and 64-bit offsets, format 3 splits
+    // the data area into block groups. A group holds
+    // BLOCKS_PER_GROUP data blocks, its slice of the
+    // inode table (from its second block on) and owns
+    // the matching ranges of both bitmaps. Older images
+    // are one group with a separate inode table. Format
+    // 4 makes indirect2 double-indirect (see BlockMap).
+    struct Layout {
+        long long diskSize = 0;         // Total image size (0 if unformatted)
+        int clusterSize = 0;            // Bytes per data block
+        long long inodeBitmapStart = 0; // Byte offset of the inode bitmap
+        int inodeBitmapSize = 0;        // Its length in bytes
+        int inodeBits = 0;              // Bits in use (format 1: all of them)
+        long long dataBitmapStart = 0;  // Byte offset of the data bitmap
+        int dataBitmapSize = 0;         // Its length in bytes
+        int dataBits = 0;               // Bits in use (format 1: all of them)
+        long long inodeStart = 0;       // Byte offset of the inode table
+        int inodeCount = 0;             // Inodes in the table
+        long long dataStart = 0;        // Byte offset of data block 0
+        int groupCount = 1;             // Block groups
+        int blocksPerGroup = 0;         // Data blocks per group (the last one takes the rest)
+        int inodesPerGroup = 0;         // Inodes per group
+        long long groupStride = 0;      // Bytes between two inode table slices
+        bool doubleIndirect = false;    // indirect2 is double-indirect (format 4)
+    };
 
     // ------------------------------------------
     // State
     // ------------------------------------------
     std::string filename_;      // Name of the filesystem image (e.g. "myfs.dat")
-    int currentDirInode_ = 0;   // Current working directory inode ID (root = 0)
+    bool useMmap_ = false;      // Memory-mapped backend requested
+    Session shell_;             // Session of threads that didn't bind one
+    BlockDevice device_;        // Image handle, open for the lifetime of the mount
+    Superblock sb_{};           // In-memory copy of the superblock (disk_size == 0 if unformatted)
+    Layout layout_{};           // Region offsets and sizes derived from sb_
+    Bitmap inodeBitmap_;        // Resident inode bitmap
+    Bitmap dataBitmap_;         // Resident data block bitmap
+    InodeCache inodeCache_;     // Write-back cache in front of the inode table
+    BlockMap blockMap_;         // Logical -> physical block translation
+    RefcountTable blockShares_; // Extra owners of data blocks shared by reflink copies and dedup
+    DedupIndex dedup_;          // Block hash -> block of file data (detached until the first dedup on)
+    ChecksumTable checksums_;   // CRC32C per cluster (detached on images without a table)
+    DentryCache dentries_;      // (parent inode, name) -> inode lookups, incl. misses
+    Journal journal_;           // Metadata write-ahead log (detached on older images)
+    int directoryCount_ = -1;   // Directories besides the root (-1 = not counted since mount)
+
+    // ------------------------------------------
+    // Concurrency
+    // ------------------------------------------
+    std::shared_mutex fsLock_;  // Shared by commands, exclusive for format
+    std::mutex renameLock_;     // Held by mv
+    InodeLocks locks_;          // Per-inode reader/writer locks
+    std::mutex allocLock_;      // Bitmaps, blockShares_, dedup_, directoryCount_
+    std::mutex sessionLock_;    // Guards sessions_
+    std::unordered_set<Session*> sessions_; // Attached client sessions
+    std::mutex txLock_;         // Guards the transaction state below and journal_
+    std::condition_variable txIdle_; // Signalled when a group of transactions committed
+    int activeTx_ = 0;          // Transactions begun and not yet committed
+    bool draining_ = false;     // A commit waits for the active ones: hold back new ones
+    bool checkpointPending_ = false; // Checkpoint once no transaction is active
+    int groupCommitUsers_ = 0;  // Scripts currently running with group commit
 
     // ------------------------------------------
     // Core helpers
     // ------------------------------------------
+    bool mount();                                             // Open image and load superblock + bitmaps
+    void commitLocked();                                      // Log staged writes (txLock_ held, none active)
+    void checkpointLocked();                                  // Write the log home (txLock_ held, none active)
+    void releaseHeldBlocks();                                 // Blocks freed before the checkpoint become reusable
+    bool lendJournalSpace(long long bytes, Journal::Ranges& ranges); // Free blocks held for a spilled record
+    Session& session();                                       // Session bound to the calling thread
+    std::ostream& out();                                      // Output stream of the session
+    std::ostream& err();                                      // Error stream of the session
+    void fail(Status status);                                 // Record why a helper failed (errno-style, in the session)
+    Status failure(Status fallback);                          // Take the recorded reason (fallback if none)
+    Status report(Status status);                             // Print "OK" or the error message, return status
+    bool isWorkingDirectory(int inodeId);                     // True if some session is inside it
+    bool isLive(int inodeId);                                 // True if the inode is allocated
+    void loadBitmaps();                                       // (Re)load both bitmaps from the image
+    bool flushInodes();                                       // Write back dirty cached inodes
     Superblock readSuperblock();                              // Read superblock from disk
+    static Layout layoutOf(const Superblock& sb);             // Region offsets of format 1 to 4
+    void writeSuperblock();                                   // Write sb_ back (its on-disk length only)
+    void loadShareTable();                                    // Load the block share counts (if any)
+    bool ensureShareTable();                                  // Create the share-count table on first use (allocLock_ held)
+    void loadDedupIndex();                                    // Load the dedup index (if any)
+    bool ensureDedupIndex();                                  // Create the dedup index on first use (allocLock_ held)
+    bool dedupActive() const { return dedup_.attached() && (sb_.dedup_flags & DEDUP_ACTIVE) != 0; }
+    void loadChecksums();                                     // Load the block checksums and attach them to device_
+    bool createChecksums(bool dataChecksums);                 // Add a checksum table to a fresh image (format)
+    void updateChecksums();                                   // Re-sum the blocks written since the last call
+    void resealReplayed();                                    // Re-sum what a journal replay wrote (mount)
     Inode readInode(int inodeId);                             // Read inode by ID
     void writeInode(int inodeId, const Inode& inode);         // Write inode to disk
 
+    // ------------------------------------------
+    // Block I/O (positioned, through device_)
+    // ------------------------------------------
+    bool readBlock(int blockId, void* buffer, size_t length, long long offset = 0);
+    bool writeBlock(int blockId, const void* buffer, size_t length, long long offset = 0);
+    // Transfer file data laid out over blocks[first..], one I/O per contiguous run, all runs as one batch
+    bool readBlocks(const std::vector<int>& blocks, char* buffer, long long length, size_t first = 0);
+    bool writeBlocks(const std::vector<int>& blocks, const char* data, long long length, size_t first = 0);
+    // writeBlocks into blocks just mapped at logicalBase + i; with dedup on, shares identical blocks instead
+    bool writeNewBlocks(Inode& inode, int logicalBase, std::vector<int>& blocks, const char* data, long long length,
+                        size_t first = 0);
+    bool writeFileData(int blockId, const char* data, size_t length); // Data write in place (never journaled)
+    // Hands the first `size` bytes laid out over blocks to `sink` chunk by chunk
+    // (data == nullptr for a run of holes), reading the next chunk meanwhile
+    using ChunkSink = std::function<bool(size_t first, const char* data, long long length)>;
+    bool streamBlocks(const std::vector<int>& blocks, long long size, const ChunkSink& sink);
+    bool streamFile(const Inode& inode, const ChunkSink& sink); // streamBlocks over a file's content (decoded)
+    std::vector<DirectoryItem> readDirEntries(const Inode& dir); // Load all entries in one read
+
+    // ------------------------------------------
+    // File block mapping (through blockMap_)
+    // ------------------------------------------
+    std::vector<int> fileBlocks(const Inode& inode);          // Physical blocks covering file_size (0 = unmapped)
+    std::vector<int> fileBlocks(const Inode& inode, int first, int count); // Blocks first..first+count-1
+    bool readFileData(const Inode& inode, char* buffer);      // Read file_size bytes of content
+    void releaseFileBlocks(const Inode& inode);               // Free data and pointer blocks of a file
+    bool replaceFileData(Inode& inode, const char* data, int size); // Rewrite content into new blocks
+    bool shrinkFile(Inode& inode, long long size);            // Free the blocks past `size` bytes
+    bool growFile(Inode& inode, long long size);              // Extend by a hole that reads as zeros
+    bool readFileRange(const Inode& inode, long long offset, char* buffer, long long length); // Read part of the content
+    bool writeFileRange(Inode& inode, long long offset, const char* data, long long length); // Patch or extend in place
+    bool cloneFileBlocks(const Inode& source, Inode& clone);  // Share source's data blocks with clone
+    bool setFileBlock(Inode& inode, int logical, int physical); // Map (or unmap with 0) one logical block
+    bool setPointer(int inodeId, int32_t& pointerBlock, int slot, int32_t value); // One pointer block entry (allocates/frees the block)
+
+    // ------------------------------------------
+    // Compressed files (INODE_COMPRESSED)
+    // ------------------------------------------
+    // The file*Range helpers, readFileData, streamFile,
+    // replaceFileData and shrinkFile/growFile call these
+    // for compressed files; see ChunkHeader for the layout.
+    static bool isCompressed(const Inode& inode) { return (inode.flags & INODE_COMPRESSED) != 0; }
+    int chunkBlocks() const;                                  // Blocks per chunk
+    bool readChunk(const Inode& inode, int chunk, long long length, char* buffer, bool* hole = nullptr); // Decode a chunk
+    bool writeChunk(Inode& inode, int chunk, const char* data, long long length); // Code a chunk into new blocks
+    bool readCompressed(const Inode& inode, long long offset, char* buffer, long long length);
+    bool writeCompressed(Inode& inode, long long offset, const char* data, long long length);
+    bool streamChunks(const Inode& inode, const ChunkSink& sink); // Decode chunk i + 1 while chunk i is consumed
+
+    // ------------------------------------------
+    // Inline files (INODE_INLINE)
+    // ------------------------------------------
+    // Content of up to INLINE_CAPACITY bytes is kept in
+    // the inode's pointer fields; the same helpers check
+    // this before compression.
+    static bool isInline(const Inode& inode) { return (inode.flags & INODE_INLINE) != 0; }
+    static bool fitsInline(const Inode& inode, long long end); // A pwrite up to `end` can stay in (or go into) the inode
+    static char* inlineData(Inode& inode);                    // The content bytes (INLINE_CAPACITY)
+    static const char* inlineData(const Inode& inode);
+    static void storeInline(Inode& inode, const char* data, long long size); // Content in place of the pointers
+    bool spillInline(Inode& inode);                           // Move the content out into a data block
+
+    // ------------------------------------------
+    // Directory entries (multi-block, hash-indexed)
+    // ------------------------------------------
+    int findDirEntry(const Inode& dir, const std::string& name, DirectoryItem* item = nullptr); // Entry index or -1
+    bool readDirEntry(const Inode& dir, int index, DirectoryItem& item);        // Read one entry
+    bool writeDirEntry(const Inode& dir, int index, const DirectoryItem& item); // Overwrite one entry
+    bool addDirEntry(int dirInodeId, Inode& dir, const DirectoryItem& item);    // Append (grows the directory)
+    bool removeDirEntry(int dirInodeId, Inode& dir, int index);                 // Remove (last entry fills the gap)
+    bool renameDirEntry(int dirInodeId, const Inode& dir, int index, const DirectoryItem& item); // Write a new name in place
+    bool buildDirIndex(Inode& dir);                           // Create the hash index of a directory
+    void freeDirIndex(const Inode& dir);                      // Free index root and bucket blocks
+    bool indexInsert(const Inode& dir, uint32_t hash, int entry);              // Add a hash -> entry slot
+    bool indexUpdate(const Inode& dir, uint32_t hash, int entry, int newEntry); // Move or drop (-1) a slot
+    int entriesPerBlock() const { return layout_.clusterSize / static_cast<int>(sizeof(DirectoryItem)); }
+    int maxDirBlocks() const { return BlockMap::DIRECT_COUNT + blockMap_.pointersPerBlock(); } // direct + indirect1
+
     // ------------------------------------------
     // Allocation utilities
     // ------------------------------------------
-    int allocateFreeInode();                                  // Find and reserve free inode
-    int allocateFreeDataBlock();                              // Find and reserve free data block
-    std::vector<int> allocateFreeDataBlocks(int count);       // Allocate multiple free data blocks
+    // Inodes go to the parent's group (directories: the group with the most
+    // free blocks); data blocks go to the group of `nearInode` (-1 = anywhere)
+    int allocateFreeInode(int parentInodeId, bool directory = false); // Find and reserve free inode
+    int allocateFreeDataBlock(int nearInode = -1);            // Find and reserve free data block
+    std::vector<int> allocateFreeDataBlocks(int count, int nearInode = -1); // Allocate multiple free data blocks
+    std::vector<int> allocateContiguousBlocks(int count, int nearInode = -1); // Allocate blocks as few contiguous runs (best-fit)
+    int blockGroupOf(int inodeId) const;                      // Group of an inode (-1 if ungrouped)
+    int groupFirstBlock(int group) const { return group * layout_.blocksPerGroup; }
+    int groupEndBlock(int group) const;                       // One past the group's last data block
+    int roomiestGroup(int from);                              // Group with most free blocks (allocLock_ held)
+    int allocateBlockNear(int nearInode);                     // One block, home group first (allocLock_ held)
+    bool allocateFileBlocks(Inode& inode, int blocksNeeded, std::vector<int>& dataBlocks); // Lay out a new file
+    void freeInode(int inodeId);                              // Clear inode bit in bitmap
+    void freeDataBlock(int blockId);                          // Clear data block bit in bitmap
+    void releaseDataBlock(int blockId);                       // Free the bit (held inside a transaction) without writing it back (allocLock_ held)
     long long dataBlockOffset(int blockId);                   // Get byte offset of a data block
     bool directoryContains(int dirInodeId, const std::string& name); // Check if dir contains item
 
+    // ------------------------------------------
+    // Path resolution (through dentries_)
+    // ------------------------------------------
+    // Paths are absolute ("/a/b") or relative to the current
+    // directory ("a/b", "../c"); "." and ".." are ordinary entries.
+    // lookup expects the directory's lock to be held; the resolvers take
+    // each directory's shared lock in turn and must be called without locks.
+    int lookup(int dirInodeId, const std::string& name);      // Child inode, -1 if absent or not a directory
+    int resolvePath(const std::string& path);                 // Inode a path refers to, -1 if not found
+    int resolveParent(const std::string& path, std::string& leaf); // Directory holding the last component, -1 if not found
+    static bool isValidName(const std::string& name);         // 1..11 chars, no '/', not "." or ".."
+
     // ------------------------------------------
     // Directory relationship helpers
     // ------------------------------------------
     int getParentInodeId(int dirInodeId);                     // Get parent inode of directory
     std::string findNameInParent(int parentInodeId, int childInodeId); // Find entry name by child inode
+    bool workingPath(std::string& path);                      // Absolute path of the current directory (false if cut short)
+
+    // ------------------------------------------
+    // Defragmentation (defrag)
+    // ------------------------------------------
+    struct Fragmentation {
+        long long items = 0;    // Files and directories holding data blocks
+        long long blocks = 0;   // Their data blocks (pointer blocks not counted)
+        long long extents = 0;  // Contiguous runs those blocks form
+        double score() const;   // 0% = one run per item, 100% = no two blocks adjacent
+    };
+    Fragmentation measureFragmentation();                     // Scan every allocated inode
+    bool defragStep(int inodeId, long long& movedBlocks);     // Relocate one item (own locks)
+    bool defragFile(int inodeId, Inode& file, long long& movedBlocks); // Data into one run, new pointer blocks
+    bool defragDirectory(int inodeId, Inode& dir, long long& movedBlocks); // Blocks into one run, compact index
+
+    // ------------------------------------------
+    // Consistency check (fsck)
+    // ------------------------------------------
+    // The inode table is checked in ranges of one group
+    // slice at most, each by one task of a work pool; a
+    // range collects what its inodes claim (defined in
+    // filesystem_fsck.cpp).
+    struct FsckRange;
+    bool fsckLoad(FsckRange& range, std::vector<Inode>& table); // Read the range of the table in one go
+    bool fsckInode(int inodeId, const Inode& inode, FsckRange& range); // Fields of one inode are sane
+    void fsckEntries(int inodeId, const Inode& dir, std::vector<int>& parents, FsckRange& range); // A directory's entries
+    void fsckClaims(int inodeId, const Inode& inode, FsckRange& range); // Blocks a reachable item owns
+    void noteDirectory(int delta);                            // Keep directoryCount_ current (if counted)
+
+    // ------------------------------------------
+    // Script execution (load)
+    // ------------------------------------------
+    bool runScriptCommand(const ScriptCommand& command);      // Run one script line; false after exit
+    void runParallel(const ScriptPlan& plan);                 // Segments in order, independent commands at once
 };
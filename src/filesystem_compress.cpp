@@ -0,0 +1,346 @@
+// =============================================
+// filesystem_compress.cpp
+// ---------------------------------------------
+// Transparent per-file compression
+// Handles:
+//   - Setting the flag on files and directories (setCompression)
+//   - Coding file data in LZ4-compressed chunks
+//   - Reading, patching and streaming compressed files
+// =============================================
+
+#include "filesystem.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <vector>
+#include "lz4.h"
+#include "work_pool.h"
+
+namespace {
+
+constexpr long long HEADER_BYTES = static_cast<long long>(sizeof(ChunkHeader));
+
+bool allZero(const char* data, long long length) {
+    return std::all_of(data, data + length, [](char c) { return c == 0; });
+}
+
+} // namespace
+
+// -------------------------------------------------
+// setCompression
+// -------------------------------------------------
+// Sets (or with `enable` false clears) the
+// compression flag. A file's content is recoded
+// into new blocks, the old ones are released once
+// that is done (an inline one stays in its inode
+// until it grows). A directory only passes the flag on
+// to the files and directories created in it later.
+// -------------------------------------------------
+Status FileSystem::setCompression(const std::string& path, bool enable) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+
+    // --- STEP 1: Validate input ---
+    if (path.empty()) return Status::InvalidName;
+
+    // --- STEP 2: Locate target ---
+    int targetInodeId = resolvePath(path);
+    if (targetInodeId == -1) return Status::FileNotFound;
+
+    // --- STEP 3: Lock and load inode ---
+    InodeLocks::Guard lock = locks_.exclusive(targetInodeId);
+    if (!isLive(targetInodeId)) return Status::FileNotFound;
+    Inode target = readInode(targetInodeId);
+    const uint8_t flags = enable ? (target.flags | INODE_COMPRESSED)
+                                 : (target.flags & ~INODE_COMPRESSED);
+
+    // --- STEP 4: Directories, empty and inline files only change the flag ---
+    if (flags == target.flags || target.is_directory || target.file_size == 0 || isInline(target)) {
+        target.flags = flags;
+        writeInode(targetInodeId, target);
+        return Status::Ok;
+    }
+
+    // --- STEP 5: Recode the content into new blocks ---
+    Inode recoded{};
+    recoded.id = target.id;
+    recoded.references = target.references;
+    recoded.flags = flags;
+    const long long clusterSize = layout_.clusterSize;
+    bool copied = streamFile(target, [&](size_t first, const char* data, long long length) {
+        return data == nullptr || writeFileRange(recoded, static_cast<long long>(first) * clusterSize, data, length);
+    });
+    copied = copied && growFile(recoded, target.file_size);
+    if (!copied) {
+        releaseFileBlocks(recoded);
+        return failure(Status::IoError);
+    }
+
+    // --- STEP 6: Switch over, free the old blocks ---
+    releaseFileBlocks(target);
+    writeInode(targetInodeId, recoded);
+
+    return Status::Ok;
+}
+
+// Blocks per chunk: 64 KB, and never fewer than 4 so compression can save one
+int FileSystem::chunkBlocks() const {
+    return std::max(4, COMPRESS_CHUNK_SIZE / layout_.clusterSize);
+}
+
+// -------------------------------------------------
+// readChunk
+// -------------------------------------------------
+// Decodes the first `length` bytes of chunk `chunk`
+// (the whole chunk unless it is the file's last).
+// A chunk with all its blocks mapped is raw, one
+// without a first block a hole (zeros, `hole` is
+// set); otherwise its leading blocks hold a header
+// and the compressed bytes.
+// -------------------------------------------------
+bool FileSystem::readChunk(const Inode& inode, int chunk, long long length, char* buffer, bool* hole) {
+    VFS_TRACE("readChunk");
+    const int clusterSize = layout_.clusterSize;
+    const int count = BlockMap::blocksFor(length, clusterSize);
+    std::vector<int> blocks = fileBlocks(inode, chunk * chunkBlocks(), count);
+    if (std::find(blocks.begin(), blocks.end(), BlockMap::UNREADABLE) != blocks.end()) return false;
+    if (hole != nullptr) *hole = blocks.empty() || blocks[0] == 0;
+
+    // --- Hole or raw ---
+    const int stored = static_cast<int>(std::find(blocks.begin(), blocks.end(), 0) - blocks.begin());
+    if (stored == 0) {
+        std::memset(buffer, 0, static_cast<size_t>(length));
+        return true;
+    }
+    if (stored == count) return readBlocks(blocks, buffer, length);
+
+    // --- Compressed: header and data in the leading blocks, nothing mapped after them ---
+    if (std::any_of(blocks.begin() + stored, blocks.end(), [](int b) { return b != 0; })) return false;
+    std::vector<char> packed(static_cast<size_t>(stored) * clusterSize);
+    if (!readBlocks(blocks, packed.data(), static_cast<long long>(packed.size()))) return false;
+
+    ChunkHeader header{};
+    std::memcpy(&header, packed.data(), sizeof(header));
+    if (header.magic != CHUNK_MAGIC || header.codec != CODEC_LZ4 ||
+        header.raw_bytes != static_cast<uint32_t>(length) ||
+        header.stored_bytes > packed.size() - sizeof(header)) {
+        return false;
+    }
+    return lz4Decompress(packed.data() + sizeof(header), header.stored_bytes, buffer, static_cast<size_t>(length));
+}
+
+// -------------------------------------------------
+// writeChunk
+// -------------------------------------------------
+// Stores `length` bytes as chunk `chunk`: as a hole
+// if they are all zeros, compressed if that saves at
+// least one block, raw otherwise. The new blocks are
+// written first; then the chunk's blocks are
+// remapped and the old ones released (a block shared
+// with a reflink copy loses one owner).
+// Updates the inode's pointers (the caller sets the
+// size and writes the inode).
+// -------------------------------------------------
+bool FileSystem::writeChunk(Inode& inode, int chunk, const char* data, long long length) {
+    VFS_TRACE("writeChunk");
+    const int clusterSize = layout_.clusterSize;
+    const int first = chunk * chunkBlocks();
+    const int slots = std::min(chunkBlocks(), blockMap_.maxBlocks() - first);
+    const int count = BlockMap::blocksFor(length, clusterSize);
+    std::vector<int> old = fileBlocks(inode, first, slots);
+    if (std::find(old.begin(), old.end(), BlockMap::UNREADABLE) != old.end()) return false;
+
+    // --- STEP 1: Encode ---
+    std::vector<char> packed;
+    const char* bytes = data;
+    long long storedLength = length;
+    int stored = count;
+    if (allZero(data, length)) {
+        stored = 0;
+    } else if (count > 1) {
+        // Only worth it if it fits in fewer blocks than the raw chunk
+        const long long room = static_cast<long long>(count - 1) * clusterSize - HEADER_BYTES;
+        packed.resize(static_cast<size_t>(HEADER_BYTES) + lz4Bound(static_cast<size_t>(length)));
+        const size_t size = lz4Compress(data, static_cast<size_t>(length), packed.data() + HEADER_BYTES,
+                                        static_cast<size_t>(room));
+        if (size > 0) {
+            ChunkHeader header{ CHUNK_MAGIC, CODEC_LZ4, static_cast<uint32_t>(size), static_cast<uint32_t>(length) };
+            std::memcpy(packed.data(), &header, sizeof(header));
+            bytes = packed.data();
+            storedLength = HEADER_BYTES + static_cast<long long>(size);
+            stored = BlockMap::blocksFor(storedLength, clusterSize);
+        }
+    }
+
+    // --- STEP 2: Write the new blocks ---
+    std::vector<int> fresh;
+    auto dropFresh = [&]() {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        for (int blockId : fresh) releaseDataBlock(blockId);
+        dataBitmap_.flush(device_);
+        return false;
+    };
+    if (stored > 0) {
+        fresh = allocateContiguousBlocks(stored, inode.id);
+        if (fresh.empty()) return false;
+        if (!writeBlocks(fresh, bytes, storedLength)) return dropFresh();
+    }
+
+    // --- STEP 3: Remap (new blocks first: only they may need pointer blocks) ---
+    for (int i = 0; i < stored; ++i) {
+        if (!setFileBlock(inode, first + i, fresh[i])) {
+            fail(Status::NoSpace);
+            for (int j = 0; j < i; ++j) setFileBlock(inode, first + j, old[j]);
+            return dropFresh();
+        }
+    }
+    for (int i = stored; i < slots; ++i) {
+        if (old[i] != 0) setFileBlock(inode, first + i, 0);
+    }
+
+    // --- STEP 4: Release the old blocks ---
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    for (int blockId : old) {
+        if (blockId > 0 && !blockShares_.dropShare(blockId)) releaseDataBlock(blockId);
+    }
+    dataBitmap_.flush(device_);
+    blockShares_.flush(device_);
+    return true;
+}
+
+// -------------------------------------------------
+// readCompressed
+// -------------------------------------------------
+// readFileRange for compressed files: every chunk
+// the range touches is decoded, straight into the
+// buffer if the range covers it whole.
+// -------------------------------------------------
+bool FileSystem::readCompressed(const Inode& inode, long long offset, char* buffer, long long length) {
+    const long long chunkBytes = static_cast<long long>(chunkBlocks()) * layout_.clusterSize;
+    const long long end = offset + length;
+    std::vector<char> decoded;
+    for (long long pos = offset; pos < end; ) {
+        const int chunk = static_cast<int>(pos / chunkBytes);
+        const long long chunkStart = chunk * chunkBytes;
+        const long long chunkLength = std::min<long long>(chunkBytes, inode.file_size - chunkStart);
+        const long long take = std::min(end, chunkStart + chunkLength) - pos;
+
+        if (pos == chunkStart && take == chunkLength) {
+            if (!readChunk(inode, chunk, chunkLength, buffer + (pos - offset))) return false;
+        } else {
+            decoded.resize(static_cast<size_t>(chunkLength));
+            if (!readChunk(inode, chunk, chunkLength, decoded.data())) return false;
+            std::memcpy(buffer + (pos - offset), decoded.data() + (pos - chunkStart), static_cast<size_t>(take));
+        }
+        pos += take;
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// writeCompressed
+// -------------------------------------------------
+// writeFileRange for compressed files. Each chunk
+// the range touches is decoded (unless the new data
+// covers it), patched and stored again; bytes
+// between the old end and `offset` read as zeros,
+// chunks lying wholly in that gap stay holes. The
+// size grows chunk by chunk, so a failure leaves
+// the file consistent.
+// Updates the inode's pointers and size (the caller
+// writes the inode).
+// -------------------------------------------------
+bool FileSystem::writeCompressed(Inode& inode, long long offset, const char* data, long long length) {
+    if (length <= 0) return true;
+    const long long chunkBytes = static_cast<long long>(chunkBlocks()) * layout_.clusterSize;
+    const long long oldSize = inode.file_size;
+    const long long end = offset + length;
+    const long long newSize = std::max(oldSize, end);
+    if (end > std::numeric_limits<int32_t>::max() ||
+        BlockMap::blocksFor(end, layout_.clusterSize) > blockMap_.maxBlocks()) {
+        fail(Status::NoSpace);
+        return false;
+    }
+
+    std::vector<char> content;
+    const int firstChunk = static_cast<int>(std::min(offset, oldSize) / chunkBytes);
+    const int lastChunk = static_cast<int>((end - 1) / chunkBytes);
+    for (int chunk = firstChunk; chunk <= lastChunk; ++chunk) {
+        const long long chunkStart = chunk * chunkBytes;
+        const long long chunkEnd = std::min(chunkStart + chunkBytes, newSize);
+        if (chunkStart >= oldSize && chunkEnd <= offset) continue;   // Gap: stays a hole
+
+        // --- Old bytes (zeros past the old end), then the new ones ---
+        const long long chunkLength = chunkEnd - chunkStart;
+        const long long oldLength = std::clamp<long long>(oldSize - chunkStart, 0, chunkLength);
+        const bool covered = offset <= chunkStart && end >= chunkEnd;
+        content.assign(static_cast<size_t>(chunkLength), 0);
+        if (oldLength > 0 && !covered && !readChunk(inode, chunk, oldLength, content.data())) return false;
+
+        const long long dataStart = std::max(chunkStart, offset);
+        const long long dataEnd = std::min(chunkEnd, end);
+        if (dataStart < dataEnd) {      // The old last chunk may only get zeros
+            std::memcpy(content.data() + (dataStart - chunkStart), data + (dataStart - offset),
+                        static_cast<size_t>(dataEnd - dataStart));
+        }
+
+        if (!writeChunk(inode, chunk, content.data(), chunkLength)) return false;
+        inode.file_size = static_cast<int32_t>(std::max<long long>(inode.file_size, chunkEnd));
+    }
+    inode.file_size = static_cast<int32_t>(newSize);
+    return true;
+}
+
+// -------------------------------------------------
+// streamChunks
+// -------------------------------------------------
+// streamBlocks for compressed files: hands the
+// decoded content to `sink` one chunk at a time
+// (holes as data == nullptr). While a chunk is
+// consumed, a helper thread decodes the next one.
+// -------------------------------------------------
+bool FileSystem::streamChunks(const Inode& inode, const ChunkSink& sink) {
+    const int perChunk = chunkBlocks();
+    const long long chunkBytes = static_cast<long long>(perChunk) * layout_.clusterSize;
+    const int count = static_cast<int>((inode.file_size + chunkBytes - 1) / chunkBytes);
+
+    struct Decoded {
+        std::vector<char> data;
+        bool hole = false;
+    };
+    auto load = [&](int chunk, Decoded& decoded) {
+        const long long length = std::min<long long>(chunkBytes, inode.file_size - chunk * chunkBytes);
+        decoded.data.resize(static_cast<size_t>(length));
+        return readChunk(inode, chunk, length, decoded.data.data(), &decoded.hole);
+    };
+    auto consume = [&](int chunk, const Decoded& decoded) {
+        return sink(static_cast<size_t>(chunk) * perChunk, decoded.hole ? nullptr : decoded.data.data(),
+                    static_cast<long long>(decoded.data.size()));
+    };
+    if (count == 0) return true;
+
+    // --- One chunk or one core: decode in place ---
+    Decoded buffers[2];
+    if (count == 1 || std::thread::hardware_concurrency() < 2) {
+        for (int chunk = 0; chunk < count; ++chunk) {
+            if (!load(chunk, buffers[0]) || !consume(chunk, buffers[0])) return false;
+        }
+        return true;
+    }
+
+    // --- Double buffering: decode chunk i + 1 while chunk i is consumed ---
+    WorkPool decoder(1);
+    bool loaded = load(0, buffers[0]);
+    for (int chunk = 0, side = 0; loaded; ++chunk, side ^= 1) {
+        const bool last = chunk + 1 >= count;
+        bool nextLoaded = true;
+        if (!last) decoder.submit([&, chunk, side](int) { nextLoaded = load(chunk + 1, buffers[side ^ 1]); });
+
+        const bool consumed = consume(chunk, buffers[side]);
+        decoder.wait();
+        if (!consumed) return false;
+        if (last) return true;
+        loaded = nextLoaded;
+    }
+    return false;
+}
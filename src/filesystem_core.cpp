@@ -4,175 +4,1810 @@
 // Core filesystem operations
 // Handles:
 //   - Superblock and bitmap management
-//   - Inode read/write
+//   - Inode read/write (through the inode cache)
 //   - Block allocation and freeing
 //   - Filesystem formatting
+//   - Metadata journal transactions and recovery
+//   - Sessions and the shared locks
 //   - Core system commands (statfs, load)
 // =============================================
 
 #define _CRT_SECURE_NO_WARNINGS
 #include "filesystem.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <cstddef>
 #include <cstring>
 #include <filesystem>
+#include <limits>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include "read_ahead.h"
+#include "work_pool.h"
+
+namespace {
+
+// Session bound to the calling thread (see useSession)
+thread_local const FileSystem* boundFs = nullptr;
+thread_local Session* boundSession = nullptr;
+
+// Script argument as a byte offset or length (-1 if it isn't a number,
+// which the command then rejects)
+long long parseNumber(const std::string& text) {
+    try {
+        size_t used = 0;
+        long long value = std::stoll(text, &used);
+        return used == text.size() ? value : -1;
+    }
+    catch (const std::exception&) {
+        return -1;
+    }
+}
+
+// 32-bit superblock fields saturate on images too large for them
+int32_t saturate(long long value) {
+    return static_cast<int32_t>(std::min<long long>(value, std::numeric_limits<int32_t>::max()));
+}
+
+} // namespace
+
+// -------------------------------------------------
+// format
+// -------------------------------------------------
+// Performs formatting of the virtual filesystem file.
+// Initializes all core structures including:
+//   - Superblock (format 4: double-indirect indirect2)
+//   - Inode and data bitmaps
+//   - Block groups with their inode table slices
+//   - Root directory (inode 0)
+//   - Metadata journal (after the slice of group 0)
+//   - Block checksum table (CRC32C per cluster)
+// The inode table gets one inode per BYTES_PER_INODE
+// of disk and the data bitmap one bit per cluster,
+// so both grow with the disk instead of being fixed.
+// The data area starts on a cluster boundary and is
+// cut into groups of BLOCKS_PER_GROUP blocks; each
+// group keeps its share of the inodes in its second
+// and following blocks, next to the data they own.
+// Prints only diagnostics (the shell's mkfs prints
+// the status).
+// -------------------------------------------------
+Status FileSystem::format(int sizeMB, int clusterSize, bool dataChecksums) {
+    // --- STEP 1: Work out the layout ---
+    if (clusterSize != 1024 && clusterSize != 4096 && clusterSize != 16384 && clusterSize != MAX_CLUSTER_SIZE) {
+        err() << "[core] Error: cluster size must be 1, 4, 16 or 64 KB.\n";
+        return Status::InvalidInput;
+    }
+    if (sizeMB <= 0) {
+        err() << "[core] Error: disk size must be positive.\n";
+        return Status::InvalidInput;
+    }
+    const long long totalBytes = static_cast<long long>(sizeMB) * BYTES_PER_MB;
+    const long long clusterCount = totalBytes / clusterSize;
+    const int inodeTarget = static_cast<int>(std::clamp<long long>(totalBytes / BYTES_PER_INODE, MIN_INODES, MAX_INODES));
+    const long long groupLimit = std::max<long long>(1, (clusterCount + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP);
+
+    // The bitmaps come first; rounding the inodes up to whole groups
+    // adds at most one inode per group
+    Layout layout;
+    layout.diskSize = totalBytes;
+    layout.clusterSize = clusterSize;
+    layout.inodeBitmapStart = sizeof(Superblock);
+    layout.inodeBitmapSize = static_cast<int>((inodeTarget + std::min<long long>(groupLimit, MAX_INODES) + 7) / 8);
+    layout.dataBitmapStart = layout.inodeBitmapStart + layout.inodeBitmapSize;
+    layout.dataBitmapSize = static_cast<int>(std::min<long long>((clusterCount + 7) / 8, MAX_DATA_BLOCKS / 8));
+    long long bitmapsEnd = layout.dataBitmapStart + layout.dataBitmapSize;
+    layout.dataStart = (bitmapsEnd + clusterSize - 1) / clusterSize * clusterSize;
+
+    const long long dataBlockCount = (totalBytes - layout.dataStart) / clusterSize;
+    if (dataBlockCount > MAX_DATA_BLOCKS) {
+        err() << "[core] Error: disk too large for the cluster size.\n";
+        return Status::InvalidInput;
+    }
+
+    // Groups: a last group too short for its inode slice joins the one before
+    int groupCount = static_cast<int>(std::max<long long>(1, (dataBlockCount + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP));
+    int inodesPerGroup = (inodeTarget + groupCount - 1) / groupCount;
+    int sliceBlocks = BlockMap::blocksFor(static_cast<long long>(inodesPerGroup) * sizeof(Inode), clusterSize);
+    if (groupCount > 1 && dataBlockCount - static_cast<long long>(groupCount - 1) * BLOCKS_PER_GROUP < sliceBlocks + 2) {
+        --groupCount;
+        inodesPerGroup = (inodeTarget + groupCount - 1) / groupCount;
+        sliceBlocks = BlockMap::blocksFor(static_cast<long long>(inodesPerGroup) * sizeof(Inode), clusterSize);
+    }
+    if (dataBlockCount < sliceBlocks + 2) {
+        err() << "[core] Error: disk too small for the metadata.\n";
+        return Status::NoSpace;
+    }
+
+    const int inodeCount = groupCount * inodesPerGroup;
+    layout.inodeCount = inodeCount;
+    layout.inodeBits = inodeCount;
+    layout.dataBits = static_cast<int>(dataBlockCount);
+    layout.groupCount = groupCount;
+    layout.doubleIndirect = true;
+    layout.blocksPerGroup = BLOCKS_PER_GROUP;
+    layout.inodesPerGroup = inodesPerGroup;
+    layout.groupStride = static_cast<long long>(BLOCKS_PER_GROUP) * clusterSize;
+    layout.inodeStart = layout.dataStart + clusterSize;
+
+    std::unique_lock<std::shared_mutex> fsGuard(fsLock_);
+
+    // Detach the current image before truncating it
+    device_.close();
+    sb_ = Superblock{};
+    layout_ = Layout{};
+    inodeBitmap_.reset();
+    dataBitmap_.reset();
+    inodeCache_.reset();
+    blockMap_.reset();
+    blockShares_.reset();
+    dedup_.reset();
+    checksums_.reset();
+    dentries_.reset();
+    journal_.reset();
+    directoryCount_ = 0;
+
+    std::ofstream file(filename_, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        err() << "[core] Error: cannot create filesystem file.\n";
+        return Status::IoError;
+    }
+    file.close();
+
+    // --- STEP 2: Expand file ---
+    try {
+        std::filesystem::resize_file(filename_, totalBytes);
+    }
+    catch (const std::filesystem::filesystem_error& e) {
+        err() << "[core] Error expanding file: " << e.what() << "\n";
+        return Status::IoError;
+    }
+
+    if (!device_.open(filename_, useMmap_)) {
+        err() << "[core] Error: cannot open filesystem file.\n";
+        return Status::IoError;
+    }
+
+    // --- STEP 3: Prepare superblock ---
+    Superblock sb{};
+    std::memset(&sb, 0, sizeof(Superblock));
+
+    std::strcpy(sb.signature, "klepac");
+    std::strcpy(sb.volume_descriptor, "ZOS_FS_2025");
+    sb.format_version = FORMAT_VERSION;
+    sb.cluster_size = clusterSize;
+    sb.inode_count = inodeCount;
+    sb.data_block_count = layout.dataBits;
+    sb.blocks_per_group = BLOCKS_PER_GROUP;
+    sb.inodes_per_group = inodesPerGroup;
+
+    // Layout offsets, 64-bit and (where they fit) 32-bit
+    sb.disk_size64 = totalBytes;
+    sb.bitmapi_start64 = layout.inodeBitmapStart;
+    sb.bitmap_start64 = layout.dataBitmapStart;
+    sb.inode_start64 = layout.inodeStart;
+    sb.data_start64 = layout.dataStart;
+    sb.disk_size = saturate(totalBytes);
+    sb.cluster_count = saturate(clusterCount);
+    sb.bitmapi_start_address = saturate(layout.inodeBitmapStart);
+    sb.bitmap_start_address = saturate(layout.dataBitmapStart);
+    sb.inode_start_address = saturate(layout.inodeStart);
+    sb.data_start_address = saturate(layout.dataStart);
+
+    // The journal takes the blocks right after the inode slice of group 0
+    int groupZeroFree = static_cast<int>(std::min<long long>(dataBlockCount, BLOCKS_PER_GROUP)) - 1 - sliceBlocks;
+    int journalBlocks = static_cast<int>(std::min<long long>({ JOURNAL_BYTES / clusterSize, dataBlockCount / 8,
+                                                               groupZeroFree }));
+    if (journalBlocks >= 2) {
+        sb.journal_start_block = 1 + sliceBlocks;
+        sb.journal_block_count = journalBlocks;
+    }
+
+    // --- STEP 4: Write superblock ---
+    device_.writeAt(0, &sb, sizeof(Superblock));
+
+    // --- STEP 5: Initialize bitmaps ---
+    std::vector<char> inodeBitmap(layout.inodeBitmapSize, 0);
+    std::vector<char> dataBitmap(layout.dataBitmapSize, 0);
+    auto markBlocks = [&dataBitmap](int first, int count) {
+        for (int blockId = first; blockId < first + count; ++blockId) {
+            dataBitmap[blockId / 8] |= static_cast<char>(1 << (blockId % 8));
+        }
+    };
+    inodeBitmap[0] = 0x01; // bit 0 set for root inode (binary: 00000001)
+    dataBitmap[0] = 0x01;  // bit 0 set for root data block (binary: 00000001)
+    for (int group = 0; group < groupCount; ++group) {
+        markBlocks(group * BLOCKS_PER_GROUP + 1, sliceBlocks);
+    }
+    markBlocks(sb.journal_start_block, sb.journal_block_count);
+    device_.writeAt(layout.inodeBitmapStart, inodeBitmap.data(), inodeBitmap.size());
+    device_.writeAt(layout.dataBitmapStart, dataBitmap.data(), dataBitmap.size());
+
+    // --- STEP 6: Initialize inode table ---
+    // The new file reads as zeros, so every slice is already empty
+    Inode root{};
+    root.id = 0;
+    root.is_directory = true;
+    root.references = 1;
+    root.file_size = 2 * sizeof(DirectoryItem);  // "." and ".."
+    root.direct1 = 0;
+
+    device_.writeAt(layout.inodeStart, &root, sizeof(Inode));
+
+    // --- STEP 7: Create root directory block ---
+    DirectoryItem rootEntries[2]{};
+    rootEntries[0].inode = 0;
+    std::strcpy(rootEntries[0].item_name, ".");
+    rootEntries[1].inode = 0;  // root's parent is itself
+    std::strcpy(rootEntries[1].item_name, "..");
+
+    device_.writeAt(layout.dataStart, rootEntries, sizeof(rootEntries));
+
+    sb_ = sb;
+    layout_ = layout;
+
+    // --- STEP 8: Create an empty journal ---
+    if (sb_.journal_block_count > 0 &&
+        !journal_.create(device_, dataBlockOffset(sb_.journal_start_block),
+                         static_cast<long long>(sb_.journal_block_count) * clusterSize)) {
+        err() << "[core] Error: cannot create journal.\n";
+    }
+
+    loadBitmaps();
+    loadShareTable();
+    loadDedupIndex();
+
+    // --- STEP 9: Checksum what was written so far ---
+    if (!createChecksums(dataChecksums)) {
+        err() << "[core] Error: no room for block checksums.\n";
+    }
+    inodeCache_.attach(layout_.inodeStart, inodeCount, inodesPerGroup, layout_.groupStride);
+    blockMap_.attach(layout_.dataStart, clusterSize, layout_.doubleIndirect);
+    locks_.attach(inodeCount);
+
+    // Transactions begun by other sessions keep staging on the new image
+    {
+        std::lock_guard<std::mutex> tx(txLock_);
+        if (activeTx_ > 0) journal_.begin(device_);
+    }
+
+    // --- STEP 10: Reset every working directory ---
+    std::lock_guard<std::mutex> sessions(sessionLock_);
+    shell_.cwdInode = 0;
+    for (Session* s : sessions_) s->cwdInode = 0;
+    return Status::Ok;
+}
+
+// -------------------------------------------------
+// mount
+// -------------------------------------------------
+// Opens the image once and caches its superblock.
+// A journal left by an interrupted session is
+// replayed before anything else is loaded.
+// Returns false if the image doesn't exist yet
+// (it will be created by format).
+// -------------------------------------------------
+bool FileSystem::mount() {
+    sb_ = Superblock{};
+    layout_ = Layout{};
+    journal_.reset();
+    journal_.setSpillSpace([this](long long bytes, Journal::Ranges& ranges) { return lendJournalSpace(bytes, ranges); });
+    directoryCount_ = -1;
+    if (!device_.open(filename_, useMmap_)) {
+        return false;
+    }
+    sb_ = readSuperblock();
+    layout_ = layoutOf(sb_);
+
+    if (layout_.diskSize != 0 && sb_.journal_block_count > 0) {
+        if (!journal_.attach(device_, dataBlockOffset(sb_.journal_start_block),
+                             static_cast<long long>(sb_.journal_block_count) * layout_.clusterSize)) {
+            err() << "[core] Error: cannot read journal.\n";
+        } else {
+            int replayed = journal_.recover(device_);
+            if (replayed < 0) {
+                err() << "[core] Error: cannot replay journal.\n";
+            } else if (replayed > 0) {
+                err() << "[core] Journal: replayed " << replayed << " transaction(s).\n";
+                sb_ = readSuperblock();
+                layout_ = layoutOf(sb_);
+            }
+        }
+    }
+
+    loadChecksums();
+    resealReplayed();
+    loadBitmaps();
+    loadShareTable();
+    loadDedupIndex();
+    if (layout_.diskSize != 0) {
+        inodeCache_.attach(layout_.inodeStart, layout_.inodeCount, layout_.inodesPerGroup, layout_.groupStride);
+        blockMap_.attach(layout_.dataStart, layout_.clusterSize, layout_.doubleIndirect);
+        locks_.attach(layout_.inodeCount);
+    }
+    return true;
+}
+
+FileSystem::~FileSystem() {
+    std::lock_guard<std::mutex> tx(txLock_);
+    activeTx_ = 0;
+    commitLocked();
+    checkpointLocked();
+    flushInodes();
+    updateChecksums();
+}
+
+// -------------------------------------------------
+// beginTransaction / commitTransaction
+// -------------------------------------------------
+// Bracket one command. Transactions of concurrent
+// sessions overlap; their writes are staged together
+// and the last one to commit logs them as a single
+// record (a commit that finds others still active
+// holds back new transactions until they are done).
+// Cached dirty inodes are written back at commit so
+// they are logged with the bitmap and block updates.
+// -------------------------------------------------
+void FileSystem::beginTransaction() {
+    std::unique_lock<std::mutex> tx(txLock_);
+    txIdle_.wait(tx, [this] { return !draining_; });
+    if (activeTx_++ == 0) journal_.begin(device_);
+}
+
+void FileSystem::commitTransaction() {
+    std::lock_guard<std::mutex> tx(txLock_);
+    if (activeTx_ > 0) --activeTx_;
+    if (activeTx_ > 0) {
+        draining_ = true;
+        return;
+    }
+
+    commitLocked();
+    if (checkpointPending_) checkpointLocked();
+    draining_ = false;
+    txIdle_.notify_all();
+}
+
+void FileSystem::commitLocked() {
+    VFS_TRACE("commit");
+    {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        if (dedup_.attached() && !dedup_.flush(device_)) {
+            err() << "[core] Error: cannot write dedup index.\n";
+        }
+    }
+    if (!device_.staging()) {
+        updateChecksums();
+        return;
+    }
+    flushInodes();
+    updateChecksums();
+    VFS_COUNT(JournalCommits);
+    if (!journal_.commit(device_)) {
+        err() << "[core] Error: cannot write journal.\n";
+    }
+    if (!device_.staging()) releaseHeldBlocks();
+}
+
+void FileSystem::checkpointLocked() {
+    VFS_TRACE("checkpoint");
+    checkpointPending_ = false;
+    if (!journal_.checkpoint(device_)) {
+        err() << "[core] Error: cannot write journal.\n";
+        return;
+    }
+    releaseHeldBlocks();
+}
+
+// -------------------------------------------------
+// releaseHeldBlocks / lendJournalSpace
+// -------------------------------------------------
+// A block freed inside a transaction stays held
+// (free on disk, taken in memory) until the log is
+// written home: until then a crash may give it back
+// to its old owner, so no new data may land on it.
+// The journal borrows free blocks the same way for a
+// record larger than the log.
+// -------------------------------------------------
+void FileSystem::releaseHeldBlocks() {
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    dataBitmap_.releaseHeld();
+}
+
+bool FileSystem::lendJournalSpace(long long bytes, Journal::Ranges& ranges) {
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    const int count = static_cast<int>((bytes + layout_.clusterSize - 1) / layout_.clusterSize);
+    const std::vector<Bitmap::Extent> runs = dataBitmap_.allocateRun(count);
+    if (runs.empty()) {
+        err() << "[core] Warning: no room to log a large transaction in one record.\n";
+        return false;
+    }
+    for (const Bitmap::Extent& run : runs) {
+        for (int blockId = run.start; blockId < run.start + run.length; ++blockId) dataBitmap_.hold(blockId);
+        ranges.emplace_back(dataBlockOffset(run.start), static_cast<long long>(run.length) * layout_.clusterSize);
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// setGroupCommit
+// -------------------------------------------------
+// Counted: group commit stays on while any script
+// runs. When the last one turns it off, the log is
+// checkpointed (right away if no transaction is
+// active, otherwise by the last one to commit).
+// -------------------------------------------------
+void FileSystem::setGroupCommit(bool enabled) {
+    std::lock_guard<std::mutex> tx(txLock_);
+    groupCommitUsers_ = std::max(0, groupCommitUsers_ + (enabled ? 1 : -1));
+    journal_.setGroupCommit(groupCommitUsers_ > 0);
+    if (groupCommitUsers_ > 0) return;
+
+    if (activeTx_ > 0) {
+        checkpointPending_ = true;
+        return;
+    }
+    commitLocked();
+    checkpointLocked();
+}
+
+// -------------------------------------------------
+// Sessions
+// -------------------------------------------------
+// A thread works in the session it bound last; a
+// thread that never bound one shares the shell
+// session. rmdir refuses to remove a directory that
+// is the working directory of any session.
+// -------------------------------------------------
+void FileSystem::attachSession(Session& session) {
+    {
+        std::lock_guard<std::mutex> guard(sessionLock_);
+        session.cwdInode = 0;
+        sessions_.insert(&session);
+    }
+    useSession(&session);
+}
+
+void FileSystem::detachSession(Session& session) {
+    {
+        std::lock_guard<std::mutex> guard(sessionLock_);
+        sessions_.erase(&session);
+    }
+    if (boundFs == this && boundSession == &session) useSession(nullptr);
+}
+
+void FileSystem::useSession(Session* session) {
+    boundFs = session != nullptr ? this : nullptr;
+    boundSession = session;
+}
+
+Session& FileSystem::session() {
+    return boundFs == this && boundSession != nullptr ? *boundSession : shell_;
+}
+
+std::ostream& FileSystem::out() {
+    Session& current = session();
+    return current.out != nullptr ? *current.out : std::cout;
+}
+
+std::ostream& FileSystem::err() {
+    Session& current = session();
+    return current.err != nullptr ? *current.err : std::cerr;
+}
+
+// -------------------------------------------------
+// fail / failure
+// -------------------------------------------------
+// A helper that fails for a reason of its own (an
+// allocator out of space) records it in the session
+// and returns its usual -1 / false; the API call on
+// top takes it with failure(), which falls back to
+// the call's own guess (mostly IoError) when none
+// was recorded. Code that recovers from a helper's
+// failure drops the reason the same way.
+// -------------------------------------------------
+void FileSystem::fail(Status status) {
+    session().failure = status;
+}
+
+Status FileSystem::failure(Status fallback) {
+    Session& current = session();
+    const Status status = current.failure != Status::Ok ? current.failure : fallback;
+    current.failure = Status::Ok;
+    return status;
+}
+
+Status FileSystem::report(Status status) {
+    if (status == Status::Ok) out() << "OK\n";
+    else err() << statusText(status) << "\n";
+    return status;
+}
+
+bool FileSystem::isWorkingDirectory(int inodeId) {
+    std::lock_guard<std::mutex> guard(sessionLock_);
+    if (shell_.cwdInode == inodeId) return true;
+    for (const Session* s : sessions_) {
+        if (s->cwdInode == inodeId) return true;
+    }
+    return false;
+}
+
+// An inode may have been freed between resolving a
+// path and locking it
+bool FileSystem::isLive(int inodeId) {
+    std::lock_guard<std::mutex> guard(allocLock_);
+    return inodeId >= 0 && inodeId < inodeBitmap_.capacity() && inodeBitmap_.test(inodeId);
+}
+
+void FileSystem::setInodeCacheCapacity(size_t capacity) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+    if (!inodeCache_.setCapacity(device_, capacity)) {
+        err() << "[core] Error: cannot write back cached inodes.\n";
+    }
+}
+
+// -------------------------------------------------
+// flushInodes
+// -------------------------------------------------
+// Writes every dirty inode held by the cache to the
+// inode table. Needed before anything reads the
+// table directly (sync, statfs).
+// -------------------------------------------------
+bool FileSystem::flushInodes() {
+    if (!inodeCache_.flush(device_)) {
+        err() << "[core] Error: cannot write back cached inodes.\n";
+        return false;
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// loadBitmaps
+// -------------------------------------------------
+// Reads the inode and data bitmaps into memory. They
+// stay resident for the whole mount; allocation and
+// freeing only write back the pages they touch.
+// -------------------------------------------------
+void FileSystem::loadBitmaps() {
+    inodeBitmap_.reset();
+    dataBitmap_.reset();
+    if (layout_.diskSize == 0) {
+        return;
+    }
+
+    if (!inodeBitmap_.load(device_, layout_.inodeBitmapStart, layout_.inodeBitmapSize, layout_.inodeBits) ||
+        !dataBitmap_.load(device_, layout_.dataBitmapStart, layout_.dataBitmapSize, layout_.dataBits)) {
+        err() << "[core] Error: cannot read bitmaps.\n";
+    }
+}
+
+// -------------------------------------------------
+// flush
+// -------------------------------------------------
+// Flushes everything written so far to the host disk:
+// cached inodes first, then the journal is committed
+// and checkpointed, then the image itself is flushed.
+// For a memory-mapped image this is the msync point.
+// While other sessions are inside a transaction the
+// checkpoint is left to the last one to commit.
+// -------------------------------------------------
+Status FileSystem::flush() {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+    if (!device_.isOpen()) return Status::PathNotFound;
+    {
+        std::lock_guard<std::mutex> tx(txLock_);
+        if (activeTx_ > 1) {
+            checkpointPending_ = true;
+        } else {
+            if (!flushInodes()) {
+                return Status::IoError;
+            }
+            commitLocked();
+            checkpointLocked();
+        }
+    }
+    if (!device_.flush()) {
+        err() << "[core] Error: cannot flush filesystem file.\n";
+        return Status::IoError;
+    }
+    return Status::Ok;
+}
+
+// -------------------------------------------------
+// readSuperblock
+// -------------------------------------------------
+// Loads and returns the current superblock from disk.
+// Returns empty superblock if file doesn't exist (will be created by format).
+// --------------------------------------------------
+Superblock FileSystem::readSuperblock() {
+    Superblock sb{};
+    if (!device_.readAt(0, &sb, sizeof(Superblock))) {
+        // File doesn't exist yet - will be created by format() command
+        return Superblock{};
+    }
+
+    // The superblock ends where the inode bitmap starts. On images from
+    // before the extension fields, the bytes read past that are bitmap.
+    size_t onDisk = static_cast<size_t>(sb.bitmapi_start_address);
+    if (onDisk < sizeof(Superblock)) {
+        std::memset(reinterpret_cast<char*>(&sb) + onDisk, 0, sizeof(Superblock) - onDisk);
+    }
+    return sb;
+}
+
+// -------------------------------------------------
+// layoutOf
+// -------------------------------------------------
+// Derives the region offsets and sizes from a
+// superblock. Format 1 images predate the size
+// fields: their regions are whatever lies between
+// the 32-bit offsets, with every bitmap bit usable.
+// An all-zero superblock gives an empty layout.
+// -------------------------------------------------
+FileSystem::Layout FileSystem::layoutOf(const Superblock& sb) {
+    Layout layout;
+    if (sb.format_version >= 2) {
+        layout.diskSize = sb.disk_size64;
+        layout.clusterSize = sb.cluster_size;
+        layout.inodeBitmapStart = sb.bitmapi_start64;
+        layout.dataBitmapStart = sb.bitmap_start64;
+        layout.inodeStart = sb.inode_start64;
+        layout.dataStart = sb.data_start64;
+        layout.inodeCount = sb.inode_count;
+        layout.inodeBits = sb.inode_count;
+        layout.dataBits = sb.data_block_count;
+        layout.inodeBitmapSize = (sb.inode_count + 7) / 8;
+        layout.dataBitmapSize = (sb.data_block_count + 7) / 8;
+        layout.blocksPerGroup = sb.data_block_count;
+        layout.inodesPerGroup = sb.inode_count;
+        layout.doubleIndirect = sb.format_version >= 4;
+        if (sb.format_version >= 3 && sb.blocks_per_group > 0 && sb.inodes_per_group > 0) {
+            layout.groupCount = sb.inode_count / sb.inodes_per_group;
+            layout.blocksPerGroup = sb.blocks_per_group;
+            layout.inodesPerGroup = sb.inodes_per_group;
+            layout.groupStride = static_cast<long long>(sb.blocks_per_group) * sb.cluster_size;
+        }
+        return layout;
+    }
+    if (sb.disk_size == 0) return layout;
+
+    layout.diskSize = sb.disk_size;
+    layout.clusterSize = sb.cluster_size;
+    layout.inodeBitmapStart = sb.bitmapi_start_address;
+    layout.dataBitmapStart = sb.bitmap_start_address;
+    layout.inodeStart = sb.inode_start_address;
+    layout.dataStart = sb.data_start_address;
+    layout.inodeBitmapSize = sb.bitmap_start_address - sb.bitmapi_start_address;
+    layout.dataBitmapSize = sb.inode_start_address - sb.bitmap_start_address;
+    layout.inodeCount = (sb.data_start_address - sb.inode_start_address) / static_cast<int>(sizeof(Inode));
+    layout.inodeBits = layout.inodeBitmapSize * 8;
+    layout.dataBits = layout.dataBitmapSize * 8;
+    layout.blocksPerGroup = layout.dataBits;
+    layout.inodesPerGroup = layout.inodeCount;
+    return layout;
+}
+
+// -------------------------------------------------
+// writeSuperblock
+// -------------------------------------------------
+// Writes the in-memory superblock back. Only the
+// bytes the image actually reserves for it are
+// written, so older images keep their layout.
+// -------------------------------------------------
+void FileSystem::writeSuperblock() {
+    size_t onDisk = std::min(sizeof(Superblock), static_cast<size_t>(sb_.bitmapi_start_address));
+    if (!device_.writeAt(0, &sb_, onDisk)) {
+        err() << "[core] Error: cannot write superblock.\n";
+    }
+}
+
+// -------------------------------------------------
+// loadShareTable
+// -------------------------------------------------
+// Loads the block share counts if the image has a
+// table (created by the first reflink copy or
+// `dedup on`).
+// -------------------------------------------------
+void FileSystem::loadShareTable() {
+    blockShares_.reset();
+    if (layout_.diskSize == 0 || sb_.refcount_start_block <= 0) {
+        return;
+    }
+
+    long long tableBytes = static_cast<long long>(sb_.refcount_block_count) * layout_.clusterSize;
+    int entries = static_cast<int>(std::min<long long>(dataBitmap_.capacity(), tableBytes));
+    if (!blockShares_.load(device_, dataBlockOffset(sb_.refcount_start_block), entries)) {
+        err() << "[core] Error: cannot read block share counts.\n";
+    }
+}
+
+// -------------------------------------------------
+// ensureShareTable
+// -------------------------------------------------
+// Creates the share-count table the first time a
+// reflink copy is made (or dedup is turned on):
+// one byte per data block inside the image, stored
+// in a contiguous run of data blocks recorded in
+// the superblock.
+// Returns false if the image has no room for the
+// superblock extension (older format) or no space.
+// -------------------------------------------------
+bool FileSystem::ensureShareTable() {
+    if (blockShares_.attached()) return true;
+    const size_t fieldsEnd = offsetof(Superblock, refcount_block_count) + sizeof(int32_t);
+    if (sb_.bitmapi_start_address < static_cast<int32_t>(fieldsEnd)) return false;
+
+    long long dataBytes = layout_.diskSize - layout_.dataStart;
+    int entries = static_cast<int>(std::min<long long>(dataBitmap_.capacity(), dataBytes / layout_.clusterSize));
+    int blockCount = BlockMap::blocksFor(entries, layout_.clusterSize);
+    if (blockCount <= 0) return false;
+
+    std::vector<Bitmap::Extent> run = dataBitmap_.allocateRun(blockCount);
+    if (run.size() != 1) {
+        for (const Bitmap::Extent& part : run) {
+            for (int i = 0; i < part.length; ++i) dataBitmap_.clear(part.start + i);
+        }
+        dataBitmap_.flush(device_);
+        return false;
+    }
+    dataBitmap_.flush(device_);
+
+    std::vector<char> zeros(static_cast<size_t>(blockCount) * layout_.clusterSize, 0);
+    writeBlock(run[0].start, zeros.data(), zeros.size());
+
+    sb_.refcount_start_block = run[0].start;
+    sb_.refcount_block_count = blockCount;
+    writeSuperblock();
+    loadShareTable();
+    return blockShares_.attached();
+}
+
+// -------------------------------------------------
+// loadChecksums
+// -------------------------------------------------
+// Loads the block checksums if the image has a
+// table and lets the device verify reads and
+// report writes against it. Everything read after
+// this (bitmaps, inodes, blocks) is checked once.
+// -------------------------------------------------
+void FileSystem::loadChecksums() {
+    device_.attachChecksums(nullptr);
+    checksums_.reset();
+    if (layout_.diskSize == 0 || sb_.checksum_start_block <= 0) {
+        return;
+    }
+
+    if (!checksums_.load(device_, dataBlockOffset(sb_.checksum_start_block), layout_.diskSize / layout_.clusterSize,
+                         layout_.clusterSize, (sb_.checksum_flags & CHECKSUM_DATA) != 0)) {
+        err() << "[core] Error: cannot read block checksums.\n";
+        return;
+    }
+    device_.attachChecksums(&checksums_);
+}
+
+// -------------------------------------------------
+// createChecksums
+// -------------------------------------------------
+// Gives a freshly formatted image its checksum
+// table: 4 bytes per cluster of the image in one
+// contiguous run of data blocks, recorded in the
+// superblock. Everything format wrote (superblock,
+// bitmaps, inode table slices, root directory) is
+// summed right away. Returns false if no run is
+// long enough; the image then has no checksums.
+// -------------------------------------------------
+bool FileSystem::createChecksums(bool dataChecksums) {
+    const long long units = layout_.diskSize / layout_.clusterSize;
+    const int blockCount = BlockMap::blocksFor(units * static_cast<long long>(sizeof(uint32_t)), layout_.clusterSize);
+
+    std::vector<Bitmap::Extent> run = dataBitmap_.allocateRun(blockCount);
+    if (run.size() != 1) {
+        for (const Bitmap::Extent& part : run) {
+            for (int i = 0; i < part.length; ++i) dataBitmap_.clear(part.start + i);
+        }
+        dataBitmap_.flush(device_);
+        return false;
+    }
+    dataBitmap_.flush(device_);
+
+    // The image was just created, so the table already reads as zeros
+    sb_.checksum_start_block = run[0].start;
+    sb_.checksum_block_count = blockCount;
+    sb_.checksum_flags = dataChecksums ? CHECKSUM_DATA : 0;
+    writeSuperblock();
+    loadChecksums();
+    if (!checksums_.attached()) return false;
+
+    const long long sliceBytes = static_cast<long long>(layout_.inodesPerGroup) * sizeof(Inode);
+    checksums_.noteWrite(0, static_cast<size_t>(layout_.dataStart), false);
+    for (int group = 0; group < layout_.groupCount; ++group) {
+        checksums_.noteWrite(layout_.inodeStart + group * layout_.groupStride, static_cast<size_t>(sliceBytes), false);
+    }
+    checksums_.noteWrite(dataBlockOffset(0), static_cast<size_t>(layout_.clusterSize), false);
+    updateChecksums();
+    return true;
+}
+
+// -------------------------------------------------
+// updateChecksums
+// -------------------------------------------------
+// Sums the blocks written since the last call and
+// writes their entries. Called before each commit,
+// so the entries are logged with the blocks.
+// -------------------------------------------------
+void FileSystem::updateChecksums() {
+    if (checksums_.attached() && !checksums_.update(device_)) {
+        err() << "[core] Error: cannot write block checksums.\n";
+    }
+}
+
+// -------------------------------------------------
+// resealReplayed
+// -------------------------------------------------
+// Blocks and their entries are logged together, so
+// a replay leaves them matching; re-summing what it
+// wrote still re-seals the entries of records that
+// don't carry them (a transaction logged in parts).
+// The new entries are logged like any commit.
+// -------------------------------------------------
+void FileSystem::resealReplayed() {
+    if (!checksums_.attached() || journal_.recovered().empty()) return;
+    journal_.begin(device_);
+    for (const auto& range : journal_.recovered()) {
+        checksums_.noteWrite(range.first, static_cast<size_t>(range.second), false);
+    }
+    updateChecksums();
+    if (!journal_.commit(device_)) {
+        err() << "[core] Error: cannot write journal.\n";
+    }
+}
+
+// -------------------------------------------------
+// readInode
+// -------------------------------------------------
+// Reads a specific inode structure by its ID.
+// Served from the inode cache; misses go to disk.
+// -------------------------------------------------
+Inode FileSystem::readInode(int inodeId) {
+    VFS_COUNT(InodeReads);
+    Inode inode{};
+
+    // If superblock is empty, file hasn't been formatted yet
+    if (layout_.diskSize == 0) {
+        return inode;
+    }
+
+    if (!inodeCache_.read(device_, inodeId, inode)) {
+        err() << "[core] Error: cannot read inode " << inodeId << ".\n";
+        return Inode{};
+    }
+    return inode;
+}
+
+// -------------------------------------------------
+// writeInode
+// -------------------------------------------------
+// Stores an inode. The cache defers the disk write
+// until the inode is evicted or the cache is flushed.
+// -------------------------------------------------
+void FileSystem::writeInode(int inodeId, const Inode& inode) {
+    VFS_COUNT(InodeWrites);
+    if (!inodeCache_.write(device_, inodeId, inode)) {
+        err() << "[core] Error: cannot write inode " << inodeId << ".\n";
+    }
+}
+
+// -------------------------------------------------
+// readBlock / writeBlock
+// -------------------------------------------------
+// Positioned access to a data block. `offset` is the
+// byte position inside the block; `length` may span
+// into the following blocks. Writing a block drops
+// any cached copy of it as a pointer block.
+// -------------------------------------------------
+bool FileSystem::readBlock(int blockId, void* buffer, size_t length, long long offset) {
+    VFS_COUNT_N(BlockReads, BlockMap::blocksFor(offset % layout_.clusterSize + static_cast<long long>(length), layout_.clusterSize));
+    return device_.readAt(dataBlockOffset(blockId) + offset, buffer, length);
+}
+
+bool FileSystem::writeBlock(int blockId, const void* buffer, size_t length, long long offset) {
+    VFS_COUNT_N(BlockWrites, BlockMap::blocksFor(offset % layout_.clusterSize + static_cast<long long>(length), layout_.clusterSize));
+    if (length > 0) {
+        long long last = (offset + static_cast<long long>(length) - 1) / layout_.clusterSize;
+        for (long long b = offset / layout_.clusterSize; b <= last; ++b) {
+            blockMap_.invalidate(blockId + static_cast<int>(b));
+        }
+    }
+    return device_.writeAt(dataBlockOffset(blockId) + offset, buffer, length);
+}
+
+// -------------------------------------------------
+// readBlocks / writeBlocks
+// -------------------------------------------------
+// Transfers `length` bytes of file data laid out over
+// `blocks` (in logical order), starting with entry
+// `first` - streamed copies move one chunk at a time
+// this way. Physically consecutive
+// blocks are merged, so a file allocated as a single
+// run is read or written with one I/O call; the runs
+// of a fragmented file go out as one batch, several
+// in flight at once.
+// Unmapped blocks (0) read as zeros; UNREADABLE
+// ones fail the transfer.
+// -------------------------------------------------
+bool FileSystem::readBlocks(const std::vector<int>& blocks, char* buffer, long long length, size_t first) {
+    VFS_TRACE("readBlocks");
+    const size_t count = blocks.size();
+    std::vector<IoRequest> batch;
+    size_t i = first;
+    while (i < count && length > 0) {
+        if (blocks[i] < 0) return false;
+        size_t runEnd = i + 1;
+        if (blocks[i] == 0) {
+            while (runEnd < count && blocks[runEnd] == 0) ++runEnd;
+        } else {
+            while (runEnd < count && blocks[runEnd] == blocks[runEnd - 1] + 1) ++runEnd;
+        }
+
+        long long chunk = std::min<long long>(length, static_cast<long long>(runEnd - i) * layout_.clusterSize);
+        if (blocks[i] == 0) {
+            std::memset(buffer, 0, static_cast<size_t>(chunk));
+        } else {
+            VFS_COUNT_N(BlockReads, BlockMap::blocksFor(chunk, layout_.clusterSize));
+            batch.push_back({ dataBlockOffset(blocks[i]), buffer, static_cast<size_t>(chunk), false });
+        }
+
+        buffer += chunk;
+        length -= chunk;
+        i = runEnd;
+    }
+    if (batch.size() == 1) return device_.readAt(batch[0].offset, batch[0].buffer, batch[0].length);
+    return device_.submit(batch);
+}
+
+bool FileSystem::writeBlocks(const std::vector<int>& blocks, const char* data, long long length, size_t first) {
+    VFS_TRACE("writeBlocks");
+    const size_t count = blocks.size();
+    std::vector<IoRequest> batch;
+    size_t i = first;
+    while (i < count && length > 0) {
+        size_t runEnd = i + 1;
+        while (runEnd < count && blocks[runEnd] == blocks[runEnd - 1] + 1) ++runEnd;
+
+        long long chunk = std::min<long long>(length, static_cast<long long>(runEnd - i) * layout_.clusterSize);
+        if (blocks[i] <= 0) return false;
+        VFS_COUNT_N(BlockWrites, BlockMap::blocksFor(chunk, layout_.clusterSize));
+        for (size_t b = i; b < runEnd; ++b) blockMap_.invalidate(blocks[b]);
+        batch.push_back({ dataBlockOffset(blocks[i]), const_cast<char*>(data), static_cast<size_t>(chunk), true });
+
+        data += chunk;
+        length -= chunk;
+        i = runEnd;
+    }
+    if (batch.size() == 1) return device_.writeData(batch[0].offset, batch[0].buffer, batch[0].length);
+    return device_.submit(batch);
+}
+
+// -------------------------------------------------
+// streamBlocks
+// -------------------------------------------------
+// Streamed reads (outcp, cp, defrag) go through
+// here. The data is cut into chunks of up to
+// STREAM_CHUNK_SIZE mapped blocks (a run of holes
+// is one chunk of its own). While `sink` consumes
+// one chunk, a helper thread already reads the
+// next into the second buffer, and ReadAhead
+// hints the host about the window after that, so
+// reading, prefetching and the consumer's writes
+// overlap. Files of one chunk, and every file on a
+// single core, are read in place; the hints still
+// let the host load ahead.
+// Returns false if a read or the sink fails.
+// -------------------------------------------------
+bool FileSystem::streamBlocks(const std::vector<int>& blocks, long long size, const ChunkSink& sink) {
+    VFS_TRACE("streamBlocks");
+    const int clusterSize = layout_.clusterSize;
+    const size_t count = std::min(blocks.size(), static_cast<size_t>(BlockMap::blocksFor(size, clusterSize)));
+    const size_t chunkBlocks = std::max<size_t>(1, STREAM_CHUNK_SIZE / clusterSize);
+
+    struct Chunk {
+        size_t first = 0;
+        size_t end = 0;             // One past the chunk's last block
+        long long length = 0;       // Bytes (the last chunk stops at `size`)
+        bool hole = false;
+    };
+    auto chunkAt = [&](size_t first) {
+        Chunk chunk;
+        chunk.first = first;
+        chunk.hole = blocks[first] == 0;
+        chunk.end = first + 1;
+        while (chunk.end < count && (blocks[chunk.end] == 0) == chunk.hole &&
+               (chunk.hole || chunk.end - first < chunkBlocks)) ++chunk.end;
+        const long long offset = static_cast<long long>(first) * clusterSize;
+        chunk.length = std::min<long long>(static_cast<long long>(chunk.end - first) * clusterSize, size - offset);
+        return chunk;
+    };
+
+    ReadAhead ahead(device_, layout_.dataStart, clusterSize, blocks);
+    std::vector<char> buffers[2];
+    auto load = [&](const Chunk& chunk, std::vector<char>& buffer) {
+        if (chunk.hole) return true;
+        ahead.access(chunk.first, chunk.end - chunk.first);
+        buffer.resize(static_cast<size_t>(chunk.length));
+        return readBlocks(blocks, buffer.data(), chunk.length, chunk.first);
+    };
+    if (count == 0) return true;
+
+    // --- One chunk or one core: no helper thread (the hints still run ahead) ---
+    Chunk current = chunkAt(0);
+    if (current.end >= count || std::thread::hardware_concurrency() < 2) {
+        for (;;) {
+            if (!load(current, buffers[0]) ||
+                !sink(current.first, current.hole ? nullptr : buffers[0].data(), current.length)) return false;
+            if (current.end >= count) return true;
+            current = chunkAt(current.end);
+        }
+    }
+
+    // --- Double buffering: read chunk i + 1 while chunk i is consumed ---
+    WorkPool reader(1);
+    bool loaded = load(current, buffers[0]);
+    for (int side = 0; loaded; side ^= 1) {
+        const bool last = current.end >= count;
+        Chunk next;
+        bool nextLoaded = true;
+        if (!last) {
+            next = chunkAt(current.end);
+            reader.submit([&, side](int) { nextLoaded = load(next, buffers[side ^ 1]); });
+        }
+
+        const bool consumed = sink(current.first, current.hole ? nullptr : buffers[side].data(), current.length);
+        reader.wait();
+        if (!consumed) return false;
+        if (last) return true;
+        current = next;
+        loaded = nextLoaded;
+    }
+    return false;
+}
+
+// -------------------------------------------------
+// writeFileData
+// -------------------------------------------------
+// File data is not journaled: it is written in place
+// before the command commits. It never lands on a
+// block a logged transaction may still hand back to
+// its old file: freed blocks are held until the
+// checkpoint (releaseDataBlock).
+// -------------------------------------------------
+bool FileSystem::writeFileData(int blockId, const char* data, size_t length) {
+    if (length == 0) return true;
+    int last = blockId + static_cast<int>((length - 1) / layout_.clusterSize);
+    for (int b = blockId; b <= last; ++b) blockMap_.invalidate(b);
+    return device_.writeData(dataBlockOffset(blockId), data, length);
+}
+
+// -------------------------------------------------
+// readDirEntries
+// -------------------------------------------------
+// Loads every entry of a directory, one read per
+// contiguous run of directory blocks.
+// Returns an empty list if the inode isn't a directory.
+// -------------------------------------------------
+std::vector<DirectoryItem> FileSystem::readDirEntries(const Inode& dir) {
+    std::vector<DirectoryItem> items;
+    if (!dir.is_directory || dir.file_size <= 0) {
+        return items;
+    }
+
+    items.resize(dir.file_size / sizeof(DirectoryItem));
+    char* buffer = reinterpret_cast<char*>(items.data());
+    long long length = static_cast<long long>(items.size()) * sizeof(DirectoryItem);
+
+    // The first block is read on its own: for the root directory it is
+    // block 0, which the block map reports as "unmapped"
+    long long head = std::min<long long>(length, layout_.clusterSize);
+    if (!readBlock(dir.direct1, buffer, static_cast<size_t>(head)) ||
+        !readBlocks(fileBlocks(dir), buffer + head, length - head, 1)) {
+        items.clear();
+    }
+    return items;
+}
+
+// -------------------------------------------------
+// fileBlocks
+// -------------------------------------------------
+// Resolves the physical blocks of a file through the
+// block map. Without a range, returns every block
+// covering file_size. Unmapped entries are 0, ones
+// behind an unreadable pointer block UNREADABLE.
+// -------------------------------------------------
+std::vector<int> FileSystem::fileBlocks(const Inode& inode) {
+    return fileBlocks(inode, 0, BlockMap::blocksFor(inode.file_size, layout_.clusterSize));
+}
+
+std::vector<int> FileSystem::fileBlocks(const Inode& inode, int first, int count) {
+    return blockMap_.range(device_, inode, first, count);
+}
+
+// -------------------------------------------------
+// readFileData
+// -------------------------------------------------
+// Reads the whole content of a file (file_size bytes)
+// into buffer, one read per contiguous run (compressed
+// files: decoded chunk by chunk, inline ones: copied
+// from the inode).
+// -------------------------------------------------
+bool FileSystem::readFileData(const Inode& inode, char* buffer) {
+    if (inode.file_size <= 0) return true;
+    if (isInline(inode)) return readFileRange(inode, 0, buffer, inode.file_size);
+    if (isCompressed(inode)) return readCompressed(inode, 0, buffer, inode.file_size);
+    return readBlocks(fileBlocks(inode), buffer, inode.file_size);
+}
+
+// -------------------------------------------------
+// streamFile
+// -------------------------------------------------
+// Hands a file's content to `sink` chunk by chunk
+// (see streamBlocks); compressed files are decoded
+// on the way (see streamChunks), inline ones are
+// one chunk.
+// -------------------------------------------------
+bool FileSystem::streamFile(const Inode& inode, const ChunkSink& sink) {
+    if (isInline(inode)) return inode.file_size <= 0 || sink(0, inlineData(inode), inode.file_size);
+    if (isCompressed(inode)) return streamChunks(inode, sink);
+    return streamBlocks(fileBlocks(inode), inode.file_size, sink);
+}
+
+// -------------------------------------------------
+// releaseFileBlocks
+// -------------------------------------------------
+// Frees every block owned by a file: all direct blocks,
+// the indirect entries covering file_size, and the
+// pointer blocks. The bitmap is written back once.
+// -------------------------------------------------
+void FileSystem::releaseFileBlocks(const Inode& inode) {
+    int mapped = std::max(BlockMap::blocksFor(inode.file_size, layout_.clusterSize), BlockMap::DIRECT_COUNT);
+    std::vector<int> blocks = fileBlocks(inode, 0, mapped);
+
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    for (int blockId : blocks) {
+        // A shared block only loses one owner
+        if (blockId > 0 && !blockShares_.dropShare(blockId)) releaseDataBlock(blockId);
+    }
+    for (int blockId : blockMap_.pointerBlocks(device_, inode)) {
+        releaseDataBlock(blockId);
+        blockMap_.invalidate(blockId);
+    }
+    dataBitmap_.flush(device_);
+    blockShares_.flush(device_);
+}
+
+// -------------------------------------------------
+// shrinkFile
+// -------------------------------------------------
+// Cuts a file down to `size` bytes (at most its
+// current size): every block past the last one still
+// needed is freed (a shared block loses one owner).
+// A pointer block is freed when it maps nothing any
+// more, else its tail entries are cleared with one
+// write. Updates the inode's pointers and size (the
+// caller writes the inode). A compressed file's cut
+// chunk is recoded first; if that fails nothing
+// changes (false). An inline file only zeroes its
+// cut bytes.
+// -------------------------------------------------
+bool FileSystem::shrinkFile(Inode& inode, long long size) {
+    if (isInline(inode)) {
+        if (size < inode.file_size) {
+            std::memset(inlineData(inode) + size, 0, static_cast<size_t>(inode.file_size - size));
+            inode.file_size = static_cast<int32_t>(size);
+        }
+        return true;
+    }
+
+    // --- Compressed: recode the chunk the new end cuts ---
+    const long long chunkBytes = static_cast<long long>(chunkBlocks()) * layout_.clusterSize;
+    if (isCompressed(inode) && size < inode.file_size && size % chunkBytes != 0) {
+        const int chunk = static_cast<int>(size / chunkBytes);
+        const long long chunkStart = chunk * chunkBytes;
+        std::vector<char> content(static_cast<size_t>(std::min<long long>(chunkBytes, inode.file_size - chunkStart)));
+        if (!readChunk(inode, chunk, static_cast<long long>(content.size()), content.data()) ||
+            !writeChunk(inode, chunk, content.data(), size - chunkStart)) {
+            return false;
+        }
+    }
+
+    const int perBlock = blockMap_.pointersPerBlock();
+    const int keep = BlockMap::blocksFor(size, layout_.clusterSize);
+    std::vector<int> dataBlocks;
+    std::vector<int> pointerBlocks;
+
+    // --- Direct blocks ---
+    int32_t* direct[BlockMap::DIRECT_COUNT] = { &inode.direct1, &inode.direct2, &inode.direct3,
+                                                &inode.direct4, &inode.direct5 };
+    for (int i = keep; i < BlockMap::DIRECT_COUNT; ++i) {
+        if (*direct[i] > 0) dataBlocks.push_back(*direct[i]);
+        *direct[i] = 0;
+    }
+
+    // --- Pointer blocks: keep entries below `keep` ---
+    std::vector<int32_t> ptrs(perBlock);
+    auto trim = [&](int32_t& pointerBlock, int firstLogical) {
+        if (pointerBlock <= 0) return;
+        const int from = std::max(0, keep - firstLogical);
+        if (from >= perBlock) return;
+
+        readBlock(pointerBlock, ptrs.data(), ptrs.size() * sizeof(int32_t));
+        for (int i = from; i < perBlock; ++i) {
+            if (ptrs[i] > 0) dataBlocks.push_back(ptrs[i]);
+            ptrs[i] = 0;
+        }
+        if (from == 0) {
+            pointerBlocks.push_back(pointerBlock);
+            pointerBlock = 0;
+        } else {
+            writeBlock(pointerBlock, ptrs.data(), ptrs.size() * sizeof(int32_t));
+        }
+    };
+    trim(inode.indirect1, BlockMap::DIRECT_COUNT);
+    const int secondFirst = BlockMap::DIRECT_COUNT + perBlock;
+    if (!blockMap_.doubleIndirect()) {
+        trim(inode.indirect2, secondFirst);
+    } else if (inode.indirect2 > 0 && keep < secondFirst + perBlock * perBlock) {
+        std::vector<int32_t> root(perBlock);
+        readBlock(inode.indirect2, root.data(), root.size() * sizeof(int32_t));
+        for (int child = std::max(0, (keep - secondFirst) / perBlock); child < perBlock; ++child) {
+            trim(root[child], secondFirst + child * perBlock);
+        }
+        if (keep <= secondFirst) {
+            pointerBlocks.push_back(inode.indirect2);
+            inode.indirect2 = 0;
+        } else {
+            writeBlock(inode.indirect2, root.data(), root.size() * sizeof(int32_t));
+        }
+    }
+
+    // --- Release (bitmap and share counts written once) ---
+    {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        for (int blockId : dataBlocks) {
+            if (!blockShares_.dropShare(blockId)) releaseDataBlock(blockId);
+        }
+        for (int blockId : pointerBlocks) {
+            releaseDataBlock(blockId);
+            blockMap_.invalidate(blockId);
+        }
+        dataBitmap_.flush(device_);
+        blockShares_.flush(device_);
+    }
+    inode.file_size = static_cast<int32_t>(size);
+    return true;
+}
+
+// -------------------------------------------------
+// growFile
+// -------------------------------------------------
+// Sets a larger size; the new bytes read as zeros.
+// Only the old last block (of a compressed file:
+// its last chunk) gets zeros written, as it may
+// hold stale bytes past the old end; the rest is a
+// hole. An inline file stays inline while it fits,
+// else its content moves to a block first. Updates
+// the inode's pointers and size (the caller writes
+// the inode).
+// -------------------------------------------------
+bool FileSystem::growFile(Inode& inode, long long size) {
+    const long long oldSize = inode.file_size;
+    if (size <= oldSize) return true;
+    if (isInline(inode) && size <= INLINE_CAPACITY) {
+        inode.file_size = static_cast<int32_t>(size);   // The bytes past the old end are zeros already
+        return true;
+    }
+    if (isInline(inode) && !spillInline(inode)) return false;
+
+    const int clusterSize = layout_.clusterSize;
+    const int unitBlocks = isCompressed(inode) ? chunkBlocks() : 1;
+    const int lastUnit = (BlockMap::blocksFor(oldSize, clusterSize) - 1) / unitBlocks * unitBlocks;
+    const long long tail = std::min<long long>(size, static_cast<long long>(lastUnit + unitBlocks) * clusterSize);
+    if (tail > oldSize && blockMap_.resolve(device_, inode, lastUnit) != 0) {
+        std::vector<char> zeros(static_cast<size_t>(tail - oldSize), 0);
+        if (!writeFileRange(inode, oldSize, zeros.data(), tail - oldSize)) return false;
+    }
+    inode.file_size = static_cast<int32_t>(size);
+    return true;
+}
+
+// -------------------------------------------------
+// replaceFileData
+// -------------------------------------------------
+// Stores new content for an existing file. The data
+// goes into freshly allocated blocks first; the old
+// blocks are released only once it is written.
+// Updates the inode's pointers and size (the caller
+// writes the inode). A compressed file's chunks are
+// laid out one by one as they are coded. Content
+// that fits the inode is stored there instead, even
+// if the file had blocks: they are released once
+// the inode holds the new bytes.
+// -------------------------------------------------
+bool FileSystem::replaceFileData(Inode& inode, const char* data, int size) {
+    if (!inode.is_directory && size <= INLINE_CAPACITY) {
+        const Inode old = inode;
+        storeInline(inode, data, size);
+        if (!isInline(old)) releaseFileBlocks(old);
+        return true;
+    }
+
+    if (isCompressed(inode)) {
+        Inode updated{};
+        updated.id = inode.id;
+        updated.references = inode.references;
+        updated.flags = inode.flags & ~INODE_INLINE;
+        if (!writeCompressed(updated, 0, data, size)) {
+            releaseFileBlocks(updated);
+            return false;
+        }
+        releaseFileBlocks(inode);
+        inode = updated;
+        return true;
+    }
+
+    Inode updated = inode;
+    updated.flags &= ~INODE_INLINE;     // allocateFileBlocks sets every pointer field
+    std::vector<int> dataBlocks;
+    if (!allocateFileBlocks(updated, BlockMap::blocksFor(size, layout_.clusterSize), dataBlocks)) {
+        return false;
+    }
+
+    if (!writeNewBlocks(updated, 0, dataBlocks, data, size)) {
+        releaseFileBlocks(updated);
+        return false;
+    }
+
+    releaseFileBlocks(inode);
+    updated.file_size = size;
+    inode = updated;
+    return true;
+}
 
 // -------------------------------------------------
-// format
+// readFileRange
 // -------------------------------------------------
-// Performs formatting of the virtual filesystem file.
-// Initializes all core structures including:
-//   - Superblock
-//   - Inode and data bitmaps
-//   - Inode table
-//   - Root directory (inode 0)
+// Reads `length` bytes of content starting at byte
+// `offset` (the caller keeps the range inside the
+// file). Only the blocks covering the range are
+// resolved and read (compressed files: the chunks
+// covering it are decoded, inline ones copied).
 // -------------------------------------------------
-bool FileSystem::format(int sizeMB) {
-    std::ofstream file(filename_, std::ios::binary | std::ios::trunc);
-    if (!file.is_open()) {
-        std::cerr << "[core] Error: cannot create filesystem file.\n";
-        return false;
+bool FileSystem::readFileRange(const Inode& inode, long long offset, char* buffer, long long length) {
+    if (length <= 0) return true;
+    if (isInline(inode)) {
+        if (offset < 0 || offset + length > INLINE_CAPACITY) return false;
+        std::memcpy(buffer, inlineData(inode) + offset, static_cast<size_t>(length));
+        return true;
     }
+    if (isCompressed(inode)) return readCompressed(inode, offset, buffer, length);
+    const int clusterSize = layout_.clusterSize;
+    const int first = static_cast<int>(offset / clusterSize);
+    const int last = static_cast<int>((offset + length - 1) / clusterSize);
+    std::vector<int> blocks = fileBlocks(inode, first, last - first + 1);
 
-    // --- STEP 1: Calculate total size ---
-    long long totalBytes = static_cast<long long>(sizeMB) * BYTES_PER_MB;
+    // Block-aligned ranges go straight into the buffer
+    const long long skip = offset % clusterSize;
+    if (skip == 0) return readBlocks(blocks, buffer, length);
 
-    // --- STEP 2: Prepare superblock ---
-    Superblock sb{};
-    std::memset(&sb, 0, sizeof(Superblock));
+    std::vector<char> span(blocks.size() * clusterSize);
+    if (!readBlocks(blocks, span.data(), skip + length)) return false;
+    std::memcpy(buffer, span.data() + skip, static_cast<size_t>(length));
+    return true;
+}
 
-    std::strcpy(sb.signature, "klepac");
-    std::strcpy(sb.volume_descriptor, "ZOS_FS_2025");
-    sb.disk_size = static_cast<int32_t>(totalBytes);
-    sb.cluster_size = CLUSTER_SIZE;
-    sb.cluster_count = sb.disk_size / sb.cluster_size;
-
-    // Layout offsets
-    sb.bitmapi_start_address = sizeof(Superblock);
-    sb.bitmap_start_address = sb.bitmapi_start_address + INODE_BITMAP_SIZE;
-    sb.inode_start_address = sb.bitmap_start_address + DATA_BITMAP_SIZE;
-    sb.data_start_address = sb.inode_start_address + INODE_TABLE_SIZE;
-
-    // --- STEP 3: Write superblock ---
-    file.write(reinterpret_cast<char*>(&sb), sizeof(Superblock));
-
-    // --- STEP 4: Initialize bitmaps ---
-    std::vector<char> inodeBitmap(INODE_BITMAP_SIZE, 0);
-    std::vector<char> dataBitmap(DATA_BITMAP_SIZE, 0);
-    inodeBitmap[0] = 0x01; // bit 0 set for root inode (binary: 00000001)
-    dataBitmap[0] = 0x01;  // bit 0 set for root data block (binary: 00000001)
-    file.write(inodeBitmap.data(), INODE_BITMAP_SIZE);
-    file.write(dataBitmap.data(), DATA_BITMAP_SIZE);
-
-    // --- STEP 5: Initialize inode table ---
-    const int inodeCount = INODE_TABLE_SIZE / sizeof(Inode);
-    std::vector<Inode> inodeTable(inodeCount);
-    std::memset(inodeTable.data(), 0, inodeTable.size() * sizeof(Inode));
-
-    // Root inode setup
-    inodeTable[0].id = 0;
-    inodeTable[0].is_directory = true;
-    inodeTable[0].references = 1;
-    inodeTable[0].file_size = 2 * sizeof(DirectoryItem);  // "." and ".."
-    inodeTable[0].direct1 = 0;
-
-    file.write(reinterpret_cast<char*>(inodeTable.data()), INODE_TABLE_SIZE);
-
-    // --- STEP 6: Create root directory block ---
-    DirectoryItem dot{};
-    dot.inode = 0;
-    std::strcpy(dot.item_name, ".");
-
-    DirectoryItem dotdot{};
-    dotdot.inode = 0;  // root's parent is itself
-    std::strcpy(dotdot.item_name, "..");
-
-    file.seekp(sb.data_start_address);
-    file.write(reinterpret_cast<char*>(&dot), sizeof(DirectoryItem));
-    file.write(reinterpret_cast<char*>(&dotdot), sizeof(DirectoryItem));
-    file.close();
+// -------------------------------------------------
+// writeFileRange
+// -------------------------------------------------
+// Writes `length` bytes at byte `offset`, touching
+// only the blocks the range covers. Holes the data
+// lands in (and blocks past the old end) get new
+// blocks; a gap left between the old end and
+// `offset` stays a hole that reads as zeros. Blocks
+// shared with a reflink copy are replaced by a
+// private copy first, partly covered blocks are
+// read, patched and written back. Compressed files
+// are patched chunk by chunk (see writeCompressed).
+// An empty or inline file patched within
+// INLINE_CAPACITY bytes keeps its content in the
+// inode; one growing past that moves it to a block
+// first. Updates the inode's pointers and size (the
+// caller writes the inode).
+// -------------------------------------------------
+bool FileSystem::writeFileRange(Inode& inode, long long offset, const char* data, long long length) {
+    if (length <= 0) return true;
+    if (fitsInline(inode, offset + length)) {
+        if (!isInline(inode)) storeInline(inode, nullptr, 0);
+        std::memcpy(inlineData(inode) + offset, data, static_cast<size_t>(length));
+        inode.file_size = static_cast<int32_t>(std::max<long long>(inode.file_size, offset + length));
+        return true;
+    }
+    if (isInline(inode) && !spillInline(inode)) return false;
+    if (isCompressed(inode)) return writeCompressed(inode, offset, data, length);
+    const int clusterSize = layout_.clusterSize;
+    const long long oldSize = inode.file_size;
+    const long long end = offset + length;
+    if (end > std::numeric_limits<int32_t>::max() || BlockMap::blocksFor(end, clusterSize) > blockMap_.maxBlocks()) {
+        fail(Status::NoSpace);
+        return false;
+    }
 
-    // --- STEP 7: Expand file to full size ---
-    try {
-        std::filesystem::resize_file(filename_, totalBytes);
+    // Bytes [from, offset) past the old end read as zeros: the
+    // old last block gets them written, later blocks stay holes
+    const long long from = std::min(offset, oldSize);
+    const int first = static_cast<int>(from / clusterSize);
+    const int last = static_cast<int>((end - 1) / clusterSize);
+    std::vector<int> blocks = fileBlocks(inode, first, last - first + 1);
+    if (std::find(blocks.begin(), blocks.end(), BlockMap::UNREADABLE) != blocks.end()) return false;
+
+    // --- STEP 1: Map blocks for the holes the data lands in ---
+    std::vector<size_t> filled;        // Indexes into blocks
+    for (size_t i = static_cast<size_t>(offset / clusterSize - first); i < blocks.size(); ++i) {
+        if (blocks[i] == 0) filled.push_back(i);
     }
-    catch (const std::filesystem::filesystem_error& e) {
-        std::cerr << "[core] Error expanding file: " << e.what() << "\n";
+    std::vector<int> fresh;
+    std::vector<char> isFresh(blocks.size(), 0);
+    size_t mapped = 0;
+    auto dropFresh = [&]() {    // Undo STEP 1 on failure (a mapped hole may share a block by now)
+        for (size_t j = 0; j < mapped; ++j) setFileBlock(inode, first + static_cast<int>(filled[j]), 0);
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        for (size_t j = 0; j < fresh.size(); ++j) {
+            const int blockId = j < mapped ? blocks[filled[j]] : fresh[j];
+            if (!blockShares_.dropShare(blockId)) releaseDataBlock(blockId);
+        }
+        dataBitmap_.flush(device_);
+        blockShares_.flush(device_);
         return false;
+    };
+    if (!filled.empty()) {
+        fresh = allocateContiguousBlocks(static_cast<int>(filled.size()), inode.id);
+        if (fresh.empty()) return false;
+        for (; mapped < filled.size(); ++mapped) {
+            if (!setFileBlock(inode, first + static_cast<int>(filled[mapped]), fresh[mapped])) {
+                fail(Status::NoSpace);
+                return dropFresh();
+            }
+            blocks[filled[mapped]] = fresh[mapped];
+            isFresh[filled[mapped]] = 1;
+        }
+    }
+
+    // --- STEP 2: Copy on write for shared blocks ---
+    // A private block is written in place: it leaves the dedup index
+    // in the same step, so dedup can't start sharing it meanwhile
+    std::vector<char> block(clusterSize);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        bool shared = false;
+        {
+            std::lock_guard<std::mutex> alloc(allocLock_);
+            shared = blocks[i] > 0 && blockShares_.shares(blocks[i]) > 0;
+            if (!shared && blocks[i] > 0) dedup_.forget(blocks[i]);
+        }
+        if (!shared) continue;
+
+        int copy = allocateFreeDataBlock(inode.id);
+        if (copy == -1) return dropFresh();
+        readBlock(blocks[i], block.data(), block.size());
+        writeFileData(copy, block.data(), block.size());
+        setFileBlock(inode, first + static_cast<int>(i), copy);
+        {
+            std::lock_guard<std::mutex> alloc(allocLock_);
+            blockShares_.dropShare(blocks[i]);
+            blockShares_.flush(device_);
+        }
+        blocks[i] = copy;
     }
 
-    std::cout << "OK\n";
+    // --- STEP 3: Write: whole blocks in runs, the rest patched ---
+    // (runs of freshly mapped blocks may be deduplicated)
+    size_t runStart = 0;
+    auto flushRun = [&](size_t runEnd) {
+        for (size_t i = runStart; i < runEnd; ) {
+            size_t end = i + 1;
+            while (end < runEnd && isFresh[end] == isFresh[i]) ++end;
+            const long long runOffset = static_cast<long long>(first + i) * clusterSize;
+            const char* runData = data + (runOffset - offset);
+            const long long runLength = static_cast<long long>(end - i) * clusterSize;
+            const bool ok = isFresh[i] ? writeNewBlocks(inode, first, blocks, runData, runLength, i)
+                                       : writeBlocks(blocks, runData, runLength, i);
+            if (!ok) return false;
+            i = end;
+        }
+        return true;
+    };
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const long long blockStart = static_cast<long long>(first + i) * clusterSize;
+        const long long blockEnd = blockStart + clusterSize;
+        if (blockStart >= offset && blockEnd <= end) continue;   // Whole block of new data
+
+        if (!flushRun(i)) return dropFresh();
+        runStart = i + 1;
+        if (blocks[i] == 0) continue;                            // Hole in the gap
+
+        // Keep the old bytes around the patched part
+        if (isFresh[i]) {
+            std::fill(block.begin(), block.end(), 0);
+        } else if (blockStart < from || std::min(blockEnd, oldSize) > std::min(blockEnd, end)) {
+            if (!readBlock(blocks[i], block.data(), block.size())) return dropFresh();
+        }
+        const long long zeroStart = std::max(blockStart, from);
+        const long long zeroEnd = std::min(blockEnd, offset);
+        if (zeroStart < zeroEnd) {
+            std::memset(block.data() + (zeroStart - blockStart), 0, static_cast<size_t>(zeroEnd - zeroStart));
+        }
+        const long long dataStart = std::max(blockStart, offset);
+        const long long dataEnd = std::min(blockEnd, end);
+        if (dataStart < dataEnd) {
+            std::memcpy(block.data() + (dataStart - blockStart), data + (dataStart - offset),
+                        static_cast<size_t>(dataEnd - dataStart));
+        }
+        if (!writeFileData(blocks[i], block.data(), block.size())) return dropFresh();
+    }
+    if (!flushRun(blocks.size())) return dropFresh();
 
-    currentDirInode_ = 0; // reset working directory
+    inode.file_size = static_cast<int32_t>(std::max(oldSize, end));
     return true;
 }
 
 // -------------------------------------------------
-// readSuperblock
+// cloneFileBlocks
 // -------------------------------------------------
-// Loads and returns the current superblock from disk.
-// Returns empty superblock if file doesn't exist (will be created by format).
-// --------------------------------------------------
-Superblock FileSystem::readSuperblock() {
-    std::ifstream file(filename_, std::ios::binary);
-    Superblock sb{};
-    if (!file.is_open()) {
-        // File doesn't exist yet - will be created by format() command
-        return sb;
+// Makes `clone` reference the same data blocks as
+// `source` (reflink). Each shared block gains one
+// owner in the share-count table; pointer blocks
+// are duplicated, since they belong to one inode.
+// No data is copied: writes always go to freshly
+// allocated blocks (see replaceFileData), so the
+// other file keeps the old content.
+// Returns false (nothing changed) if the blocks
+// can't be shared; the caller then copies.
+// -------------------------------------------------
+bool FileSystem::cloneFileBlocks(const Inode& source, Inode& clone) {
+    {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        if (!ensureShareTable()) return false;
     }
-    file.read(reinterpret_cast<char*>(&sb), sizeof(Superblock));
-    file.close();
-    return sb;
+
+    std::vector<int> blocks = fileBlocks(source);
+    if (std::find(blocks.begin(), blocks.end(), BlockMap::UNREADABLE) != blocks.end()) return false;
+
+    // --- Duplicate the pointer blocks ---
+    std::vector<int> sourcePointers = blockMap_.pointerBlocks(device_, source);
+    std::vector<int> clonePointers;
+    if (!sourcePointers.empty()) {
+        clonePointers = allocateFreeDataBlocks(static_cast<int>(sourcePointers.size()), clone.id);
+        if (clonePointers.empty()) return false;
+    }
+    std::unordered_map<int, int> copyOf;
+    for (size_t i = 0; i < sourcePointers.size(); ++i) copyOf[sourcePointers[i]] = clonePointers[i];
+
+    std::vector<int32_t> ptrs(blockMap_.pointersPerBlock());
+    for (size_t i = 0; i < sourcePointers.size(); ++i) {
+        readBlock(sourcePointers[i], ptrs.data(), ptrs.size() * sizeof(int32_t));
+        // A double-indirect root points at the clone's own copies
+        if (blockMap_.doubleIndirect() && sourcePointers[i] == source.indirect2) {
+            for (int32_t& ptr : ptrs) {
+                if (ptr > 0) ptr = copyOf[ptr];
+            }
+        }
+        writeBlock(clonePointers[i], ptrs.data(), ptrs.size() * sizeof(int32_t));
+    }
+
+    // --- Share the data blocks (all or none) ---
+    {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        bool shareable = std::all_of(blocks.begin(), blocks.end(),
+            [this](int blockId) { return blockId <= 0 || blockShares_.canShare(blockId); });
+        if (!shareable) {
+            for (int blockId : clonePointers) releaseDataBlock(blockId);
+            dataBitmap_.flush(device_);
+            return false;
+        }
+        for (int blockId : blocks) {
+            if (blockId > 0) blockShares_.addShare(blockId);
+        }
+        blockShares_.flush(device_);
+    }
+
+    int32_t* direct[BlockMap::DIRECT_COUNT] = { &clone.direct1, &clone.direct2, &clone.direct3,
+                                                &clone.direct4, &clone.direct5 };
+    for (int i = 0; i < BlockMap::DIRECT_COUNT; ++i) {
+        *direct[i] = i < static_cast<int>(blocks.size()) ? blocks[i] : 0;
+    }
+    clone.indirect1 = source.indirect1 > 0 ? copyOf[source.indirect1] : 0;
+    clone.indirect2 = source.indirect2 > 0 ? copyOf[source.indirect2] : 0;
+    clone.file_size = source.file_size;
+    clone.flags = source.flags;     // The shared blocks keep their coding
+    return true;
 }
 
 // -------------------------------------------------
-// readInode
+// Inline files
 // -------------------------------------------------
-// Reads a specific inode structure by its ID from disk.
+// A file whose content fits INLINE_CAPACITY bytes
+// keeps it where its block pointers would be, so
+// reading it costs only the inode. Files turn
+// inline when their whole content is replaced by a
+// small one (write, incp), empty files also on
+// their first small pwrite; directories never do.
 // -------------------------------------------------
-Inode FileSystem::readInode(int inodeId) {
-    Superblock sb = readSuperblock();
-    Inode inode{};
-    
-    // If superblock is empty, file hasn't been formatted yet
-    if (sb.disk_size == 0) {
-        return inode;
+bool FileSystem::fitsInline(const Inode& inode, long long end) {
+    return !inode.is_directory && end <= INLINE_CAPACITY && (isInline(inode) || inode.file_size == 0);
+}
+
+char* FileSystem::inlineData(Inode& inode) {
+    return reinterpret_cast<char*>(&inode) + offsetof(Inode, direct1);
+}
+
+const char* FileSystem::inlineData(const Inode& inode) {
+    return reinterpret_cast<const char*>(&inode) + offsetof(Inode, direct1);
+}
+
+// Overwrites the block pointers: the caller releases the old blocks, if any
+void FileSystem::storeInline(Inode& inode, const char* data, long long size) {
+    std::memset(inlineData(inode), 0, INLINE_CAPACITY);
+    if (size > 0) std::memcpy(inlineData(inode), data, static_cast<size_t>(size));
+    inode.flags |= INODE_INLINE;
+    inode.file_size = static_cast<int32_t>(size);
+}
+
+// -------------------------------------------------
+// spillInline
+// -------------------------------------------------
+// Turns an inline file back into a block-mapped one
+// of the same content, before it grows past
+// INLINE_CAPACITY: the bytes go into one new block
+// (compressed files: chunk 0 is coded). The inode
+// is unchanged if that fails.
+// -------------------------------------------------
+bool FileSystem::spillInline(Inode& inode) {
+    Inode spilled = inode;
+    spilled.flags &= ~INODE_INLINE;
+    spilled.file_size = 0;
+    std::memset(inlineData(spilled), 0, INLINE_CAPACITY);
+    if (inode.file_size > 0) {
+        if (isCompressed(spilled)) {
+            if (!writeCompressed(spilled, 0, inlineData(inode), inode.file_size)) return false;
+        } else {
+            std::vector<char> block(layout_.clusterSize, 0);
+            std::memcpy(block.data(), inlineData(inode), static_cast<size_t>(inode.file_size));
+            const int blockId = allocateFreeDataBlock(inode.id);
+            if (blockId == -1) return false;
+            if (!writeFileData(blockId, block.data(), block.size())) {
+                freeDataBlock(blockId);
+                return false;
+            }
+            spilled.direct1 = blockId;
+            spilled.file_size = inode.file_size;
+        }
     }
-    
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "[core] Error: cannot open filesystem file (readInode).\n";
-        return inode;
+    inode = spilled;
+    return true;
+}
+
+// -------------------------------------------------
+// setFileBlock
+// -------------------------------------------------
+// Points logical block `logical` of the inode at
+// `physical` (0 unmaps it). Pointer blocks, the
+// double-indirect one and its children too, are
+// allocated on first use and freed again once their
+// last entry is unmapped. The caller writes the
+// inode.
+// -------------------------------------------------
+bool FileSystem::setFileBlock(Inode& inode, int logical, int physical) {
+    if (logical < 0 || logical >= blockMap_.maxBlocks()) return false;
+
+    int32_t* direct[BlockMap::DIRECT_COUNT] = { &inode.direct1, &inode.direct2, &inode.direct3,
+                                                &inode.direct4, &inode.direct5 };
+    if (logical < BlockMap::DIRECT_COUNT) {
+        *direct[logical] = physical;
+        return true;
     }
 
-    long long offset = static_cast<long long>(sb.inode_start_address)
-        + static_cast<long long>(inodeId) * sizeof(Inode);
-    file.seekg(offset);
-    file.read(reinterpret_cast<char*>(&inode), sizeof(Inode));
-    file.close();
-    return inode;
+    const int perBlock = blockMap_.pointersPerBlock();
+    int slot = logical - BlockMap::DIRECT_COUNT;
+    if (slot < perBlock) return setPointer(inode.id, inode.indirect1, slot, physical);
+    slot -= perBlock;
+    if (!blockMap_.doubleIndirect()) return setPointer(inode.id, inode.indirect2, slot, physical);
+
+    // --- Double-indirect: the child first, then its slot in the root ---
+    const int childSlot = slot / perBlock;
+    const int32_t oldChild = inode.indirect2 > 0 ? blockMap_.pointerAt(device_, inode.indirect2, childSlot) : 0;
+    int32_t child = oldChild;
+    if (!setPointer(inode.id, child, slot % perBlock, physical)) return false;
+    if (child == oldChild) return true;
+
+    if (!setPointer(inode.id, inode.indirect2, childSlot, child)) {
+        if (oldChild == 0) freeDataBlock(child);
+        return false;
+    }
+    return true;
 }
 
 // -------------------------------------------------
-// writeInode
+// setPointer
 // -------------------------------------------------
-// Writes an inode structure to its correct position on disk.
+// Stores `value` in entry `slot` of the pointer block
+// `pointerBlock`, allocating the block (near the
+// inode's group) if it is 0. A block left with no
+// entries is freed and `pointerBlock` reset to 0.
 // -------------------------------------------------
-void FileSystem::writeInode(int inodeId, const Inode& inode) {
-    Superblock sb = readSuperblock();
-    std::fstream file(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "[core] Error: cannot open filesystem file (writeInode).\n";
-        return;
+bool FileSystem::setPointer(int inodeId, int32_t& pointerBlock, int slot, int32_t value) {
+    const int perBlock = blockMap_.pointersPerBlock();
+    if (pointerBlock <= 0) {
+        if (value == 0) return true;
+        int blockId = allocateFreeDataBlock(inodeId);
+        if (blockId == -1) return false;
+
+        std::vector<int32_t> zeros(perBlock, 0);
+        writeBlock(blockId, zeros.data(), zeros.size() * sizeof(int32_t));
+        pointerBlock = blockId;
     }
 
-    long long offset = static_cast<long long>(sb.inode_start_address)
-        + static_cast<long long>(inodeId) * sizeof(Inode);
-    file.seekp(offset);
-    file.write(reinterpret_cast<const char*>(&inode), sizeof(Inode));
-    file.close();
+    if (!writeBlock(pointerBlock, &value, sizeof(value), static_cast<long long>(slot) * sizeof(int32_t))) {
+        return false;
+    }
+
+    // Release the pointer block once it maps nothing
+    if (value == 0) {
+        std::vector<int32_t> ptrs(perBlock, 0);
+        readBlock(pointerBlock, ptrs.data(), ptrs.size() * sizeof(int32_t));
+        if (std::all_of(ptrs.begin(), ptrs.end(), [](int32_t p) { return p <= 0; })) {
+            freeDataBlock(pointerBlock);
+            blockMap_.invalidate(pointerBlock);
+            pointerBlock = 0;
+        }
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// Block groups
+// -------------------------------------------------
+// Group g owns data blocks [g * blocksPerGroup,
+// groupEndBlock(g)) and inodes [g * inodesPerGroup,
+// (g + 1) * inodesPerGroup); the last group also
+// takes the blocks of a tail too short for a group
+// of its own. Images without groups (format 1 and
+// 2, or a single group) allocate from the whole
+// bitmaps as before.
+// -------------------------------------------------
+int FileSystem::blockGroupOf(int inodeId) const {
+    if (layout_.groupCount <= 1 || inodeId < 0 || inodeId >= layout_.inodeCount) return -1;
+    return inodeId / layout_.inodesPerGroup;
+}
+
+int FileSystem::groupEndBlock(int group) const {
+    return group == layout_.groupCount - 1 ? layout_.dataBits : (group + 1) * layout_.blocksPerGroup;
+}
+
+// Group with the most free data blocks; ties go to
+// the first one at or after `from`
+int FileSystem::roomiestGroup(int from) {
+    int best = from;
+    int bestFree = -1;
+    for (int i = 0; i < layout_.groupCount; ++i) {
+        int group = (from + i) % layout_.groupCount;
+        int first = groupFirstBlock(group);
+        int last = groupEndBlock(group);
+        int freeBlocks = (last - first) - dataBitmap_.usedIn(first, last);
+        if (freeBlocks > bestFree) {
+            best = group;
+            bestFree = freeBlocks;
+        }
+    }
+    return best;
 }
 
 // -------------------------------------------------
@@ -180,36 +1815,39 @@ void FileSystem::writeInode(int inodeId, const Inode& inode) {
 // -------------------------------------------------
 // Searches for a free inode in the bitmap,
 // marks it as used, and returns its ID.
+// On grouped images a file goes to the group of its
+// parent directory; a new directory goes to the
+// group with the most free blocks, so directories
+// spread out and their files follow them. A full
+// group passes on to the next one.
 // -------------------------------------------------
-int FileSystem::allocateFreeInode() {
-    Superblock sb = readSuperblock();
-    std::fstream file(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "[alloc] Error: cannot open filesystem file (inode allocation).\n";
+int FileSystem::allocateFreeInode(int parentInodeId, bool directory) {
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    if (inodeBitmap_.capacity() == 0) {
+        err() << "[alloc] Error: inode bitmap not loaded.\n";
         return -1;
     }
 
-    std::vector<char> bitmap(INODE_BITMAP_SIZE);
-    file.seekg(sb.bitmapi_start_address);
-    file.read(bitmap.data(), INODE_BITMAP_SIZE);
-
-    // Search for free bit in bitmap
-    for (int byteIdx = 0; byteIdx < INODE_BITMAP_SIZE; ++byteIdx) {
-        for (int bitIdx = 0; bitIdx < 8; ++bitIdx) {
-            if ((bitmap[byteIdx] & (1 << bitIdx)) == 0) {
-                // Found free bit
-                bitmap[byteIdx] |= (1 << bitIdx);
-                file.seekp(sb.bitmapi_start_address);
-                file.write(bitmap.data(), INODE_BITMAP_SIZE);
-                file.close();
-                return byteIdx * 8 + bitIdx;
-            }
+    int inodeId = -1;
+    int home = blockGroupOf(parentInodeId);
+    if (home == -1) {
+        // A format 1 bitmap has more bits than the table has inodes
+        inodeId = inodeBitmap_.allocate(layout_.inodeCount);
+    } else {
+        if (directory) home = roomiestGroup(home);
+        for (int i = 0; i < layout_.groupCount && inodeId == -1; ++i) {
+            int group = (home + i) % layout_.groupCount;
+            inodeId = inodeBitmap_.allocateIn(group * layout_.inodesPerGroup,
+                                              (group + 1) * layout_.inodesPerGroup);
         }
     }
+    if (inodeId == -1) {
+        fail(Status::NoSpace);
+        return -1;
+    }
 
-    std::cerr << "NO SPACE\n";
-    file.close();
-    return -1;
+    inodeBitmap_.flush(device_);
+    return inodeId;
 }
 
 // -------------------------------------------------
@@ -217,81 +1855,213 @@ int FileSystem::allocateFreeInode() {
 // -------------------------------------------------
 // Searches for a free data block in the bitmap,
 // marks it as used, and returns its block ID.
+// On grouped images the block comes from the group
+// of `nearInode` if it has room, else from the
+// groups after it.
 // -------------------------------------------------
-int FileSystem::allocateFreeDataBlock() {
-    Superblock sb = readSuperblock();
-    std::fstream file(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "[alloc] Error: cannot open filesystem file (data block allocation).\n";
+int FileSystem::allocateFreeDataBlock(int nearInode) {
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    if (dataBitmap_.capacity() == 0) {
+        err() << "[alloc] Error: data bitmap not loaded.\n";
         return -1;
     }
 
-    std::vector<char> bitmap(DATA_BITMAP_SIZE);
-    file.seekg(sb.bitmap_start_address);
-    file.read(bitmap.data(), DATA_BITMAP_SIZE);
-
-    // Search for free bit in bitmap
-    for (int byteIdx = 0; byteIdx < DATA_BITMAP_SIZE; ++byteIdx) {
-        for (int bitIdx = 0; bitIdx < 8; ++bitIdx) {
-            if ((bitmap[byteIdx] & (1 << bitIdx)) == 0) {
-                // Found free bit
-                bitmap[byteIdx] |= (1 << bitIdx);
-                file.seekp(sb.bitmap_start_address);
-                file.write(bitmap.data(), DATA_BITMAP_SIZE);
-                file.close();
-                return byteIdx * 8 + bitIdx;
-            }
-        }
+    int blockId = allocateBlockNear(nearInode);
+    if (blockId == -1) {
+        fail(Status::NoSpace);
+        return -1;
     }
+    VFS_COUNT(BlocksAllocated);
 
-    std::cerr << "NO SPACE\n";
-    file.close();
+    dataBitmap_.flush(device_);
+    return blockId;
+}
+
+// One block from the group of `nearInode` onwards (allocLock_ held)
+int FileSystem::allocateBlockNear(int nearInode) {
+    int home = blockGroupOf(nearInode);
+    if (home == -1) return dataBitmap_.allocate();
+
+    for (int i = 0; i < layout_.groupCount; ++i) {
+        int group = (home + i) % layout_.groupCount;
+        int blockId = dataBitmap_.allocateIn(groupFirstBlock(group), groupEndBlock(group));
+        if (blockId != -1) return blockId;
+    }
     return -1;
 }
 
-// Allocate multiple data blocks at once to reduce file I/O overhead
-std::vector<int> FileSystem::allocateFreeDataBlocks(int count) {
+// Allocate multiple data blocks at once to reduce file I/O overhead.
+// All-or-nothing: on shortage nothing stays allocated.
+std::vector<int> FileSystem::allocateFreeDataBlocks(int count, int nearInode) {
+    std::lock_guard<std::mutex> alloc(allocLock_);
     std::vector<int> allocated;
-    
-    Superblock sb = readSuperblock();
-    std::fstream file(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "[alloc-batch] Error: cannot open filesystem file.\n";
+    if (dataBitmap_.capacity() == 0) {
+        err() << "[alloc-batch] Error: data bitmap not loaded.\n";
         return allocated;
     }
 
-    std::vector<char> bitmap(DATA_BITMAP_SIZE);
-    file.seekg(sb.bitmap_start_address);
-    file.read(bitmap.data(), DATA_BITMAP_SIZE);
-    
-    // Search for free bits and allocate them
-    int allocatedCount = 0;
-    for (int byteIdx = 0; byteIdx < DATA_BITMAP_SIZE && allocatedCount < count; ++byteIdx) {
-        for (int bitIdx = 0; bitIdx < 8 && allocatedCount < count; ++bitIdx) {
-            if ((bitmap[byteIdx] & (1 << bitIdx)) == 0) {
-                // Found free bit
-                bitmap[byteIdx] |= (1 << bitIdx);
-                allocated.push_back(byteIdx * 8 + bitIdx);
-                allocatedCount++;
-            }
-        }
+    allocated.reserve(count);
+    while (static_cast<int>(allocated.size()) < count) {
+        int blockId = allocateBlockNear(nearInode);
+        if (blockId == -1) break;
+        allocated.push_back(blockId);
     }
-    
-    // Write bitmap back only once
-    if (allocatedCount > 0) {
-        file.seekp(sb.bitmap_start_address);
-        file.write(bitmap.data(), DATA_BITMAP_SIZE);
+
+    if (static_cast<int>(allocated.size()) < count) {
+        for (int blockId : allocated) dataBitmap_.clear(blockId);
+        allocated.clear();
+        fail(Status::NoSpace);
     }
+    VFS_COUNT_N(BlocksAllocated, allocated.size());
 
-    file.close();
+    // Write dirty bitmap pages back only once
+    dataBitmap_.flush(device_);
+    return allocated;
+}
+
+// -------------------------------------------------
+// allocateContiguousBlocks
+// -------------------------------------------------
+// Allocates `count` data blocks, preferring a single
+// contiguous run (best-fit over the free extents).
+// Falls back to the fewest possible runs when the
+// space is fragmented. Blocks are returned in order.
+// On grouped images a run inside the group of
+// `nearInode` is tried first.
+// All-or-nothing, like allocateFreeDataBlocks.
+// -------------------------------------------------
+std::vector<int> FileSystem::allocateContiguousBlocks(int count, int nearInode) {
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    std::vector<int> allocated;
+    if (dataBitmap_.capacity() == 0) {
+        err() << "[alloc-extent] Error: data bitmap not loaded.\n";
+        return allocated;
+    }
 
-    if (allocatedCount < count) {
-        std::cerr << "NO SPACE\n";
+    std::vector<Bitmap::Extent> runs;
+    int home = blockGroupOf(nearInode);
+    Bitmap::Extent local;
+    if (home != -1 && dataBitmap_.allocateRunIn(count, groupFirstBlock(home), groupEndBlock(home), local)) {
+        runs.push_back(local);
+    } else {
+        runs = dataBitmap_.allocateRun(count);
     }
+    if (runs.empty()) {
+        fail(Status::NoSpace);
+        return allocated;
+    }
+
+    allocated.reserve(count);
+    for (const Bitmap::Extent& run : runs) {
+        for (int i = 0; i < run.length; ++i) allocated.push_back(run.start + i);
+    }
+    VFS_COUNT_N(BlocksAllocated, count);
 
+    dataBitmap_.flush(device_);
     return allocated;
 }
 
+// -------------------------------------------------
+// allocateFileBlocks
+// -------------------------------------------------
+// Allocates storage for a file of `blocksNeeded` data
+// blocks and records it in the inode: the data blocks
+// come from allocateContiguousBlocks, the pointer
+// blocks (indirect1/indirect2) are allocated apart so
+// they don't split the data run. Pointer blocks are
+// written here; the caller writes the data.
+// -------------------------------------------------
+bool FileSystem::allocateFileBlocks(Inode& inode, int blocksNeeded, std::vector<int>& dataBlocks) {
+    dataBlocks.clear();
+    if (blocksNeeded <= 0) return true;
+
+    if (blocksNeeded > blockMap_.maxBlocks()) {
+        fail(Status::NoSpace);
+        return false;
+    }
+    const int perBlock = blockMap_.pointersPerBlock();
+    const int pointerBlocksNeeded = blockMap_.pointerBlocksFor(blocksNeeded);
+
+    // --- Data first, so it gets the best-fitting run ---
+    dataBlocks = allocateContiguousBlocks(blocksNeeded, inode.id);
+    if (dataBlocks.empty()) return false;
+
+    std::vector<int> pointerBlocks;
+    if (pointerBlocksNeeded > 0) {
+        pointerBlocks = allocateFreeDataBlocks(pointerBlocksNeeded, inode.id);
+        if (pointerBlocks.empty()) {
+            std::lock_guard<std::mutex> alloc(allocLock_);
+            for (int blockId : dataBlocks) dataBitmap_.clear(blockId);
+            dataBitmap_.flush(device_);
+            dataBlocks.clear();
+            return false;
+        }
+    }
+
+    // --- Direct pointers ---
+    int32_t* direct[BlockMap::DIRECT_COUNT] = { &inode.direct1, &inode.direct2, &inode.direct3,
+                                                &inode.direct4, &inode.direct5 };
+    for (int i = 0; i < BlockMap::DIRECT_COUNT; ++i) {
+        *direct[i] = i < blocksNeeded ? dataBlocks[i] : 0;
+    }
+
+    // --- Indirect pointer blocks ---
+    // pointerBlocks: indirect1, indirect2, then the children of a
+    // double-indirect indirect2 (each maps the next P data blocks)
+    std::vector<int32_t> ptrs(perBlock);
+    auto fillPointers = [&](int blockId, int first) {
+        int last = std::min(blocksNeeded, first + perBlock);
+        std::fill(ptrs.begin(), ptrs.end(), 0);
+        for (int i = first; i < last; ++i) ptrs[i - first] = dataBlocks[i];
+        writeBlock(blockId, ptrs.data(), ptrs.size() * sizeof(int32_t));
+    };
+    inode.indirect1 = 0;
+    inode.indirect2 = 0;
+    if (pointerBlocksNeeded >= 1) {
+        fillPointers(pointerBlocks[0], BlockMap::DIRECT_COUNT);
+        inode.indirect1 = pointerBlocks[0];
+    }
+    if (pointerBlocksNeeded >= 2 && !blockMap_.doubleIndirect()) {
+        fillPointers(pointerBlocks[1], BlockMap::DIRECT_COUNT + perBlock);
+        inode.indirect2 = pointerBlocks[1];
+    } else if (pointerBlocksNeeded >= 2) {
+        for (int child = 0; child + 2 < pointerBlocksNeeded; ++child) {
+            fillPointers(pointerBlocks[child + 2], BlockMap::DIRECT_COUNT + (child + 1) * perBlock);
+        }
+        std::vector<int32_t> root(perBlock, 0);
+        std::copy(pointerBlocks.begin() + 2, pointerBlocks.end(), root.begin());
+        writeBlock(pointerBlocks[1], root.data(), root.size() * sizeof(int32_t));
+        inode.indirect2 = pointerBlocks[1];
+    }
+
+    return true;
+}
+
+// -------------------------------------------------
+// freeInode / freeDataBlock
+// -------------------------------------------------
+// Clears the bitmap bit of an inode or data block.
+// Only the dirty bitmap page is written back.
+// -------------------------------------------------
+void FileSystem::freeInode(int inodeId) {
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    inodeBitmap_.clear(inodeId);
+    inodeBitmap_.flush(device_);
+}
+
+void FileSystem::freeDataBlock(int blockId) {
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    releaseDataBlock(blockId);
+    dataBitmap_.flush(device_);
+}
+
+void FileSystem::releaseDataBlock(int blockId) {
+    VFS_COUNT(BlocksReleased);
+    if (device_.staging()) dataBitmap_.hold(blockId);
+    else dataBitmap_.clear(blockId);
+    dedup_.forget(blockId);
+}
+
 // -------------------------------------------------
 // dataBlockOffset
 // -------------------------------------------------
@@ -299,110 +2069,111 @@ std::vector<int> FileSystem::allocateFreeDataBlocks(int count) {
 // within the virtual filesystem file.
 // --------------------------------------------------
 long long FileSystem::dataBlockOffset(int blockId) {
-    Superblock sb = readSuperblock();
-    return static_cast<long long>(sb.data_start_address)
-        + static_cast<long long>(blockId) * sb.cluster_size;
+    return layout_.dataStart + static_cast<long long>(blockId) * layout_.clusterSize;
 }
 
 // -------------------------------------------------
 // directoryContains
 // -------------------------------------------------
 // Checks if a directory contains an item
-// with the given name.
+// with the given name (through the dentry cache).
 // -------------------------------------------------
 bool FileSystem::directoryContains(int dirInodeId, const std::string& name) {
     Inode dirInode = readInode(dirInodeId);
     if (!dirInode.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
         return false;
     }
 
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "[core] Error: cannot open filesystem file.\n";
-        return false;
-    }
+    return lookup(dirInodeId, name) != -1;
+}
 
-    file.seekg(dataBlockOffset(dirInode.direct1));
+// -------------------------------------------------
+// statFilesystem
+// -------------------------------------------------
+// Overall filesystem statistics such as used/free
+// inodes, data blocks, and directory count.
+// The directories are counted by scanning the inode
+// table only once per mount (unless fsck counted
+// them already); mkdir and rmdir keep the count.
+// IoError on an unformatted image.
+// -------------------------------------------------
+Status FileSystem::statFilesystem(FsStat& result) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+    if (layout_.diskSize == 0) return Status::IoError;
 
-    DirectoryItem item{};
-    int entries = dirInode.file_size / sizeof(DirectoryItem);
+    // --- Count used and free bits (popcount, kept up to date) ---
+    std::unique_lock<std::mutex> alloc(allocLock_);
+    result = FsStat{};
+    result.diskSize = layout_.diskSize;
+    result.clusterSize = layout_.clusterSize;
+    result.usedInodes = inodeBitmap_.used();
+    result.usedBlocks = dataBitmap_.used();
+    result.totalInodes = inodeBitmap_.capacity();
+    result.totalBlocks = dataBitmap_.capacity();
 
-    for (int i = 0; i < entries; ++i) {
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == name) {
-            file.close();
-            return true;
+    // --- Count directories (table must be current on disk) ---
+    if (directoryCount_ < 0) {
+        flushInodes();
+        directoryCount_ = 0;
+        const int sliceCount = layout_.inodesPerGroup;
+        std::vector<Inode> copy;
+        for (int group = 0; group < layout_.groupCount; ++group) {
+            const long long sliceStart = layout_.inodeStart + group * layout_.groupStride;
+            const Inode* inodeTable = device_.view<const Inode>(sliceStart, sliceCount);
+            if (inodeTable == nullptr) {
+                copy.resize(sliceCount);
+                device_.readAt(sliceStart, copy.data(), copy.size() * sizeof(Inode));
+                inodeTable = copy.data();
+            }
+            // Freed inodes keep their old contents: only allocated ones count
+            const int firstId = group * sliceCount;
+            for (int i = 0; i < sliceCount; ++i) {
+                if (inodeTable[i].is_directory && inodeTable[i].id != 0 && inodeBitmap_.test(firstId + i))
+                    directoryCount_++;
+            }
         }
     }
+    result.directories = directoryCount_;
+    alloc.unlock();
 
-    file.close();
-    return false;
+    result.checksums = checksums_.attached();
+    result.dataChecksums = result.checksums && checksums_.coversData();
+    result.badBlocks = result.checksums ? checksums_.mismatches() : 0;
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// statfs
+// stats
 // -------------------------------------------------
-// Prints overall filesystem statistics such as
-// used/free inodes, data blocks, and directory count.
+// Reports what Metrics has counted since the start
+// (or the last reset): counters and the latency
+// of every command, "--json" as one JSON object.
+// "trace on" starts keeping trace events, "dump"
+// writes the ones kept to a host file in the
+// Chrome trace format.
 // -------------------------------------------------
-void FileSystem::statfs() {
-    Superblock sb = readSuperblock();
-
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "[statfs] Error: cannot open filesystem file.\n";
-        return;
+Status FileSystem::stats(const std::string& action, const std::string& arg) {
+    Metrics& metrics = Metrics::instance();
+    if (!Metrics::compiledIn()) {
+        out() << "Metrics not compiled in (built with VFS_NO_METRICS)\n";
+        return Status::Ok;
     }
 
-    // --- Read bitmaps ---
-    std::vector<char> inodeBitmap(INODE_BITMAP_SIZE);
-    std::vector<char> dataBitmap(DATA_BITMAP_SIZE);
-    file.seekg(sb.bitmapi_start_address);
-    file.read(inodeBitmap.data(), INODE_BITMAP_SIZE);
-    file.seekg(sb.bitmap_start_address);
-    file.read(dataBitmap.data(), DATA_BITMAP_SIZE);
-
-    // --- Count used and free bits ---
-    int usedInodes = 0, usedBlocks = 0;
-    for (char byte : inodeBitmap) {
-        for (int i = 0; i < 8; ++i) {
-            if (byte & (1 << i)) usedInodes++;
-        }
+    if (action.empty()) metrics.print(out());
+    else if (action == "--json") metrics.printJson(out());
+    else if (action == "reset") {
+        metrics.reset();
+        return report(Status::Ok);
     }
-    for (char byte : dataBitmap) {
-        for (int i = 0; i < 8; ++i) {
-            if (byte & (1 << i)) usedBlocks++;
-        }
+    else if (action == "trace" && (arg == "on" || arg == "off")) {
+        metrics.setTracing(arg == "on");
+        return report(Status::Ok);
     }
-
-    int totalInodes = INODE_BITMAP_SIZE * 8;
-    int totalBlocks = DATA_BITMAP_SIZE * 8;
-    int freeInodes = totalInodes - usedInodes;
-    int freeBlocks = totalBlocks - usedBlocks;
-
-    // --- Count directories ---
-    int directoryCount = 0;
-    file.seekg(sb.inode_start_address);
-    const int inodeCount = INODE_TABLE_SIZE / sizeof(Inode);
-    for (int i = 0; i < inodeCount; ++i) {
-        Inode inode{};
-        file.read(reinterpret_cast<char*>(&inode), sizeof(Inode));
-        if (inode.is_directory && inode.id != 0)
-            directoryCount++;
+    else if (action == "dump" && !arg.empty()) {
+        return report(metrics.writeTrace(arg) ? Status::Ok : Status::PathNotFound);
     }
-
-    file.close();
-
-    // --- Print results ---
-    std::cout << "\nFilesystem statistics:\n";
-    std::cout << "- Disk size: " << sb.disk_size << " bytes\n";
-    std::cout << "- Cluster size: " << sb.cluster_size << " bytes\n";
-    std::cout << "- Used inodes: " << usedInodes << " / " << totalInodes << "\n";
-    std::cout << "- Free inodes: " << freeInodes << "\n";
-    std::cout << "- Used data blocks: " << usedBlocks << " / " << totalBlocks << "\n";
-    std::cout << "- Free data blocks: " << freeBlocks << "\n";
-    std::cout << "- Directories: " << directoryCount << "\n\n";
+    else return report(Status::InvalidInput);
+    return Status::Ok;
 }
 
 // -------------------------------------------------
@@ -410,13 +2181,14 @@ void FileSystem::statfs() {
 // -------------------------------------------------
 // Executes a batch of commands from a text file
 // located on the host filesystem.
+// With `parallel`, commands that touch unrelated
+// paths run at the same time (see ScriptPlan);
+// scripts that print inode or block numbers still
+// run in order, since those depend on it.
 // -------------------------------------------------
-void FileSystem::load(const std::string& hostFilePath) {
+Status FileSystem::load(const std::string& hostFilePath, bool parallel) {
     std::ifstream script(hostFilePath, std::ios::binary);
-    if (!script.is_open()) {
-        std::cerr << "FILE NOT FOUND\n";
-        return;
-    }
+    if (!script.is_open()) return report(Status::FileNotFound);
 
     // Read entire file and remove UTF-8 BOM if present
     std::vector<char> fileContent((std::istreambuf_iterator<char>(script)),
@@ -432,43 +2204,194 @@ void FileSystem::load(const std::string& hostFilePath) {
         startPos = 3;
     }
 
-    // Process lines
-    std::string content(fileContent.begin() + startPos, fileContent.end());
-    std::istringstream scriptStream(content);
+    // Parse the whole script up front
+    ScriptPlan plan;
+    plan.parse(std::string(fileContent.begin() + startPos, fileContent.end()));
+
+    // One transaction per line, committed as a group:
+    // the log is checkpointed once the script ends
+    setGroupCommit(true);
+
+    if (parallel && !plan.orderSensitive()) {
+        runParallel(plan);
+    } else {
+        for (const ScriptCommand& command : plan.commands()) {
+            beginTransaction();
+            bool more = runScriptCommand(command);
+            commitTransaction();
+            if (!more) break;
+        }
+    }
+
+    setGroupCommit(false);
+    return report(Status::Ok);
+}
+
+// -------------------------------------------------
+// runScriptCommand
+// -------------------------------------------------
+// Dispatches one script line. Returns false for
+// `exit`, which ends the script. Its latency goes
+// into the command's histogram (see Metrics).
+// -------------------------------------------------
+bool FileSystem::runScriptCommand(const ScriptCommand& command) {
+    const std::string& cmd = command.name;
+    const std::string& arg1 = command.arg1;
+    const std::string& arg2 = command.arg2;
+    const std::string& arg3 = command.arg3;
+    Metrics::CommandTimer timer(cmd);
+
+    // --- Basic command parser ---
+    if (cmd == "format") {
+        // Optional cluster size, then optional --data-checksums
+        const bool dataChecksums = arg2 == "--data-checksums" || arg3 == "--data-checksums";
+        const std::string kb = arg2 == "--data-checksums" ? "" : arg2;
+        const long long sizeMB = parseNumber(arg1);
+        const long long clusterKB = kb.empty() ? DEFAULT_CLUSTER_SIZE / 1024 : parseNumber(kb);
+        if (sizeMB <= 0 || sizeMB > std::numeric_limits<int>::max() ||
+            clusterKB <= 0 || clusterKB > std::numeric_limits<int>::max() / 1024) report(Status::InvalidInput);
+        else mkfs(static_cast<int>(sizeMB), static_cast<int>(clusterKB * 1024), dataChecksums);
+    }
+    else if (cmd == "mkdir") mkdir(arg1);
+    else if (cmd == "rmdir") rmdir(arg1);
+    else if (cmd == "ls") ls();
+    else if (cmd == "cd") cd(arg1);
+    else if (cmd == "pwd") pwd();
+    else if (cmd == "touch") touch(arg1);
+    else if (cmd == "write") write(arg1, arg2);
+    else if (cmd == "pread") pread(arg1, parseNumber(arg2), parseNumber(arg3));
+    else if (cmd == "pwrite") pwrite(arg1, parseNumber(arg2), arg3);
+    else if (cmd == "truncate") {
+        if (arg1 == "--extend") truncate(arg2, parseNumber(arg3), true);
+        else truncate(arg1, parseNumber(arg2));
+    }
+    else if (cmd == "cat") cat(arg1);
+    else if (cmd == "rm") rm(arg1);
+    else if (cmd == "cp") { if (arg1 == "--reflink") cp(arg2, arg3, true); else cp(arg1, arg2); }
+    else if (cmd == "mv") mv(arg1, arg2);
+    else if (cmd == "info") info(arg1);
+    else if (cmd == "compress") { if (arg1 == "--off") compress(arg2, false); else compress(arg1); }
+    else if (cmd == "statfs") statfs();
+    else if (cmd == "fsck") fsck(arg1 == "--repair");
+    else if (cmd == "stats") stats(arg1, arg2);
+    else if (cmd == "dedup") dedup(arg1);
+    else if (cmd == "sync") sync();
+    else if (cmd == "defrag") {
+        // A barrier, alone in its transaction: defrag commits each step itself
+        commitTransaction();
+        defrag(arg1 == "--rate" ? parseNumber(arg2) : 0);
+        beginTransaction();
+    }
+    else if (cmd == "incp") incp(arg1, arg2);
+    else if (cmd == "outcp") outcp(arg1, arg2);
+    else if (cmd == "xcp") xcp(arg1, arg2, arg3);
+    else if (cmd == "add") add(arg1, arg2);
+    else if (cmd == "exit") { timer.cancel(); out() << "Terminating script.\n"; return false; }
+    else {
+        timer.cancel();
+        err() << "UNKNOWN COMMAND\n";
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// runParallel
+// -------------------------------------------------
+// Runs the script segment by segment. A barrier
+// (cd, format, ...) runs alone on the calling
+// thread; the commands between two barriers form a
+// dependency graph whose ready commands are run by
+// a work-stealing pool, each in a worker session
+// placed in the current directory. A finished
+// command releases the ones waiting for it. Output
+// is buffered per command and printed in script
+// order once the segment is done.
+// -------------------------------------------------
+void FileSystem::runParallel(const ScriptPlan& plan) {
+    const std::vector<ScriptCommand>& commands = plan.commands();
+    const int workerCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<Session> workers(workerCount);
+    std::vector<char> attached(workerCount, 0);   // Each flag is touched by its worker only
+    WorkPool pool(workerCount);
+
+    auto runInOrder = [this, &commands](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            beginTransaction();
+            bool more = runScriptCommand(commands[i]);
+            commitTransaction();
+            if (!more) return false;
+        }
+        return true;
+    };
+
+    size_t first = 0;
+    while (first < commands.size()) {
+        // --- STEP 1: A barrier runs alone ---
+        if (plan.isBarrier(first)) {
+            if (!runInOrder(first, first + 1)) break;
+            ++first;
+            continue;
+        }
 
-    std::string line;
-    while (std::getline(scriptStream, line)) {
-        // Skip empty lines or comments (#)
-        if (line.empty() || line[0] == '#')
+        // --- STEP 2: Plan the segment against the current directory ---
+        const size_t last = plan.segmentEnd(first);
+        const size_t count = last - first;
+        const int cwdInode = session().cwdInode;
+        std::string cwdPath;
+        bool resolved = false;
+        {
+            std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+            resolved = workingPath(cwdPath);
+        }
+        if (!resolved) {
+            runInOrder(first, last);
+            first = last;
             continue;
+        }
+
+        std::vector<std::vector<size_t>> deps = plan.dependencies(first, last, cwdPath);
+        std::vector<std::vector<size_t>> dependents(count);
+        std::unique_ptr<std::atomic<int>[]> waiting(new std::atomic<int>[count]);
+        for (size_t i = 0; i < count; ++i) {
+            waiting[i] = static_cast<int>(deps[i].size());
+            for (size_t dep : deps[i]) dependents[dep - first].push_back(i);
+        }
+        for (Session& worker : workers) worker.cwdInode = cwdInode;
+
+        // --- STEP 3: Run ready commands; each releases its dependents ---
+        std::vector<std::ostringstream> outs(count), errs(count);
+        std::function<void(size_t, int)> run = [&](size_t i, int worker) {
+            Session& own = workers[worker];
+            if (!attached[worker]) {
+                attachSession(own);
+                own.cwdInode = cwdInode;
+                attached[worker] = 1;
+            }
+            own.out = &outs[i];
+            own.err = &errs[i];
+
+            beginTransaction();
+            runScriptCommand(commands[first + i]);
+            commitTransaction();
+
+            for (size_t next : dependents[i]) {
+                if (--waiting[next] == 0) pool.submit([&run, next](int w) { run(next, w); });
+            }
+        };
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < count; ++i) {
+            if (deps[i].empty()) ready.push_back(i);
+        }
+        for (size_t i : ready) pool.submit([&run, i](int w) { run(i, w); });
+        pool.wait();
 
-        std::istringstream iss(line);
-        std::string cmd, arg1, arg2, arg3;
-        iss >> cmd >> arg1 >> arg2 >> arg3;
-
-        // --- Basic command parser ---
-        if (cmd == "format") { int n = std::stoi(arg1); format(n); }
-        else if (cmd == "mkdir") mkdir(arg1);
-        else if (cmd == "rmdir") rmdir(arg1);
-        else if (cmd == "ls") ls();
-        else if (cmd == "cd") cd(arg1);
-        else if (cmd == "pwd") pwd();
-        else if (cmd == "touch") touch(arg1);
-        else if (cmd == "write") write(arg1, arg2);
-        else if (cmd == "cat") cat(arg1);
-        else if (cmd == "rm") rm(arg1);
-        else if (cmd == "cp") cp(arg1, arg2);
-        else if (cmd == "mv") mv(arg1, arg2);
-        else if (cmd == "info") info(arg1);
-        else if (cmd == "statfs") statfs();
-        else if (cmd == "incp") incp(arg1, arg2);
-        else if (cmd == "outcp") outcp(arg1, arg2);
-        else if (cmd == "xcp") xcp(arg1, arg2, arg3);
-        else if (cmd == "add") add(arg1, arg2);
-        else if (cmd == "exit") { std::cout << "Terminating script.\n"; break; }
-        else std::cerr << "UNKNOWN COMMAND\n";
+        // --- STEP 4: Output in script order ---
+        for (size_t i = 0; i < count; ++i) {
+            out() << outs[i].str();
+            err() << errs[i].str();
+        }
+        first = last;
     }
 
-    script.close();
-    std::cout << "OK\n";
-}
\ No newline at end of file
+    for (Session& worker : workers) detachSession(worker);
+}
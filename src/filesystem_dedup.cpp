@@ -0,0 +1,257 @@
+// =============================================
+// filesystem_dedup.cpp
+// ---------------------------------------------
+// Content-addressed block deduplication
+// Handles:
+//   - The dedup command (switch on/off, report)
+//   - Creating and loading the on-disk index
+//   - Sharing new data blocks with identical ones
+// =============================================
+
+#include "filesystem.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "xxhash.h"
+
+// -------------------------------------------------
+// dedup
+// -------------------------------------------------
+// "on" creates the index on first use and marks the
+// image: from then on every whole block of new file
+// data is looked up before it is written. "off"
+// stops that (blocks already shared stay shared,
+// the index keeps tracking freed blocks). Without a
+// mode the state is reported. The setting is kept
+// in the superblock, so it survives a remount.
+// -------------------------------------------------
+Status FileSystem::dedup(const std::string& mode) {
+    std::unique_lock<std::shared_mutex> fsGuard(fsLock_);
+    if (layout_.diskSize == 0) {
+        err() << "[dedup] Error: cannot read bitmaps.\n";
+        return Status::IoError;
+    }
+
+    // --- Report ---
+    if (mode.empty()) {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        out() << "Dedup: " << (dedupActive() ? "on" : "off");
+        if (dedup_.attached()) {
+            out() << ", " << dedup_.size() << " block(s) indexed, "
+                  << blockShares_.totalShares() << " block(s) saved by sharing";
+        }
+        out() << "\n";
+        return Status::Ok;
+    }
+    if (mode != "on" && mode != "off") return report(Status::InvalidInput);
+
+    // --- Switch ---
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    if (mode == "on" && (!ensureShareTable() || !ensureDedupIndex())) return report(Status::NoSpace);
+    if (mode == "on") sb_.dedup_flags |= DEDUP_ACTIVE;
+    else sb_.dedup_flags &= ~DEDUP_ACTIVE;
+    if (dedup_.attached()) writeSuperblock();
+    return report(Status::Ok);
+}
+
+// -------------------------------------------------
+// loadDedupIndex
+// -------------------------------------------------
+// Loads the index if the image has one (created by
+// the first `dedup on`).
+// -------------------------------------------------
+void FileSystem::loadDedupIndex() {
+    dedup_.reset();
+    if (layout_.diskSize == 0 || sb_.dedup_start_block <= 0) {
+        return;
+    }
+
+    const int buckets = DedupIndex::bucketsFor(layout_.dataBits);
+    if (static_cast<long long>(buckets) * DEDUP_BUCKET_SLOTS * static_cast<long long>(sizeof(DedupEntry)) >
+            static_cast<long long>(sb_.dedup_block_count) * layout_.clusterSize ||
+        !dedup_.load(device_, dataBlockOffset(sb_.dedup_start_block), buckets)) {
+        err() << "[core] Error: cannot read dedup index.\n";
+    }
+}
+
+// -------------------------------------------------
+// ensureDedupIndex
+// -------------------------------------------------
+// Creates the index the first time dedup is turned
+// on, in a contiguous run of data blocks recorded in
+// the superblock (its size follows from the data
+// area, see DedupIndex::bucketsFor). Returns false
+// if the image has no room for the superblock
+// extension (older format) or no space.
+// -------------------------------------------------
+bool FileSystem::ensureDedupIndex() {
+    if (dedup_.attached()) return true;
+    const size_t fieldsEnd = offsetof(Superblock, dedup_flags) + sizeof(int32_t);
+    if (sb_.bitmapi_start_address < static_cast<int32_t>(fieldsEnd)) return false;
+
+    const long long bytes = static_cast<long long>(DedupIndex::bucketsFor(layout_.dataBits)) *
+                            DEDUP_BUCKET_SLOTS * static_cast<long long>(sizeof(DedupEntry));
+    const int blockCount = BlockMap::blocksFor(bytes, layout_.clusterSize);
+
+    std::vector<Bitmap::Extent> run = dataBitmap_.allocateRun(blockCount);
+    if (run.size() != 1) {
+        for (const Bitmap::Extent& part : run) {
+            for (int i = 0; i < part.length; ++i) dataBitmap_.clear(part.start + i);
+        }
+        dataBitmap_.flush(device_);
+        return false;
+    }
+    dataBitmap_.flush(device_);
+
+    std::vector<char> zeros(static_cast<size_t>(blockCount) * layout_.clusterSize, 0);
+    writeBlock(run[0].start, zeros.data(), zeros.size());
+
+    sb_.dedup_start_block = run[0].start;
+    sb_.dedup_block_count = blockCount;
+    writeSuperblock();
+    loadDedupIndex();
+    return dedup_.attached();
+}
+
+// -------------------------------------------------
+// writeNewBlocks
+// -------------------------------------------------
+// writeBlocks for data going into blocks that were
+// just allocated and mapped at logical blocks
+// logicalBase + i (i indexing `blocks`). With dedup
+// on, each whole block of the data is hashed first:
+//   - one matching an indexed block is remapped to
+//     it (one more owner in the share-count table)
+//     and its fresh block handed back unwritten
+//   - one repeating an earlier block of the same
+//     call shares that block
+//   - the rest is written and indexed
+// The bytes of an indexed block are compared before
+// it is shared; the block is pinned by its extra
+// owner meanwhile, so it can't be freed or rewritten
+// in place under the comparison. `blocks` receives
+// the blocks finally mapped. Nothing is remapped if
+// the write fails.
+// -------------------------------------------------
+bool FileSystem::writeNewBlocks(Inode& inode, int logicalBase, std::vector<int>& blocks, const char* data,
+                                long long length, size_t first) {
+    VFS_TRACE("writeNewBlocks");
+    const int clusterSize = layout_.clusterSize;
+    const size_t available = first < blocks.size() ? blocks.size() - first : 0;
+    const size_t whole = std::min(available, static_cast<size_t>(length / clusterSize));
+    if (!dedupActive() || whole == 0) return writeBlocks(blocks, data, length, first);
+    auto blockData = [&](size_t i) { return data + i * clusterSize; };
+
+    // --- STEP 1: Hash the whole blocks, spot repeats within the data ---
+    std::vector<uint64_t> hashes(whole);
+    std::vector<long long> repeatOf(whole, -1);     // Earlier block of this call with the same bytes
+    std::unordered_map<uint64_t, size_t> firstWith;
+    for (size_t i = 0; i < whole; ++i) {
+        hashes[i] = xxh64(blockData(i), static_cast<size_t>(clusterSize));
+        auto seen = firstWith.emplace(hashes[i], i);
+        if (!seen.second && std::memcmp(blockData(i), blockData(seen.first->second), clusterSize) == 0) {
+            repeatOf[i] = static_cast<long long>(seen.first->second);
+        }
+    }
+
+    // --- STEP 2: Pin the indexed candidates ---
+    std::vector<int> target(whole, 0);              // Block to share instead of writing
+    std::vector<int> pinned;
+    {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        for (size_t i = 0; i < whole; ++i) {
+            if (repeatOf[i] >= 0) continue;
+            const int candidate = dedup_.find(hashes[i]);
+            if (candidate <= 0 || candidate == blocks[first + i] || !dataBitmap_.test(candidate) ||
+                !blockShares_.canShare(candidate)) continue;
+            blockShares_.addShare(candidate);
+            target[i] = candidate;
+            pinned.push_back(candidate);
+        }
+    }
+    auto unpin = [&](int blockId) {                 // allocLock_ held
+        if (!blockShares_.dropShare(blockId)) releaseDataBlock(blockId);
+    };
+
+    // --- STEP 3: Confirm the candidates byte for byte ---
+    std::vector<char> stored(pinned.size() * clusterSize);
+    const bool read = pinned.empty() || readBlocks(pinned, stored.data(), static_cast<long long>(stored.size()));
+    {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        size_t next = 0;
+        for (size_t i = 0; i < whole; ++i) {
+            if (target[i] == 0) continue;
+            if (!read || std::memcmp(stored.data() + next * clusterSize, blockData(i), clusterSize) != 0) {
+                unpin(target[i]);
+                target[i] = 0;
+            }
+            ++next;
+        }
+
+        // A repeat shares what its first occurrence ends up with
+        for (size_t i = 0; i < whole; ++i) {
+            if (repeatOf[i] < 0) continue;
+            const size_t original = static_cast<size_t>(repeatOf[i]);
+            const int shared = target[original] != 0 ? target[original] : blocks[first + original];
+            if (!blockShares_.canShare(shared)) continue;
+            blockShares_.addShare(shared);
+            target[i] = shared;
+        }
+        dataBitmap_.flush(device_);
+    }
+
+    // --- STEP 4: Write the blocks without a match, run by run ---
+    const size_t count = std::min(available, static_cast<size_t>(BlockMap::blocksFor(length, clusterSize)));
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; ) {
+        if (i < whole && target[i] != 0) {
+            ++i;
+            continue;
+        }
+        size_t end = i + 1;
+        while (end < count && !(end < whole && target[end] != 0)) ++end;
+        const long long runOffset = static_cast<long long>(i) * clusterSize;
+        const long long runLength = std::min<long long>(length - runOffset, static_cast<long long>(end - i) * clusterSize);
+        ok = writeBlocks(blocks, blockData(i), runLength, first + i);
+        i = end;
+    }
+    if (!ok) {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        for (size_t i = 0; i < whole; ++i) {
+            if (target[i] != 0) unpin(target[i]);
+        }
+        dataBitmap_.flush(device_);
+        blockShares_.flush(device_);
+        return false;
+    }
+
+    // --- STEP 5: Remap the matches (a failed remap writes the block instead) ---
+    std::vector<int> unused;
+    for (size_t i = 0; i < whole; ++i) {
+        if (target[i] == 0) continue;
+        const int logical = logicalBase + static_cast<int>(first + i);
+        if (setFileBlock(inode, logical, target[i])) {
+            unused.push_back(blocks[first + i]);
+            blocks[first + i] = target[i];
+            continue;
+        }
+        failure(Status::Ok);    // No pointer block for the remap: recovered by the write below
+        {
+            std::lock_guard<std::mutex> alloc(allocLock_);
+            unpin(target[i]);
+        }
+        target[i] = 0;
+        if (!writeBlocks(blocks, blockData(i), clusterSize, first + i)) ok = false;
+    }
+
+    // --- STEP 6: Hand back the unused blocks, index the written ones ---
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    for (int blockId : unused) dataBitmap_.clear(blockId);     // Never written: nothing to protect
+    for (size_t i = 0; i < whole; ++i) {
+        if (ok && target[i] == 0) dedup_.insert(hashes[i], blocks[first + i]);
+    }
+    dataBitmap_.flush(device_);
+    blockShares_.flush(device_);
+    return ok;
+}
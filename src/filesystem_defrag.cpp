@@ -0,0 +1,297 @@
+// =============================================
+// filesystem_defrag.cpp
+// ---------------------------------------------
+// Online defragmentation (defrag)
+// Handles:
+//   - Scoring how fragmented files and directories are
+//   - Moving a file's data into one contiguous run
+//   - Moving directory blocks, compacting hash indexes
+//   - Pacing the work with a rate limit
+// =============================================
+
+#include "filesystem.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Contiguous runs among the mapped entries of a block list (0 =
+// unmapped, skipped over). `firstMapped`: entry 0 is a real
+// block even if it is 0 - a directory's first block, block 0 for
+// the root. `mapped` receives the number of mapped entries.
+long long countRuns(const std::vector<int>& blocks, bool firstMapped, long long& mapped) {
+    long long runs = 0;
+    long long previous = -2;
+    mapped = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i] == 0 && !(firstMapped && i == 0)) continue;
+        if (blocks[i] != previous + 1) ++runs;
+        previous = blocks[i];
+        ++mapped;
+    }
+    return runs;
+}
+
+long long countRuns(const std::vector<int>& blocks) {
+    long long mapped = 0;
+    return countRuns(blocks, false, mapped);
+}
+
+} // namespace
+
+double FileSystem::Fragmentation::score() const {
+    if (blocks <= items) return 0.0;
+    return 100.0 * static_cast<double>(extents - items) / static_cast<double>(blocks - items);
+}
+
+// -------------------------------------------------
+// defrag
+// -------------------------------------------------
+// Scores the image, then walks the inode table and
+// relocates every fragmented item: a file whose data
+// forms several runs is copied into one free run
+// (with new pointer blocks), a directory's blocks
+// are moved together and a hash index with spare
+// bucket blocks is rebuilt (or dropped).
+// Each item is one step: its own transaction and
+// locks, so other sessions keep working in between
+// and a crash loses at most the step in progress.
+// With a rate limit the loop sleeps after a step
+// until the data moved so far fits the budget.
+// Items without a free run big enough, sparse files
+// and reflinked files are left where they are.
+// -------------------------------------------------
+Status FileSystem::defrag(long long rateKBps) {
+    if (layout_.diskSize == 0) {
+        err() << "[defrag] Error: cannot read bitmaps.\n";
+        return Status::IoError;
+    }
+    if (rateKBps < 0) return report(Status::InvalidInput);
+
+    auto printScore = [this](const char* when, const Fragmentation& f) {
+        out() << "Fragmentation " << when << ": " << std::fixed << std::setprecision(1) << f.score()
+              << "% (" << f.extents << " extents, " << f.items << " items, " << f.blocks << " blocks)\n";
+        out() << std::defaultfloat;
+    };
+
+    // --- STEP 1: Score before ---
+    printScore("before", measureFragmentation());
+
+    // --- STEP 2: One item per step ---
+    const auto started = std::chrono::steady_clock::now();
+    const long long clusterSize = layout_.clusterSize;
+    long long movedItems = 0, movedBlocks = 0;
+    for (int inodeId = 0; inodeId < layout_.inodeCount; ++inodeId) {
+        if (!isLive(inodeId)) continue;
+
+        long long moved = 0;
+        beginTransaction();
+        const bool changed = defragStep(inodeId, moved);
+        commitTransaction();
+        if (!changed) continue;
+
+        ++movedItems;
+        movedBlocks += moved;
+
+        // --- Rate limit: average at most rateKBps since the start ---
+        if (rateKBps > 0 && moved > 0) {
+            const double seconds = static_cast<double>(movedBlocks * clusterSize) / (rateKBps * 1024.0);
+            std::this_thread::sleep_until(started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                        std::chrono::duration<double>(seconds)));
+        }
+    }
+
+    // --- STEP 3: Score after ---
+    out() << "Relocated " << movedItems << " items (" << movedBlocks << " blocks)\n";
+    printScore("after", measureFragmentation());
+    return report(Status::Ok);
+}
+
+// -------------------------------------------------
+// measureFragmentation
+// -------------------------------------------------
+// Counts the runs the data blocks of every file and
+// directory form, each one read under its shared
+// lock. Holes and pointer blocks don't count.
+// -------------------------------------------------
+FileSystem::Fragmentation FileSystem::measureFragmentation() {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+    Fragmentation result;
+    for (int inodeId = 0; inodeId < layout_.inodeCount; ++inodeId) {
+        if (!isLive(inodeId)) continue;
+        InodeLocks::Guard lock = locks_.shared(inodeId);
+        if (!isLive(inodeId)) continue;
+
+        Inode inode = readInode(inodeId);
+        long long mapped = 0;
+        const long long runs = countRuns(fileBlocks(inode), inode.is_directory, mapped);
+        if (runs == 0) continue;
+        result.items++;
+        result.blocks += mapped;
+        result.extents += runs;
+    }
+    return result;
+}
+
+// -------------------------------------------------
+// defragStep
+// -------------------------------------------------
+// Relocates one item under its exclusive lock.
+// Returns true if anything changed; `movedBlocks`
+// receives the data blocks copied.
+// -------------------------------------------------
+bool FileSystem::defragStep(int inodeId, long long& movedBlocks) {
+    VFS_TRACE("defragStep");
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+    if (inodeId >= layout_.inodeCount) return false;
+
+    InodeLocks::Guard lock = locks_.exclusive(inodeId);
+    if (!isLive(inodeId)) return false;
+
+    Inode inode = readInode(inodeId);
+    const bool changed = inode.is_directory ? defragDirectory(inodeId, inode, movedBlocks)
+                                            : defragFile(inodeId, inode, movedBlocks);
+    failure(Status::Ok);    // An item there was no room for just stays where it is
+    return changed;
+}
+
+// -------------------------------------------------
+// defragFile
+// -------------------------------------------------
+// Copies a fragmented file into one free run, the
+// way replaceFileData lays out new content: data
+// and pointer blocks come from allocateFileBlocks,
+// the old blocks are released once the copy is
+// written. The copy is streamed in chunks.
+// -------------------------------------------------
+bool FileSystem::defragFile(int inodeId, Inode& file, long long& movedBlocks) {
+    // --- STEP 1: Worth moving? ---
+    const std::vector<int> blocks = fileBlocks(file);
+    const int count = static_cast<int>(blocks.size());
+    if (countRuns(blocks) <= 1) return false;
+    if (std::find(blocks.begin(), blocks.end(), 0) != blocks.end()) return false;   // Sparse
+    {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        if (blockShares_.attached() &&
+            std::any_of(blocks.begin(), blocks.end(), [this](int b) { return blockShares_.shares(b) > 0; })) {
+            return false;                                                            // Reflinked
+        }
+        const int pointerBlocks = blockMap_.pointerBlocksFor(count);
+        if (dataBitmap_.longestRun() < count ||
+            dataBitmap_.capacity() - dataBitmap_.used() < count + pointerBlocks) {
+            return false;                                                            // No single run free
+        }
+    }
+
+    // --- STEP 2: New layout ---
+    Inode moved = file;
+    std::vector<int> target;
+    if (!allocateFileBlocks(moved, count, target)) return false;
+    if (countRuns(target) > 1) {
+        releaseFileBlocks(moved);
+        return false;
+    }
+
+    // --- STEP 3: Copy the data, chunk by chunk ---
+    const bool copied = streamBlocks(blocks, file.file_size, [&](size_t first, const char* data, long long length) {
+        return writeBlocks(target, data, length, first);
+    });
+    if (!copied) {
+        releaseFileBlocks(moved);
+        err() << "PATH NOT FOUND\n";
+        return false;
+    }
+
+    // --- STEP 4: Switch over, free the old blocks ---
+    releaseFileBlocks(file);
+    file = moved;
+    writeInode(inodeId, file);
+    movedBlocks += count;
+    return true;
+}
+
+// -------------------------------------------------
+// defragDirectory
+// -------------------------------------------------
+// Moves the blocks of a directory into one free run
+// (entries are already packed: removing one moves
+// the last entry into its place). The root keeps
+// its first block, block 0. Then the hash index:
+// dropped if the directory fits one block again,
+// rebuilt if it holds more bucket blocks than its
+// slots need.
+// -------------------------------------------------
+bool FileSystem::defragDirectory(int inodeId, Inode& dir, long long& movedBlocks) {
+    bool changed = false;
+    const long long clusterSize = layout_.clusterSize;
+
+    // --- STEP 1: Directory blocks into one run ---
+    const std::vector<int> blocks = fileBlocks(dir);
+    const int first = dir.direct1 == 0 ? 1 : 0;
+    const std::vector<int> movable(blocks.begin() + std::min<size_t>(first, blocks.size()), blocks.end());
+    const int count = static_cast<int>(movable.size());
+
+    bool fits = false;
+    if (countRuns(movable) > 1) {
+        std::lock_guard<std::mutex> alloc(allocLock_);
+        fits = dataBitmap_.longestRun() >= count;
+    }
+    if (fits) {
+        std::vector<int> target = allocateContiguousBlocks(count, inodeId);
+        std::vector<char> data(static_cast<size_t>(count * clusterSize));
+        bool copied = !target.empty() && readBlocks(movable, data.data(), count * clusterSize);
+        for (int i = 0; copied && i < count; ++i) {
+            copied = writeBlock(target[i], data.data() + i * clusterSize, static_cast<size_t>(clusterSize));
+        }
+
+        if (copied) {
+            for (int i = 0; i < count; ++i) setFileBlock(dir, first + i, target[i]);
+            std::lock_guard<std::mutex> alloc(allocLock_);
+            for (int blockId : movable) releaseDataBlock(blockId);
+            dataBitmap_.flush(device_);
+            movedBlocks += count;
+            changed = true;
+        } else if (!target.empty()) {
+            std::lock_guard<std::mutex> alloc(allocLock_);
+            for (int blockId : target) releaseDataBlock(blockId);
+            dataBitmap_.flush(device_);
+        }
+    }
+
+    // --- STEP 2: Compact the hash index ---
+    if (dir.indirect2 > 0) {
+        const int entries = dir.file_size / static_cast<int>(sizeof(DirectoryItem));
+        bool rebuild = entries > entriesPerBlock();
+        if (rebuild) {
+            // Bucket blocks in use against the blocks their slots need
+            int32_t heads[DIR_INDEX_BUCKETS] = {};
+            readBlock(dir.indirect2, heads, sizeof(heads));
+            long long held = 0, needed = 0;
+            for (int32_t bucketBlock : heads) {
+                long long slots = 0;
+                while (bucketBlock > 0) {
+                    DirIndexBucket bucket{};
+                    if (!readBlock(bucketBlock, &bucket, sizeof(bucket))) break;
+                    slots += std::min(bucket.count, DIR_INDEX_SLOTS);
+                    ++held;
+                    bucketBlock = bucket.next;
+                }
+                needed += (slots + DIR_INDEX_SLOTS - 1) / DIR_INDEX_SLOTS;
+            }
+            if (held <= needed) rebuild = false;
+        }
+
+        if (entries <= entriesPerBlock() || rebuild) {
+            freeDirIndex(dir);
+            dir.indirect2 = 0;
+            if (rebuild) buildDirIndex(dir);
+            changed = true;
+        }
+    }
+
+    if (changed) writeInode(inodeId, dir);
+    return changed;
+}
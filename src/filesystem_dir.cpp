@@ -3,63 +3,52 @@
 // ---------------------------------------------
 // Directory-level operations
 // Handles:
-//   - Creating and removing directories (mkdir, rmdir)
-//   - Listing and navigating directories (ls, cd, pwd)
+//   - Creating and removing directories (makeDirectory, removeDirectory)
+//   - Listing and navigating directories (listDirectory, changeDirectory,
+//     currentDirectory)
 //   - Resolving parent/child relationships (getParentInodeId, findNameInParent)
+//   - Directory entry storage and the hashed name index
 // =============================================
 
 #define _CRT_SECURE_NO_WARNINGS
 #include "filesystem.h"
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <algorithm>
 
 // -------------------------------------------------
-// mkdir
+// makeDirectory
 // -------------------------------------------------
-// Creates a new subdirectory in the current working directory.
+// Creates a new directory (path relative to the current
+// working directory, or absolute).
 // Allocates inode and data block, initializes "." and "..",
 // and links the new directory to its parent.
 // -------------------------------------------------
-void FileSystem::mkdir(const std::string& name) {
-    const int parentInodeId = currentDirInode_; // current working directory
+Status FileSystem::makeDirectory(const std::string& path) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
-    // --- STEP 1: Validate input name ---
-    if (name.empty()) {
-        std::cerr << "INVALID NAME\n";
-        return;
-    }
-
-    if (name.size() > MAX_NAME_LENGTH) {
-        std::cerr << "INVALID NAME\n";
-        return;
-    }
-
-    if (name.find('/') != std::string::npos) {
-        std::cerr << "INVALID NAME\n";
-        return;
-    }
-
-    // --- STEP 2: Check if directory already exists ---
-    if (directoryContains(parentInodeId, name)) {
-        std::cerr << "EXIST\n";
-        return;
-    }
+    // --- STEP 1: Resolve parent and validate the new name ---
+    std::string name;
+    const int parentInodeId = resolveParent(path, name);
+    if (parentInodeId == -1) return Status::PathNotFound;
+    if (!isValidName(name)) return Status::InvalidName;
 
-    // --- STEP 3: Load parent inode ---
+    // --- STEP 2: Lock the parent and load its inode ---
+    InodeLocks::Guard lock = locks_.exclusive(parentInodeId);
     Inode parentInode = readInode(parentInodeId);
-    if (!parentInode.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    if (!isLive(parentInodeId) || !parentInode.is_directory) return Status::PathNotFound;
+
+    // --- STEP 3: Check if directory already exists ---
+    if (directoryContains(parentInodeId, name)) return Status::Exists;
 
     // --- STEP 4: Allocate new inode and data block ---
-    int newInodeId = allocateFreeInode();
-    int newBlockId = allocateFreeDataBlock();
-    if (newInodeId == -1 || newBlockId == -1) {
-        std::cerr << "NO SPACE\n";
-        return;
+    int newInodeId = allocateFreeInode(parentInodeId, true);
+    if (newInodeId == -1) return failure(Status::NoSpace);
+    int newBlockId = allocateFreeDataBlock(newInodeId);
+    if (newBlockId == -1) {
+        freeInode(newInodeId);
+        return failure(Status::NoSpace);
     }
 
     // --- STEP 5: Initialize inode for new directory ---
@@ -67,6 +56,7 @@ void FileSystem::mkdir(const std::string& name) {
     newInode.id = newInodeId;
     newInode.is_directory = true;
     newInode.references = 1; // one reference from parent
+    newInode.flags = parentInode.flags & INODE_COMPRESSED;
     newInode.file_size = 2 * sizeof(DirectoryItem); // entries: "." and ".."
     newInode.direct1 = newBlockId;
 
@@ -81,185 +71,83 @@ void FileSystem::mkdir(const std::string& name) {
     dotdot.inode = parentInodeId;
     std::strcpy(dotdot.item_name, "..");
 
-    std::fstream dirFile(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!dirFile.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
+    DirectoryItem initial[2] = { dot, dotdot };
+    if (!writeBlock(newBlockId, initial, sizeof(initial))) {
+        freeDataBlock(newBlockId);
+        freeInode(newInodeId);
+        return Status::IoError;
     }
 
-    dirFile.seekp(dataBlockOffset(newBlockId));
-    dirFile.write(reinterpret_cast<char*>(&dot), sizeof(DirectoryItem));
-    dirFile.write(reinterpret_cast<char*>(&dotdot), sizeof(DirectoryItem));
-    dirFile.close();
-
     // --- STEP 7: Add entry to parent directory ---
     DirectoryItem newEntry{};
     newEntry.inode = newInodeId;
     std::strncpy(newEntry.item_name, name.c_str(), MAX_NAME_LENGTH);
     newEntry.item_name[MAX_NAME_LENGTH] = '\0';
 
-    std::fstream parentFile(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!parentFile.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
+    if (!addDirEntry(parentInodeId, parentInode, newEntry)) {
+        freeDataBlock(newBlockId);
+        freeInode(newInodeId);
+        return failure(Status::IoError);
     }
 
-    long long offset = dataBlockOffset(parentInode.direct1) + parentInode.file_size;
-    parentFile.seekp(offset);
-    parentFile.write(reinterpret_cast<char*>(&newEntry), sizeof(DirectoryItem));
-    parentFile.close();
-
-    parentInode.file_size += sizeof(DirectoryItem);
-    writeInode(parentInodeId, parentInode);
-
-    std::cout << "OK\n";
+    noteDirectory(1);
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// ls
+// listDirectory
 // -------------------------------------------------
-// Lists contents of the current or specified directory.
-// Displays files and subdirectories with '/' suffix.
+// Lists the entries of the current or specified
+// directory, "." and ".." included, in the order
+// they are stored.
 // -------------------------------------------------
-void FileSystem::ls(const std::string& name) {
-    int targetInodeId = currentDirInode_;  // current directory
+Status FileSystem::listDirectory(const std::string& path, std::vector<DirEntry>& entries) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+    int targetInodeId = session().cwdInode;  // current directory
 
     // --- STEP 1: Resolve target directory ---
-    if (!name.empty()) {
-        Inode current = readInode(currentDirInode_);
-        std::ifstream file(filename_, std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "PATH NOT FOUND\n";
-            return;
-        }
-
-        file.seekg(dataBlockOffset(current.direct1));
-
-        DirectoryItem item{};
-        int entries = current.file_size / sizeof(DirectoryItem);
-        bool found = false;
-
-        for (int i = 0; i < entries; ++i) {
-            file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-            if (std::string(item.item_name) == name) {
-                targetInodeId = item.inode;
-                found = true;
-                break;
-            }
-        }
-        file.close();
-
-        if (!found) {
-            std::cerr << "FILE NOT FOUND\n";
-            return;
-        }
+    if (!path.empty()) {
+        targetInodeId = resolvePath(path);
+        if (targetInodeId == -1) return Status::FileNotFound;
     }
 
-    // --- STEP 2: Load inode and verify directory ---
+    // --- STEP 2: Lock, load inode and verify directory ---
+    InodeLocks::Guard lock = locks_.shared(targetInodeId);
+    if (!isLive(targetInodeId)) return Status::FileNotFound;
     Inode dirInode = readInode(targetInodeId);
-    if (!dirInode.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    // --- STEP 3: Read and print directory entries ---
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    if (!dirInode.is_directory) return Status::PathNotFound;
 
-    file.seekg(dataBlockOffset(dirInode.direct1));
-
-    DirectoryItem item{};
-    int entries = dirInode.file_size / sizeof(DirectoryItem);
-
-    for (int i = 0; i < entries; ++i) {
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        // Show all entries, including "." and ".."
-        Inode entry = readInode(item.inode);
-        if (entry.is_directory)
-            std::cout << "DIR: ";
-        else
-            std::cout << "FILE: ";
-        std::cout << item.item_name << "\n";
+    // --- STEP 3: Read directory entries ---
+    entries.clear();
+    for (const DirectoryItem& item : readDirEntries(dirInode)) {
+        entries.push_back({ item.item_name, item.inode, readInode(item.inode).is_directory != 0 });
     }
-
-    file.close();
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// cd
+// changeDirectory
 // -------------------------------------------------
 // Changes the current working directory.
-// Supports navigation into subdirectories
-// and '..' for moving up one level.
-// -------------------------------------------------
-void FileSystem::cd(const std::string& name) {
-    // --- STEP 1: Handle "cd .." ---
-    if (name == "..") {
-        Inode current = readInode(currentDirInode_);
-
-        std::ifstream file(filename_, std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "PATH NOT FOUND\n";
-            return;
-        }
-
-        // Skip "." entry, read ".."
-        file.seekg(dataBlockOffset(current.direct1) + sizeof(DirectoryItem));
-        DirectoryItem parent{};
-        file.read(reinterpret_cast<char*>(&parent), sizeof(DirectoryItem));
-        file.close();
-
-        currentDirInode_ = parent.inode;
-        std::cout << "OK\n";
-        return;
-    }
-
-    // --- STEP 2: Load current inode ---
-    Inode current = readInode(currentDirInode_);
-    if (!current.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    // --- STEP 3: Search for target ---
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    file.seekg(dataBlockOffset(current.direct1));
-
-    DirectoryItem item{};
-    int entries = current.file_size / sizeof(DirectoryItem);
-    bool found = false;
-
-    for (int i = 0; i < entries; ++i) {
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == name) {
-            Inode target = readInode(item.inode);
-            if (!target.is_directory) {
-                std::cerr << "PATH NOT FOUND\n";
-                file.close();
-                return;
-            }
-            currentDirInode_ = item.inode;
-            found = true;
-            break;
-        }
-    }
+// Accepts absolute and relative paths; '..' moves
+// up one level.
+// -------------------------------------------------
+Status FileSystem::changeDirectory(const std::string& path) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
-    file.close();
+    // --- STEP 1: Resolve target ---
+    int targetInodeId = resolvePath(path);
+    if (targetInodeId == -1) return Status::PathNotFound;
 
-    if (!found) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 2: Verify it is (still) a directory ---
+    // Holding the lock keeps rmdir from removing it
+    // before it becomes the working directory.
+    InodeLocks::Guard lock = locks_.shared(targetInodeId);
+    Inode target = readInode(targetInodeId);
+    if (!isLive(targetInodeId) || !target.is_directory) return Status::PathNotFound;
+    session().cwdInode = targetInodeId;
 
-    std::cout << "OK\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
@@ -276,16 +164,11 @@ int FileSystem::getParentInodeId(int dirInodeId) {
         return -1;
     }
 
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        return -1;
-    }
-
     // Skip "." and read ".."
-    file.seekg(dataBlockOffset(dirInode.direct1) + sizeof(DirectoryItem));
     DirectoryItem parent{};
-    file.read(reinterpret_cast<char*>(&parent), sizeof(DirectoryItem));
-    file.close();
+    if (!readBlock(dirInode.direct1, &parent, sizeof(DirectoryItem), sizeof(DirectoryItem))) {
+        return -1;
+    }
 
     return parent.inode;
 }
@@ -305,180 +188,560 @@ std::string FileSystem::findNameInParent(int parentInodeId, int childInodeId) {
         return "";
     }
 
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        return "";
-    }
-
-    file.seekg(dataBlockOffset(parent.direct1));
-
-    DirectoryItem item{};
-    int entries = parent.file_size / sizeof(DirectoryItem);
-    std::string result;
-
-    for (int i = 0; i < entries; ++i) {
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
+    for (const DirectoryItem& item : readDirEntries(parent)) {
         if (item.inode == childInodeId &&
             std::strcmp(item.item_name, ".") != 0 &&
             std::strcmp(item.item_name, "..") != 0) {
-            result = item.item_name;
-            break;
+            return item.item_name;
         }
     }
 
-    file.close();
-    return result;
+    return "";
 }
 
 
 // -------------------------------------------------
-// pwd
+// currentDirectory
 // -------------------------------------------------
-// Prints the absolute path of the current working directory.
-// Traverses parent directories upward using ".." links.
+// Absolute path of the current working directory
+// (what the shell prompt shows). IoError if a link
+// on the way up can't be read; `path` then holds
+// the part that was found.
 // -------------------------------------------------
-void FileSystem::pwd() {
-    int currentId = currentDirInode_;
-    std::vector<std::string> pathParts;
+Status FileSystem::currentDirectory(std::string& path) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
+    return workingPath(path) ? Status::Ok : Status::IoError;
+}
 
-    // --- STEP 1: Root special case ---
-    if (currentId == 0) {
-        std::cout << "/\n";
-        return;
-    }
+// -------------------------------------------------
+// workingPath
+// -------------------------------------------------
+// Builds the absolute path of the current working
+// directory. Traverses parent directories upward;
+// each step is answered by the dentry cache, and
+// only a miss reads the ".." entry and the parent's
+// entries. Returns false if a link is missing (the
+// path then holds the part that was found).
+// -------------------------------------------------
+bool FileSystem::workingPath(std::string& path) {
+    int currentId = session().cwdInode;
+    std::vector<std::string> pathParts;
+    bool complete = true;
 
-    // --- STEP 2: Walk upward through parent links ---
+    // --- STEP 1: Walk upward through parent links ---
     while (currentId != 0) {
-        int parentId = getParentInodeId(currentId);
-        if (parentId == -1)
-            break;
+        int parentId = -1;
+        std::string name;
+        if (!dentries_.parentOf(currentId, parentId, name)) {
+            {
+                InodeLocks::Guard lock = locks_.shared(currentId);
+                parentId = getParentInodeId(currentId);
+            }
+            if (parentId == -1) {
+                complete = false;
+                break;
+            }
 
-        std::string name = findNameInParent(parentId, currentId);
-        if (name.empty())
-            break;
+            {
+                InodeLocks::Guard lock = locks_.shared(parentId);
+                name = findNameInParent(parentId, currentId);
+            }
+            if (name.empty()) {
+                complete = false;
+                break;
+            }
+            dentries_.insert(parentId, name, currentId);
+        }
 
         pathParts.push_back(name);
         currentId = parentId;
     }
 
-    // --- STEP 3: Print path ---
-    std::cout << "/";
+    // --- STEP 2: Join the names, root first ---
+    path = "/";
     for (auto it = pathParts.rbegin(); it != pathParts.rend(); ++it) {
-        std::cout << *it;
+        path += *it;
         if (it + 1 != pathParts.rend())
-            std::cout << "/";
+            path += "/";
     }
-    std::cout << "\n";
+    return complete;
 }
 
 // -------------------------------------------------
-// rmdir
+// removeDirectory
 // -------------------------------------------------
-// Removes an empty subdirectory from the current directory.
-// Frees its inode and data block from the bitmaps.
+// Removes an empty directory (path relative to the
+// current directory, or absolute).
+// Frees its inode, data block and name index.
 // -------------------------------------------------
-void FileSystem::rmdir(const std::string& name) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::removeDirectory(const std::string& path) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (name.empty()) {
-        std::cerr << "INVALID NAME\n";
-        return;
+    std::string name;
+    const int parentInodeId = resolveParent(path, name);
+    if (parentInodeId == -1) return Status::PathNotFound;
+    if (name.empty() || name == "." || name == "..") return Status::InvalidName;
+
+    // --- STEP 2: Find the target, then lock parent and target ---
+    int targetInodeId = -1;
+    {
+        InodeLocks::Guard lock = locks_.shared(parentInodeId);
+        targetInodeId = lookup(parentInodeId, name);
     }
+    if (targetInodeId == -1) return Status::FileNotFound;
+    InodeLocks::Guard lock = locks_.acquire({ { parentInodeId, InodeLocks::Mode::Exclusive },
+                                              { targetInodeId, InodeLocks::Mode::Exclusive } });
 
-    // --- STEP 2: Verify parent directory ---
     Inode parent = readInode(parentInodeId);
-    if (!parent.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
+    if (!isLive(parentInodeId) || !parent.is_directory) return Status::PathNotFound;
+
+    // --- STEP 3: Locate target directory entry (it may have changed) ---
+    DirectoryItem item{};
+    int targetIndex = findDirEntry(parent, name, &item);
+    if (targetIndex == -1 || item.inode != targetInodeId) return Status::FileNotFound;
+
+    // --- STEP 4: Verify target is a directory ---
+    Inode target = readInode(targetInodeId);
+    if (!target.is_directory) return Status::FileNotFound;
+
+    // --- STEP 5: Check if directory is empty (and not the one we are in) ---
+    if (target.file_size > static_cast<int32_t>(2 * sizeof(DirectoryItem))) return Status::NotEmpty;
+    if (isWorkingDirectory(targetInodeId)) return Status::InvalidInput;
+
+    // --- STEP 6: Free inode, data block and name index ---
+    // An emptied directory keeps only direct1; the index
+    // (if it ever grew one) is all that is left besides it.
+    freeInode(targetInodeId);
+    freeDirIndex(target);
+    if (target.direct1 > 0) {
+        freeDataBlock(target.direct1);
     }
 
-    // --- STEP 3: Locate target directory entry ---
-    std::fstream file(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
+    // --- STEP 7: Remove entry from parent directory ---
+    removeDirEntry(parentInodeId, parent, targetIndex);
+    dentries_.forgetDirectory(targetInodeId);
+    noteDirectory(-1);
+
+    return Status::Ok;
+}
+
+// -------------------------------------------------
+// Directory entry storage
+// -------------------------------------------------
+// Entries form one array spread over the directory's
+// blocks (64 per block): direct1..direct5, then the
+// indirect1 pointer block. Once a directory outgrows
+// its first block it gets a hash index rooted at
+// indirect2 (see DirIndexBucket), so a name lookup
+// costs one bucket read plus one entry read instead
+// of a scan. Every change made here is mirrored in
+// the dentry cache.
+// -------------------------------------------------
+namespace {
+
+// FNV-1a hash of an entry name
+uint32_t hashName(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (const char* c = name; *c != '\0'; ++c) {
+        hash ^= static_cast<unsigned char>(*c);
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    file.seekg(dataBlockOffset(parent.direct1));
-    DirectoryItem item{};
-    int entries = parent.file_size / sizeof(DirectoryItem);
-    int targetIndex = -1, targetInodeId = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        long long pos = dataBlockOffset(parent.direct1) + i * sizeof(DirectoryItem);
-        file.seekg(pos);
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == name) {
-            targetIndex = i;
-            targetInodeId = item.inode;
-            break;
+// Physical block holding logical directory block `logical`.
+// Logical block 0 is direct1 itself - block 0 for the root.
+int dirBlock(BlockMap& map, BlockDevice& device, const Inode& dir, int logical) {
+    return logical == 0 ? dir.direct1 : map.resolve(device, dir, logical);
+}
+
+} // namespace
+
+bool FileSystem::readDirEntry(const Inode& dir, int index, DirectoryItem& item) {
+    int logical = index / entriesPerBlock();
+    int blockId = dirBlock(blockMap_, device_, dir, logical);
+    if (logical > 0 && blockId == 0) return false;
+    return readBlock(blockId, &item, sizeof(DirectoryItem),
+                     static_cast<long long>(index % entriesPerBlock()) * sizeof(DirectoryItem));
+}
+
+bool FileSystem::writeDirEntry(const Inode& dir, int index, const DirectoryItem& item) {
+    int logical = index / entriesPerBlock();
+    int blockId = dirBlock(blockMap_, device_, dir, logical);
+    if (logical > 0 && blockId == 0) return false;
+    return writeBlock(blockId, &item, sizeof(DirectoryItem),
+                      static_cast<long long>(index % entriesPerBlock()) * sizeof(DirectoryItem));
+}
+
+// -------------------------------------------------
+// findDirEntry
+// -------------------------------------------------
+// Looks up a name in a directory. Returns the entry
+// index (and the entry itself through `item`), or -1
+// if there is no such entry.
+// -------------------------------------------------
+int FileSystem::findDirEntry(const Inode& dir, const std::string& name, DirectoryItem* item) {
+    if (!dir.is_directory || dir.file_size <= 0) return -1;
+    const int entries = dir.file_size / sizeof(DirectoryItem);
+
+    // --- Indexed directory: follow the name's hash bucket ---
+    if (dir.indirect2 > 0) {
+        uint32_t hash = hashName(name.c_str());
+        int bucketBlock = blockMap_.pointerAt(device_, dir.indirect2, hash % DIR_INDEX_BUCKETS);
+
+        while (bucketBlock > 0) {
+            DirIndexBucket bucket{};
+            if (!readBlock(bucketBlock, &bucket, sizeof(bucket))) return -1;
+
+            int used = std::min(bucket.count, DIR_INDEX_SLOTS);
+            for (int i = 0; i < used; ++i) {
+                const DirIndexSlot& slot = bucket.slots[i];
+                DirectoryItem candidate{};
+                if (slot.hash == hash && slot.entry >= 0 && slot.entry < entries &&
+                    readDirEntry(dir, slot.entry, candidate) && name == candidate.item_name) {
+                    if (item != nullptr) *item = candidate;
+                    return slot.entry;
+                }
+            }
+            bucketBlock = bucket.next;
         }
+        return -1;
     }
 
-    if (targetInodeId == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        file.close();
-        return;
+    // --- Single-block directory on a mapped image: scan in place ---
+    if (entries <= entriesPerBlock()) {
+        if (const DirectoryItem* items = device_.view<const DirectoryItem>(dataBlockOffset(dir.direct1), entries)) {
+            for (int i = 0; i < entries; ++i) {
+                if (name == items[i].item_name) {
+                    if (item != nullptr) *item = items[i];
+                    return i;
+                }
+            }
+            return -1;
+        }
     }
 
-    // --- STEP 4: Verify target is a directory ---
-    Inode target = readInode(targetInodeId);
-    if (!target.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        file.close();
-        return;
+    // --- Otherwise: scan all entries ---
+    std::vector<DirectoryItem> items = readDirEntries(dir);
+    for (int i = 0; i < static_cast<int>(items.size()); ++i) {
+        if (name == items[i].item_name) {
+            if (item != nullptr) *item = items[i];
+            return i;
+        }
     }
+    return -1;
+}
 
-    // --- STEP 5: Check if directory is empty ---
-    if (target.file_size > 2 * sizeof(DirectoryItem)) {
-        std::cerr << "NOT EMPTY\n";
-        file.close();
-        return;
+// -------------------------------------------------
+// addDirEntry
+// -------------------------------------------------
+// Appends an entry, allocating a new directory block
+// when the last one is full. Builds the hash index
+// when the directory outgrows its first block, and
+// writes the updated directory inode.
+// -------------------------------------------------
+bool FileSystem::addDirEntry(int dirInodeId, Inode& dir, const DirectoryItem& item) {
+    const int index = dir.file_size / sizeof(DirectoryItem);
+    const int logical = index / entriesPerBlock();
+
+    // --- STEP 1: Grow by one block if needed ---
+    if (index % entriesPerBlock() == 0 && dirBlock(blockMap_, device_, dir, logical) == 0) {
+        if (logical >= maxDirBlocks()) {
+            fail(Status::NoSpace);
+            return false;
+        }
+        int blockId = allocateFreeDataBlock(dirInodeId);
+        if (blockId == -1) {
+            return false;
+        }
+        if (!setFileBlock(dir, logical, blockId)) {
+            freeDataBlock(blockId);
+            fail(Status::NoSpace);
+            return false;
+        }
     }
 
-    // --- STEP 6: Free inode and data block bitmaps ---
-    Superblock sb = readSuperblock();
+    // --- STEP 2: Store the entry ---
+    if (!writeDirEntry(dir, index, item)) {
+        return false;
+    }
+    dir.file_size += sizeof(DirectoryItem);
 
-    std::vector<char> inodeBitmap(INODE_BITMAP_SIZE);
-    file.seekg(sb.bitmapi_start_address);
-    file.read(inodeBitmap.data(), INODE_BITMAP_SIZE);
-    int inodeByteIdx = targetInodeId / 8;
-    int inodeBitIdx = targetInodeId % 8;
-    if (inodeByteIdx < INODE_BITMAP_SIZE) {
-        inodeBitmap[inodeByteIdx] &= ~(1 << inodeBitIdx);
-        file.seekp(sb.bitmapi_start_address);
-        file.write(inodeBitmap.data(), INODE_BITMAP_SIZE);
+    // --- STEP 3: Keep the hash index and dentry cache current ---
+    if (dir.indirect2 > 0) {
+        indexInsert(dir, hashName(item.item_name), index);
     }
+    else if (index + 1 > entriesPerBlock()) {
+        buildDirIndex(dir);
+    }
+    dentries_.insert(dirInodeId, item.item_name, item.inode);
 
-    std::vector<char> dataBitmap(DATA_BITMAP_SIZE);
-    file.seekg(sb.bitmap_start_address);
-    file.read(dataBitmap.data(), DATA_BITMAP_SIZE);
-    if (target.direct1 > 0) {
-        int byteIdx = target.direct1 / 8;
-        int bitIdx = target.direct1 % 8;
-        if (byteIdx < DATA_BITMAP_SIZE) {
-            dataBitmap[byteIdx] &= ~(1 << bitIdx);
-            file.seekp(sb.bitmap_start_address);
-            file.write(dataBitmap.data(), DATA_BITMAP_SIZE);
+    writeInode(dirInodeId, dir);
+    return true;
+}
+
+// -------------------------------------------------
+// removeDirEntry
+// -------------------------------------------------
+// Removes the entry at `index`; the last entry moves
+// into its place. A directory block left empty at
+// the end is freed. Writes the updated inode.
+// -------------------------------------------------
+bool FileSystem::removeDirEntry(int dirInodeId, Inode& dir, int index) {
+    const int entries = dir.file_size / sizeof(DirectoryItem);
+    if (index < 0 || index >= entries) return false;
+    const int last = entries - 1;
+
+    DirectoryItem removed{}, lastItem{};
+    if (!readDirEntry(dir, index, removed) || !readDirEntry(dir, last, lastItem)) {
+        return false;
+    }
+
+    // --- STEP 1: Fill the gap with the last entry ---
+    const bool indexed = dir.indirect2 > 0;
+    if (indexed) {
+        indexUpdate(dir, hashName(removed.item_name), index, -1);
+    }
+    if (index != last) {
+        writeDirEntry(dir, index, lastItem);
+        if (indexed) {
+            indexUpdate(dir, hashName(lastItem.item_name), last, index);
         }
     }
+    dir.file_size -= sizeof(DirectoryItem);
+    dentries_.insert(dirInodeId, removed.item_name, DentryCache::NEGATIVE);
 
-    // --- STEP 7: Remove entry from parent directory ---
-    if (entries > 1 && targetIndex != entries - 1) {
-        DirectoryItem last{};
-        long long lastPos = dataBlockOffset(parent.direct1) + (entries - 1) * sizeof(DirectoryItem);
-        file.seekg(lastPos);
-        file.read(reinterpret_cast<char*>(&last), sizeof(DirectoryItem));
+    // --- STEP 2: Release a block that became empty ---
+    if (last > 0 && last % entriesPerBlock() == 0) {
+        int logical = last / entriesPerBlock();
+        int blockId = dirBlock(blockMap_, device_, dir, logical);
+        setFileBlock(dir, logical, 0);
+        if (blockId > 0) {
+            freeDataBlock(blockId);
+        }
+    }
+
+    writeInode(dirInodeId, dir);
+    return true;
+}
 
-        long long replacePos = dataBlockOffset(parent.direct1) + targetIndex * sizeof(DirectoryItem);
-        file.seekp(replacePos);
-        file.write(reinterpret_cast<char*>(&last), sizeof(DirectoryItem));
+// -------------------------------------------------
+// renameDirEntry
+// -------------------------------------------------
+// Overwrites the entry at `index` (same position,
+// new name) and moves it to its new hash bucket.
+// -------------------------------------------------
+bool FileSystem::renameDirEntry(int dirInodeId, const Inode& dir, int index, const DirectoryItem& item) {
+    DirectoryItem old{};
+    if (!readDirEntry(dir, index, old) || !writeDirEntry(dir, index, item)) {
+        return false;
     }
+    dentries_.insert(dirInodeId, old.item_name, DentryCache::NEGATIVE);
+    dentries_.insert(dirInodeId, item.item_name, item.inode);
+
+    if (dir.indirect2 > 0) {
+        indexUpdate(dir, hashName(old.item_name), index, -1);
+        indexInsert(dir, hashName(item.item_name), index);
+    }
+    return true;
+}
 
-    parent.file_size -= sizeof(DirectoryItem);
-    writeInode(parentInodeId, parent);
-    file.close();
+// -------------------------------------------------
+// buildDirIndex
+// -------------------------------------------------
+// Creates the hash index of a directory and fills it
+// with every existing entry. On failure the directory
+// stays unindexed (lookups fall back to scanning).
+// -------------------------------------------------
+bool FileSystem::buildDirIndex(Inode& dir) {
+    int root = allocateFreeDataBlock(dir.id);
+    if (root == -1) return false;
+
+    int32_t empty[DIR_INDEX_BUCKETS] = {};
+    writeBlock(root, empty, sizeof(empty));
+    dir.indirect2 = root;
+
+    std::vector<DirectoryItem> items = readDirEntries(dir);
+    for (int i = 0; i < static_cast<int>(items.size()); ++i) {
+        if (!indexInsert(dir, hashName(items[i].item_name), i)) {
+            freeDirIndex(dir);
+            dir.indirect2 = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// freeDirIndex
+// -------------------------------------------------
+// Frees the index root and every bucket block.
+// -------------------------------------------------
+void FileSystem::freeDirIndex(const Inode& dir) {
+    if (dir.indirect2 <= 0) return;
+
+    std::vector<int> blocks;
+    int32_t heads[DIR_INDEX_BUCKETS] = {};
+    readBlock(dir.indirect2, heads, sizeof(heads));
+    for (int32_t bucketBlock : heads) {
+        while (bucketBlock > 0) {
+            DirIndexBucket bucket{};
+            readBlock(bucketBlock, &bucket, sizeof(bucket));
+            blocks.push_back(bucketBlock);
+            bucketBlock = bucket.next;
+        }
+    }
+    blocks.push_back(dir.indirect2);
+
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    for (int blockId : blocks) releaseDataBlock(blockId);
+    dataBitmap_.flush(device_);
+    blockMap_.invalidate(dir.indirect2);
+}
+
+// -------------------------------------------------
+// indexInsert
+// -------------------------------------------------
+// Adds a (hash, entry) slot to the name's bucket.
+// When every block of the chain is full, a new
+// block is put at the head of the chain.
+// -------------------------------------------------
+bool FileSystem::indexInsert(const Inode& dir, uint32_t hash, int entry) {
+    const int bucketSlot = static_cast<int>(hash % DIR_INDEX_BUCKETS);
+    const int head = blockMap_.pointerAt(device_, dir.indirect2, bucketSlot);
+
+    for (int bucketBlock = head; bucketBlock > 0; ) {
+        DirIndexBucket bucket{};
+        if (!readBlock(bucketBlock, &bucket, sizeof(bucket))) return false;
+        if (bucket.count < DIR_INDEX_SLOTS) {
+            bucket.slots[bucket.count++] = DirIndexSlot{ hash, entry };
+            return writeBlock(bucketBlock, &bucket, sizeof(bucket));
+        }
+        bucketBlock = bucket.next;
+    }
+
+    int newBlock = allocateFreeDataBlock(dir.id);
+    if (newBlock == -1) return false;
+
+    DirIndexBucket bucket{};
+    bucket.count = 1;
+    bucket.next = head;
+    bucket.slots[0] = DirIndexSlot{ hash, entry };
+    writeBlock(newBlock, &bucket, sizeof(bucket));
+
+    int32_t ptr = newBlock;
+    return writeBlock(dir.indirect2, &ptr, sizeof(ptr), static_cast<long long>(bucketSlot) * sizeof(int32_t));
+}
+
+// -------------------------------------------------
+// indexUpdate
+// -------------------------------------------------
+// Finds the slot (hash, entry) and points it at
+// `newEntry`, or removes it when newEntry is -1.
+// -------------------------------------------------
+bool FileSystem::indexUpdate(const Inode& dir, uint32_t hash, int entry, int newEntry) {
+    int bucketBlock = blockMap_.pointerAt(device_, dir.indirect2, hash % DIR_INDEX_BUCKETS);
+
+    while (bucketBlock > 0) {
+        DirIndexBucket bucket{};
+        if (!readBlock(bucketBlock, &bucket, sizeof(bucket))) return false;
+
+        int used = std::min(bucket.count, DIR_INDEX_SLOTS);
+        for (int i = 0; i < used; ++i) {
+            if (bucket.slots[i].hash != hash || bucket.slots[i].entry != entry) continue;
+
+            if (newEntry == -1) {
+                bucket.slots[i] = bucket.slots[used - 1];
+                bucket.count = used - 1;
+            } else {
+                bucket.slots[i].entry = newEntry;
+            }
+            return writeBlock(bucketBlock, &bucket, sizeof(bucket));
+        }
+        bucketBlock = bucket.next;
+    }
+    return false;
+}
+
+// -------------------------------------------------
+// lookup
+// -------------------------------------------------
+// Returns the inode a name refers to inside a
+// directory, or -1. Hits and misses are served from
+// (and recorded in) the dentry cache.
+// -------------------------------------------------
+int FileSystem::lookup(int dirInodeId, const std::string& name) {
+    int inodeId = DentryCache::NEGATIVE;
+    if (dentries_.lookup(dirInodeId, name, inodeId)) {
+        return inodeId;
+    }
+
+    Inode dir = readInode(dirInodeId);
+    if (!dir.is_directory) {
+        return -1;
+    }
+
+    DirectoryItem item{};
+    inodeId = findDirEntry(dir, name, &item) == -1 ? DentryCache::NEGATIVE : item.inode;
+    dentries_.insert(dirInodeId, name, inodeId);
+    return inodeId;
+}
+
+// -------------------------------------------------
+// resolvePath
+// -------------------------------------------------
+// Walks a path one component at a time, starting at
+// the root ("/...") or the current directory. Empty
+// components ("a//b", trailing '/') are skipped.
+// Each directory is locked (shared) only while its
+// name is looked up; callers lock what they use.
+// Returns the inode of the last component, or -1.
+// -------------------------------------------------
+int FileSystem::resolvePath(const std::string& path) {
+    if (path.empty()) return -1;
+
+    int current = path[0] == '/' ? 0 : session().cwdInode.load();
+    size_t pos = 0;
+    while (pos <= path.size()) {
+        size_t slash = path.find('/', pos);
+        if (slash == std::string::npos) slash = path.size();
+
+        std::string part = path.substr(pos, slash - pos);
+        pos = slash + 1;
+        if (part.empty()) continue;
+
+        InodeLocks::Guard lock = locks_.shared(current);
+        current = lookup(current, part);
+        if (current == -1) return -1;
+    }
+    return current;
+}
+
+// -------------------------------------------------
+// resolveParent
+// -------------------------------------------------
+// Splits a path into its directory and last name.
+// Returns the directory's inode (which must exist
+// and be a directory) and stores the name in `leaf`;
+// the name itself need not exist.
+// -------------------------------------------------
+int FileSystem::resolveParent(const std::string& path, std::string& leaf) {
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos) {
+        leaf = path;
+        return session().cwdInode;
+    }
+
+    leaf = path.substr(slash + 1);
+    int dirInodeId = resolvePath(slash == 0 ? "/" : path.substr(0, slash));
+    if (dirInodeId == -1 || !readInode(dirInodeId).is_directory) {
+        return -1;
+    }
+    return dirInodeId;
+}
 
-    std::cout << "OK\n";
+bool FileSystem::isValidName(const std::string& name) {
+    return !name.empty() && name.size() <= MAX_NAME_LENGTH &&
+           name.find('/') == std::string::npos && name != "." && name != "..";
 }
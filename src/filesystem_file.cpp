@@ -4,1244 +4,665 @@
 // File-level operations
 // Handles:
 //   - Creating, reading, writing and deleting files
+//   - File metadata (stat) and byte-range I/O
 //   - Copying, moving and concatenating files
 //   - Importing and exporting between host FS and VFS
+// The shell commands on top of these are in
+// filesystem_shell.cpp.
 // =============================================
 
 #define _CRT_SECURE_NO_WARNINGS
 #include "filesystem.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <filesystem>
+#include <limits>
 
 // -------------------------------------------------
-// touch
+// createFile
 // -------------------------------------------------
-// Creates an empty file in the current directory.
+// Creates an empty file (path relative to the current
+// directory, or absolute).
 // Validates the name, checks for duplicates,
 // allocates an inode, and links it to the parent.
 // -------------------------------------------------
-void FileSystem::touch(const std::string& name) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::createFile(const std::string& path) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
-    // --- STEP 1: Validate name ---
-    if (name.empty() || name.size() > MAX_NAME_LENGTH || name.find('/') != std::string::npos) {
-        std::cerr << "INVALID NAME\n";
-        return;
-    }
+    // --- STEP 1: Resolve parent and validate name ---
+    std::string name;
+    const int parentInodeId = resolveParent(path, name);
+    if (parentInodeId == -1) return Status::PathNotFound;
 
-    // --- STEP 2: Check for duplicates ---
-    if (directoryContains(parentInodeId, name)) {
-        std::cerr << "EXIST\n";
-        return;
-    }
+    if (!isValidName(name)) return Status::InvalidName;
+
+    // --- STEP 2: Lock the parent and check for duplicates ---
+    InodeLocks::Guard lock = locks_.exclusive(parentInodeId);
+    Inode parent = readInode(parentInodeId);
+    if (!isLive(parentInodeId) || !parent.is_directory) return Status::PathNotFound;
+
+    if (directoryContains(parentInodeId, name)) return Status::Exists;
 
     // --- STEP 3: Allocate inode ---
-    int newInodeId = allocateFreeInode();
-    if (newInodeId == -1) {
-        std::cerr << "NO SPACE\n";
-        return;
-    }
+    int newInodeId = allocateFreeInode(parentInodeId);
+    if (newInodeId == -1) return failure(Status::NoSpace);
 
     // --- STEP 4: Initialize inode ---
     Inode newFile{};
     newFile.id = newInodeId;
     newFile.is_directory = false;
     newFile.references = 1;
+    newFile.flags = parent.flags & INODE_COMPRESSED;
     newFile.file_size = 0;
     writeInode(newInodeId, newFile);
 
     // --- STEP 5: Add entry to parent directory ---
-    Inode parent = readInode(parentInodeId);
-    if (!parent.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
     DirectoryItem newItem{};
     newItem.inode = newInodeId;
     std::strncpy(newItem.item_name, name.c_str(), MAX_NAME_LENGTH);
     newItem.item_name[MAX_NAME_LENGTH] = '\0';
 
-    std::fstream file(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
+    if (!addDirEntry(parentInodeId, parent, newItem)) {
+        freeInode(newInodeId);
+        return failure(Status::IoError);
     }
 
-    long long offset = dataBlockOffset(parent.direct1) + parent.file_size;
-    file.seekp(offset);
-    file.write(reinterpret_cast<char*>(&newItem), sizeof(DirectoryItem));
-    file.close();
-
-    parent.file_size += sizeof(DirectoryItem);
-    writeInode(parentInodeId, parent);
-
-    std::cout << "OK\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// cat
+// readFile
 // -------------------------------------------------
-// Displays the contents of a file.
-// Prints its content or "<empty file>" if empty.
+// Reads the whole content of a file (holes as
+// zeros) into `content`.
 // -------------------------------------------------
-void FileSystem::cat(const std::string& name) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::readFile(const std::string& path, std::vector<char>& content) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (name.empty()) {
-        std::cerr << "INVALID NAME\n";
-        return;
-    }
+    if (path.empty()) return Status::InvalidName;
 
-    // --- STEP 2: Locate file in current directory ---
-    Inode dir = readInode(parentInodeId);
-    if (!dir.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 2: Locate file ---
+    int fileInodeId = resolvePath(path);
+    if (fileInodeId == -1) return Status::FileNotFound;
+
+    // --- STEP 3: Lock and verify it’s a file ---
+    InodeLocks::Guard lock = locks_.shared(fileInodeId);
+    if (!isLive(fileInodeId)) return Status::FileNotFound;
+    Inode target = readInode(fileInodeId);
+    if (target.is_directory) return Status::IsDirectory;
 
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
+    // --- STEP 4: Read content (one read per contiguous run) ---
+    content.assign(static_cast<size_t>(target.file_size), 0);
+    if (target.file_size > 0 && !readFileData(target, content.data())) {
+        content.clear();
+        return Status::IoError;
     }
+    return Status::Ok;
+}
 
-    file.seekg(dataBlockOffset(dir.direct1));
-    DirectoryItem item{};
-    int entries = dir.file_size / sizeof(DirectoryItem);
-    int fileInodeId = -1;
+// -------------------------------------------------
+// writeFile
+// -------------------------------------------------
+// Replaces the content of an existing file with
+// `length` bytes (at least one) and updates its size.
+// -------------------------------------------------
+Status FileSystem::writeFile(const std::string& path, const char* data, long long length) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
-    for (int i = 0; i < entries; ++i) {
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == name) {
-            fileInodeId = item.inode;
-            break;
-        }
-    }
-    file.close();
+    // --- STEP 1: Validate input ---
+    if (path.empty()) return Status::InvalidName;
+    if (length <= 0) return Status::InvalidInput;
+    if (length > std::numeric_limits<int32_t>::max()) return Status::NoSpace;
 
-    if (fileInodeId == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        return;
-    }
+    // --- STEP 2: Locate target file ---
+    int fileInodeId = resolvePath(path);
+    if (fileInodeId == -1) return Status::FileNotFound;
 
-    // --- STEP 3: Verify it’s a file ---
+    // --- STEP 3: Lock and load inode ---
+    InodeLocks::Guard lock = locks_.exclusive(fileInodeId);
     Inode target = readInode(fileInodeId);
-    if (target.is_directory) {
-        std::cerr << "IS DIRECTORY\n";
-        return;
-    }
+    if (!isLive(fileInodeId) || target.is_directory) return Status::FileNotFound;
 
-    if (target.file_size == 0 || target.direct1 == 0) {
-        std::cout << "<empty file>\n";
-        return;
+    // --- STEP 4: Store content in a fresh contiguous run ---
+    if (!replaceFileData(target, data, static_cast<int>(length))) {
+        return failure(Status::IoError);
     }
 
-    // --- STEP 4: Build list of blocks to read ---
-    std::vector<int> blockList;
-    
-    // Add direct blocks
-    if (target.direct1 > 0) blockList.push_back(target.direct1);
-    if (target.direct2 > 0) blockList.push_back(target.direct2);
-    if (target.direct3 > 0) blockList.push_back(target.direct3);
-    if (target.direct4 > 0) blockList.push_back(target.direct4);
-    if (target.direct5 > 0) blockList.push_back(target.direct5);
-    
-    // Add indirect blocks (read pointers from indirect blocks)
-    if (target.indirect1 > 0) {
-        std::ifstream fsind(filename_, std::ios::binary);
-        fsind.seekg(dataBlockOffset(target.indirect1));
-        for (int i = 0; i < 256; ++i) {
-            int32_t ptr = 0;
-            fsind.read(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-            if (ptr > 0) {
-                blockList.push_back(ptr);
-            } else {
-                break;
-            }
-        }
-        fsind.close();
-    }
-    
-    if (target.indirect2 > 0) {
-        std::ifstream fsind(filename_, std::ios::binary);
-        fsind.seekg(dataBlockOffset(target.indirect2));
-        for (int i = 0; i < 256; ++i) {
-            int32_t ptr = 0;
-            fsind.read(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-            if (ptr > 0) {
-                blockList.push_back(ptr);
-            } else {
-                break;
-            }
-        }
-        fsind.close();
-    }
-    
-    // --- STEP 5: Read content from all blocks ---
-    std::vector<char> buffer(target.file_size + 1, 0);
-    std::ifstream fs(filename_, std::ios::binary);
-    if (!fs.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-    
-    int totalRead = 0;
-    for (int blockId : blockList) {
-        if (totalRead >= target.file_size) break;
-        
-        int toRead = std::min(CLUSTER_SIZE, target.file_size - totalRead);
-        fs.seekg(dataBlockOffset(blockId));
-        fs.read(buffer.data() + totalRead, toRead);
-        totalRead += toRead;
-    }
-    fs.close();
+    // --- STEP 5: Update inode ---
+    writeInode(fileInodeId, target);
 
-    std::cout << buffer.data() << "\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// write
+// readAt
 // -------------------------------------------------
-// Writes text into an existing file.
-// Overwrites current content and updates inode size.
+// Reads up to `length` bytes of a file starting at
+// byte `offset` into `data`. Only the blocks holding
+// the range are read; a range past the end is cut
+// off (`data` stays empty from the end on).
 // -------------------------------------------------
-void FileSystem::write(const std::string& name, const std::string& content) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::readAt(const std::string& path, long long offset, long long length, std::vector<char>& data) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (name.empty()) {
-        std::cerr << "INVALID NAME\n";
-        return;
-    }
-    if (content.empty()) {
-        std::cerr << "INVALID INPUT\n";
-        return;
-    }
+    if (path.empty()) return Status::InvalidName;
+    if (offset < 0 || length <= 0) return Status::InvalidInput;
 
-    // --- STEP 2: Locate target file ---
-    Inode dir = readInode(parentInodeId);
-    if (!dir.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 2: Locate file ---
+    int fileInodeId = resolvePath(path);
+    if (fileInodeId == -1) return Status::FileNotFound;
 
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 3: Lock and verify it's a file ---
+    InodeLocks::Guard lock = locks_.shared(fileInodeId);
+    Inode target = readInode(fileInodeId);
+    if (!isLive(fileInodeId) || target.is_directory) return Status::FileNotFound;
 
-    file.seekg(dataBlockOffset(dir.direct1));
-    DirectoryItem item{};
-    int entries = dir.file_size / sizeof(DirectoryItem);
-    int fileInodeId = -1;
+    data.clear();
+    if (offset >= target.file_size) return Status::Ok;
 
-    for (int i = 0; i < entries; ++i) {
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == name) {
-            fileInodeId = item.inode;
-            break;
-        }
+    // --- STEP 4: Read the range ---
+    length = std::min<long long>(length, target.file_size - offset);
+    data.resize(static_cast<size_t>(length));
+    if (!readFileRange(target, offset, data.data(), length)) {
+        data.clear();
+        return Status::IoError;
     }
-    file.close();
+    return Status::Ok;
+}
 
-    if (fileInodeId == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        return;
-    }
+// -------------------------------------------------
+// writeAt
+// -------------------------------------------------
+// Writes `length` bytes into a file at byte `offset`,
+// replacing what is there and growing the file if
+// the range ends past it. Only the blocks the range
+// covers are written (see writeFileRange).
+// -------------------------------------------------
+Status FileSystem::writeAt(const std::string& path, long long offset, const char* data, long long length) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
-    // --- STEP 3: Load inode ---
+    // --- STEP 1: Validate input ---
+    if (path.empty()) return Status::InvalidName;
+    if (offset < 0 || length <= 0) return Status::InvalidInput;
+
+    // --- STEP 2: Locate target file ---
+    int fileInodeId = resolvePath(path);
+    if (fileInodeId == -1) return Status::FileNotFound;
+
+    // --- STEP 3: Lock and load inode ---
+    InodeLocks::Guard lock = locks_.exclusive(fileInodeId);
     Inode target = readInode(fileInodeId);
-    if (target.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        return;
-    }
+    if (!isLive(fileInodeId) || target.is_directory) return Status::FileNotFound;
 
-    // --- STEP 4: Allocate blocks for content ---
-    int contentSize = static_cast<int>(content.size());
-    int blocksNeeded = (contentSize + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
-    
-    std::vector<int> blockList;
-    
-    // Allocate direct blocks (1-5)
-    for (int i = 0; i < std::min(5, blocksNeeded); ++i) {
-        int blockId;
-        if (i == 0 && target.direct1 > 0) {
-            blockId = target.direct1;
-        } else if (i == 1 && target.direct2 > 0) {
-            blockId = target.direct2;
-        } else if (i == 2 && target.direct3 > 0) {
-            blockId = target.direct3;
-        } else if (i == 3 && target.direct4 > 0) {
-            blockId = target.direct4;
-        } else if (i == 4 && target.direct5 > 0) {
-            blockId = target.direct5;
-        } else {
-            blockId = allocateFreeDataBlock();
-            if (blockId == -1) {
-                std::cerr << "NO SPACE\n";
-                return;
-            }
-        }
-        blockList.push_back(blockId);
-    }
-    
-    // Allocate indirect blocks if needed
-    if (blocksNeeded > 5) {
-        int indirectBlocksNeeded = blocksNeeded - 5;
-        
-        // indirect1
-        int indBlock1 = target.indirect1;
-        if (indBlock1 == 0) {
-            indBlock1 = allocateFreeDataBlock();
-            if (indBlock1 == -1) {
-                std::cerr << "NO SPACE\n";
-                return;
-            }
-            target.indirect1 = indBlock1;
-        }
-        
-        // Allocate pointers in indirect1
-        std::fstream fs(filename_, std::ios::in | std::ios::out | std::ios::binary);
-        fs.seekp(dataBlockOffset(indBlock1));
-        
-        for (int i = 0; i < std::min(256, indirectBlocksNeeded); ++i) {
-            int blockId = allocateFreeDataBlock();
-            if (blockId == -1) {
-                fs.close();
-                std::cerr << "NO SPACE\n";
-                return;
-            }
-            int32_t ptr = blockId;
-            fs.write(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-            blockList.push_back(blockId);
-        }
-        
-        // indirect2 if needed
-        if (indirectBlocksNeeded > 256) {
-            int indBlock2 = target.indirect2;
-            if (indBlock2 == 0) {
-                indBlock2 = allocateFreeDataBlock();
-                if (indBlock2 == -1) {
-                    fs.close();
-                    std::cerr << "NO SPACE\n";
-                    return;
-                }
-                target.indirect2 = indBlock2;
-            }
-            
-            fs.seekp(dataBlockOffset(indBlock2));
-            for (int i = 0; i < indirectBlocksNeeded - 256; ++i) {
-                int blockId = allocateFreeDataBlock();
-                if (blockId == -1) {
-                    fs.close();
-                    std::cerr << "NO SPACE\n";
-                    return;
-                }
-                int32_t ptr = blockId;
-                fs.write(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-                blockList.push_back(blockId);
-            }
-        }
-        fs.close();
-    }
-    
-    // --- STEP 5: Write content to allocated blocks ---
-    std::fstream fileOut(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!fileOut.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-    
-    int written = 0;
-    for (int blockId : blockList) {
-        int toWrite = std::min(CLUSTER_SIZE, contentSize - written);
-        fileOut.seekp(dataBlockOffset(blockId));
-        fileOut.write(content.c_str() + written, toWrite);
-        written += toWrite;
-    }
-    fileOut.close();
-    
-    // --- STEP 6: Update direct pointers in inode ---
-    if (blockList.size() >= 1) target.direct1 = blockList[0];
-    if (blockList.size() >= 2) target.direct2 = blockList[1];
-    if (blockList.size() >= 3) target.direct3 = blockList[2];
-    if (blockList.size() >= 4) target.direct4 = blockList[3];
-    if (blockList.size() >= 5) target.direct5 = blockList[4];
-    
-    // --- STEP 7: Update inode ---
-    target.file_size = contentSize;
+    // --- STEP 4: Patch the covered blocks ---
+    bool written = writeFileRange(target, offset, data, length);
+
+    // --- STEP 5: Update inode (a failed write may still have remapped blocks) ---
     writeInode(fileInodeId, target);
+    if (!written) return failure(Status::IoError);
 
-    std::cout << "OK\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// rm
+// resizeFile
 // -------------------------------------------------
-// Deletes a file or an empty directory from the
-// current working directory and frees its inode.
+// Sets the size of a file. Shrinking frees the
+// blocks past the new end; growing adds a hole, so
+// no blocks are allocated and the new bytes read as
+// zeros. With `extendOnly` (truncate --extend) a
+// larger file is left as it is.
 // -------------------------------------------------
-void FileSystem::rm(const std::string& name) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::resizeFile(const std::string& path, long long size, bool extendOnly) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (name.empty()) {
-        std::cerr << "INVALID NAME\n";
-        return;
+    if (path.empty()) return Status::InvalidName;
+    if (size < 0) return Status::InvalidInput;
+    if (size > std::numeric_limits<int32_t>::max() ||
+        BlockMap::blocksFor(size, layout_.clusterSize) > blockMap_.maxBlocks()) {
+        return Status::NoSpace;
     }
 
-    // --- STEP 2: Locate target in current directory ---
-    Inode parent = readInode(parentInodeId);
-    if (!parent.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 2: Locate target file ---
+    int fileInodeId = resolvePath(path);
+    if (fileInodeId == -1) return Status::FileNotFound;
 
-    std::fstream file(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 3: Lock and load inode ---
+    InodeLocks::Guard lock = locks_.exclusive(fileInodeId);
+    Inode target = readInode(fileInodeId);
+    if (!isLive(fileInodeId) || target.is_directory) return Status::FileNotFound;
 
-    file.seekg(dataBlockOffset(parent.direct1));
-    DirectoryItem item{};
-    int entries = parent.file_size / sizeof(DirectoryItem);
-    int targetIndex = -1, targetInodeId = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        long long pos = dataBlockOffset(parent.direct1) + i * sizeof(DirectoryItem);
-        file.seekg(pos);
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-
-        if (std::string(item.item_name) == name) {
-            targetIndex = i;
-            targetInodeId = item.inode;
-            break;
-        }
+    // --- STEP 4: Shrink, or grow by a hole ---
+    if (size < target.file_size && !extendOnly) {
+        if (!shrinkFile(target, size)) return failure(Status::IoError);
+    } else if (!growFile(target, size)) {
+        return failure(Status::IoError);
     }
 
-    if (targetInodeId == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        file.close();
-        return;
-    }
+    // --- STEP 5: Update inode ---
+    writeInode(fileInodeId, target);
 
-    // --- STEP 3: Load target inode ---
-    Inode target = readInode(targetInodeId);
-    if (target.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        file.close();
-        return;
-    }
+    return Status::Ok;
+}
 
-    // --- STEP 4: Free data block and inode ---
-    Superblock sb = readSuperblock();
-    std::vector<char> dataBitmap(DATA_BITMAP_SIZE);
-    file.seekg(sb.bitmap_start_address);
-    file.read(dataBitmap.data(), DATA_BITMAP_SIZE);
-
-    // Free all data blocks used by this file
-    if (target.direct1 > 0) {
-        int byteIdx = target.direct1 / 8;
-        int bitIdx = target.direct1 % 8;
-        if (byteIdx < DATA_BITMAP_SIZE) {
-            dataBitmap[byteIdx] &= ~(1 << bitIdx);
-        }
-    }
-    if (target.direct2 > 0) {
-        int byteIdx = target.direct2 / 8;
-        int bitIdx = target.direct2 % 8;
-        if (byteIdx < DATA_BITMAP_SIZE) {
-            dataBitmap[byteIdx] &= ~(1 << bitIdx);
-        }
-    }
-    if (target.direct3 > 0) {
-        int byteIdx = target.direct3 / 8;
-        int bitIdx = target.direct3 % 8;
-        if (byteIdx < DATA_BITMAP_SIZE) {
-            dataBitmap[byteIdx] &= ~(1 << bitIdx);
-        }
-    }
-    if (target.direct4 > 0) {
-        int byteIdx = target.direct4 / 8;
-        int bitIdx = target.direct4 % 8;
-        if (byteIdx < DATA_BITMAP_SIZE) {
-            dataBitmap[byteIdx] &= ~(1 << bitIdx);
-        }
-    }
-    if (target.direct5 > 0) {
-        int byteIdx = target.direct5 / 8;
-        int bitIdx = target.direct5 % 8;
-        if (byteIdx < DATA_BITMAP_SIZE) {
-            dataBitmap[byteIdx] &= ~(1 << bitIdx);
-        }
-    }
-    if (target.indirect1 > 0) {
-        int byteIdx = target.indirect1 / 8;
-        int bitIdx = target.indirect1 % 8;
-        if (byteIdx < DATA_BITMAP_SIZE) {
-            dataBitmap[byteIdx] &= ~(1 << bitIdx);
-        }
-    }
-    if (target.indirect2 > 0) {
-        int byteIdx = target.indirect2 / 8;
-        int bitIdx = target.indirect2 % 8;
-        if (byteIdx < DATA_BITMAP_SIZE) {
-            dataBitmap[byteIdx] &= ~(1 << bitIdx);
-        }
-    }
-    
-    file.seekp(sb.bitmap_start_address);
-    file.write(dataBitmap.data(), DATA_BITMAP_SIZE);
+// -------------------------------------------------
+// removeFile
+// -------------------------------------------------
+// Deletes a file (path relative to the current
+// directory, or absolute) and frees its inode.
+// -------------------------------------------------
+Status FileSystem::removeFile(const std::string& path) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
-    std::vector<char> inodeBitmap(INODE_BITMAP_SIZE);
-    file.seekg(sb.bitmapi_start_address);
-    file.read(inodeBitmap.data(), INODE_BITMAP_SIZE);
+    // --- STEP 1: Validate input ---
+    if (path.empty()) return Status::InvalidName;
 
-    // Free the inode
-    int inodeByteIdx = targetInodeId / 8;
-    int inodeBitIdx = targetInodeId % 8;
-    if (inodeByteIdx < INODE_BITMAP_SIZE) {
-        inodeBitmap[inodeByteIdx] &= ~(1 << inodeBitIdx);
-        file.seekp(sb.bitmapi_start_address);
-        file.write(inodeBitmap.data(), INODE_BITMAP_SIZE);
+    // --- STEP 2: Locate target entry ---
+    std::string name;
+    const int parentInodeId = resolveParent(path, name);
+    if (parentInodeId == -1) return Status::PathNotFound;
+
+    int targetInodeId = -1;
+    {
+        InodeLocks::Guard lock = locks_.shared(parentInodeId);
+        targetInodeId = lookup(parentInodeId, name);
     }
+    if (targetInodeId == -1) return Status::FileNotFound;
 
-    // --- STEP 5: Remove directory entry ---
-    if (entries > 1 && targetIndex != entries - 1) {
-        DirectoryItem last{};
-        long long lastPos = dataBlockOffset(parent.direct1) + (entries - 1) * sizeof(DirectoryItem);
-        file.seekg(lastPos);
-        file.read(reinterpret_cast<char*>(&last), sizeof(DirectoryItem));
+    // --- STEP 3: Lock parent and target, then re-check the entry ---
+    InodeLocks::Guard lock = locks_.acquire({ { parentInodeId, InodeLocks::Mode::Exclusive },
+                                              { targetInodeId, InodeLocks::Mode::Exclusive } });
 
-        long long replacePos = dataBlockOffset(parent.direct1) + targetIndex * sizeof(DirectoryItem);
-        file.seekp(replacePos);
-        file.write(reinterpret_cast<char*>(&last), sizeof(DirectoryItem));
-    }
+    Inode parent = readInode(parentInodeId);
+    if (!isLive(parentInodeId) || !parent.is_directory) return Status::PathNotFound;
+
+    DirectoryItem item{};
+    int targetIndex = findDirEntry(parent, name, &item);
+    if (targetIndex == -1 || item.inode != targetInodeId) return Status::FileNotFound;
+
+    // --- STEP 4: Load target inode ---
+    Inode target = readInode(targetInodeId);
+    if (target.is_directory) return Status::FileNotFound;
+
+    // --- STEP 5: Free data blocks and inode ---
+    // Data and pointer blocks, found through the block map
+    releaseFileBlocks(target);
+
+    // Free the inode
+    freeInode(targetInodeId);
 
-    parent.file_size -= sizeof(DirectoryItem);
-    writeInode(parentInodeId, parent);
-    file.close();
+    // --- STEP 6: Remove directory entry ---
+    removeDirEntry(parentInodeId, parent, targetIndex);
 
-    std::cout << "OK\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// info
+// stat
 // -------------------------------------------------
-// Prints detailed information about a file or directory.
-// Includes size, inode number, and direct data blocks.
+// Metadata of a file or directory: size, inode,
+// flags and the blocks its pointers hold. For a
+// compressed file the blocks actually stored are
+// counted too.
 // -------------------------------------------------
-void FileSystem::info(const std::string& name) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::stat(const std::string& path, FileStat& result) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (name.empty()) {
-        std::cerr << "INVALID NAME\n";
-        return;
-    }
-
-    // --- STEP 2: Locate target in current directory ---
-    Inode parent = readInode(parentInodeId);
-    if (!parent.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    if (path.empty()) return Status::InvalidName;
 
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 2: Locate target ---
+    int targetInodeId = resolvePath(path);
+    if (targetInodeId == -1) return Status::FileNotFound;
 
-    file.seekg(dataBlockOffset(parent.direct1));
-    DirectoryItem item{};
-    int entries = parent.file_size / sizeof(DirectoryItem);
-    int targetInodeId = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == name) {
-            targetInodeId = item.inode;
-            break;
-        }
-    }
-
-    file.close();
-
-    if (targetInodeId == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        return;
-    }
-
-    // --- STEP 3: Load inode ---
+    // --- STEP 3: Lock and load inode ---
+    InodeLocks::Guard lock = locks_.shared(targetInodeId);
+    if (!isLive(targetInodeId)) return Status::FileNotFound;
     Inode target = readInode(targetInodeId);
 
-    // --- STEP 4: Print info ---
-    std::cout << name
-        << " - " << target.file_size << " B"
-        << " - inode " << target.id
-        << " - ";
-
-    int directBlocks[5] = { target.direct1, target.direct2, target.direct3,
-                            target.direct4, target.direct5 };
-
-    // Print direct blocks
-    std::cout << "direct: ";
-    bool firstDirect = true;
-    for (int b : directBlocks) {
-        if (b > 0) {
-            if (!firstDirect) std::cout << ", ";
-            std::cout << b;
-            firstDirect = false;
-        }
-    }
-    if (firstDirect) {
-        std::cout << "none";
-    }
-    
-    // Print indirect blocks
-    std::cout << " | indirect: ";
-    bool firstIndirect = true;
-    if (target.indirect1 > 0) {
-        std::cout << target.indirect1;
-        firstIndirect = false;
-    }
-    if (target.indirect2 > 0) {
-        if (!firstIndirect) std::cout << ", ";
-        std::cout << target.indirect2;
-        firstIndirect = false;
-    }
-    if (firstIndirect) {
-        std::cout << "none";
-    }
-
-    std::cout << "\n";
+    // --- STEP 4: Fill in the result ---
+    result = FileStat{};
+    result.inode = target.id;
+    result.isDirectory = target.is_directory != 0;
+    result.size = target.file_size;
+    result.references = target.references;
+    result.compressed = isCompressed(target);
+    result.inlined = isInline(target);
+    if (result.inlined) return Status::Ok;      // The pointer fields hold content
+
+    if (result.compressed && !result.isDirectory) {
+        // Logical size above, blocks actually stored here
+        std::vector<int> blocks = fileBlocks(target);
+        long long stored = std::count_if(blocks.begin(), blocks.end(), [](int b) { return b > 0; });
+        result.compressedBytes = stored * layout_.clusterSize;
+    }
+    for (int b : { target.direct1, target.direct2, target.direct3, target.direct4, target.direct5 }) {
+        if (b > 0) result.directBlocks.push_back(b);
+    }
+    for (int b : { target.indirect1, target.indirect2 }) {
+        if (b > 0) result.indirectBlocks.push_back(b);
+    }
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// cp
+// copyFile
 // -------------------------------------------------
 // Copies a file within the virtual filesystem.
 // Reads the content of the source file and creates
-// a duplicate under a new name in the same directory.
+// a duplicate under the destination path.
+// With `reflink`, the copy shares the source's data
+// blocks instead (copy-on-write).
 // -------------------------------------------------
-void FileSystem::cp(const std::string& source, const std::string& destination) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::copyFile(const std::string& source, const std::string& destination, bool reflink) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate ---
-    if (source.empty() || destination.empty()) {
-        std::cerr << "INVALID INPUT\n";
-        return;
-    }
+    if (source.empty() || destination.empty()) return Status::InvalidInput;
 
     // --- STEP 2: Locate source file ---
-    Inode parent = readInode(parentInodeId);
-    if (!parent.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    std::ifstream file(filename_, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    file.seekg(dataBlockOffset(parent.direct1));
-    DirectoryItem item{};
-    int entries = parent.file_size / sizeof(DirectoryItem);
-    int srcInodeId = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        file.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == source) {
-            srcInodeId = item.inode;
-            break;
-        }
-    }
-    file.close();
-
-    if (srcInodeId == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        return;
-    }
+    int srcInodeId = resolvePath(source);
+    if (srcInodeId == -1) return Status::FileNotFound;
 
     Inode src = readInode(srcInodeId);
-    if (src.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        return;
-    }
-
-    // --- STEP 3: Read content from source ---
-    std::string content;
-    if (src.file_size > 0 && src.direct1 > 0) {
-        // Build list of blocks to read (same as cat)
-        std::vector<int> blockList;
-        
-        // Add direct blocks
-        if (src.direct1 > 0) blockList.push_back(src.direct1);
-        if (src.direct2 > 0) blockList.push_back(src.direct2);
-        if (src.direct3 > 0) blockList.push_back(src.direct3);
-        if (src.direct4 > 0) blockList.push_back(src.direct4);
-        if (src.direct5 > 0) blockList.push_back(src.direct5);
-        
-        // Add indirect1 blocks
-        if (src.indirect1 > 0) {
-            std::ifstream fsind(filename_, std::ios::binary);
-            fsind.seekg(dataBlockOffset(src.indirect1));
-            for (int i = 0; i < 256; ++i) {
-                int32_t ptr = 0;
-                fsind.read(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-                if (ptr > 0) {
-                    blockList.push_back(ptr);
-                } else {
-                    break;
-                }
-            }
-            fsind.close();
-        }
-        
-        // Add indirect2 blocks
-        if (src.indirect2 > 0) {
-            std::ifstream fsind(filename_, std::ios::binary);
-            fsind.seekg(dataBlockOffset(src.indirect2));
-            for (int i = 0; i < 256; ++i) {
-                int32_t ptr = 0;
-                fsind.read(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-                if (ptr > 0) {
-                    blockList.push_back(ptr);
-                } else {
-                    break;
-                }
-            }
-            fsind.close();
-        }
-        
-        // Read content from all blocks
-        std::vector<char> buffer(src.file_size + 1, 0);
-        std::ifstream fs(filename_, std::ios::binary);
-        if (fs.is_open()) {
-            int totalRead = 0;
-            for (int blockId : blockList) {
-                if (totalRead >= src.file_size) break;
-                
-                int toRead = std::min(CLUSTER_SIZE, src.file_size - totalRead);
-                fs.seekg(dataBlockOffset(blockId));
-                fs.read(buffer.data() + totalRead, toRead);
-                totalRead += toRead;
-            }
-            fs.close();
-            content = std::string(buffer.data(), src.file_size);
-        }
-    }
-
-    // --- STEP 4: Check if destination exists ---
-    if (directoryContains(parentInodeId, destination)) {
-        std::cerr << "EXIST\n";
-        return;
-    }
+    if (src.is_directory) return Status::FileNotFound;
+
+    // --- STEP 3: Check if destination exists ---
+    std::string destName;
+    const int parentInodeId = resolveParent(destination, destName);
+    if (parentInodeId == -1) return Status::PathNotFound;
+    if (!isValidName(destName)) return Status::InvalidName;
+
+    // --- STEP 4: Lock source and destination directory ---
+    InodeLocks::Guard lock = locks_.acquire({ { srcInodeId, InodeLocks::Mode::Shared },
+                                              { parentInodeId, InodeLocks::Mode::Exclusive } });
+    src = readInode(srcInodeId);
+    if (!isLive(srcInodeId) || src.is_directory) return Status::FileNotFound;
+    if (!isLive(parentInodeId) || !readInode(parentInodeId).is_directory) return Status::PathNotFound;
+    if (directoryContains(parentInodeId, destName)) return Status::Exists;
+
+    // Source blocks (content is streamed below)
+    const bool hasContent = src.file_size > 0;
+    std::vector<int> srcBlocks;
+    if (hasContent) {
+        srcBlocks = fileBlocks(src);
+    }
+    const bool sparse = std::find(srcBlocks.begin(), srcBlocks.end(), 0) != srcBlocks.end();
 
     // --- STEP 5: Create destination file ---
-    int newInodeId = allocateFreeInode();
-    if (newInodeId == -1) {
-        std::cerr << "NO SPACE\n";
-        return;
-    }
+    int newInodeId = allocateFreeInode(parentInodeId);
+    if (newInodeId == -1) return failure(Status::NoSpace);
 
     Inode newFile{};
     newFile.id = newInodeId;
     newFile.is_directory = false;
     newFile.references = 1;
-    newFile.file_size = static_cast<int>(content.size());
-
-    if (!content.empty()) {
-        int contentSize = content.size();
-        int blocksNeeded = (contentSize + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
-        int extraBlocksForIndirection = 0;
-        
-        // Calculate extra blocks needed for indirection
-        if (blocksNeeded > 5) {
-            if (blocksNeeded <= 261) {  // 5 + 256
-                extraBlocksForIndirection = 1;  // indirect1 block
-            } else {
-                extraBlocksForIndirection = 2;  // indirect1 + indirect2 blocks
-            }
-        }
-        
-        std::vector<int> allBlocks = allocateFreeDataBlocks(blocksNeeded + extraBlocksForIndirection);
-        if (allBlocks.size() != blocksNeeded + extraBlocksForIndirection) {
-            std::cerr << "NO SPACE\n";
-            return;
+    newFile.flags = readInode(parentInodeId).flags & INODE_COMPRESSED;
+    newFile.file_size = hasContent ? src.file_size : 0;
+
+    // Inline content travels with the inode: nothing to read or share
+    const bool inlined = hasContent && isInline(src);
+    if (inlined) storeInline(newFile, inlineData(src), src.file_size);
+
+    // Reflink: share the source's blocks; falls back to a copy if that isn't possible
+    const bool cloned = hasContent && !inlined && reflink && cloneFileBlocks(src, newFile);
+
+    if (hasContent && !cloned && !inlined && (sparse || isCompressed(newFile) || src.file_size <= INLINE_CAPACITY)) {
+        // Copy only the mapped runs: the holes stay holes
+        // (a compressed copy is coded chunk by chunk, a tiny one kept inline)
+        newFile.file_size = 0;
+        const long long clusterSize = layout_.clusterSize;
+        bool copied = streamFile(src, [&](size_t first, const char* data, long long length) {
+            return data == nullptr || writeFileRange(newFile, static_cast<long long>(first) * clusterSize, data, length);
+        });
+        copied = copied && growFile(newFile, src.file_size);
+        if (!copied) {
+            releaseFileBlocks(newFile);
+            freeInode(newInodeId);
+            return failure(Status::IoError);
+        }
+    }
+    else if (hasContent && !cloned && !inlined) {
+        // Data lands in one contiguous run where possible (a compressed
+        // source without holes has only raw chunks: its blocks are the content)
+        const int clusterSize = layout_.clusterSize;
+        int blocksNeeded = BlockMap::blocksFor(newFile.file_size, clusterSize);
+        std::vector<int> dataBlocks;
+        if (!allocateFileBlocks(newFile, blocksNeeded, dataBlocks)) {
+            freeInode(newInodeId);
+            return failure(Status::NoSpace);
+        }
+
+        // Copy chunk by chunk; memory use doesn't grow with the file
+        const bool copied = streamBlocks(srcBlocks, newFile.file_size, [&](size_t first, const char* data, long long length) {
+            return writeNewBlocks(newFile, 0, dataBlocks, data, length, first);
+        });
+        if (!copied) {
+            releaseFileBlocks(newFile);
+            freeInode(newInodeId);
+            return failure(Status::IoError);
         }
-        
-        std::vector<int> directBlocks(5, 0);
-        std::vector<int> indirectBlocks;
-        int indirect1 = 0, indirect2 = 0;
-        int blockIndex = 0;
-        
-        std::fstream vfs(filename_, std::ios::in | std::ios::out | std::ios::binary);
-        int written = 0;
-        
-        // Assign first 5 blocks as direct blocks
-        for (int i = 0; i < std::min(5, (int)allBlocks.size()); ++i) {
-            directBlocks[i] = allBlocks[blockIndex++];
-            int toWrite = std::min(CLUSTER_SIZE, contentSize - written);
-            vfs.seekp(dataBlockOffset(directBlocks[i]));
-            vfs.write(content.data() + written, toWrite);
-            written += toWrite;
-        }
-        
-        // Handle indirect blocks if needed
-        if (blocksNeeded > 5) {
-            int indirectBlocksNeeded = blocksNeeded - 5;
-            
-            // Use pre-allocated indirect1 block
-            indirect1 = allBlocks[blockIndex++];
-            
-            // Collect indirect1 blocks
-            std::vector<int> indirect1Blocks;
-            int blocksForIndirect1 = std::min(256, indirectBlocksNeeded);
-            for (int i = 0; i < blocksForIndirect1; ++i) {
-                indirect1Blocks.push_back(allBlocks[blockIndex++]);
-                indirectBlocks.push_back(allBlocks[blockIndex - 1]);
-            }
-            
-            // Write pointers for indirect1
-            vfs.seekp(dataBlockOffset(indirect1));
-            for (int i = 0; i < indirect1Blocks.size(); ++i) {
-                int32_t ptr = indirect1Blocks[i];
-                vfs.write(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-            }
-            
-            // Write data for indirect1 blocks
-            for (int i = 0; i < indirect1Blocks.size(); ++i) {
-                int toWrite = std::min(CLUSTER_SIZE, contentSize - written);
-                vfs.seekp(dataBlockOffset(indirect1Blocks[i]));
-                vfs.write(content.data() + written, toWrite);
-                written += toWrite;
-            }
-            
-            // Handle indirect2 if needed
-            if (indirectBlocksNeeded > 256) {
-                // Use pre-allocated indirect2 block
-                indirect2 = allBlocks[blockIndex++];
-                
-                // Collect indirect2 blocks
-                std::vector<int> indirect2Blocks;
-                int blocksForIndirect2 = indirectBlocksNeeded - 256;
-                
-                for (int i = 0; i < blocksForIndirect2; ++i) {
-                    if (blockIndex >= allBlocks.size()) {
-                        break;
-                    }
-                    indirect2Blocks.push_back(allBlocks[blockIndex++]);
-                    indirectBlocks.push_back(allBlocks[blockIndex - 1]);
-                }
-                
-                // Write pointers for indirect2
-                vfs.seekp(dataBlockOffset(indirect2));
-                for (int i = 0; i < indirect2Blocks.size(); ++i) {
-                    int32_t ptr = indirect2Blocks[i];
-                    vfs.write(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-                }
-                
-                // Write data for indirect2 blocks
-                for (int i = 0; i < indirect2Blocks.size(); ++i) {
-                    int toWrite = std::min(CLUSTER_SIZE, contentSize - written);
-                    vfs.seekp(dataBlockOffset(indirect2Blocks[i]));
-                    vfs.write(content.data() + written, toWrite);
-                    written += toWrite;
-                }
-            }
-        }
-        vfs.close();
-        
-        // Set block references in inode
-        newFile.direct1 = directBlocks[0];
-        newFile.direct2 = directBlocks[1];
-        newFile.direct3 = directBlocks[2];
-        newFile.direct4 = directBlocks[3];
-        newFile.direct5 = directBlocks[4];
-        newFile.indirect1 = indirect1;
-        newFile.indirect2 = indirect2;
     }
 
     writeInode(newInodeId, newFile);
 
     // --- STEP 6: Add directory entry ---
+    Inode parent = readInode(parentInodeId);
     DirectoryItem newItem{};
     newItem.inode = newInodeId;
-    std::strncpy(newItem.item_name, destination.c_str(), MAX_NAME_LENGTH);
+    std::strncpy(newItem.item_name, destName.c_str(), MAX_NAME_LENGTH);
     newItem.item_name[MAX_NAME_LENGTH] = '\0';
 
-    std::fstream parentFile(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    long long offset = dataBlockOffset(parent.direct1) + parent.file_size;
-    parentFile.seekp(offset);
-    parentFile.write(reinterpret_cast<char*>(&newItem), sizeof(DirectoryItem));
-    parentFile.close();
-
-    parent.file_size += sizeof(DirectoryItem);
-    writeInode(parentInodeId, parent);
+    if (!addDirEntry(parentInodeId, parent, newItem)) {
+        releaseFileBlocks(newFile);
+        freeInode(newInodeId);
+        return failure(Status::IoError);
+    }
 
-    std::cout << "OK\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// mv
+// rename
 // -------------------------------------------------
-// Moves or renames a file inside the virtual filesystem.
-// If destination is a path, moves the file to that folder.
-// Otherwise, renames it within the same directory.
+// Moves or renames a file or directory. If the
+// destination is an existing directory, the item
+// moves into it under its current name; otherwise
+// the destination path names the new location.
 // -------------------------------------------------
-void FileSystem::mv(const std::string& source, const std::string& destination) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::rename(const std::string& source, const std::string& destination) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (source.empty() || destination.empty()) {
-        std::cerr << "INVALID INPUT\n";
-        return;
-    }
+    if (source.empty() || destination.empty()) return Status::InvalidInput;
 
-    // --- STEP 2: Find source item in current directory ---
-    Inode parent = readInode(parentInodeId);
-    if (!parent.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // Renames are serialized, so the tree can't change
+    // shape under the subtree check below
+    std::lock_guard<std::mutex> renameGuard(renameLock_);
 
-    std::fstream fs(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    if (!fs.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 2: Find source entry ---
+    std::string srcName;
+    const int parentInodeId = resolveParent(source, srcName);
+    if (parentInodeId == -1) return Status::PathNotFound;
+    if (srcName == "." || srcName == "..") return Status::InvalidName;
 
-    DirectoryItem srcItem{};
-    int entries = parent.file_size / sizeof(DirectoryItem);
     int srcInodeId = -1;
-    long long srcPos = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        long long pos = dataBlockOffset(parent.direct1) + i * sizeof(DirectoryItem);
-        fs.seekg(pos);
-        fs.read(reinterpret_cast<char*>(&srcItem), sizeof(DirectoryItem));
-        if (std::string(srcItem.item_name) == source) {
-            srcInodeId = srcItem.inode;
-            srcPos = pos;
-            break;
-        }
+    {
+        InodeLocks::Guard lock = locks_.shared(parentInodeId);
+        srcInodeId = lookup(parentInodeId, srcName);
     }
+    if (srcInodeId == -1) return Status::FileNotFound;
 
-    if (srcInodeId == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        fs.close();
-        return;
-    }
-
-    // --- STEP 3: Parse destination ---
-    size_t slashPos = destination.find('/');
-    std::string destDirName;
+    // --- STEP 3: Resolve destination ---
     std::string destFileName;
-
-    if (slashPos == std::string::npos) {
-        destDirName = "";
-        destFileName = destination;
+    int destDirInodeId = resolvePath(destination);
+    if (destDirInodeId != -1 && readInode(destDirInodeId).is_directory) {
+        destFileName = srcName;
     }
     else {
-        destDirName = destination.substr(0, slashPos);
-        destFileName = destination.substr(slashPos + 1);
+        destDirInodeId = resolveParent(destination, destFileName);
+        if (destDirInodeId == -1) return Status::PathNotFound;
     }
 
-    // --- STEP 4: Locate destination directory ---
-    int destDirInodeId = parentInodeId;
-
-    if (!destDirName.empty()) {
-        fs.seekg(dataBlockOffset(parent.direct1));
-        DirectoryItem dirItem{};
-        bool foundDir = false;
-        for (int i = 0; i < entries; ++i) {
-            fs.read(reinterpret_cast<char*>(&dirItem), sizeof(DirectoryItem));
-            if (std::string(dirItem.item_name) == destDirName) {
-                Inode check = readInode(dirItem.inode);
-                if (check.is_directory) {
-                    destDirInodeId = dirItem.inode;
-                    foundDir = true;
-                }
-                break;
-            }
-        }
+    if (!isValidName(destFileName)) return Status::InvalidName;
 
-        if (!foundDir) {
-            std::cerr << "PATH NOT FOUND\n";
-            fs.close();
-            return;
+    // --- Lock both directories and the moved item, then re-check the entry ---
+    InodeLocks::Guard lock = locks_.acquire({ { parentInodeId, InodeLocks::Mode::Exclusive },
+                                              { destDirInodeId, InodeLocks::Mode::Exclusive },
+                                              { srcInodeId, InodeLocks::Mode::Exclusive } });
+    Inode parent = readInode(parentInodeId);
+    DirectoryItem srcItem{};
+    int srcIndex = findDirEntry(parent, srcName, &srcItem);
+    if (srcIndex == -1 || srcItem.inode != srcInodeId) return Status::FileNotFound;
+    if (!isLive(destDirInodeId) || !readInode(destDirInodeId).is_directory) return Status::PathNotFound;
+
+    // --- STEP 4: A directory can't move into its own subtree ---
+    Inode moved = readInode(srcInodeId);
+    if (moved.is_directory) {
+        for (int id = destDirInodeId; id >= 0; id = getParentInodeId(id)) {
+            if (id == srcInodeId) return Status::InvalidInput;
+            if (id == 0) break;
         }
     }
 
     Inode destDir = readInode(destDirInodeId);
-    if (!destDir.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        fs.close();
-        return;
-    }
+    if (destDirInodeId == parentInodeId && destFileName == srcName) return Status::Ok;
+    if (directoryContains(destDirInodeId, destFileName)) return Status::Exists;
 
     // --- STEP 5: Rename if in same directory ---
     if (destDirInodeId == parentInodeId) {
         std::strncpy(srcItem.item_name, destFileName.c_str(), MAX_NAME_LENGTH);
         srcItem.item_name[MAX_NAME_LENGTH] = '\0';
-        fs.seekp(srcPos);
-        fs.write(reinterpret_cast<char*>(&srcItem), sizeof(DirectoryItem));
-        fs.close();
-        std::cout << "OK\n";
-        return;
+        renameDirEntry(parentInodeId, parent, srcIndex, srcItem);
+        return Status::Ok;
     }
 
     // --- STEP 6: Move to another directory ---
-    // Remove from current directory
-    if (entries > 1 && srcPos != dataBlockOffset(parent.direct1) + (entries - 1) * sizeof(DirectoryItem)) {
-        DirectoryItem last{};
-        long long lastPos = dataBlockOffset(parent.direct1) + (entries - 1) * sizeof(DirectoryItem);
-        fs.seekg(lastPos);
-        fs.read(reinterpret_cast<char*>(&last), sizeof(DirectoryItem));
-
-        fs.seekp(srcPos);
-        fs.write(reinterpret_cast<char*>(&last), sizeof(DirectoryItem));
-    }
-
-    parent.file_size -= sizeof(DirectoryItem);
-    writeInode(parentInodeId, parent);
-
-    // Add entry to destination directory
+    // Add entry to destination directory first, so a full
+    // destination leaves the item where it was
     DirectoryItem newEntry{};
     newEntry.inode = srcInodeId;
     std::strncpy(newEntry.item_name, destFileName.c_str(), MAX_NAME_LENGTH);
     newEntry.item_name[MAX_NAME_LENGTH] = '\0';
 
-    std::fstream destFs(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    long long destOffset = dataBlockOffset(destDir.direct1) + destDir.file_size;
-    destFs.seekp(destOffset);
-    destFs.write(reinterpret_cast<char*>(&newEntry), sizeof(DirectoryItem));
-    destFs.close();
+    if (!addDirEntry(destDirInodeId, destDir, newEntry)) {
+        return failure(Status::IoError);
+    }
 
-    destDir.file_size += sizeof(DirectoryItem);
-    writeInode(destDirInodeId, destDir);
+    // Remove from source directory
+    removeDirEntry(parentInodeId, parent, srcIndex);
+
+    // A moved directory's ".." now refers to its new parent
+    if (moved.is_directory) {
+        DirectoryItem dotdot{};
+        dotdot.inode = destDirInodeId;
+        std::strcpy(dotdot.item_name, "..");
+        writeDirEntry(moved, 1, dotdot);
+        dentries_.insert(srcInodeId, "..", destDirInodeId);
+    }
 
-    fs.close();
-    std::cout << "OK\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// incp
+// importFile
 // -------------------------------------------------
 // Imports a file from the host filesystem into the VFS.
 // Reads the real file, allocates inode and data block,
 // and writes its content to the virtual filesystem.
 // -------------------------------------------------
-void FileSystem::incp(const std::string& sourceHostPath, const std::string& destVfsPath) {
-    // --- STEP 1: Read real file ---
-    std::ifstream input(sourceHostPath, std::ios::binary);
-    if (!input.is_open()) {
-        std::cerr << "FILE NOT FOUND\n";
-        return;
-    }
-
-    std::vector<char> content((std::istreambuf_iterator<char>(input)),
-        std::istreambuf_iterator<char>());
-    input.close();
+Status FileSystem::importFile(const std::string& sourceHostPath, const std::string& destVfsPath) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
-    // Check for BOM
-    if (content.size() >= 3) {
-        unsigned char b0 = (unsigned char)content[0];
-        unsigned char b1 = (unsigned char)content[1];
-        unsigned char b2 = (unsigned char)content[2];
-        if (b0 == 0xEF && b1 == 0xBB && b2 == 0xBF) {
-            // Remove UTF-8 BOM
-            content.erase(content.begin(), content.begin() + 3);
-        }
-    }
+    // --- STEP 1: Open real file (content is streamed below) ---
+    std::ifstream input(sourceHostPath, std::ios::binary | std::ios::ate);
+    if (!input.is_open()) return Status::FileNotFound;
 
-    // --- STEP 2: Parse destination path ---
-    size_t slashPos = destVfsPath.find('/');
-    std::string destDirName;
-    std::string destFileName;
+    long long contentSize = static_cast<long long>(input.tellg());
+    if (contentSize < 0) return Status::FileNotFound;
+    input.seekg(0);
 
-    if (slashPos == std::string::npos) {
-        destDirName = "";
-        destFileName = destVfsPath;
+    // Skip UTF-8 BOM
+    char bom[3] = {};
+    if (contentSize >= 3 && input.read(bom, 3) &&
+        (unsigned char)bom[0] == 0xEF && (unsigned char)bom[1] == 0xBB && (unsigned char)bom[2] == 0xBF) {
+        contentSize -= 3;
     }
     else {
-        destDirName = destVfsPath.substr(0, slashPos);
-        destFileName = destVfsPath.substr(slashPos + 1);
+        input.clear();
+        input.seekg(0);
     }
 
-    // --- STEP 3: Locate destination directory ---
-    int destDirInodeId = currentDirInode_;
-    Inode parent = readInode(destDirInodeId);
-
-    std::ifstream fs(filename_, std::ios::binary);
-    if (!fs.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    if (!destDirName.empty()) {
-        fs.seekg(dataBlockOffset(parent.direct1));
-        DirectoryItem item{};
-        int entries = parent.file_size / sizeof(DirectoryItem);
-        bool found = false;
-
-        for (int i = 0; i < entries; ++i) {
-            fs.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-            if (std::string(item.item_name) == destDirName) {
-                Inode check = readInode(item.inode);
-                if (check.is_directory) {
-                    destDirInodeId = item.inode;
-                    found = true;
-                }
-                break;
-            }
-        }
+    // --- STEP 2: Locate destination directory ---
+    std::string destFileName;
+    const int destDirInodeId = resolveParent(destVfsPath, destFileName);
+    if (destDirInodeId == -1) return Status::PathNotFound;
 
-        if (!found) {
-            std::cerr << "PATH NOT FOUND\n";
-            fs.close();
-            return;
-        }
-    }
-    fs.close();
+    // --- STEP 3: Validate the new name ---
+    if (!isValidName(destFileName)) return Status::InvalidName;
 
     // --- STEP 4: Create file in destination directory ---
-    if (directoryContains(destDirInodeId, destFileName)) {
-        std::cerr << "EXIST\n";
-        return;
-    }
+    InodeLocks::Guard lock = locks_.exclusive(destDirInodeId);
+    if (!isLive(destDirInodeId) || !readInode(destDirInodeId).is_directory) return Status::PathNotFound;
+    if (directoryContains(destDirInodeId, destFileName)) return Status::Exists;
 
-    int newInodeId = allocateFreeInode();
-    if (newInodeId == -1) {
-        std::cerr << "NO SPACE\n";
-        return;
-    }
+    int newInodeId = allocateFreeInode(destDirInodeId);
+    if (newInodeId == -1) return failure(Status::NoSpace);
 
-    // --- STEP 5: Allocate blocks and write content ---
-    int contentSize = static_cast<int>(content.size());
-    int blocksNeeded = (contentSize + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
-    
-    // Batch allocate all needed blocks upfront (including indirect block pointers)
-    int extraBlocksForIndirection = 0;
-    if (blocksNeeded > 5) {
-        int indirectBlocksNeeded = blocksNeeded - 5;
-        if (indirectBlocksNeeded > 0) extraBlocksForIndirection++;  // indirect1
-        if (indirectBlocksNeeded > 256) extraBlocksForIndirection++; // indirect2
-    }
-    
-    std::vector<int> allBlocks = allocateFreeDataBlocks(blocksNeeded + extraBlocksForIndirection);
-    if (allBlocks.size() != blocksNeeded + extraBlocksForIndirection) {
-        std::cerr << "NO SPACE\n";
-        return;
-    }
-    
-    std::vector<int> directBlocks(5, 0);
-    std::vector<int> indirectBlocks;
-    int indirect1 = 0, indirect2 = 0;
-    int blockIndex = 0;
-    
-    std::fstream vfs(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    int written = 0;
-    
-    // Assign first 5 blocks as direct blocks
-    for (int i = 0; i < std::min(5, (int)allBlocks.size()); ++i) {
-        directBlocks[i] = allBlocks[blockIndex++];
-        int toWrite = std::min(CLUSTER_SIZE, contentSize - written);
-        vfs.seekp(dataBlockOffset(directBlocks[i]));
-        vfs.write(content.data() + written, toWrite);
-        written += toWrite;
+    // --- STEP 5: Allocate blocks and stream content ---
+    // Data lands in one contiguous run where possible
+    const int clusterSize = layout_.clusterSize;
+    if (contentSize > static_cast<long long>(blockMap_.maxBlocks()) * clusterSize ||
+        contentSize > std::numeric_limits<int32_t>::max()) {
+        freeInode(newInodeId);
+        return Status::NoSpace;
     }
-    
-    // Handle indirect blocks if needed
-    if (blocksNeeded > 5) {
-        int indirectBlocksNeeded = blocksNeeded - 5;
-        
-        // Use pre-allocated indirect1 block
-        indirect1 = allBlocks[blockIndex++];
-        
-        // Collect indirect1 blocks
-        std::vector<int> indirect1Blocks;
-        int blocksForIndirect1 = std::min(256, indirectBlocksNeeded);
-        for (int i = 0; i < blocksForIndirect1; ++i) {
-            indirect1Blocks.push_back(allBlocks[blockIndex++]);
-            indirectBlocks.push_back(allBlocks[blockIndex - 1]);
-        }
-        
-        // Write pointers for indirect1
-        vfs.seekp(dataBlockOffset(indirect1));
-        for (int i = 0; i < indirect1Blocks.size(); ++i) {
-            int32_t ptr = indirect1Blocks[i];
-            vfs.write(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-        }
-        
-        // Write data for indirect1 blocks
-        for (int i = 0; i < indirect1Blocks.size(); ++i) {
-            int toWrite = std::min(CLUSTER_SIZE, contentSize - written);
-            vfs.seekp(dataBlockOffset(indirect1Blocks[i]));
-            vfs.write(content.data() + written, toWrite);
-            written += toWrite;
-        }
-        
-        // Handle indirect2 if needed
-        if (indirectBlocksNeeded > 256) {
-            // Use pre-allocated indirect2 block
-            indirect2 = allBlocks[blockIndex++];
-            
-            // Collect indirect2 blocks
-            std::vector<int> indirect2Blocks;
-            int blocksForIndirect2 = indirectBlocksNeeded - 256;
-            
-            for (int i = 0; i < blocksForIndirect2; ++i) {
-                if (blockIndex >= allBlocks.size()) {
-                    break;
-                }
-                indirect2Blocks.push_back(allBlocks[blockIndex++]);
-                indirectBlocks.push_back(allBlocks[blockIndex - 1]);
-            }
-            
-            // Write pointers for indirect2
-            vfs.seekp(dataBlockOffset(indirect2));
-            for (int i = 0; i < indirect2Blocks.size(); ++i) {
-                int32_t ptr = indirect2Blocks[i];
-                vfs.write(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-            }
-            
-            // Write data for indirect2 blocks
-            for (int i = 0; i < indirect2Blocks.size(); ++i) {
-                int toWrite = std::min(CLUSTER_SIZE, contentSize - written);
-                vfs.seekp(dataBlockOffset(indirect2Blocks[i]));
-                vfs.write(content.data() + written, toWrite);
-                written += toWrite;
-            }
+    int blocksNeeded = BlockMap::blocksFor(contentSize, clusterSize);
+
+    // A compressed file (the directory's flag) is coded chunk by chunk instead,
+    // a tiny one kept inline; both go through writeFileRange
+    Inode newFile{};
+    newFile.id = newInodeId;
+    newFile.flags = readInode(destDirInodeId).flags & INODE_COMPRESSED;
+    const bool ranged = isCompressed(newFile) || contentSize <= INLINE_CAPACITY;
+    newFile.file_size = ranged ? 0 : static_cast<int32_t>(contentSize);
+    std::vector<int> dataBlocks;
+    if (!ranged && !allocateFileBlocks(newFile, blocksNeeded, dataBlocks)) {
+        freeInode(newInodeId);
+        return failure(Status::NoSpace);
+    }
+
+    std::vector<char> buffer(std::min<long long>(STREAM_CHUNK_SIZE, static_cast<long long>(blocksNeeded) * clusterSize));
+    const int chunkBlocks = static_cast<int>(buffer.size()) / clusterSize;
+    for (int first = 0; first < blocksNeeded; first += chunkBlocks) {
+        long long offset = static_cast<long long>(first) * clusterSize;
+        long long chunk = std::min<long long>(buffer.size(), contentSize - offset);
+        if (!input.read(buffer.data(), chunk)) {
+            // Host file shrank while reading
+            releaseFileBlocks(newFile);
+            freeInode(newInodeId);
+            return Status::FileNotFound;
+        }
+        if (!ranged) {
+            writeNewBlocks(newFile, 0, dataBlocks, buffer.data(), chunk, first);
+        } else if (!writeFileRange(newFile, offset, buffer.data(), chunk)) {
+            releaseFileBlocks(newFile);
+            freeInode(newInodeId);
+            return failure(Status::IoError);
         }
     }
-    vfs.close();
+    input.close();
 
     // --- STEP 6: Create inode and directory entry ---
-    Inode newFile{};
-    newFile.id = newInodeId;
     newFile.is_directory = false;
     newFile.references = 1;
-    newFile.file_size = contentSize;
-    
-    newFile.direct1 = directBlocks[0];
-    newFile.direct2 = directBlocks[1];
-    newFile.direct3 = directBlocks[2];
-    newFile.direct4 = directBlocks[3];
-    newFile.direct5 = directBlocks[4];
-    if (indirect1 > 0) newFile.indirect1 = indirect1;
-    if (indirect2 > 0) newFile.indirect2 = indirect2;
-    
+
     writeInode(newInodeId, newFile);
 
     Inode destDir = readInode(destDirInodeId);
@@ -1250,468 +671,237 @@ void FileSystem::incp(const std::string& sourceHostPath, const std::string& dest
     std::strncpy(newItem.item_name, destFileName.c_str(), MAX_NAME_LENGTH);
     newItem.item_name[MAX_NAME_LENGTH] = '\0';
 
-    std::fstream dirFile(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    long long offset = dataBlockOffset(destDir.direct1) + destDir.file_size;
-    dirFile.seekp(offset);
-    dirFile.write(reinterpret_cast<char*>(&newItem), sizeof(DirectoryItem));
-    dirFile.close();
-
-    destDir.file_size += sizeof(DirectoryItem);
-    writeInode(destDirInodeId, destDir);
+    if (!addDirEntry(destDirInodeId, destDir, newItem)) {
+        releaseFileBlocks(newFile);
+        freeInode(newInodeId);
+        return failure(Status::IoError);
+    }
 
-    std::cout << "OK\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// outcp
+// exportFile
 // -------------------------------------------------
 // Exports a file from the virtual filesystem to the
 // host filesystem. Reads VFS content and writes it
 // into a real file on the host disk.
 // -------------------------------------------------
-void FileSystem::outcp(const std::string& sourceVfsPath, const std::string& destHostPath) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::exportFile(const std::string& sourceVfsPath, const std::string& destHostPath) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (sourceVfsPath.empty() || destHostPath.empty()) {
-        std::cerr << "INVALID INPUT\n";
-        return;
-    }
+    if (sourceVfsPath.empty() || destHostPath.empty()) return Status::InvalidInput;
 
-    // --- STEP 2: Parse VFS source path ---
-    size_t slashPos = sourceVfsPath.find('/');
-    std::string srcDirName;
+    // --- STEP 2: Find source directory ---
     std::string srcFileName;
+    const int srcDirInodeId = resolveParent(sourceVfsPath, srcFileName);
+    if (srcDirInodeId == -1) return Status::PathNotFound;
 
-    if (slashPos == std::string::npos) {
-        srcDirName = "";
-        srcFileName = sourceVfsPath;
-    }
-    else {
-        srcDirName = sourceVfsPath.substr(0, slashPos);
-        srcFileName = sourceVfsPath.substr(slashPos + 1);
-    }
-
-    // --- STEP 3: Find source file in current or specified directory ---
-    int srcDirInodeId = parentInodeId;
-    Inode parent = readInode(srcDirInodeId);
-
-    std::ifstream fs(filename_, std::ios::binary);
-    if (!fs.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    if (!srcDirName.empty()) {
-        fs.seekg(dataBlockOffset(parent.direct1));
-        DirectoryItem item{};
-        int entries = parent.file_size / sizeof(DirectoryItem);
-        bool foundDir = false;
-
-        for (int i = 0; i < entries; ++i) {
-            fs.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-            if (std::string(item.item_name) == srcDirName) {
-                Inode check = readInode(item.inode);
-                if (check.is_directory) {
-                    srcDirInodeId = item.inode;
-                    foundDir = true;
-                }
-                break;
-            }
-        }
-
-        if (!foundDir) {
-            std::cerr << "PATH NOT FOUND\n";
-            fs.close();
-            return;
-        }
-    }
-
-    fs.close();
-
-    // --- STEP 4: Locate file ---
-    Inode srcDir = readInode(srcDirInodeId);
-    std::ifstream vfs(filename_, std::ios::binary);
-    if (!vfs.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    vfs.seekg(dataBlockOffset(srcDir.direct1));
-    DirectoryItem item{};
-    int entries = srcDir.file_size / sizeof(DirectoryItem);
+    // --- STEP 3: Locate and lock file ---
     int fileInodeId = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        vfs.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == srcFileName) {
-            fileInodeId = item.inode;
-            break;
-        }
-    }
-
-    if (fileInodeId == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
+    {
+        InodeLocks::Guard dirLock = locks_.shared(srcDirInodeId);
+        fileInodeId = lookup(srcDirInodeId, srcFileName);
     }
+    if (fileInodeId == -1) return Status::FileNotFound;
 
+    InodeLocks::Guard lock = locks_.shared(fileInodeId);
     Inode srcFile = readInode(fileInodeId);
-    if (srcFile.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
+    if (!isLive(fileInodeId) || srcFile.is_directory) return Status::FileNotFound;
 
-    // --- STEP 5: Read file content from VFS ---
-    if (srcFile.file_size == 0 || srcFile.direct1 == 0) {
+    // --- STEP 4: Read file content from VFS ---
+    if (srcFile.file_size == 0) {
         std::ofstream output(destHostPath, std::ios::binary);
-        if (!output.is_open()) {
-            std::cerr << "PATH NOT FOUND\n";
-            vfs.close();
-            return;
-        }
+        if (!output.is_open()) return Status::PathNotFound;
         output.close();
-        std::cout << "OK\n";
-        return;
-    }
-
-    // Build list of blocks to read
-    std::vector<int> blockList;
-    
-    // Add direct blocks
-    if (srcFile.direct1 > 0) blockList.push_back(srcFile.direct1);
-    if (srcFile.direct2 > 0) blockList.push_back(srcFile.direct2);
-    if (srcFile.direct3 > 0) blockList.push_back(srcFile.direct3);
-    if (srcFile.direct4 > 0) blockList.push_back(srcFile.direct4);
-    if (srcFile.direct5 > 0) blockList.push_back(srcFile.direct5);
-    
-    // Add indirect blocks (read pointers from indirect blocks)
-    if (srcFile.indirect1 > 0) {
-        vfs.seekg(dataBlockOffset(srcFile.indirect1));
-        for (int i = 0; i < 256; ++i) {
-            int32_t ptr = 0;
-            vfs.read(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-            if (ptr > 0) {
-                blockList.push_back(ptr);
-            } else {
-                break;
-            }
-        }
-    }
-    
-    if (srcFile.indirect2 > 0) {
-        vfs.seekg(dataBlockOffset(srcFile.indirect2));
-        for (int i = 0; i < 256; ++i) {
-            int32_t ptr = 0;
-            vfs.read(reinterpret_cast<char*>(&ptr), sizeof(int32_t));
-            if (ptr > 0) {
-                blockList.push_back(ptr);
-            } else {
-                break;
-            }
-        }
-    }
-
-    // Read content from all blocks
-    std::vector<char> buffer(srcFile.file_size);
-    int totalRead = 0;
-    for (int blockId : blockList) {
-        if (totalRead >= srcFile.file_size) break;
-        
-        int toRead = std::min(CLUSTER_SIZE, srcFile.file_size - totalRead);
-        vfs.seekg(dataBlockOffset(blockId));
-        vfs.read(buffer.data() + totalRead, toRead);
-        totalRead += toRead;
+        return Status::Ok;
     }
-    vfs.close();
 
-    // --- STEP 6: Write to host file ---
+    // --- STEP 5: Stream content to host file ---
+    // Holes are skipped with a seek, so the host file is sparse too
     std::ofstream output(destHostPath, std::ios::binary);
-    if (!output.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    output.write(buffer.data(), srcFile.file_size);
+    if (!output.is_open()) return Status::PathNotFound;
+
+    // (the next chunk is read while this one is written)
+    const bool exported = streamFile(srcFile, [&output](size_t, const char* data, long long length) {
+        if (data == nullptr) output.seekp(length, std::ios::cur);
+        else output.write(data, length);
+        return output.good();
+    });
     output.close();
+    if (!exported) return Status::IoError;
 
-    std::cout << "OK\n";
+    // A trailing hole leaves the host file short of the full size
+    std::error_code resized;
+    std::filesystem::resize_file(destHostPath, static_cast<std::uintmax_t>(srcFile.file_size), resized);
+
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// xcp
+// concatenate
 // -------------------------------------------------
-// Concatenates two files (s1 + s2) into a new file s3
-// inside the same directory of the virtual filesystem.
+// Concatenates two files (s1 + s2) into a new file s3.
+// All three are paths in the virtual filesystem.
 // -------------------------------------------------
-void FileSystem::xcp(const std::string& s1, const std::string& s2, const std::string& s3) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::concatenate(const std::string& s1, const std::string& s2, const std::string& s3) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (s1.empty() || s2.empty() || s3.empty()) {
-        std::cerr << "INVALID INPUT\n";
-        return;
-    }
+    if (s1.empty() || s2.empty() || s3.empty()) return Status::InvalidInput;
 
-    // --- STEP 2: Verify current directory ---
-    Inode parent = readInode(parentInodeId);
-    if (!parent.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    std::ifstream vfs(filename_, std::ios::binary);
-    if (!vfs.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    // --- STEP 2: Resolve destination directory ---
+    std::string destName;
+    const int parentInodeId = resolveParent(s3, destName);
+    if (parentInodeId == -1) return Status::PathNotFound;
 
     // --- STEP 3: Find s1 ---
-    vfs.seekg(dataBlockOffset(parent.direct1));
-    DirectoryItem item{};
-    int entries = parent.file_size / sizeof(DirectoryItem);
-    int inode1 = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        vfs.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == s1) {
-            inode1 = item.inode;
-            break;
-        }
-    }
-
-    if (inode1 == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
-
-    Inode f1 = readInode(inode1);
-    if (f1.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
+    int inode1 = resolvePath(s1);
+    if (inode1 == -1) return Status::FileNotFound;
 
     // --- STEP 4: Find s2 ---
-    vfs.clear();
-    vfs.seekg(dataBlockOffset(parent.direct1));
-    int inode2 = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        vfs.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == s2) {
-            inode2 = item.inode;
-            break;
-        }
-    }
-
-    if (inode2 == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
+    int inode2 = resolvePath(s2);
+    if (inode2 == -1) return Status::FileNotFound;
 
+    // Lock both sources and the destination directory
+    InodeLocks::Guard lock = locks_.acquire({ { inode1, InodeLocks::Mode::Shared },
+                                              { inode2, InodeLocks::Mode::Shared },
+                                              { parentInodeId, InodeLocks::Mode::Exclusive } });
+    Inode f1 = readInode(inode1);
     Inode f2 = readInode(inode2);
-    if (f2.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
+    if (!isLive(inode1) || !isLive(inode2) || f1.is_directory || f2.is_directory) return Status::FileNotFound;
 
-    // --- STEP 5: Read content of s1 and s2 ---
-    std::string combined;
-    if (f1.file_size > 0 && f1.direct1 > 0) {
-        vfs.seekg(dataBlockOffset(f1.direct1));
-        std::vector<char> buf1(f1.file_size);
-        vfs.read(buf1.data(), f1.file_size);
-        combined.append(buf1.begin(), buf1.end());
-    }
+    // --- STEP 5: Size of the result ---
+    const long long size1 = f1.file_size;
+    const long long totalSize = size1 + f2.file_size;
+    if (totalSize > std::numeric_limits<int32_t>::max()) return Status::NoSpace;
 
-    if (f2.file_size > 0 && f2.direct1 > 0) {
-        vfs.seekg(dataBlockOffset(f2.direct1));
-        std::vector<char> buf2(f2.file_size);
-        vfs.read(buf2.data(), f2.file_size);
-        combined.append(buf2.begin(), buf2.end());
-    }
-
-    vfs.close();
-
-    // --- STEP 6: Check destination existence ---
-    if (directoryContains(parentInodeId, s3)) {
-        std::cerr << "EXIST\n";
-        return;
-    }
+    // --- STEP 6: Check destination name and existence ---
+    if (!isValidName(destName)) return Status::InvalidName;
+    if (!isLive(parentInodeId) || !readInode(parentInodeId).is_directory) return Status::PathNotFound;
+    if (directoryContains(parentInodeId, destName)) return Status::Exists;
 
     // --- STEP 7: Create new file s3 ---
-    int newInodeId = allocateFreeInode();
-    if (newInodeId == -1) {
-        std::cerr << "NO SPACE\n";
-        return;
-    }
+    int newInodeId = allocateFreeInode(parentInodeId);
+    if (newInodeId == -1) return failure(Status::NoSpace);
 
     Inode newFile{};
     newFile.id = newInodeId;
     newFile.is_directory = false;
     newFile.references = 1;
-    newFile.file_size = static_cast<int>(combined.size());
-
-    if (!combined.empty()) {
-        int newBlock = allocateFreeDataBlock();
-        if (newBlock == -1) {
-            std::cerr << "NO SPACE\n";
-            return;
+    newFile.flags = readInode(parentInodeId).flags & INODE_COMPRESSED;
+    const bool ranged = isCompressed(newFile) || totalSize <= INLINE_CAPACITY;
+    newFile.file_size = ranged ? 0 : static_cast<int32_t>(totalSize);
+
+    // Stream s1 and then s2 chunk by chunk into one contiguous run
+    // (compressed: coded chunk by chunk, tiny: kept inline); a chunk
+    // that straddles the two takes the head of s2
+    if (totalSize > 0) {
+        const int clusterSize = layout_.clusterSize;
+        int blocksNeeded = BlockMap::blocksFor(totalSize, clusterSize);
+        std::vector<int> dataBlocks;
+        if (!ranged && !allocateFileBlocks(newFile, blocksNeeded, dataBlocks)) {
+            freeInode(newInodeId);
+            return failure(Status::NoSpace);
+        }
+
+        std::vector<char> buffer(std::min<long long>(STREAM_CHUNK_SIZE, static_cast<long long>(blocksNeeded) * clusterSize));
+        const int chunkBlocks = static_cast<int>(buffer.size()) / clusterSize;
+        for (int first = 0; first < blocksNeeded; first += chunkBlocks) {
+            long long offset = static_cast<long long>(first) * clusterSize;
+            long long chunk = std::min<long long>(buffer.size(), totalSize - offset);
+            long long fromFirst = std::clamp<long long>(size1 - offset, 0, chunk);
+            readFileRange(f1, offset, buffer.data(), fromFirst);
+            readFileRange(f2, offset + fromFirst - size1, buffer.data() + fromFirst, chunk - fromFirst);
+            if (!ranged) {
+                writeNewBlocks(newFile, 0, dataBlocks, buffer.data(), chunk, first);
+            } else if (!writeFileRange(newFile, offset, buffer.data(), chunk)) {
+                releaseFileBlocks(newFile);
+                freeInode(newInodeId);
+                return failure(Status::IoError);
+            }
         }
-
-        newFile.direct1 = newBlock;
-        std::fstream fs(filename_, std::ios::in | std::ios::out | std::ios::binary);
-        fs.seekp(dataBlockOffset(newBlock));
-        fs.write(combined.c_str(), combined.size());
-        fs.close();
     }
 
     writeInode(newInodeId, newFile);
 
     // --- STEP 8: Add directory entry ---
+    Inode parent = readInode(parentInodeId);
     DirectoryItem newItem{};
     newItem.inode = newInodeId;
-    std::strncpy(newItem.item_name, s3.c_str(), MAX_NAME_LENGTH);
+    std::strncpy(newItem.item_name, destName.c_str(), MAX_NAME_LENGTH);
     newItem.item_name[MAX_NAME_LENGTH] = '\0';
 
-    std::fstream parentFile(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    long long offset = dataBlockOffset(parent.direct1) + parent.file_size;
-    parentFile.seekp(offset);
-    parentFile.write(reinterpret_cast<char*>(&newItem), sizeof(DirectoryItem));
-    parentFile.close();
-
-    parent.file_size += sizeof(DirectoryItem);
-    writeInode(parentInodeId, parent);
+    if (!addDirEntry(parentInodeId, parent, newItem)) {
+        releaseFileBlocks(newFile);
+        freeInode(newInodeId);
+        return failure(Status::IoError);
+    }
 
-    std::cout << "OK\n";
+    return Status::Ok;
 }
 
 // -------------------------------------------------
-// add
+// append
 // -------------------------------------------------
 // Appends the content of file s2 to file s1
-// within the same directory of the virtual filesystem.
+// (both paths in the virtual filesystem).
+// s1 is extended in place: its partly used last
+// block is filled and only the new blocks are
+// allocated, so the cost follows the size of s2.
 // -------------------------------------------------
-void FileSystem::add(const std::string& s1, const std::string& s2) {
-    const int parentInodeId = currentDirInode_;
+Status FileSystem::append(const std::string& s1, const std::string& s2) {
+    std::shared_lock<std::shared_mutex> fsGuard(fsLock_);
 
     // --- STEP 1: Validate input ---
-    if (s1.empty() || s2.empty()) {
-        std::cerr << "INVALID INPUT\n";
-        return;
-    }
-
-    Inode parent = readInode(parentInodeId);
-    if (!parent.is_directory) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
-
-    std::ifstream vfs(filename_, std::ios::binary);
-    if (!vfs.is_open()) {
-        std::cerr << "PATH NOT FOUND\n";
-        return;
-    }
+    if (s1.empty() || s2.empty()) return Status::InvalidInput;
 
     // --- STEP 2: Locate s1 ---
-    vfs.seekg(dataBlockOffset(parent.direct1));
-    DirectoryItem item{};
-    int entries = parent.file_size / sizeof(DirectoryItem);
-    int inode1 = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        vfs.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == s1) {
-            inode1 = item.inode;
-            break;
-        }
-    }
-
-    if (inode1 == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
-
-    Inode f1 = readInode(inode1);
-    if (f1.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
+    int inode1 = resolvePath(s1);
+    if (inode1 == -1) return Status::FileNotFound;
 
     // --- STEP 3: Locate s2 ---
-    vfs.clear();
-    vfs.seekg(dataBlockOffset(parent.direct1));
-    int inode2 = -1;
-
-    for (int i = 0; i < entries; ++i) {
-        vfs.read(reinterpret_cast<char*>(&item), sizeof(DirectoryItem));
-        if (std::string(item.item_name) == s2) {
-            inode2 = item.inode;
-            break;
-        }
-    }
-
-    if (inode2 == -1) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
+    int inode2 = resolvePath(s2);
+    if (inode2 == -1) return Status::FileNotFound;
 
+    // s1 is rewritten, s2 only read (one lock if they are the same file)
+    InodeLocks::Guard lock = locks_.acquire({ { inode1, InodeLocks::Mode::Exclusive },
+                                              { inode2, InodeLocks::Mode::Shared } });
+    Inode f1 = readInode(inode1);
     Inode f2 = readInode(inode2);
-    if (f2.is_directory) {
-        std::cerr << "FILE NOT FOUND\n";
-        vfs.close();
-        return;
-    }
-
-    // --- STEP 4: Read s2 content ---
-    std::string content2;
-    if (f2.file_size > 0 && f2.direct1 > 0) {
-        vfs.seekg(dataBlockOffset(f2.direct1));
-        std::vector<char> buf2(f2.file_size);
-        vfs.read(buf2.data(), f2.file_size);
-        content2.assign(buf2.begin(), buf2.end());
-    }
-    vfs.close();
-
-    // --- STEP 5: Read s1 content ---
-    std::string content1;
-    if (f1.file_size > 0 && f1.direct1 > 0) {
-        std::ifstream fs(filename_, std::ios::binary);
-        fs.seekg(dataBlockOffset(f1.direct1));
-        std::vector<char> buf1(f1.file_size);
-        fs.read(buf1.data(), f1.file_size);
-        fs.close();
-        content1.assign(buf1.begin(), buf1.end());
-    }
-
-    // --- STEP 6: Combine and write back ---
-    std::string combined = content1 + content2;
-
-    int newBlock = f1.direct1;
-    if (newBlock == 0) {
-        newBlock = allocateFreeDataBlock();
-        if (newBlock == -1) {
-            std::cerr << "NO SPACE\n";
-            return;
-        }
-        f1.direct1 = newBlock;
-    }
-
-    std::fstream fs(filename_, std::ios::in | std::ios::out | std::ios::binary);
-    fs.seekp(dataBlockOffset(newBlock));
-    fs.write(combined.c_str(), combined.size());
-    fs.close();
-
-    f1.file_size = static_cast<int>(combined.size());
+    if (!isLive(inode1) || !isLive(inode2) || f1.is_directory || f2.is_directory) return Status::FileNotFound;
+
+    // --- STEP 4: Check the final size ---
+    const long long oldSize = f1.file_size;
+    const long long appendSize = f2.file_size;
+    if (oldSize + appendSize > std::numeric_limits<int32_t>::max() ||
+        BlockMap::blocksFor(oldSize + appendSize, layout_.clusterSize) > blockMap_.maxBlocks()) {
+        return Status::NoSpace;
+    }
+
+    // --- STEP 5: Append s2 chunk by chunk ---
+    // appendSize is a snapshot: with s1 == s2 only the original bytes are
+    // copied. They are read through f1 itself, whose bytes below oldSize
+    // never change (a compressed s1 recodes its last chunk into new
+    // blocks, so f2's pointers would go stale)
+    const Inode& source = inode1 == inode2 ? f1 : f2;
+    std::vector<char> buffer(static_cast<size_t>(std::min<long long>(STREAM_CHUNK_SIZE, appendSize)));
+    for (long long done = 0; done < appendSize; ) {
+        long long chunk = std::min<long long>(buffer.size(), appendSize - done);
+        const bool read = readFileRange(source, done, buffer.data(), chunk);
+        if (!read || !writeFileRange(f1, oldSize + done, buffer.data(), chunk)) {
+            // Give back what was appended so far
+            const Status status = read ? failure(Status::IoError) : Status::IoError;
+            shrinkFile(f1, oldSize);
+            writeInode(inode1, f1);
+            return status;
+        }
+        done += chunk;
+    }
+
+    // --- STEP 6: Update inode ---
     writeInode(inode1, f1);
 
-    std::cout << "OK\n";
+    return Status::Ok;
 }
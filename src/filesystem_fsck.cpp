@@ -0,0 +1,496 @@
+// =============================================
+// filesystem_fsck.cpp
+// ---------------------------------------------
+// Consistency check (fsck)
+// Handles:
+//   - Reading the inode table in large chunks and
+//     checking the chunks in parallel
+//   - Reachability of every inode from the root
+//   - Leaked, unmarked and cross-linked blocks,
+//     share counts of shared blocks
+//   - Comparing both bitmaps with what is in use,
+//     word by word, and rewriting them (--repair)
+//   - The directory count statfs reports
+// =============================================
+
+#include "filesystem.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include "work_pool.h"
+
+namespace {
+
+constexpr int CHUNK_INODES = 8192;      // Inodes per range (320 KB of table per read)
+constexpr size_t MAX_PROBLEMS = 20;     // Problem lines kept per range and in the report
+
+// Counts one more claim of a block (saturating). 16 bits: a block
+// may have 1 + RefcountTable::MAX_SHARES owners, one more than 8 hold
+inline void addClaim(std::vector<uint16_t>& claims, int blockId) {
+    if (claims[blockId] < UINT16_MAX) ++claims[blockId];
+}
+
+inline void setBit(std::vector<uint64_t>& words, int bit) {
+    words[bit / 64] |= 1ULL << (bit % 64);
+}
+
+inline void note(std::vector<std::string>& problems, const std::string& text) {
+    if (problems.size() < MAX_PROBLEMS) problems.push_back(text);
+}
+
+} // namespace
+
+// One range of the inode table and what its inodes
+// hold. A task only writes its own range and the
+// per-inode slots of its own inodes.
+struct FileSystem::FsckRange {
+    int first = 0;                              // First inode of the range
+    int count = 0;                              // Inodes in it
+    int blockLimit = 0;                         // Data blocks that exist on the image
+    std::vector<std::pair<int, int>> entries;   // (directory, inode) of every entry but "." and ".."
+    std::vector<int> shared;                    // File data blocks (may have several owners)
+    std::vector<int> owned;                     // Directory, pointer and index blocks (one owner)
+    std::vector<std::string> problems;
+    int badInodes = 0;
+    int badEntries = 0;
+    int unreadableDirectories = 0;
+    int badChecksums = 0;
+};
+
+// -------------------------------------------------
+// checkFilesystem
+// -------------------------------------------------
+// Checks the whole image under the exclusive lock:
+//   1. the inode table is read range by range (one
+//      read per range) and every used inode and
+//      directory is checked, ranges in parallel
+//   2. the tree is walked from the root: orphans,
+//      items named twice, wrong ".." entries
+//   3. the blocks each reachable item owns are
+//      collected, ranges in parallel, and merged
+//      with the metadata regions into claim counts
+//   4. both bitmaps are compared with the used sets
+//   5. with repair, and only if the tree itself is
+//      intact, the bitmaps are rewritten to match
+// The directory count for statfs is taken on the way.
+// -------------------------------------------------
+Status FileSystem::checkFilesystem(FsckReport& report, bool repair) {
+    VFS_TRACE("fsck");
+    std::unique_lock<std::shared_mutex> fsGuard(fsLock_);
+    report = FsckReport{};
+    if (layout_.diskSize == 0 || !flushInodes()) return Status::IoError;
+    // Bitmaps that failed to load at mount can't be compared
+    if (inodeBitmap_.capacity() < layout_.inodeCount || dataBitmap_.capacity() < layout_.dataBits) return Status::IoError;
+
+    // --- STEP 1: Load and check the inode table ---
+    const int inodeCount = layout_.inodeCount;
+    const int blockLimit = static_cast<int>(std::min<long long>(layout_.dataBits,
+                                                                (layout_.diskSize - layout_.dataStart) / layout_.clusterSize));
+    std::vector<FsckRange> ranges;
+    for (int group = 0; group < layout_.groupCount; ++group) {
+        const int sliceFirst = group * layout_.inodesPerGroup;
+        const int sliceEnd = std::min(inodeCount, sliceFirst + layout_.inodesPerGroup);
+        for (int first = sliceFirst; first < sliceEnd; first += CHUNK_INODES) {
+            FsckRange range;
+            range.first = first;
+            range.count = std::min(CHUNK_INODES, sliceEnd - first);
+            range.blockLimit = blockLimit;
+            ranges.push_back(std::move(range));
+        }
+    }
+
+    std::vector<Inode> table(inodeCount);
+    std::vector<int> parents(inodeCount, -1);   // ".." of each directory
+    std::vector<uint8_t> bad(inodeCount, 0);    // Fields that can't be trusted
+    std::vector<int> entryFaults(inodeCount, 0); // Bad entries of a directory (-1: unreadable)
+    std::atomic<bool> unreadable{ false };
+    const int workerCount = static_cast<int>(std::clamp<size_t>(std::thread::hardware_concurrency(), 1, ranges.size()));
+    WorkPool pool(workerCount);
+    for (FsckRange& range : ranges) {
+        pool.submit([this, &range, &table, &parents, &bad, &entryFaults, &unreadable](int) {
+            if (!fsckLoad(range, table)) {
+                unreadable = true;
+                return;
+            }
+            for (int id = range.first; id < range.first + range.count; ++id) {
+                if (!inodeBitmap_.test(id)) continue;
+                if (!fsckInode(id, table[id], range)) {
+                    bad[id] = 1;
+                } else if (table[id].is_directory) {
+                    const int badEntries = range.badEntries;
+                    const int unreadableDirectories = range.unreadableDirectories;
+                    fsckEntries(id, table[id], parents, range);
+                    entryFaults[id] = range.unreadableDirectories > unreadableDirectories ? -1 : range.badEntries - badEntries;
+                }
+            }
+        });
+    }
+    pool.wait();
+    if (unreadable) return Status::IoError;
+
+    // Faults are counted once the walk shows which inodes are
+    // reachable: an orphan is dropped by the repair, not a fault
+    std::vector<std::pair<int, int>> entries;
+    for (FsckRange& range : ranges) {
+        entries.insert(entries.end(), range.entries.begin(), range.entries.end());
+        for (const std::string& line : range.problems) note(report.problems, line);
+        range.entries.clear();
+        range.problems.clear();
+        report.badChecksums += range.badChecksums;
+        range.badInodes = range.badEntries = range.unreadableDirectories = range.badChecksums = 0;
+    }
+
+    // --- STEP 2: Walk the tree from the root ---
+    // Ranges list their directories in inode order, so the
+    // entries are sorted by directory already
+    FsckRange walk;
+    walk.blockLimit = blockLimit;
+    std::vector<uint8_t> reachable(inodeCount, 0);
+    std::vector<std::pair<int, int>> queue;     // (directory, the directory naming it)
+    if (!inodeBitmap_.test(0) && !fsckInode(0, table[0], walk)) bad[0] = 1;
+    if (bad[0] || !table[0].is_directory) {
+        if (!bad[0]) walk.badInodes++;
+        note(walk.problems, "inode 0: the root is not a valid directory");
+    } else {
+        reachable[0] = 1;
+        queue.emplace_back(0, 0);
+    }
+
+    auto byDirectory = [](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first < b.first; };
+    std::vector<int> children;
+    for (size_t next = 0; next < queue.size(); ++next) {
+        const int dirId = queue[next].first;
+
+        // A directory marked free was not listed in step 1
+        children.clear();
+        if (inodeBitmap_.test(dirId)) {
+            auto span = std::equal_range(entries.begin(), entries.end(), std::make_pair(dirId, 0), byDirectory);
+            for (auto it = span.first; it != span.second; ++it) children.push_back(it->second);
+        } else {
+            fsckEntries(dirId, table[dirId], parents, walk);
+            for (const auto& entry : walk.entries) children.push_back(entry.second);
+            walk.entries.clear();
+        }
+        if (parents[dirId] != -1 && parents[dirId] != queue[next].second) {
+            walk.badEntries++;
+            note(walk.problems, "directory " + std::to_string(dirId) + ": \"..\" names " +
+                                std::to_string(parents[dirId]) + " instead of " + std::to_string(queue[next].second));
+        }
+
+        for (int child : children) {
+            if (reachable[child]) {
+                walk.badEntries++;
+                note(walk.problems, "inode " + std::to_string(child) + ": named by more than one entry");
+                continue;
+            }
+            reachable[child] = 1;
+            if (!inodeBitmap_.test(child) && !fsckInode(child, table[child], walk)) bad[child] = 1;
+            if (!bad[child] && table[child].is_directory) queue.emplace_back(child, dirId);
+        }
+    }
+    for (int id = 0; id < inodeCount; ++id) {
+        if (!reachable[id] || !inodeBitmap_.test(id)) continue;
+        if (bad[id]) report.badInodes++;
+        if (entryFaults[id] < 0) report.unreadableDirectories++;
+        else report.badEntries += entryFaults[id];
+    }
+    report.badInodes += walk.badInodes;
+    report.badEntries += walk.badEntries;
+    report.unreadableDirectories += walk.unreadableDirectories;
+    for (const std::string& line : walk.problems) note(report.problems, line);
+
+    // --- STEP 3: Collect the blocks in use ---
+    for (FsckRange& range : ranges) {
+        pool.submit([this, &range, &table, &reachable, &bad](int) {
+            for (int id = range.first; id < range.first + range.count; ++id) {
+                if (reachable[id] && !bad[id]) fsckClaims(id, table[id], range);
+            }
+        });
+    }
+    pool.wait();
+
+    std::vector<uint16_t> shared(blockLimit, 0), owned(blockLimit, 0);
+    auto claimRegion = [&owned, blockLimit](int start, int count) {
+        for (int blockId = std::max(start, 0); blockId < start + count && blockId < blockLimit; ++blockId) {
+            addClaim(owned, blockId);
+        }
+    };
+    if (layout_.groupStride > 0) {
+        // Inode table slices live in the data area from format 3 on
+        const int sliceBlocks = BlockMap::blocksFor(static_cast<long long>(layout_.inodesPerGroup) * sizeof(Inode),
+                                                    layout_.clusterSize);
+        for (int group = 0; group < layout_.groupCount; ++group) claimRegion(groupFirstBlock(group) + 1, sliceBlocks);
+    }
+    if (sb_.journal_start_block > 0) claimRegion(sb_.journal_start_block, sb_.journal_block_count);
+    if (sb_.refcount_start_block > 0) claimRegion(sb_.refcount_start_block, sb_.refcount_block_count);
+    if (sb_.checksum_start_block > 0) claimRegion(sb_.checksum_start_block, sb_.checksum_block_count);
+    if (sb_.dedup_start_block > 0) claimRegion(sb_.dedup_start_block, sb_.dedup_block_count);
+
+    for (FsckRange& range : ranges) {
+        for (int blockId : range.shared) addClaim(shared, blockId);
+        for (int blockId : range.owned) addClaim(owned, blockId);
+        report.badInodes += range.badInodes;
+        for (const std::string& line : range.problems) note(report.problems, line);
+        range = FsckRange{};
+    }
+
+    // A block has one owner, or 1 + its share count if it is file data
+    std::unique_lock<std::mutex> alloc(allocLock_);
+    std::vector<uint64_t> usedBlocks((static_cast<size_t>(dataBitmap_.capacity()) + 63) / 64, 0);
+    for (int blockId = 0; blockId < blockLimit; ++blockId) {
+        const int shares = blockShares_.shares(blockId);
+        if (owned[blockId] + shared[blockId] == 0) {
+            if (shares > 0) report.shareMismatches++;
+            continue;
+        }
+        setBit(usedBlocks, blockId);
+        report.blocks++;
+
+        const int owners = owned[blockId] + shared[blockId];
+        if (owned[blockId] > 0 ? owners > 1 : owners > 1 + shares) {
+            report.crossLinkedBlocks++;
+            note(report.problems, "block " + std::to_string(blockId) + ": claimed " + std::to_string(owners) + " times");
+        } else if (owned[blockId] == 0 && owners < 1 + shares) {
+            report.shareMismatches++;
+            note(report.problems, "block " + std::to_string(blockId) + ": share count " + std::to_string(shares) +
+                                  " for " + std::to_string(owners) + " owner(s)");
+        }
+    }
+    // Bits past the blocks of the image are left as they are
+    for (int blockId = blockLimit; blockId < dataBitmap_.capacity(); ++blockId) {
+        if (dataBitmap_.test(blockId)) setBit(usedBlocks, blockId);
+    }
+
+    // --- STEP 4: Compare the bitmaps ---
+    std::vector<uint64_t> usedInodes((static_cast<size_t>(inodeBitmap_.capacity()) + 63) / 64, 0);
+    for (int id = 0; id < inodeCount; ++id) {
+        if (reachable[id]) {
+            setBit(usedInodes, id);
+            (table[id].is_directory ? report.directories : report.files)++;
+        }
+    }
+    for (int id = inodeCount; id < inodeBitmap_.capacity(); ++id) {
+        if (inodeBitmap_.test(id)) setBit(usedInodes, id);
+    }
+
+    std::vector<int> orphaned, unmarkedInodes, leaked, unmarkedBlocks;
+    inodeBitmap_.diff(usedInodes, orphaned, unmarkedInodes);
+    dataBitmap_.diff(usedBlocks, leaked, unmarkedBlocks);
+    report.orphanedInodes = static_cast<int>(orphaned.size());
+    report.unmarkedInodes = static_cast<int>(unmarkedInodes.size());
+    report.leakedBlocks = static_cast<int>(leaked.size());
+    report.unmarkedBlocks = static_cast<int>(unmarkedBlocks.size());
+    for (int id : orphaned) note(report.problems, "inode " + std::to_string(id) + ": not reachable from the root");
+    for (int id : unmarkedInodes) note(report.problems, "inode " + std::to_string(id) + ": in use but marked free");
+    for (int blockId : leaked) note(report.problems, "block " + std::to_string(blockId) + ": marked used but not in use");
+    for (int blockId : unmarkedBlocks) note(report.problems, "block " + std::to_string(blockId) + ": in use but marked free");
+
+    // --- STEP 5: Repair the bitmaps ---
+    // Orphans are dropped with their blocks; a damaged tree could
+    // make whole subtrees look orphaned, so it is left alone
+    if (repair && report.treeErrors() == 0 && report.bitmapErrors() > 0) {
+        for (int id : orphaned) inodeBitmap_.clear(id);
+        for (int id : unmarkedInodes) inodeBitmap_.set(id);
+        for (int blockId : leaked) releaseDataBlock(blockId);
+        for (int blockId : unmarkedBlocks) dataBitmap_.set(blockId);
+        const bool inodesWritten = inodeBitmap_.flush(device_);
+        const bool blocksWritten = dataBitmap_.flush(device_);
+        if (!inodesWritten || !blocksWritten) return Status::IoError;
+        report.repaired = true;
+    }
+
+    // --- STEP 6: Directory count, as statfs counts it ---
+    int directories = 0;
+    for (int id = 0; id < inodeCount; ++id) {
+        if (table[id].is_directory && table[id].id != 0 && inodeBitmap_.test(id)) directories++;
+    }
+    directoryCount_ = directories;
+    return Status::Ok;
+}
+
+// -------------------------------------------------
+// fsckLoad
+// -------------------------------------------------
+// Reads the range's inodes with one read (its slice
+// of the table is contiguous). A block failing its
+// checksum is noted and its inodes are checked like
+// the others; only a failed read ends the check.
+// -------------------------------------------------
+bool FileSystem::fsckLoad(FsckRange& range, std::vector<Inode>& table) {
+    const int group = range.first / layout_.inodesPerGroup;
+    const long long offset = layout_.inodeStart + group * layout_.groupStride +
+                             static_cast<long long>(range.first - group * layout_.inodesPerGroup) * sizeof(Inode);
+    const long long length = static_cast<long long>(range.count) * sizeof(Inode);
+    VFS_COUNT_N(InodeReads, range.count);
+    std::vector<long long> badUnits;
+    if (!device_.readAt(offset, &table[range.first], static_cast<size_t>(length), badUnits)) return false;
+
+    for (long long unit : badUnits) {
+        const long long start = std::max(unit * layout_.clusterSize, offset) - offset;
+        const long long end = std::min((unit + 1) * layout_.clusterSize, offset + length) - offset;
+        const int first = range.first + static_cast<int>(start / static_cast<long long>(sizeof(Inode)));
+        const int last = range.first + static_cast<int>((end - 1) / static_cast<long long>(sizeof(Inode)));
+        range.badChecksums++;
+        note(range.problems, "inodes " + std::to_string(first) + "-" + std::to_string(last) +
+                             ": table block fails its checksum");
+    }
+    return true;
+}
+
+// -------------------------------------------------
+// fsckInode
+// -------------------------------------------------
+// Checks the fields of a used inode: its ID, a size
+// the addressing can hold, a directory's entry
+// array, inline content that fits, and block
+// pointers inside the data area. Returns false
+// (and notes why) if the inode can't be trusted.
+// -------------------------------------------------
+bool FileSystem::fsckInode(int inodeId, const Inode& inode, FsckRange& range) {
+    const int maxBlocks = inode.is_directory ? maxDirBlocks() : blockMap_.maxBlocks();
+    const long long maxSize = static_cast<long long>(maxBlocks) * layout_.clusterSize;
+    const int32_t pointers[] = { inode.direct1, inode.direct2, inode.direct3, inode.direct4,
+                                 inode.direct5, inode.indirect1, inode.indirect2 };
+
+    std::string fault;
+    if (inode.id != inodeId) {
+        fault = "ID field is " + std::to_string(inode.id);
+    } else if (inode.file_size < 0 || inode.file_size > maxSize) {
+        fault = "size " + std::to_string(inode.file_size) + " out of range";
+    } else if (inode.is_directory && (isInline(inode) || inode.file_size % sizeof(DirectoryItem) != 0 ||
+                                      inode.file_size < static_cast<int32_t>(2 * sizeof(DirectoryItem)))) {
+        fault = "not a valid directory";
+    } else if (isInline(inode) && inode.file_size > INLINE_CAPACITY) {
+        fault = "inline content of " + std::to_string(inode.file_size) + " B";
+    } else if (!isInline(inode)) {
+        for (int32_t pointer : pointers) {
+            if (pointer < 0 || pointer >= range.blockLimit) {
+                fault = "block pointer " + std::to_string(pointer) + " out of range";
+                break;
+            }
+        }
+        if (fault.empty() && inode.is_directory && inodeId != 0 && inode.direct1 == 0) {
+            fault = "directory without a first block";
+        }
+    }
+
+    if (fault.empty()) return true;
+    range.badInodes++;
+    note(range.problems, "inode " + std::to_string(inodeId) + ": " + fault);
+    return false;
+}
+
+// -------------------------------------------------
+// fsckEntries
+// -------------------------------------------------
+// Reads a directory's entries: "." and ".." must come
+// first ("..": recorded in `parents`), every other
+// entry needs a valid name and an inode other than
+// the root. Those are listed in range.entries.
+// -------------------------------------------------
+void FileSystem::fsckEntries(int inodeId, const Inode& dir, std::vector<int>& parents, FsckRange& range) {
+    const std::vector<DirectoryItem> items = readDirEntries(dir);
+    const std::string where = "directory " + std::to_string(inodeId) + ": ";
+    if (items.size() < 2) {
+        range.unreadableDirectories++;
+        note(range.problems, where + "entries cannot be read");
+        return;
+    }
+
+    if (items[0].inode != inodeId || std::strcmp(items[0].item_name, ".") != 0) {
+        range.badEntries++;
+        note(range.problems, where + "first entry is not \".\"");
+    }
+    if (std::strcmp(items[1].item_name, "..") != 0) {
+        range.badEntries++;
+        note(range.problems, where + "second entry is not \"..\"");
+    } else {
+        parents[inodeId] = items[1].inode;
+    }
+
+    for (size_t i = 2; i < items.size(); ++i) {
+        const DirectoryItem& item = items[i];
+        const bool terminated = std::memchr(item.item_name, '\0', sizeof(item.item_name)) != nullptr;
+        if (!terminated || !isValidName(item.item_name) || item.inode <= 0 || item.inode >= layout_.inodeCount) {
+            range.badEntries++;
+            note(range.problems, where + "entry " + std::to_string(i) + " is invalid");
+            continue;
+        }
+        range.entries.emplace_back(inodeId, item.inode);
+    }
+}
+
+// -------------------------------------------------
+// fsckClaims
+// -------------------------------------------------
+// Lists the blocks a reachable item owns, the way
+// releaseFileBlocks and rmdir would free them: data
+// blocks (file data may be shared), pointer blocks,
+// and a directory's first block (block 0 for the
+// root) and hash index. Inline files own none.
+// -------------------------------------------------
+void FileSystem::fsckClaims(int inodeId, const Inode& inode, FsckRange& range) {
+    if (isInline(inode)) return;
+    bool damaged = false;
+    auto claim = [&range, &damaged](std::vector<int>& into, int blockId) {
+        if (blockId < 0 || blockId >= range.blockLimit) damaged = true;
+        else into.push_back(blockId);
+    };
+
+    // --- Data blocks (and a directory's first block) ---
+    const int mapped = std::max(BlockMap::blocksFor(inode.file_size, layout_.clusterSize), BlockMap::DIRECT_COUNT);
+    const std::vector<int> blocks = fileBlocks(inode, 0, mapped);
+    std::vector<int>& data = inode.is_directory ? range.owned : range.shared;
+    if (inode.is_directory) claim(range.owned, inode.direct1);
+    for (size_t i = inode.is_directory ? 1 : 0; i < blocks.size(); ++i) {
+        if (blocks[i] == BlockMap::UNREADABLE) damaged = true;
+        else if (blocks[i] > 0) claim(data, blocks[i]);
+    }
+
+    // --- Pointer blocks ---
+    if (!inode.is_directory) {
+        for (int blockId : blockMap_.pointerBlocks(device_, inode)) claim(range.owned, blockId);
+    } else if (inode.indirect1 > 0) {
+        claim(range.owned, inode.indirect1);
+    }
+
+    // --- Directory hash index: root, then each bucket chain ---
+    if (inode.is_directory && inode.indirect2 > 0) {
+        claim(range.owned, inode.indirect2);
+        int32_t heads[DIR_INDEX_BUCKETS] = {};
+        if (!readBlock(inode.indirect2, heads, sizeof(heads))) damaged = true;
+        const int maxChain = maxDirBlocks() * entriesPerBlock() / DIR_INDEX_SLOTS + 1;
+        for (int32_t bucketBlock : heads) {
+            for (int length = 0; bucketBlock > 0 && !damaged; ++length) {
+                DirIndexBucket bucket{};
+                if (length >= maxChain || bucketBlock >= range.blockLimit ||
+                    !readBlock(bucketBlock, &bucket, sizeof(bucket))) {
+                    damaged = true;
+                    break;
+                }
+                claim(range.owned, bucketBlock);
+                bucketBlock = bucket.next;
+            }
+        }
+    }
+
+    if (damaged) {
+        range.badInodes++;
+        note(range.problems, "inode " + std::to_string(inodeId) + ": unreadable or out-of-range block pointers");
+    }
+}
+
+// -------------------------------------------------
+// noteDirectory
+// -------------------------------------------------
+// mkdir and rmdir keep the count statfs reports
+// current once it has been taken (by fsck or the
+// first statfs).
+// -------------------------------------------------
+void FileSystem::noteDirectory(int delta) {
+    std::lock_guard<std::mutex> alloc(allocLock_);
+    if (directoryCount_ >= 0) directoryCount_ += delta;
+}
@@ -0,0 +1,275 @@
+// =============================================
+// filesystem_shell.cpp
+// ---------------------------------------------
+// Shell commands: the text front end of the API
+// Handles:
+//   - Printing "OK" or the error message of a status
+//   - Formatting listings, contents and metadata
+//     (ls, cat, pread, info, statfs, fsck, pwd)
+// The shell (main.cpp) and load scripts call these;
+// the work is done by the API calls they wrap.
+// =============================================
+
+#include "filesystem.h"
+#include <iostream>
+#include <utility>
+#include <vector>
+
+// -------------------------------------------------
+// Directory commands
+// -------------------------------------------------
+Status FileSystem::mkdir(const std::string& path) {
+    return report(makeDirectory(path));
+}
+
+Status FileSystem::rmdir(const std::string& path) {
+    return report(removeDirectory(path));
+}
+
+Status FileSystem::cd(const std::string& path) {
+    return report(changeDirectory(path));
+}
+
+// -------------------------------------------------
+// ls
+// -------------------------------------------------
+// One line per entry, "." and ".." included:
+// "DIR: name" or "FILE: name".
+// -------------------------------------------------
+Status FileSystem::ls(const std::string& path) {
+    std::vector<DirEntry> entries;
+    const Status status = listDirectory(path, entries);
+    if (status != Status::Ok) return report(status);
+
+    for (const DirEntry& entry : entries) {
+        out() << (entry.isDirectory ? "DIR: " : "FILE: ") << entry.name << "\n";
+    }
+    return status;
+}
+
+// -------------------------------------------------
+// pwd
+// -------------------------------------------------
+// Prints the absolute path of the current working
+// directory (as much of it as could be found).
+// -------------------------------------------------
+Status FileSystem::pwd() {
+    std::string path;
+    const Status status = currentDirectory(path);
+    out() << path << "\n";
+    return status;
+}
+
+// -------------------------------------------------
+// File commands
+// -------------------------------------------------
+Status FileSystem::touch(const std::string& path) {
+    return report(createFile(path));
+}
+
+Status FileSystem::write(const std::string& path, const std::string& content) {
+    return report(writeFile(path, content.data(), static_cast<long long>(content.size())));
+}
+
+Status FileSystem::pwrite(const std::string& path, long long offset, const std::string& data) {
+    return report(writeAt(path, offset, data.data(), static_cast<long long>(data.size())));
+}
+
+Status FileSystem::truncate(const std::string& path, long long size, bool extendOnly) {
+    return report(resizeFile(path, size, extendOnly));
+}
+
+Status FileSystem::rm(const std::string& path) {
+    return report(removeFile(path));
+}
+
+Status FileSystem::compress(const std::string& path, bool enable) {
+    return report(setCompression(path, enable));
+}
+
+// -------------------------------------------------
+// cat
+// -------------------------------------------------
+// Prints the content as text (up to the first zero
+// byte) or "<empty file>".
+// -------------------------------------------------
+Status FileSystem::cat(const std::string& path) {
+    std::vector<char> content;
+    const Status status = readFile(path, content);
+    if (status != Status::Ok) return report(status);
+
+    if (content.empty()) {
+        out() << "<empty file>\n";
+        return status;
+    }
+    content.push_back('\0');
+    out() << content.data() << "\n";
+    return status;
+}
+
+// -------------------------------------------------
+// pread
+// -------------------------------------------------
+// Prints the bytes of the range as they are, or
+// "<end of file>" if it starts at or past the end.
+// -------------------------------------------------
+Status FileSystem::pread(const std::string& path, long long offset, long long length) {
+    std::vector<char> data;
+    const Status status = readAt(path, offset, length, data);
+    if (status != Status::Ok) return report(status);
+
+    if (data.empty()) {
+        out() << "<end of file>\n";
+        return status;
+    }
+    out().write(data.data(), static_cast<std::streamsize>(data.size()));
+    out() << "\n";
+    return status;
+}
+
+// -------------------------------------------------
+// info
+// -------------------------------------------------
+// One line: path, size (and what a compressed file
+// stores), inode, then the direct and indirect
+// blocks or "inline".
+// -------------------------------------------------
+Status FileSystem::info(const std::string& path) {
+    FileStat stat;
+    const Status status = this->stat(path, stat);
+    if (status != Status::Ok) return report(status);
+
+    out() << path << " - " << stat.size << " B";
+    if (stat.compressed && stat.isDirectory) {
+        out() << " - compressed";
+    } else if (stat.compressed && !stat.inlined) {
+        out() << " - compressed " << stat.compressedBytes << " B";
+    }
+    out() << " - inode " << stat.inode << " - ";
+
+    // Inline content takes the place of the block pointers
+    if (stat.inlined) {
+        out() << "inline\n";
+        return status;
+    }
+
+    auto printBlocks = [this](const std::vector<int>& blocks) {
+        if (blocks.empty()) out() << "none";
+        for (size_t i = 0; i < blocks.size(); ++i) out() << (i > 0 ? ", " : "") << blocks[i];
+    };
+    out() << "direct: ";
+    printBlocks(stat.directBlocks);
+    out() << " | indirect: ";
+    printBlocks(stat.indirectBlocks);
+    out() << "\n";
+    return status;
+}
+
+// -------------------------------------------------
+// statfs
+// -------------------------------------------------
+// Prints overall filesystem statistics such as
+// used/free inodes, data blocks, and directory count.
+// -------------------------------------------------
+Status FileSystem::statfs() {
+    FsStat stat;
+    const Status status = statFilesystem(stat);
+    if (status != Status::Ok) {
+        err() << "[statfs] Error: cannot read bitmaps.\n";
+        return status;
+    }
+
+    out() << "\nFilesystem statistics:\n";
+    out() << "- Disk size: " << stat.diskSize << " bytes\n";
+    out() << "- Cluster size: " << stat.clusterSize << " bytes\n";
+    out() << "- Used inodes: " << stat.usedInodes << " / " << stat.totalInodes << "\n";
+    out() << "- Free inodes: " << stat.totalInodes - stat.usedInodes << "\n";
+    out() << "- Used data blocks: " << stat.usedBlocks << " / " << stat.totalBlocks << "\n";
+    out() << "- Free data blocks: " << stat.totalBlocks - stat.usedBlocks << "\n";
+    out() << "- Directories: " << stat.directories << "\n";
+    if (stat.checksums) {
+        out() << "- Checksums: CRC32C, metadata" << (stat.dataChecksums ? " and data" : "")
+              << ", " << stat.badBlocks << " bad block(s)\n";
+    }
+    out() << "\n";
+    return status;
+}
+
+// -------------------------------------------------
+// fsck
+// -------------------------------------------------
+// Prints what the check found: the reachable items,
+// a line per kind of problem there is, the first
+// problems themselves, and whether the bitmaps were
+// rewritten. "OK" if nothing is left to fix.
+// -------------------------------------------------
+Status FileSystem::fsck(bool repair) {
+    FsckReport result;
+    const Status status = checkFilesystem(result, repair);
+    if (status != Status::Ok) {
+        err() << "[fsck] Error: cannot read the inode table or bitmaps.\n";
+        return status;
+    }
+
+    out() << "\nFilesystem check:\n";
+    out() << "- Reachable: " << result.directories << " directories, " << result.files << " files, "
+          << result.blocks << " data blocks in use\n";
+    const std::pair<const char*, int> counts[] = {
+        { "Bad inodes", result.badInodes },
+        { "Bad directory entries", result.badEntries },
+        { "Unreadable directories", result.unreadableDirectories },
+        { "Inode table blocks failing their checksum", result.badChecksums },
+        { "Cross-linked blocks", result.crossLinkedBlocks },
+        { "Wrong share counts", result.shareMismatches },
+        { "Orphaned inodes", result.orphanedInodes },
+        { "Inodes in use but marked free", result.unmarkedInodes },
+        { "Leaked blocks", result.leakedBlocks },
+        { "Blocks in use but marked free", result.unmarkedBlocks },
+    };
+    for (const auto& count : counts) {
+        if (count.second > 0) out() << "- " << count.first << ": " << count.second << "\n";
+    }
+    for (const std::string& problem : result.problems) out() << "  " << problem << "\n";
+    if (result.repaired) {
+        out() << "- Bitmaps rewritten\n";
+    } else if (repair && result.bitmapErrors() > 0) {
+        out() << "- Bitmaps not rewritten: the directory tree is damaged\n";
+    }
+    out() << "\n";
+    return report(result.remainingErrors() > 0 ? Status::Corrupt : Status::Ok);
+}
+
+Status FileSystem::sync() {
+    return report(flush());
+}
+
+Status FileSystem::mkfs(int sizeMB, int clusterSize, bool dataChecksums) {
+    return report(format(sizeMB, clusterSize, dataChecksums));
+}
+
+// -------------------------------------------------
+// Copy, move and host commands
+// -------------------------------------------------
+Status FileSystem::cp(const std::string& source, const std::string& destination, bool reflink) {
+    return report(copyFile(source, destination, reflink));
+}
+
+Status FileSystem::mv(const std::string& source, const std::string& destination) {
+    return report(rename(source, destination));
+}
+
+Status FileSystem::xcp(const std::string& first, const std::string& second, const std::string& result) {
+    return report(concatenate(first, second, result));
+}
+
+Status FileSystem::add(const std::string& target, const std::string& source) {
+    return report(append(target, source));
+}
+
+Status FileSystem::incp(const std::string& sourceHostPath, const std::string& destVfsPath) {
+    return report(importFile(sourceHostPath, destVfsPath));
+}
+
+Status FileSystem::outcp(const std::string& sourceVfsPath, const std::string& destHostPath) {
+    return report(exportFile(sourceVfsPath, destHostPath));
+}
@@ -0,0 +1,168 @@
+// =============================================
+// inode_cache.cpp
+// ---------------------------------------------
+// Write-back inode cache
+// Handles:
+//   - Serving inode reads from memory (LRU)
+//   - Deferring inode writes until eviction or flush
+//   - Writing dirty inodes back in table order
+// =============================================
+
+#include "inode_cache.h"
+#include <algorithm>
+#include <vector>
+#include "metrics.h"
+
+void InodeCache::attach(long long tableOffset, int inodeCount, int inodesPerGroup, long long groupStride) {
+    reset();
+    std::lock_guard<std::mutex> guard(lock_);
+    tableOffset_ = tableOffset;
+    inodeCount_ = inodeCount;
+    inodesPerGroup_ = inodesPerGroup > 0 ? inodesPerGroup : std::max(inodeCount, 1);
+    groupStride_ = groupStride;
+}
+
+void InodeCache::reset() {
+    std::lock_guard<std::mutex> guard(lock_);
+    lru_.clear();
+    index_.clear();
+    tableOffset_ = 0;
+    inodeCount_ = 0;
+    inodesPerGroup_ = 1;
+    groupStride_ = 0;
+}
+
+size_t InodeCache::capacity() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return capacity_;
+}
+
+size_t InodeCache::size() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return lru_.size();
+}
+
+// Inode i lives in slice i / inodesPerGroup_
+long long InodeCache::offsetOf(int inodeId) const {
+    return tableOffset_ + static_cast<long long>(inodeId / inodesPerGroup_) * groupStride_
+        + static_cast<long long>(inodeId % inodesPerGroup_) * sizeof(Inode);
+}
+
+// -------------------------------------------------
+// read
+// -------------------------------------------------
+// Returns the inode from the cache, loading it from
+// the image (and evicting the LRU entry) on a miss.
+// -------------------------------------------------
+bool InodeCache::read(BlockDevice& device, int inodeId, Inode& inode) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (inodeId < 0 || inodeId >= inodeCount_) return false;
+
+    auto it = index_.find(inodeId);
+    if (it != index_.end()) {
+        VFS_COUNT(InodeCacheHits);
+        lru_.splice(lru_.begin(), lru_, it->second);
+        inode = it->second->inode;
+        return true;
+    }
+
+    VFS_COUNT(InodeCacheMisses);
+    if (!device.readAt(offsetOf(inodeId), &inode, sizeof(Inode))) return false;
+    if (capacity_ == 0) return true;
+
+    bool ok = evictToFit(device, capacity_ - 1);
+    insert(inodeId, inode, false);
+    return ok;
+}
+
+// -------------------------------------------------
+// write
+// -------------------------------------------------
+// Updates the cached copy and marks it dirty. The
+// image is written later, on eviction or flush.
+// -------------------------------------------------
+bool InodeCache::write(BlockDevice& device, int inodeId, const Inode& inode) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (inodeId < 0 || inodeId >= inodeCount_) return false;
+    if (capacity_ == 0) return device.writeAt(offsetOf(inodeId), &inode, sizeof(Inode));
+
+    auto it = index_.find(inodeId);
+    if (it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        it->second->inode = inode;
+        it->second->dirty = true;
+        return true;
+    }
+
+    bool ok = evictToFit(device, capacity_ - 1);
+    insert(inodeId, inode, true);
+    return ok;
+}
+
+// -------------------------------------------------
+// flush
+// -------------------------------------------------
+// Writes every dirty inode back. Entries are sorted
+// by ID so that neighbouring inodes go out in a
+// single write (a run stops at the end of a slice).
+// -------------------------------------------------
+bool InodeCache::flush(BlockDevice& device) {
+    std::lock_guard<std::mutex> guard(lock_);
+    std::vector<Entry*> dirty;
+    for (Entry& entry : lru_) {
+        if (entry.dirty) dirty.push_back(&entry);
+    }
+    std::sort(dirty.begin(), dirty.end(),
+              [](const Entry* a, const Entry* b) { return a->id < b->id; });
+
+    bool ok = true;
+    std::vector<Inode> run;
+    for (size_t i = 0; i < dirty.size(); ) {
+        size_t end = i + 1;
+        while (end < dirty.size() && dirty[end]->id == dirty[end - 1]->id + 1 &&
+               dirty[end]->id % inodesPerGroup_ != 0) ++end;
+
+        run.clear();
+        for (size_t j = i; j < end; ++j) run.push_back(dirty[j]->inode);
+        if (device.writeAt(offsetOf(dirty[i]->id), run.data(), run.size() * sizeof(Inode))) {
+            for (size_t j = i; j < end; ++j) dirty[j]->dirty = false;
+        } else {
+            ok = false;
+        }
+        i = end;
+    }
+    return ok;
+}
+
+bool InodeCache::setCapacity(BlockDevice& device, size_t capacity) {
+    std::lock_guard<std::mutex> guard(lock_);
+    capacity_ = capacity;
+    return evictToFit(device, capacity);
+}
+
+// -------------------------------------------------
+// evictToFit
+// -------------------------------------------------
+// Drops least recently used entries until at most
+// `limit` remain. Dirty ones are written first; an
+// entry whose write fails stays cached (and dirty).
+// -------------------------------------------------
+bool InodeCache::evictToFit(BlockDevice& device, size_t limit) {
+    bool ok = true;
+    auto it = lru_.end();
+    while (lru_.size() > limit && it != lru_.begin()) {
+        --it;
+        if (it->dirty && !device.writeAt(offsetOf(it->id), &it->inode, sizeof(Inode))) {
+            ok = false;
+            continue;
+        }
+        index_.erase(it->id);
+        it = lru_.erase(it);
+    }
+    return ok;
+}
+
+void InodeCache::insert(int inodeId, const Inode& inode, bool dirty) {
+    lru_.push_front(Entry{ inodeId, inode, dirty });
+    index_[inodeId] = lru_.begin();
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "structures.h"
+#include "block_device.h"
+
+// =============================================
+// inode_cache.h
+// ---------------------------------------------
+// Defines the InodeCache class, a write-back cache
+// of inodes kept in front of the on-disk inode
+// table. Entries are evicted in LRU order; a dirty
+// inode reaches the image only when it is evicted
+// or when the cache is flushed (sync, exit).
+//
+// The table may be split into equal slices, one
+// per block group, `groupStride` bytes apart.
+//
+// A capacity of 0 disables caching: every read and
+// write goes straight to the image.
+//
+// All methods are thread-safe (one internal mutex);
+// readers get a copy of the inode, never a pointer.
+// =============================================
+class InodeCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 256;   // Inodes kept resident by default
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    // Bind to an inode table (drops old entries); inodesPerGroup 0 = one contiguous table
+    void attach(long long tableOffset, int inodeCount, int inodesPerGroup = 0, long long groupStride = 0);
+    void reset();                                 // Forget every entry without writing it
+    bool flush(BlockDevice& device);              // Write all dirty inodes back
+    bool setCapacity(BlockDevice& device, size_t capacity); // Resize, evicting as needed
+
+    // ------------------------------------------
+    // Inode access
+    // ------------------------------------------
+    bool read(BlockDevice& device, int inodeId, Inode& inode);         // Cached read
+    bool write(BlockDevice& device, int inodeId, const Inode& inode);  // Cached (deferred) write
+
+    // ------------------------------------------
+    // Statistics
+    // ------------------------------------------
+    size_t capacity() const;                      // Maximum resident inodes
+    size_t size() const;                          // Currently resident inodes
+
+private:
+    struct Entry {
+        int id;
+        Inode inode;
+        bool dirty;
+    };
+    using EntryList = std::list<Entry>;
+
+    long long offsetOf(int inodeId) const;        // Byte offset of an inode in the image
+    bool evictToFit(BlockDevice& device, size_t limit); // Evict LRU entries until size() <= limit
+    void insert(int inodeId, const Inode& inode, bool dirty); // Add as most recently used
+
+    EntryList lru_;                               // Front = most recently used
+    std::unordered_map<int, EntryList::iterator> index_; // Inode ID -> entry
+    size_t capacity_ = DEFAULT_CAPACITY;
+    long long tableOffset_ = 0;                   // Byte offset of the inode table (first slice)
+    int inodeCount_ = 0;                          // Inodes in the table
+    int inodesPerGroup_ = 1;                      // Inodes per slice
+    long long groupStride_ = 0;                   // Bytes from one slice to the next
+    mutable std::mutex lock_;                     // Guards everything above
+};
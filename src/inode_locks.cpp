@@ -0,0 +1,65 @@
+// =============================================
+// inode_locks.cpp
+// ---------------------------------------------
+// Per-inode reader/writer locks
+// Handles:
+//   - Sizing the lock table to the inode table
+//   - Taking a command's locks in a fixed order
+//   - Releasing them when the command ends
+// =============================================
+
+#include "inode_locks.h"
+#include <algorithm>
+
+void InodeLocks::attach(int inodeCount) {
+    count_ = std::max(inodeCount, 0);
+    locks_.reset(count_ > 0 ? new std::shared_mutex[count_] : nullptr);
+}
+
+// -------------------------------------------------
+// acquire
+// -------------------------------------------------
+// Sorts the requests by inode, merges duplicates
+// (one exclusive request makes the lock exclusive)
+// and locks them in that order. Requests for
+// inodes outside the table (e.g. -1) are ignored.
+// -------------------------------------------------
+InodeLocks::Guard InodeLocks::acquire(std::vector<Request> requests) {
+    requests.erase(std::remove_if(requests.begin(), requests.end(),
+        [this](const Request& r) { return r.inodeId < 0 || r.inodeId >= count_; }), requests.end());
+    std::sort(requests.begin(), requests.end(),
+        [](const Request& a, const Request& b) { return a.inodeId < b.inodeId; });
+
+    Guard guard;
+    for (size_t i = 0; i < requests.size(); ) {
+        size_t end = i;
+        Mode mode = Mode::Shared;
+        for (; end < requests.size() && requests[end].inodeId == requests[i].inodeId; ++end) {
+            if (requests[end].mode == Mode::Exclusive) mode = Mode::Exclusive;
+        }
+
+        std::shared_mutex* lock = &locks_[requests[i].inodeId];
+        if (mode == Mode::Exclusive) lock->lock();
+        else lock->lock_shared();
+        guard.held_.emplace_back(lock, mode);
+        i = end;
+    }
+    return guard;
+}
+
+InodeLocks::Guard& InodeLocks::Guard::operator=(Guard&& other) noexcept {
+    if (this != &other) {
+        release();
+        held_ = std::move(other.held_);
+        other.held_.clear();
+    }
+    return *this;
+}
+
+void InodeLocks::Guard::release() {
+    for (auto it = held_.rbegin(); it != held_.rend(); ++it) {
+        if (it->second == Mode::Exclusive) it->first->unlock();
+        else it->first->unlock_shared();
+    }
+    held_.clear();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+// =============================================
+// inode_locks.h
+// ---------------------------------------------
+// Defines the InodeLocks class, one reader/writer
+// lock per inode of the mounted image.
+//
+// A directory's lock covers its entries (blocks and
+// hash index), a file's lock covers its content and
+// block map. Commands that only read take shared
+// locks; commands that change an inode take it
+// exclusively.
+//
+// All locks a command needs are requested at once
+// and taken in inode order, so two commands can
+// never wait for each other. A thread must not ask
+// for more locks while it holds a Guard.
+// =============================================
+class InodeLocks {
+public:
+    enum class Mode { Shared, Exclusive };
+
+    struct Request {
+        int inodeId;
+        Mode mode;
+    };
+
+    // Holds a set of locks; releases them when destroyed
+    class Guard {
+    public:
+        Guard() = default;
+        Guard(Guard&& other) noexcept : held_(std::move(other.held_)) { other.held_.clear(); }
+        Guard& operator=(Guard&& other) noexcept;
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        ~Guard() { release(); }
+
+        void release();                           // Unlock early (no-op if empty)
+
+    private:
+        friend class InodeLocks;
+        std::vector<std::pair<std::shared_mutex*, Mode>> held_;
+    };
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    void attach(int inodeCount);                  // One lock per inode (no lock may be held)
+
+    // ------------------------------------------
+    // Locking
+    // ------------------------------------------
+    Guard acquire(std::vector<Request> requests); // Lock all, in inode order (exclusive wins on duplicates)
+    Guard shared(int inodeId) { return acquire({ { inodeId, Mode::Shared } }); }
+    Guard exclusive(int inodeId) { return acquire({ { inodeId, Mode::Exclusive } }); }
+
+private:
+    std::unique_ptr<std::shared_mutex[]> locks_;  // Indexed by inode ID
+    int count_ = 0;                               // Inodes covered
+};
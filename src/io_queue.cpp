@@ -0,0 +1,152 @@
+// =============================================
+// io_queue.cpp
+// ---------------------------------------------
+// Batched submission of positioned I/O
+// Handles:
+//   - Sorting and coalescing the requests of a batch
+//   - Keeping several transfers in flight
+//   - Waiting for a whole batch to complete
+// =============================================
+
+#include "io_queue.h"
+#include <algorithm>
+#include <cstring>
+
+IoQueue::IoQueue(Transfer transfer, int depth)
+    : transfer_(std::move(transfer)), depth_(std::max(1, depth)) {}
+
+IoQueue::~IoQueue() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    queued_.notify_all();
+    for (std::thread& worker : workers_) worker.join();
+}
+
+// -------------------------------------------------
+// run
+// -------------------------------------------------
+// Coalesces the batch into transfers, queues all
+// but the first for the workers and runs the first
+// itself. While the batch is unfinished the caller
+// keeps taking queued transfers, so a busy queue
+// never leaves it idle.
+// -------------------------------------------------
+bool IoQueue::run(std::vector<IoRequest>& batch) {
+    // --- STEP 1: Sort and coalesce ---
+    std::vector<IoRequest> sorted;
+    sorted.reserve(batch.size());
+    for (const IoRequest& request : batch) {
+        if (request.length > 0) sorted.push_back(request);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const IoRequest& a, const IoRequest& b) { return a.offset < b.offset; });
+
+    std::vector<Op> ops;
+    size_t mergedBytes = 0;
+    for (const IoRequest& request : sorted) {
+        if (!ops.empty()) {
+            const IoRequest& tail = ops.back().parts.back();
+            if (tail.write == request.write &&
+                tail.offset + static_cast<long long>(tail.length) == request.offset &&
+                mergedBytes + request.length <= MAX_MERGED_BYTES) {
+                ops.back().parts.push_back(request);
+                mergedBytes += request.length;
+                continue;
+            }
+        }
+        ops.emplace_back();
+        ops.back().parts.push_back(request);
+        mergedBytes = request.length;
+    }
+
+    if (ops.empty()) return true;
+    if (ops.size() == 1 || depth_ == 1) {
+        bool ok = true;
+        for (const Op& op : ops) ok = perform(op) && ok;
+        return ok;
+    }
+
+    // --- STEP 2: Queue all but the first ---
+    Batch state;
+    state.remaining = static_cast<int>(ops.size());
+    for (Op& op : ops) op.batch = &state;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (workers_.empty()) startWorkers();
+        for (size_t i = 1; i < ops.size(); ++i) pending_.push_back(&ops[i]);
+    }
+    queued_.notify_all();
+
+    // --- STEP 3: Run the first, help until the batch is done ---
+    complete(ops[0], perform(ops[0]));
+
+    std::unique_lock<std::mutex> lock(lock_);
+    while (state.remaining > 0) {
+        if (pending_.empty()) {
+            completed_.wait(lock);
+            continue;
+        }
+        Op* op = pending_.front();
+        pending_.pop_front();
+        lock.unlock();
+        complete(*op, perform(*op));
+        lock.lock();
+    }
+    return state.ok;
+}
+
+// A coalesced transfer goes through one bounce buffer
+bool IoQueue::perform(const Op& op) {
+    if (op.parts.size() == 1) return transfer_(op.parts.front());
+
+    size_t total = 0;
+    for (const IoRequest& part : op.parts) total += part.length;
+    std::vector<char> bounce(total);
+    const IoRequest whole{ op.parts.front().offset, bounce.data(), total, op.parts.front().write };
+
+    if (whole.write) {
+        size_t at = 0;
+        for (const IoRequest& part : op.parts) {
+            std::memcpy(bounce.data() + at, part.buffer, part.length);
+            at += part.length;
+        }
+        return transfer_(whole);
+    }
+
+    if (!transfer_(whole)) return false;
+    size_t at = 0;
+    for (const IoRequest& part : op.parts) {
+        std::memcpy(part.buffer, bounce.data() + at, part.length);
+        at += part.length;
+    }
+    return true;
+}
+
+void IoQueue::complete(Op& op, bool ok) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        op.batch->ok = op.batch->ok && ok;
+        --op.batch->remaining;
+    }
+    completed_.notify_all();
+}
+
+// The submitting thread is the first of `depth_` in flight
+void IoQueue::startWorkers() {
+    for (int i = 1; i < depth_; ++i) workers_.emplace_back([this] { work(); });
+}
+
+void IoQueue::work() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        queued_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+        if (pending_.empty()) return;
+        Op* op = pending_.front();
+        pending_.pop_front();
+        lock.unlock();
+        complete(*op, perform(*op));
+        lock.lock();
+    }
+}
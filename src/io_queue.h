@@ -0,0 +1,80 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// =============================================
+// io_queue.h
+// ---------------------------------------------
+// Defines the IoQueue class, the submission queue
+// BlockDevice issues batches of positioned reads
+// and writes through.
+//
+// A batch is sorted by offset and requests that
+// continue one another (same direction, adjacent
+// bytes) are coalesced into one transfer of up to
+// MAX_MERGED_BYTES. The transfers are then issued
+// together, up to `depth` at a time: the submitting
+// thread runs one itself while worker threads run
+// the others, so the host (and an NVMe device
+// behind it) sees several requests in flight
+// instead of one after the other. run() returns
+// once every request of the batch has completed,
+// so callers stay synchronous.
+//
+// Requests of one batch must not overlap. Several
+// threads may run batches at once; the workers are
+// shared and started on first use.
+// =============================================
+
+// One positioned read or write of a batch
+struct IoRequest {
+    long long offset;         // Byte offset in the image
+    char* buffer;             // Read target or write source (not modified by a write)
+    size_t length;            // Bytes to transfer
+    bool write;               // true = write, false = read
+};
+
+class IoQueue {
+public:
+    static constexpr int DEFAULT_DEPTH = 4;                 // Transfers in flight per batch
+    static constexpr size_t MAX_MERGED_BYTES = 256 * 1024;  // Largest coalesced transfer
+
+    // Performs one transfer exactly (short transfers retried); false on failure
+    using Transfer = std::function<bool(const IoRequest& request)>;
+
+    explicit IoQueue(Transfer transfer, int depth = DEFAULT_DEPTH);
+    ~IoQueue();                                   // Stops the workers (no batch may be running)
+    IoQueue(const IoQueue&) = delete;
+    IoQueue& operator=(const IoQueue&) = delete;
+
+    bool run(std::vector<IoRequest>& batch);      // Issue a batch, wait for all of it; false if any failed
+
+private:
+    struct Batch {
+        int remaining = 0;                        // Transfers not yet completed (under lock_)
+        bool ok = true;                           // False once a transfer failed (under lock_)
+    };
+    struct Op {
+        std::vector<IoRequest> parts;             // Adjacent requests, in offset order
+        Batch* batch = nullptr;
+    };
+
+    bool perform(const Op& op);                   // One coalesced transfer
+    void complete(Op& op, bool ok);
+    void work();                                  // Worker loop
+    void startWorkers();                          // Caller holds lock_
+
+    Transfer transfer_;
+    int depth_;
+    std::vector<std::thread> workers_;
+    std::deque<Op*> pending_;                     // Transfers waiting for a thread
+    std::mutex lock_;                             // Guards pending_, batches and stopping_
+    std::condition_variable queued_;              // Signalled when a transfer is queued
+    std::condition_variable completed_;           // Signalled when a transfer completes
+    bool stopping_ = false;                       // Set by the destructor
+};
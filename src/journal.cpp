@@ -0,0 +1,390 @@
+// =============================================
+// journal.cpp
+// ---------------------------------------------
+// Metadata write-ahead log
+// Handles:
+//   - Creating and attaching the journal region
+//   - Committing staged writes as checksummed records
+//   - Restarting a full log, spilling oversized records
+//   - Group commit and checkpointing
+//   - Replaying committed records after a crash
+// =============================================
+
+#include "journal.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+long long roundUp(long long bytes) {
+    return (bytes + Journal::BLOCK_SIZE - 1) / Journal::BLOCK_SIZE * Journal::BLOCK_SIZE;
+}
+
+} // namespace
+
+bool Journal::create(BlockDevice& device, long long offset, long long size) {
+    reset();
+    if (size < 2 * BLOCK_SIZE) return false;
+
+    offset_ = offset;
+    size_ = size;
+    tail_ = BLOCK_SIZE;
+    sequence_ = 1;
+    firstSequence_ = 1;
+
+    // Clear the header and the first record slot
+    std::vector<char> zeros(2 * BLOCK_SIZE, 0);
+    if (!device.writeThrough(offset_, zeros.data(), zeros.size()) || !writeHeader(device)) {
+        reset();
+        return false;
+    }
+    return true;
+}
+
+bool Journal::attach(BlockDevice& device, long long offset, long long size) {
+    reset();
+    if (size < 2 * BLOCK_SIZE) return false;
+
+    JournalHeader header{};
+    if (!device.readAt(offset, &header, sizeof(header)) ||
+        header.magic != JOURNAL_MAGIC || header.version != VERSION) {
+        return false;
+    }
+
+    offset_ = offset;
+    size_ = size;
+    tail_ = BLOCK_SIZE;
+    sequence_ = header.sequence;
+    firstSequence_ = header.sequence;
+    return true;
+}
+
+void Journal::reset() {
+    offset_ = 0;
+    size_ = 0;
+    tail_ = 0;
+    sequence_ = 0;
+    firstSequence_ = 0;
+    logged_.clear();
+    recovered_.clear();
+}
+
+// -------------------------------------------------
+// recover
+// -------------------------------------------------
+// Replays the log left by a crashed session. Records
+// are applied in order for as long as they carry the
+// expected sequence number and a valid checksum;
+// replaying one twice is harmless. A spilled record
+// is read from the ranges it names and checked the
+// same way. The ranges written home are kept in
+// recovered(). The log is then emptied. Returns the
+// number of records replayed, or -1 if the image
+// could not be written.
+// -------------------------------------------------
+int Journal::recover(BlockDevice& device) {
+    recovered_.clear();
+    if (!attached()) return 0;
+
+    long long pos = BLOCK_SIZE;
+    uint32_t sequence = firstSequence_;
+    int replayed = 0;
+    std::vector<char> record;
+    std::vector<char> spilled;
+
+    while (pos + static_cast<long long>(sizeof(JournalRecord)) <= size_) {
+        // --- STEP 1: Read the record and verify its checksum ---
+        JournalRecord head{};
+        if (!device.readAt(offset_ + pos, &head, sizeof(head))) break;
+        const long long bytes = static_cast<long long>(sizeof(JournalRecord)) + head.payload_bytes;
+        if (head.payload_bytes <= 0 || pos + bytes > size_) break;
+        record.resize(static_cast<size_t>(bytes));
+        if (!device.readAt(offset_ + pos, record.data(), record.size()) || !verify(record, sequence)) break;
+
+        // --- STEP 2: A spilled record is read from its ranges ---
+        std::vector<char>* body = &record;
+        if (head.flags & RECORD_SPILLED) {
+            if (static_cast<size_t>(head.payload_bytes) != static_cast<size_t>(head.extent_count) * sizeof(JournalExtent)) break;
+            spilled.clear();
+            bool read = true;
+            for (int i = 0; i < head.extent_count && read; ++i) {
+                JournalExtent range{};
+                std::memcpy(&range, record.data() + sizeof(JournalRecord) + i * sizeof(range), sizeof(range));
+                const size_t at = spilled.size();
+                spilled.resize(at + range.length);
+                read = range.offset >= 0 && device.readAt(range.offset, spilled.data() + at, range.length);
+            }
+            if (!read || !verify(spilled, sequence)) break;
+            JournalRecord inner{};
+            std::memcpy(&inner, spilled.data(), sizeof(inner));
+            if (inner.flags != 0) break;
+            body = &spilled;
+        }
+
+        // --- STEP 3: Validate the extent list ---
+        JournalRecord entry{};
+        std::memcpy(&entry, body->data(), sizeof(entry));
+        size_t at = sizeof(JournalRecord);
+        bool valid = true;
+        for (int i = 0; i < entry.extent_count && valid; ++i) {
+            JournalExtent extent{};
+            if (at + sizeof(extent) > body->size()) { valid = false; break; }
+            std::memcpy(&extent, body->data() + at, sizeof(extent));
+            at += sizeof(extent);
+            valid = extent.offset >= 0 && at + extent.length <= body->size();
+            at += extent.length;
+        }
+        if (!valid) break;
+
+        // --- STEP 4: Write the extents home, as one batch ---
+        std::vector<IoRequest> batch;
+        at = sizeof(JournalRecord);
+        for (int i = 0; i < entry.extent_count; ++i) {
+            JournalExtent extent{};
+            std::memcpy(&extent, body->data() + at, sizeof(extent));
+            at += sizeof(extent);
+            batch.push_back({ extent.offset, body->data() + at, extent.length, true });
+            recovered_.emplace_back(extent.offset, static_cast<long long>(extent.length));
+            at += extent.length;
+        }
+        if (!device.submit(batch)) return -1;
+
+        ++replayed;
+        ++sequence;
+        pos += roundUp(bytes);
+    }
+
+    sequence_ = sequence;
+    firstSequence_ = sequence;
+    tail_ = BLOCK_SIZE;
+    logged_.clear();
+    if (replayed == 0) return 0;
+
+    if (!device.flush() || !writeHeader(device) || !device.flush()) return -1;
+    return replayed;
+}
+
+// -------------------------------------------------
+// begin
+// -------------------------------------------------
+// Starts a transaction: metadata writes are staged
+// from now on. In group mode a log that is more than
+// half full is checkpointed first.
+// -------------------------------------------------
+void Journal::begin(BlockDevice& device) {
+    if (!attached()) return;
+    if (groupCommit_ && tail_ - BLOCK_SIZE > (size_ - BLOCK_SIZE) / 2) {
+        checkpoint(device);
+    }
+    device.beginStaging();
+}
+
+// -------------------------------------------------
+// commit
+// -------------------------------------------------
+// Appends the writes staged since the last commit as
+// one record. Without group commit the log is then
+// checkpointed right away. Nothing is written home
+// that is not in the log first: a record larger
+// than the whole log goes through logLarge.
+// -------------------------------------------------
+bool Journal::commit(BlockDevice& device) {
+    if (!attached() || !device.staging()) return true;
+
+    BlockDevice::Extents tx = device.takeTransaction();
+    if (!tx.empty()) {
+        std::vector<Piece> pieces;
+        pieces.reserve(tx.size());
+        for (const auto& extent : tx) pieces.push_back({ extent.first, extent.second.data(), extent.second.size() });
+
+        const std::vector<char> record = makeRecord(pieces, 0);
+        const bool logged = static_cast<long long>(record.size()) <= size_ - BLOCK_SIZE
+                                ? append(device, record, pieces)
+                                : logLarge(device, pieces, record);
+        if (!logged) return false;
+    }
+
+    return groupCommit_ ? true : checkpoint(device);
+}
+
+// -------------------------------------------------
+// checkpoint
+// -------------------------------------------------
+// Makes the logged records durable, writes every
+// staged extent to its home location, makes that
+// durable and empties the log. The new header needs
+// no flush of its own: until it reaches the disk the
+// old one only leads recovery to records that were
+// already written home.
+// -------------------------------------------------
+bool Journal::checkpoint(BlockDevice& device) {
+    if (!attached()) return true;
+    if (!device.staging() && tail_ == BLOCK_SIZE) return true;
+
+    bool ok = device.flush();
+    ok = device.applyStaged() && ok;
+    if (!device.flush() || !ok) return false;
+
+    firstSequence_ = sequence_;
+    tail_ = BLOCK_SIZE;
+    logged_.clear();
+    return writeHeader(device);
+}
+
+// -------------------------------------------------
+// makeRecord
+// -------------------------------------------------
+// Serializes header, descriptors and data (only the
+// descriptors with RECORD_SPILLED), padded to whole
+// blocks, with the next sequence number.
+// -------------------------------------------------
+std::vector<char> Journal::makeRecord(const std::vector<Piece>& pieces, uint32_t flags) const {
+    const bool withData = (flags & RECORD_SPILLED) == 0;
+    size_t payload = 0;
+    for (const Piece& piece : pieces) payload += sizeof(JournalExtent) + (withData ? piece.length : 0);
+    const size_t bytes = sizeof(JournalRecord) + payload;
+
+    std::vector<char> record(static_cast<size_t>(roundUp(static_cast<long long>(bytes))), 0);
+    size_t at = sizeof(JournalRecord);
+    for (const Piece& piece : pieces) {
+        JournalExtent descriptor{ piece.offset, static_cast<uint32_t>(piece.length), 0 };
+        std::memcpy(record.data() + at, &descriptor, sizeof(descriptor));
+        at += sizeof(descriptor);
+        if (!withData) continue;
+        std::memcpy(record.data() + at, piece.data, piece.length);
+        at += piece.length;
+    }
+
+    JournalRecord head{ RECORD_MAGIC, sequence_, static_cast<int32_t>(pieces.size()),
+                        static_cast<int32_t>(payload), 0, flags };
+    std::memcpy(record.data(), &head, sizeof(head));
+    head.checksum = checksum(record.data(), bytes);
+    std::memcpy(record.data(), &head, sizeof(head));
+    return record;
+}
+
+// -------------------------------------------------
+// append / restart
+// -------------------------------------------------
+// A record that doesn't fit behind the last one
+// restarts the log: the records in it are made
+// durable, what they write goes home (from the
+// merged copy, not the staged bytes, which hold the
+// new transaction as well), and the log is emptied.
+// -------------------------------------------------
+bool Journal::append(BlockDevice& device, const std::vector<char>& record, const std::vector<Piece>& pieces) {
+    if (tail_ + static_cast<long long>(record.size()) > size_ && !restart(device)) return false;
+    if (!device.writeThrough(offset_ + tail_, record.data(), record.size())) return false;
+    tail_ += static_cast<long long>(record.size());
+    ++sequence_;
+    for (const Piece& piece : pieces) BlockDevice::merge(logged_, piece.offset, piece.data, piece.length);
+    return true;
+}
+
+bool Journal::restart(BlockDevice& device) {
+    if (!device.flush()) return false;
+    bool ok = true;
+    for (const auto& extent : logged_) {
+        ok = device.writeThrough(extent.first, extent.second.data(), extent.second.size()) && ok;
+    }
+    if (!ok || !device.flush()) return false;
+
+    logged_.clear();
+    firstSequence_ = sequence_;
+    tail_ = BLOCK_SIZE;
+    return writeHeader(device);
+}
+
+// -------------------------------------------------
+// logLarge
+// -------------------------------------------------
+// A record larger than the log is written to space
+// lent by the filesystem (nothing else writes there
+// before the checkpoint), and the log gets a short
+// RECORD_SPILLED record naming the ranges: replayed
+// whole or not at all, like any other.
+// Without room for it, the transaction is cut into
+// records that fit. Each is logged before any of it
+// goes home, but a crash between them leaves only
+// the first ones applied.
+// -------------------------------------------------
+bool Journal::logLarge(BlockDevice& device, const std::vector<Piece>& pieces, const std::vector<char>& record) {
+    // --- Spill the record ---
+    Ranges ranges;
+    if (spillSpace_ && spillSpace_(static_cast<long long>(record.size()), ranges)) {
+        std::vector<Piece> pointers;
+        size_t at = 0;
+        for (const auto& range : ranges) {
+            if (at >= record.size()) break;
+            const size_t length = std::min(record.size() - at, static_cast<size_t>(range.second));
+            if (!device.writeThrough(range.first, record.data() + at, length)) return false;
+            pointers.push_back({ range.first, nullptr, length });
+            at += length;
+        }
+        const std::vector<char> pointer = makeRecord(pointers, RECORD_SPILLED);
+        if (at == record.size() && static_cast<long long>(pointer.size()) <= size_ - BLOCK_SIZE) {
+            if (!append(device, pointer, {})) return false;
+            for (const Piece& piece : pieces) BlockDevice::merge(logged_, piece.offset, piece.data, piece.length);
+            return true;
+        }
+    }
+
+    // --- No room: one record per part that fits ---
+    const size_t capacity = static_cast<size_t>(size_ - BLOCK_SIZE);
+    std::vector<Piece> part;
+    size_t partBytes = sizeof(JournalRecord);
+    for (const Piece& piece : pieces) {
+        for (size_t done = 0; done < piece.length; ) {
+            if (partBytes + sizeof(JournalExtent) >= capacity) {
+                if (!append(device, makeRecord(part, 0), part)) return false;
+                part.clear();
+                partBytes = sizeof(JournalRecord);
+            }
+            const size_t take = std::min(piece.length - done, capacity - partBytes - sizeof(JournalExtent));
+            part.push_back({ piece.offset + static_cast<long long>(done), piece.data + done, take });
+            partBytes += sizeof(JournalExtent) + take;
+            done += take;
+        }
+    }
+    return part.empty() || append(device, makeRecord(part, 0), part);
+}
+
+// -------------------------------------------------
+// verify
+// -------------------------------------------------
+// Checks a record read back (at least its header
+// long): magic, sequence number, sizes that fit the
+// buffer and the checksum. Trims it to its size.
+// -------------------------------------------------
+bool Journal::verify(std::vector<char>& record, uint32_t sequence) {
+    if (record.size() < sizeof(JournalRecord)) return false;
+    JournalRecord head{};
+    std::memcpy(&head, record.data(), sizeof(head));
+    if (head.magic != RECORD_MAGIC || head.sequence != sequence ||
+        head.extent_count <= 0 || head.payload_bytes <= 0 ||
+        sizeof(JournalRecord) + static_cast<size_t>(head.payload_bytes) > record.size()) {
+        return false;
+    }
+    const size_t bytes = sizeof(JournalRecord) + static_cast<size_t>(head.payload_bytes);
+    std::vector<char> copy(record.begin(), record.begin() + static_cast<std::ptrdiff_t>(bytes));
+    std::memset(copy.data() + offsetof(JournalRecord, checksum), 0, sizeof(uint32_t));
+    if (checksum(copy.data(), copy.size()) != head.checksum) return false;
+    record.resize(bytes);
+    return true;
+}
+
+bool Journal::writeHeader(BlockDevice& device) {
+    JournalHeader header{ JOURNAL_MAGIC, VERSION, firstSequence_ };
+    return device.writeThrough(offset_, &header, sizeof(header));
+}
+
+// FNV-1a over the whole record
+uint32_t Journal::checksum(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "structures.h"
+#include "block_device.h"
+
+// =============================================
+// journal.h
+// ---------------------------------------------
+// Defines the Journal class, a write-ahead log of
+// metadata updates kept in a region of the image
+// reserved at format time.
+//
+// Every command runs as one transaction: its
+// bitmap, inode and directory/pointer block writes
+// are staged by the BlockDevice, appended to the
+// log as a single checksummed record and only then
+// written to their home locations (checkpoint).
+// File data is written in place before the commit
+// (ordered mode) and is never logged; blocks a
+// transaction frees are held back from reuse until
+// it is checkpointed (see Bitmap::hold).
+//
+// A record that doesn't fit the free part of the
+// log first writes the records before it home and
+// starts the log over. One larger than the whole
+// log goes to free blocks the filesystem lends
+// until the checkpoint, and the log gets a short
+// record naming them. Only with no room for that
+// is a transaction logged in several records.
+//
+// With group commit (used by `load`) records are
+// appended without a checkpoint, so a whole script
+// costs two fsyncs instead of two per command. The
+// log is checkpointed when half of it is in use.
+//
+// After a crash, recover() replays every complete
+// record in sequence order; torn records fail their
+// checksum and end the replay.
+// =============================================
+class Journal {
+public:
+    static constexpr int BLOCK_SIZE = 1024;       // Header block and record granularity
+    static constexpr uint32_t VERSION = 1;
+
+    // Image ranges (offset, length) covering `bytes` that nothing else writes
+    // until the next checkpoint; false if there is no room
+    using Ranges = std::vector<std::pair<long long, long long>>;
+    using SpillSpace = std::function<bool(long long bytes, Ranges& ranges)>;
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    bool create(BlockDevice& device, long long offset, long long size); // Write an empty log (format)
+    bool attach(BlockDevice& device, long long offset, long long size); // Read the log header (mount)
+    void reset();                                 // Detach (image without a journal)
+    bool attached() const { return size_ > 0; }   // True if the image has a journal
+    void setSpillSpace(SpillSpace provider) { spillSpace_ = std::move(provider); } // Lender for oversized records
+
+    int recover(BlockDevice& device);             // Replay committed records; count or -1
+    const Ranges& recovered() const { return recovered_; } // Ranges the last recover() wrote home
+
+    // ------------------------------------------
+    // Transactions
+    // ------------------------------------------
+    void begin(BlockDevice& device);              // Start staging metadata writes
+    bool commit(BlockDevice& device);             // Log the staged writes as one record
+    bool checkpoint(BlockDevice& device);         // Write logged updates home, empty the log
+    void setGroupCommit(bool enabled) { groupCommit_ = enabled; }
+    bool groupCommit() const { return groupCommit_; }
+
+private:
+    // Bytes of one extent going into a record (data == nullptr: descriptor only)
+    struct Piece {
+        long long offset;
+        const char* data;
+        size_t length;
+    };
+
+    std::vector<char> makeRecord(const std::vector<Piece>& pieces, uint32_t flags) const;
+    bool append(BlockDevice& device, const std::vector<char>& record, const std::vector<Piece>& pieces);
+    bool restart(BlockDevice& device);            // Write the logged records home, empty the log
+    bool logLarge(BlockDevice& device, const std::vector<Piece>& pieces, const std::vector<char>& record);
+    bool writeHeader(BlockDevice& device);
+    static bool verify(std::vector<char>& record, uint32_t sequence);
+    static uint32_t checksum(const char* data, size_t length);
+
+    long long offset_ = 0;          // Byte offset of the journal region
+    long long size_ = 0;            // Length of the region in bytes (0 = no journal)
+    long long tail_ = 0;            // Where the next record goes (relative to offset_)
+    uint32_t sequence_ = 0;         // Sequence number of the next record
+    uint32_t firstSequence_ = 0;    // Sequence number of the first record in the log
+    bool groupCommit_ = false;      // Defer checkpoints until the log fills up
+    BlockDevice::Extents logged_;   // What the records in the log write, merged
+    SpillSpace spillSpace_;         // Lends room for records larger than the log
+    Ranges recovered_;              // (offset, length) of every extent replayed
+};
@@ -0,0 +1,171 @@
+// =============================================
+// lz4.cpp
+// ---------------------------------------------
+// LZ4 block codec
+// Handles:
+//   - Greedy hash-table matching (compression)
+//   - Bounds-checked sequence decoding
+// =============================================
+
+#include "lz4.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr int HASH_BITS = 12;           // 4096 table slots
+constexpr size_t MIN_MATCH = 4;         // Shortest match the format encodes
+constexpr size_t LAST_LITERALS = 5;     // A block ends with at least 5 literals
+constexpr size_t MATCH_LIMIT = 12;      // No match starts in the last 12 bytes
+constexpr size_t MAX_OFFSET = 65535;    // Offsets are 16-bit
+
+uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t hashOf(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Length past the 15 of a token nibble: 255s, then the rest
+bool putLength(unsigned char*& out, const unsigned char* end, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (out >= end) return false;
+        *out++ = 255;
+    }
+    if (out >= end) return false;
+    *out++ = static_cast<unsigned char>(length);
+    return true;
+}
+
+bool getLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+    unsigned char byte = 255;
+    while (byte == 255) {
+        if (in >= end) return false;
+        byte = *in++;
+        length += byte;
+    }
+    return true;
+}
+
+} // namespace
+
+// -------------------------------------------------
+// lz4Compress
+// -------------------------------------------------
+// Each position's first four bytes are hashed; the
+// table remembers where that hash was seen last. A
+// hit that really matches is extended both ways and
+// emitted as one sequence (literals, offset, match
+// length). The tail is emitted as literals.
+// -------------------------------------------------
+size_t lz4Compress(const char* source, size_t size, char* dest, size_t capacity) {
+    const unsigned char* const in = reinterpret_cast<const unsigned char*>(source);
+    const unsigned char* const inEnd = in + size;
+    unsigned char* out = reinterpret_cast<unsigned char*>(dest);
+    unsigned char* const outEnd = out + capacity;
+    const unsigned char* anchor = in;   // First byte not emitted yet
+
+    // One sequence: literals [anchor, matchStart), then (unless last) the match
+    auto emit = [&](const unsigned char* matchStart, size_t offset, size_t matchLength) {
+        const size_t literals = static_cast<size_t>(matchStart - anchor);
+        if (out >= outEnd) return false;
+        unsigned char* token = out++;
+        *token = static_cast<unsigned char>(std::min<size_t>(literals, 15) << 4);
+        if (literals >= 15 && !putLength(out, outEnd, literals - 15)) return false;
+        if (static_cast<size_t>(outEnd - out) < literals) return false;
+        std::memcpy(out, anchor, literals);
+        out += literals;
+        if (matchLength == 0) return true;
+
+        if (outEnd - out < 2) return false;
+        *out++ = static_cast<unsigned char>(offset & 0xFF);
+        *out++ = static_cast<unsigned char>(offset >> 8);
+        const size_t extra = matchLength - MIN_MATCH;
+        *token |= static_cast<unsigned char>(std::min<size_t>(extra, 15));
+        return extra < 15 || putLength(out, outEnd, extra - 15);
+    };
+
+    if (size > MATCH_LIMIT) {
+        std::vector<uint32_t> table(size_t{ 1 } << HASH_BITS, 0);
+        const unsigned char* const matchLimit = inEnd - MATCH_LIMIT;
+        const unsigned char* const extendLimit = inEnd - LAST_LITERALS;
+        const unsigned char* p = in;
+        while (p < matchLimit) {
+            const uint32_t sequence = read32(p);
+            uint32_t& slot = table[hashOf(sequence)];
+            const unsigned char* candidate = in + slot;
+            slot = static_cast<uint32_t>(p - in);
+            if (candidate >= p || static_cast<size_t>(p - candidate) > MAX_OFFSET || read32(candidate) != sequence) {
+                ++p;
+                continue;
+            }
+
+            size_t length = MIN_MATCH;
+            while (p + length < extendLimit && candidate[length] == p[length]) ++length;
+            while (p > anchor && candidate > in && p[-1] == candidate[-1]) {
+                --p;
+                --candidate;
+                ++length;
+            }
+
+            if (!emit(p, static_cast<size_t>(p - candidate), length)) return 0;
+            p += length;
+            anchor = p;
+        }
+    }
+
+    if (!emit(inEnd, 0, 0)) return 0;
+    return static_cast<size_t>(out - reinterpret_cast<unsigned char*>(dest));
+}
+
+// -------------------------------------------------
+// lz4Decompress
+// -------------------------------------------------
+// Replays the sequences. Every length and offset is
+// checked against both buffers, so a damaged block
+// fails instead of writing out of bounds.
+// -------------------------------------------------
+bool lz4Decompress(const char* source, size_t size, char* dest, size_t length) {
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(source);
+    const unsigned char* const inEnd = in + size;
+    unsigned char* const outStart = reinterpret_cast<unsigned char*>(dest);
+    unsigned char* out = outStart;
+    unsigned char* const outEnd = out + length;
+
+    while (in < inEnd) {
+        const unsigned token = *in++;
+
+        // --- Literals ---
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(in, inEnd, literals)) return false;
+        if (literals > static_cast<size_t>(inEnd - in) || literals > static_cast<size_t>(outEnd - out)) return false;
+        std::memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == inEnd) break;                 // The last sequence has no match
+
+        // --- Match ---
+        if (inEnd - in < 2) return false;
+        const size_t offset = static_cast<size_t>(in[0]) | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        size_t match = token & 15;
+        if (match == 15 && !getLength(in, inEnd, match)) return false;
+        match += MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(out - outStart) ||
+            match > static_cast<size_t>(outEnd - out)) return false;
+
+        const unsigned char* from = out - offset;
+        if (offset >= match) {
+            std::memcpy(out, from, match);
+        } else {
+            for (size_t i = 0; i < match; ++i) out[i] = from[i];   // Overlapping: repeats the pattern
+        }
+        out += match;
+    }
+    return out == outEnd;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+
+// =============================================
+// lz4.h
+// ---------------------------------------------
+// LZ4 block format (raw blocks, no frame), the
+// codec of compressed files. Fast greedy matcher
+// with a 4 KB hash table; the output can be read
+// by any LZ4 block decoder and vice versa.
+// =============================================
+
+// Largest output lz4Compress can produce for `size` bytes
+inline size_t lz4Bound(size_t size) { return size + size / 255 + 16; }
+
+// Compresses `size` bytes into dest; returns the compressed length,
+// or 0 if it doesn't fit in `capacity` bytes
+size_t lz4Compress(const char* source, size_t size, char* dest, size_t capacity);
+
+// Decompresses a whole block; false unless it yields exactly `length` bytes
+bool lz4Decompress(const char* source, size_t size, char* dest, size_t length);
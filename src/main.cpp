@@ -1,5 +1,6 @@
 #include "filesystem.h"
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -11,32 +12,62 @@
 // Command-line shell for interacting with the
 // virtual filesystem (FileSystem class).
 // Supports basic file and directory operations,
-// import/export, and batch command execution.
+// import/export, and batch command execution
+// (--batch: read commands from stdin without a
+// prompt; exit status 1 if any of them failed;
+// --fsck: check the image before the first one).
 // =============================================
 
-// Helper function to capture the current working path
-std::string getCurrentPath(FileSystem& fs) {
-    std::ostringstream buffer;
-    std::streambuf* oldCout = std::cout.rdbuf(buffer.rdbuf());
-    fs.pwd();
-    std::cout.rdbuf(oldCout);
-    std::string path = buffer.str();
-
-    if (!path.empty() && path.back() == '\n')
-        path.pop_back();
-
-    return path;
+// Parses a byte offset or length; false if `text` isn't a whole number
+bool parseNumber(const std::string& text, long long& value) {
+    try {
+        size_t used = 0;
+        value = std::stoll(text, &used);
+        return used == text.size();
+    }
+    catch (const std::exception&) {
+        return false;
+    }
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << (argc > 0 ? argv[0] : "filesystem") << " <filesystem_file>\n";
+    // Optional flags precede the image name
+    bool useMmap = false;
+    bool batch = false;            // Commands from stdin, no banner or prompt
+    bool checkAtMount = false;     // Run fsck before the first command
+    long long inodeCacheSize = -1; // -1 = keep the default capacity
+    int argIdx = 1;
+    while (argIdx < argc && std::string(argv[argIdx]).rfind("--", 0) == 0) {
+        std::string flag = argv[argIdx++];
+        if (flag == "--mmap") useMmap = true;
+        else if (flag == "--batch") batch = true;
+        else if (flag == "--fsck") checkAtMount = true;
+        else if (flag == "--inode-cache" && argIdx < argc) {
+            try {
+                inodeCacheSize = std::stoll(argv[argIdx++]);
+            }
+            catch (const std::exception&) {
+                inodeCacheSize = -2;
+            }
+            if (inodeCacheSize < 0) {
+                std::cerr << "Invalid inode cache size\n";
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    if (argIdx >= argc) {
+        std::cerr << "Usage: " << (argc > 0 ? argv[0] : "filesystem") << " [--mmap] [--batch] [--fsck] [--inode-cache N] <filesystem_file>\n";
         return 1;
     }
 
     // Find bin directory by going up from executable location
     std::string filename;
-    std::string arg = std::string(argv[1]);
+    std::string arg = std::string(argv[argIdx]);
     
     // Try to find bin/ directory by checking parent directories
     std::string currentPath = ".";
@@ -54,15 +85,23 @@ int main(int argc, char* argv[]) {
         filename = arg;
     }
 
-    FileSystem fs(filename);
+    FileSystem fs(filename, useMmap);
+    if (inodeCacheSize >= 0) fs.setInodeCacheCapacity(static_cast<size_t>(inodeCacheSize));
     std::string input;
+    std::string path;
+    bool failed = false;           // Batch mode: some command did not succeed
 
-    std::cout << "===== Virtual Filesystem Shell =====\n";
-    std::cout << "Type 'help' for a list of commands.\n\n";
+    if (!batch) {
+        std::cout << "===== Virtual Filesystem Shell =====\n";
+        std::cout << "Type 'help' for a list of commands.\n\n";
+    }
+    if (checkAtMount && fs.fsck() != Status::Ok) failed = true;
 
     while (true) {
-        std::string path = getCurrentPath(fs);
-        std::cout << path << "> ";
+        if (!batch) {
+            fs.currentDirectory(path);
+            std::cout << path << "> ";
+        }
 
         if (!std::getline(std::cin, input))
             break;
@@ -73,8 +112,21 @@ int main(int argc, char* argv[]) {
 
         if (cmd.empty()) continue;
 
+        Status status = Status::Ok;
+        auto usage = [&status](const char* text) {
+            std::cerr << "Usage: " << text << "\n";
+            status = Status::InvalidInput;
+        };
+
+        // Every command is one journal transaction; load commits
+        // each of its lines and defrag each of its steps on its own
+        const bool journaled = cmd != "load" && cmd != "defrag";
+        Metrics::CommandTimer timer(cmd);   // Latency histogram of the command
+        if (journaled) fs.beginTransaction();
+
         // ---------------- exit ----------------
         if (cmd == "exit") {
+            timer.cancel();
             std::cout << "Terminating shell.\n";
             break;
         }
@@ -83,44 +135,69 @@ int main(int argc, char* argv[]) {
         else if (cmd == "help") {
             std::cout
                 << "\nAvailable commands:\n"
-                << " format [MB]          - create new filesystem\n"
+                << " format [MB] [KB]     - create new filesystem (cluster 1/4/16/64 KB)\n"
+                << " format [MB] [KB] --data-checksums - also checksum file data\n"
                 << " mkdir [name]         - create directory\n"
                 << " rmdir [name]         - remove empty directory\n"
                 << " ls [name]            - list directory contents\n"
-                << " cd [name]            - change directory (.. to go up)\n"
+                << " cd [path]            - change directory (.. to go up)\n"
                 << " pwd                  - print current path\n"
                 << " touch [file]         - create empty file\n"
                 << " write [file] [text]  - overwrite file content\n"
                 << " cat [file]           - show file content\n"
+                << " pread [f] [off] [n]  - show n bytes from offset\n"
+                << " pwrite [f] [off] [s] - write text s at offset (in place)\n"
+                << " truncate [f] [size]  - set file size (growing leaves a hole)\n"
+                << " truncate --extend [f] [size] - only grow the file\n"
                 << " rm [file]            - delete file\n"
                 << " cp [src] [dst]       - copy file\n"
-                << " mv [src] [dst]       - move or rename file\n"
+                << " cp --reflink [s] [d] - copy sharing blocks (copy-on-write)\n"
+                << " mv [src] [dst]       - move or rename file or directory\n"
                 << " info [item]          - show file/dir metadata\n"
+                << " compress [item]      - compress a file (directory: new items)\n"
+                << " compress --off [item] - store it uncompressed again\n"
                 << " statfs               - show filesystem stats\n"
+                << " fsck [--repair]      - check consistency (repair: rewrite the bitmaps)\n"
+                << " stats [--json]       - counters and command latencies\n"
+                << " stats reset          - zero them\n"
+                << " stats trace [on|off] - record trace events\n"
+                << " stats dump [host]    - write them as Chrome trace JSON\n"
+                << " dedup [on|off]       - share identical new data blocks (no arg: state)\n"
+                << " sync                 - flush changes to disk\n"
+                << " defrag [--rate KB/s] - move files into contiguous runs\n"
                 << " incp [host] [vfs]    - import file from host\n"
                 << " outcp [vfs] [host]   - export file to host\n"
                 << " xcp [f1] [f2] [out]  - concatenate two files\n"
                 << " add [f1] [f2]        - append f2 to f1\n"
                 << " load [script]        - execute batch commands\n"
-                << " exit                 - quit program\n\n";
+                << " load --parallel [s]  - run independent commands at once\n"
+                << " exit                 - quit program\n"
+                << "VFS names may be paths: absolute (/a/b) or relative (a/b, ../c)\n\n";
         }
 
         // ---------------- format ----------------
         else if (cmd == "format") {
-            if (arg1.empty()) std::cerr << "Usage: format [sizeMB]\n";
-            else fs.format(std::stoi(arg1));
+            // Optional cluster size, then optional --data-checksums
+            const bool dataChecksums = arg2 == "--data-checksums" || arg3 == "--data-checksums";
+            const std::string kb = arg2 == "--data-checksums" ? "" : arg2;
+            long long sizeMB = 0, clusterKB = FileSystem::DEFAULT_CLUSTER_SIZE / 1024;
+            if (!parseNumber(arg1, sizeMB) || (!kb.empty() && !parseNumber(kb, clusterKB)) ||
+                sizeMB <= 0 || sizeMB > std::numeric_limits<int>::max() ||
+                clusterKB <= 0 || clusterKB > std::numeric_limits<int>::max() / 1024)
+                usage("format [sizeMB] [clusterKB] [--data-checksums]");
+            else status = fs.mkfs(static_cast<int>(sizeMB), static_cast<int>(clusterKB * 1024), dataChecksums);
         }
 
         // ---------------- directory commands ----------------
-        else if (cmd == "mkdir") { if (arg1.empty()) std::cerr << "Usage: mkdir [name]\n"; else fs.mkdir(arg1); }
-        else if (cmd == "rmdir") { if (arg1.empty()) std::cerr << "Usage: rmdir [name]\n"; else fs.rmdir(arg1); }
-        else if (cmd == "ls") { fs.ls(arg1); }
-        else if (cmd == "cd") { if (arg1.empty()) std::cerr << "Usage: cd [name]\n"; else fs.cd(arg1); }
-        else if (cmd == "pwd") { fs.pwd(); }
+        else if (cmd == "mkdir") { if (arg1.empty()) usage("mkdir [name]"); else status = fs.mkdir(arg1); }
+        else if (cmd == "rmdir") { if (arg1.empty()) usage("rmdir [name]"); else status = fs.rmdir(arg1); }
+        else if (cmd == "ls") { status = fs.ls(arg1); }
+        else if (cmd == "cd") { if (arg1.empty()) usage("cd [name]"); else status = fs.cd(arg1); }
+        else if (cmd == "pwd") { status = fs.pwd(); }
 
         // ---------------- file commands ----------------
-        else if (cmd == "touch") { if (arg1.empty()) std::cerr << "Usage: touch [file]\n"; else fs.touch(arg1); }
-        else if (cmd == "cat") { if (arg1.empty()) std::cerr << "Usage: cat [file]\n"; else fs.cat(arg1); }
+        else if (cmd == "touch") { if (arg1.empty()) usage("touch [file]"); else status = fs.touch(arg1); }
+        else if (cmd == "cat") { if (arg1.empty()) usage("cat [file]"); else status = fs.cat(arg1); }
 
         else if (cmd == "write") {
             std::string filename, text;
@@ -128,30 +205,95 @@ int main(int argc, char* argv[]) {
             iss2 >> cmd >> filename;
             std::getline(iss2, text);
             if (!text.empty() && text[0] == ' ') text.erase(0, 1);
-            if (filename.empty()) std::cerr << "Usage: write [file] [text]\n";
-            else fs.write(filename, text);
+            if (filename.empty()) usage("write [file] [text]");
+            else status = fs.write(filename, text);
         }
 
-        else if (cmd == "rm") { if (arg1.empty()) std::cerr << "Usage: rm [file]\n"; else fs.rm(arg1); }
-        else if (cmd == "info") { if (arg1.empty()) std::cerr << "Usage: info [item]\n"; else fs.info(arg1); }
-        else if (cmd == "statfs") { fs.statfs(); }
+        else if (cmd == "pread") {
+            long long offset = 0, length = 0;
+            if (arg1.empty() || !parseNumber(arg2, offset) || !parseNumber(arg3, length))
+                usage("pread [file] [offset] [length]");
+            else status = fs.pread(arg1, offset, length);
+        }
+
+        else if (cmd == "pwrite") {
+            std::string filename, offsetText, text;
+            std::istringstream iss2(input);
+            iss2 >> cmd >> filename >> offsetText;
+            std::getline(iss2, text);
+            if (!text.empty() && text[0] == ' ') text.erase(0, 1);
+            long long offset = 0;
+            if (filename.empty() || !parseNumber(offsetText, offset)) usage("pwrite [file] [offset] [text]");
+            else status = fs.pwrite(filename, offset, text);
+        }
+
+        else if (cmd == "truncate") {
+            bool extendOnly = arg1 == "--extend";
+            const std::string& file = extendOnly ? arg2 : arg1;
+            long long size = 0;
+            if (file.empty() || !parseNumber(extendOnly ? arg3 : arg2, size)) usage("truncate [--extend] [file] [size]");
+            else status = fs.truncate(file, size, extendOnly);
+        }
+
+        else if (cmd == "rm") { if (arg1.empty()) usage("rm [file]"); else status = fs.rm(arg1); }
+        else if (cmd == "info") { if (arg1.empty()) usage("info [item]"); else status = fs.info(arg1); }
+        else if (cmd == "compress") {
+            bool off = arg1 == "--off";
+            const std::string& item = off ? arg2 : arg1;
+            if (item.empty()) usage("compress [--off] [item]");
+            else status = fs.compress(item, !off);
+        }
+        else if (cmd == "statfs") { status = fs.statfs(); }
+        else if (cmd == "fsck") {
+            if (!arg1.empty() && arg1 != "--repair") usage("fsck [--repair]");
+            else status = fs.fsck(arg1 == "--repair");
+        }
+        else if (cmd == "stats") {
+            const bool valid = arg1.empty() || arg1 == "--json" || arg1 == "reset" ||
+                               (arg1 == "trace" && (arg2 == "on" || arg2 == "off")) || (arg1 == "dump" && !arg2.empty());
+            if (!valid) usage("stats [--json | reset | trace on|off | dump host]");
+            else status = fs.stats(arg1, arg2);
+        }
+        else if (cmd == "dedup") { if (!arg1.empty() && arg1 != "on" && arg1 != "off") usage("dedup [on|off]"); else status = fs.dedup(arg1); }
+        else if (cmd == "sync") { status = fs.sync(); }
+        else if (cmd == "defrag") {
+            long long rate = 0;
+            if (!arg1.empty() && (arg1 != "--rate" || !parseNumber(arg2, rate))) usage("defrag [--rate KB/s]");
+            else status = fs.defrag(rate);
+        }
 
         // ---------------- file manipulation ----------------
-        else if (cmd == "cp") { if (arg1.empty() || arg2.empty()) std::cerr << "Usage: cp [src] [dst]\n"; else fs.cp(arg1, arg2); }
-        else if (cmd == "mv") { if (arg1.empty() || arg2.empty()) std::cerr << "Usage: mv [src] [dst]\n"; else fs.mv(arg1, arg2); }
-        else if (cmd == "xcp") { if (arg1.empty() || arg2.empty() || arg3.empty()) std::cerr << "Usage: xcp [f1] [f2] [out]\n"; else fs.xcp(arg1, arg2, arg3); }
-        else if (cmd == "add") { if (arg1.empty() || arg2.empty()) std::cerr << "Usage: add [f1] [f2]\n"; else fs.add(arg1, arg2); }
+        else if (cmd == "cp") {
+            bool reflink = arg1 == "--reflink";
+            const std::string& src = reflink ? arg2 : arg1;
+            const std::string& dst = reflink ? arg3 : arg2;
+            if (src.empty() || dst.empty()) usage("cp [--reflink] [src] [dst]");
+            else status = fs.cp(src, dst, reflink);
+        }
+        else if (cmd == "mv") { if (arg1.empty() || arg2.empty()) usage("mv [src] [dst]"); else status = fs.mv(arg1, arg2); }
+        else if (cmd == "xcp") { if (arg1.empty() || arg2.empty() || arg3.empty()) usage("xcp [f1] [f2] [out]"); else status = fs.xcp(arg1, arg2, arg3); }
+        else if (cmd == "add") { if (arg1.empty() || arg2.empty()) usage("add [f1] [f2]"); else status = fs.add(arg1, arg2); }
 
         // ---------------- host integration ----------------
-        else if (cmd == "incp") { if (arg1.empty() || arg2.empty()) std::cerr << "Usage: incp [host] [vfs]\n"; else fs.incp(arg1, arg2); }
-        else if (cmd == "outcp") { if (arg1.empty() || arg2.empty()) std::cerr << "Usage: outcp [vfs] [host]\n"; else fs.outcp(arg1, arg2); }
-        else if (cmd == "load") { if (arg1.empty()) std::cerr << "Usage: load [script]\n"; else fs.load(arg1); }
+        else if (cmd == "incp") { if (arg1.empty() || arg2.empty()) usage("incp [host] [vfs]"); else status = fs.incp(arg1, arg2); }
+        else if (cmd == "outcp") { if (arg1.empty() || arg2.empty()) usage("outcp [vfs] [host]"); else status = fs.outcp(arg1, arg2); }
+        else if (cmd == "load") {
+            bool parallel = arg1 == "--parallel";
+            const std::string& script = parallel ? arg2 : arg1;
+            if (script.empty()) usage("load [--parallel] [script]");
+            else status = fs.load(script, parallel);
+        }
 
         // ---------------- fallback ----------------
         else {
+            timer.cancel();
             std::cerr << "Unknown command: " << cmd << "\n";
+            status = Status::InvalidInput;
         }
+
+        if (journaled) fs.commitTransaction();
+        if (status != Status::Ok) failed = true;
     }
 
-    return 0;
+    return batch && failed ? 1 : 0;
 }
@@ -0,0 +1,240 @@
+// =============================================
+// metrics.cpp
+// ---------------------------------------------
+// Counters, command latencies and trace events
+// Handles:
+//   - Latency histograms (log2 buckets)
+//   - Keeping trace events while tracing is on
+//   - The stats report, its JSON form and the
+//     Chrome trace file
+// =============================================
+
+#include "metrics.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+namespace {
+
+struct CounterName {
+    const char* key;     // JSON key
+    const char* label;   // Report line
+};
+
+// In Counter order
+const CounterName COUNTER_NAMES[] = {
+    { "image_reads", "Image reads" },
+    { "image_writes", "Image writes" },
+    { "bytes_read", "Bytes read" },
+    { "bytes_written", "Bytes written" },
+    { "block_reads", "Data blocks read" },
+    { "block_writes", "Data blocks written" },
+    { "inode_reads", "Inode reads" },
+    { "inode_writes", "Inode writes" },
+    { "inode_cache_hits", "Inode cache hits" },
+    { "inode_cache_misses", "Inode cache misses" },
+    { "pointer_cache_hits", "Pointer block cache hits" },
+    { "pointer_cache_misses", "Pointer block cache misses" },
+    { "dentry_hits", "Dentry cache hits" },
+    { "dentry_misses", "Dentry cache misses" },
+    { "bitmap_scans", "Bitmap scans" },
+    { "blocks_allocated", "Data blocks allocated" },
+    { "blocks_released", "Data blocks released" },
+    { "journal_commits", "Journal commits" },
+};
+static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) == static_cast<size_t>(Counter::Count),
+              "every counter needs a name");
+
+long long microsBetween(Metrics::Clock::time_point from, Metrics::Clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+// Names are command words and literals; quotes and control characters are dropped
+std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c != '"' && c != '\\' && static_cast<unsigned char>(c) >= 0x20) quoted += c;
+    }
+    return quoted + "\"";
+}
+
+} // namespace
+
+bool Metrics::compiledIn() {
+#ifndef VFS_NO_METRICS
+    return true;
+#else
+    return false;
+#endif
+}
+
+int Metrics::threadIndex() {
+    static std::atomic<int> next{ 1 };
+    thread_local const int index = next.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+// -------------------------------------------------
+// recordCommand / recordEvent
+// -------------------------------------------------
+// A latency lands in bucket i if it is below 2^i
+// microseconds (bucket 0: under one). Trace events
+// are kept only while tracing is on, up to
+// MAX_TRACE_EVENTS.
+// -------------------------------------------------
+void Metrics::recordCommand(const std::string& name, uint64_t micros) {
+    int bucket = 0;
+    while (bucket + 1 < HISTOGRAM_BUCKETS && (micros >> bucket) != 0) ++bucket;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    Histogram& histogram = commands_[name];
+    histogram.count++;
+    histogram.totalMicros += micros;
+    histogram.maxMicros = std::max(histogram.maxMicros, micros);
+    histogram.buckets[bucket]++;
+}
+
+void Metrics::recordEvent(const char* name, Clock::time_point start, Clock::time_point end) {
+    if (!tracing()) return;
+    Event event{ name, threadIndex(), microsBetween(epoch_, start), microsBetween(start, end) };
+
+    std::lock_guard<std::mutex> guard(lock_);
+    if (events_.size() >= MAX_TRACE_EVENTS) {
+        droppedEvents_++;
+        return;
+    }
+    events_.push_back(std::move(event));
+}
+
+void Metrics::setTracing(bool enabled) {
+    tracing_.store(enabled, std::memory_order_relaxed);
+}
+
+void Metrics::reset() {
+    for (Slot& slot : counters_) slot.value.store(0, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(lock_);
+    commands_.clear();
+    events_.clear();
+    droppedEvents_ = 0;
+}
+
+uint64_t Metrics::Histogram::percentile(double fraction) const {
+    const uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) return std::min(maxMicros, (uint64_t{ 1 } << i) - 1);
+    }
+    return maxMicros;
+}
+
+// -------------------------------------------------
+// print
+// -------------------------------------------------
+// Counters first, then one line per command: the
+// sample count, the average and the percentiles
+// (estimated from the buckets) and the maximum.
+// -------------------------------------------------
+void Metrics::print(std::ostream& out) const {
+    out << "\nCounters:\n";
+    for (size_t i = 0; i < static_cast<size_t>(Counter::Count); ++i) {
+        out << "- " << COUNTER_NAMES[i].label << ": " << counters_[i].value.load(std::memory_order_relaxed) << "\n";
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+    out << "\nCommand latency (us):\n";
+    out << std::left << std::setw(10) << "command" << std::right << std::setw(10) << "count"
+        << std::setw(10) << "avg" << std::setw(10) << "p50" << std::setw(10) << "p90"
+        << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+    for (const auto& entry : commands_) {
+        const Histogram& histogram = entry.second;
+        out << std::left << std::setw(10) << entry.first << std::right << std::setw(10) << histogram.count
+            << std::setw(10) << histogram.totalMicros / histogram.count
+            << std::setw(10) << histogram.percentile(0.5) << std::setw(10) << histogram.percentile(0.9)
+            << std::setw(10) << histogram.percentile(0.99) << std::setw(10) << histogram.maxMicros << "\n";
+    }
+
+    out << "\nTracing: " << (tracing() ? "on" : "off") << ", " << events_.size() << " event(s) kept";
+    if (droppedEvents_ > 0) out << ", " << droppedEvents_ << " dropped";
+    out << "\n\n";
+}
+
+void Metrics::printJson(std::ostream& out) const {
+    out << "{\"counters\":{";
+    for (size_t i = 0; i < static_cast<size_t>(Counter::Count); ++i) {
+        out << (i > 0 ? "," : "") << jsonString(COUNTER_NAMES[i].key) << ":"
+            << counters_[i].value.load(std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+    out << "},\"commands\":{";
+    bool first = true;
+    for (const auto& entry : commands_) {
+        const Histogram& histogram = entry.second;
+        out << (first ? "" : ",") << jsonString(entry.first) << ":{\"count\":" << histogram.count
+            << ",\"total_us\":" << histogram.totalMicros << ",\"max_us\":" << histogram.maxMicros
+            << ",\"p50_us\":" << histogram.percentile(0.5) << ",\"p90_us\":" << histogram.percentile(0.9)
+            << ",\"p99_us\":" << histogram.percentile(0.99) << ",\"buckets\":[";
+        for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) out << (i > 0 ? "," : "") << histogram.buckets[i];
+        out << "]}";
+        first = false;
+    }
+    out << "},\"tracing\":" << (tracing() ? "true" : "false") << ",\"trace_events\":" << events_.size()
+        << ",\"dropped_events\":" << droppedEvents_ << "}\n";
+}
+
+// -------------------------------------------------
+// writeTrace
+// -------------------------------------------------
+// Writes the kept events as complete ("X") events
+// of the Chrome trace format, one track per thread.
+// -------------------------------------------------
+bool Metrics::writeTrace(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    file << "{\"traceEvents\":[";
+    for (size_t i = 0; i < events_.size(); ++i) {
+        const Event& event = events_[i];
+        file << (i > 0 ? ",\n" : "\n") << "{\"name\":" << jsonString(event.name)
+             << ",\"cat\":\"vfs\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+             << ",\"ts\":" << event.startMicros << ",\"dur\":" << event.durationMicros << "}";
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(file);
+}
+
+// -------------------------------------------------
+// Scope / CommandTimer
+// -------------------------------------------------
+// Both read the clock only when there is something
+// to record: a Scope while tracing is on, a
+// CommandTimer always (one sample per command).
+// -------------------------------------------------
+Metrics::Scope::Scope(const char* name) {
+    if (!instance().tracing()) return;
+    name_ = name;
+    start_ = Clock::now();
+}
+
+Metrics::Scope::~Scope() {
+    if (name_ != nullptr) instance().recordEvent(name_, start_, Clock::now());
+}
+
+Metrics::CommandTimer::CommandTimer(const std::string& name) {
+#ifndef VFS_NO_METRICS
+    name_ = &name;
+    start_ = Clock::now();
+#else
+    (void)name;
+#endif
+}
+
+Metrics::CommandTimer::~CommandTimer() {
+    if (name_ == nullptr) return;
+    const Clock::time_point end = Clock::now();
+    Metrics& metrics = instance();
+    metrics.recordCommand(*name_, static_cast<uint64_t>(microsBetween(start_, end)));
+    metrics.recordEvent(name_->c_str(), start_, end);
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// =============================================
+// metrics.h
+// ---------------------------------------------
+// Defines the Metrics registry, the instrumentation
+// shared by every part of the filesystem:
+//   - event counters (I/O requests and bytes, inode
+//     reads and writes, cache hits and misses,
+//     bitmap scans, block allocations)
+//   - a latency histogram per command
+//   - trace events of scoped operations, kept while
+//     tracing is on and written as Chrome trace JSON
+//     (chrome://tracing, Perfetto)
+//
+// The hooks are the VFS_COUNT / VFS_COUNT_N / VFS_TRACE
+// macros and CommandTimer. Counters are relaxed
+// atomics, each on its own cache line; a trace
+// scope costs one flag test while tracing is off.
+// Building with VFS_NO_METRICS compiles every hook
+// out; `stats` then only reports that.
+// =============================================
+
+// Counted events (named in metrics.cpp)
+enum class Counter {
+    ImageReads,          // Read requests that reached the image
+    ImageWrites,         // Write requests that reached the image
+    BytesRead,           // Bytes read from the image
+    BytesWritten,        // Bytes written to the image
+    BlockReads,          // Data blocks read (file data, directories, pointer blocks)
+    BlockWrites,         // Data blocks written
+    InodeReads,          // readInode calls
+    InodeWrites,         // writeInode calls
+    InodeCacheHits,      // Inodes served by the inode cache
+    InodeCacheMisses,    // Inodes read from the inode table
+    PointerCacheHits,    // Pointer blocks served by the block map cache
+    PointerCacheMisses,  // Pointer blocks read from the image
+    DentryHits,          // Path components resolved by the dentry cache
+    DentryMisses,        // Path components looked up in the directory
+    BitmapScans,         // Searches of an allocation bitmap
+    BlocksAllocated,     // Data blocks handed out
+    BlocksReleased,      // Data blocks freed
+    JournalCommits,      // Transactions logged
+    Count
+};
+
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int HISTOGRAM_BUCKETS = 32;       // Bucket i: below 2^i microseconds
+    static constexpr size_t MAX_TRACE_EVENTS = 1 << 20; // Later events are dropped (and counted)
+
+    // The process-wide registry
+    static Metrics& instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    // False if built with VFS_NO_METRICS
+    static bool compiledIn();
+
+    // ------------------------------------------
+    // Recording
+    // ------------------------------------------
+    void add(Counter counter, uint64_t amount = 1) {
+        counters_[static_cast<size_t>(counter)].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+    uint64_t value(Counter counter) const {
+        return counters_[static_cast<size_t>(counter)].value.load(std::memory_order_relaxed);
+    }
+    void recordCommand(const std::string& name, uint64_t micros); // One sample of a command's latency
+    void recordEvent(const char* name, Clock::time_point start, Clock::time_point end); // Trace event (tracing on)
+
+    void setTracing(bool enabled);                     // Start or stop keeping trace events
+    bool tracing() const { return tracing_.load(std::memory_order_relaxed); }
+    void reset();                                      // Zero counters and histograms, drop trace events
+
+    // ------------------------------------------
+    // Output
+    // ------------------------------------------
+    void print(std::ostream& out) const;               // Human-readable report
+    void printJson(std::ostream& out) const;           // The same as one JSON object
+    bool writeTrace(const std::string& path) const;    // Trace events as Chrome trace JSON
+
+    // ------------------------------------------
+    // Hooks
+    // ------------------------------------------
+    // A trace event covering the lifetime of the scope
+    class Scope {
+    public:
+        explicit Scope(const char* name);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* name_ = nullptr;                   // nullptr: tracing was off at the start
+        Clock::time_point start_;
+    };
+
+    // Times one command: a latency sample for its
+    // histogram and, while tracing, a trace event
+    class CommandTimer {
+    public:
+        explicit CommandTimer(const std::string& name);
+        ~CommandTimer();
+        void cancel() { name_ = nullptr; }             // Not a command: record nothing
+        CommandTimer(const CommandTimer&) = delete;
+        CommandTimer& operator=(const CommandTimer&) = delete;
+
+    private:
+        const std::string* name_ = nullptr;
+        Clock::time_point start_;
+    };
+
+private:
+    Metrics() : epoch_(Clock::now()) {}
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{ 0 };
+    };
+    struct Histogram {
+        uint64_t count = 0;
+        uint64_t totalMicros = 0;
+        uint64_t maxMicros = 0;
+        std::array<uint64_t, HISTOGRAM_BUCKETS> buckets{};
+        uint64_t percentile(double fraction) const;   // Upper bound of the bucket holding it
+    };
+    struct Event {
+        std::string name;
+        int thread = 0;
+        long long startMicros = 0;                     // Since epoch_
+        long long durationMicros = 0;
+    };
+
+    static int threadIndex();                          // Small stable number of the calling thread
+
+    std::array<Slot, static_cast<size_t>(Counter::Count)> counters_;
+    std::atomic<bool> tracing_{ false };
+    const Clock::time_point epoch_;                    // Trace timestamps start here
+
+    mutable std::mutex lock_;                          // Guards commands_, events_, droppedEvents_
+    std::map<std::string, Histogram> commands_;        // Command name -> latencies
+    std::vector<Event> events_;                        // Trace events in completion order
+    uint64_t droppedEvents_ = 0;                       // Events past MAX_TRACE_EVENTS
+};
+
+#ifndef VFS_NO_METRICS
+#define VFS_COUNT(counter) Metrics::instance().add(Counter::counter)
+#define VFS_COUNT_N(counter, amount) Metrics::instance().add(Counter::counter, static_cast<uint64_t>(amount))
+#define VFS_TRACE(name) Metrics::Scope vfsTraceScope_(name)
+#else
+#define VFS_COUNT(counter) ((void)0)
+#define VFS_COUNT_N(counter, amount) ((void)0)
+#define VFS_TRACE(name) ((void)0)
+#endif
@@ -0,0 +1,60 @@
+// =============================================
+// read_ahead.cpp
+// ---------------------------------------------
+// Sequential readahead for streamed reads
+// Handles:
+//   - Detecting sequential access
+//   - Growing and resetting the prefetch window
+//   - Hinting physically adjacent blocks as one run
+// =============================================
+
+#include "read_ahead.h"
+#include <algorithm>
+
+ReadAhead::ReadAhead(BlockDevice& device, long long dataStart, int clusterSize, const std::vector<int>& blocks)
+    : device_(device), dataStart_(dataStart), clusterSize_(clusterSize), blocks_(blocks) {}
+
+// -------------------------------------------------
+// access
+// -------------------------------------------------
+// A read starting where the last one ended (or at
+// the start of the file) is sequential: the window
+// doubles, starting from twice the read, and
+// everything up to its end that hasn't been hinted
+// yet is prefetched.
+// -------------------------------------------------
+void ReadAhead::access(size_t first, size_t count) {
+    const size_t end = std::min(first + count, blocks_.size());
+    if (first != next_) {
+        window_ = 0;
+        fetched_ = end;
+        next_ = end;
+        return;
+    }
+
+    const size_t maxWindow = std::max<size_t>(1, static_cast<size_t>(MAX_WINDOW_BYTES / clusterSize_));
+    window_ = std::min(maxWindow, std::max(window_ * 2, count * 2));
+    next_ = end;
+
+    const size_t from = std::max(fetched_, end);
+    const size_t to = std::min(blocks_.size(), end + window_);
+    if (from < to) prefetch(from, to);
+    fetched_ = std::max(fetched_, to);
+}
+
+// Physically consecutive blocks are hinted as one range; holes are skipped
+void ReadAhead::prefetch(size_t first, size_t last) {
+    size_t i = first;
+    while (i < last) {
+        if (blocks_[i] == 0) {
+            ++i;
+            continue;
+        }
+        size_t runEnd = i + 1;
+        while (runEnd < last && blocks_[runEnd] == blocks_[runEnd - 1] + 1) ++runEnd;
+
+        device_.prefetch(dataStart_ + static_cast<long long>(blocks_[i]) * clusterSize_,
+                         (runEnd - i) * static_cast<size_t>(clusterSize_));
+        i = runEnd;
+    }
+}
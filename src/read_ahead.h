@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "block_device.h"
+
+// =============================================
+// read_ahead.h
+// ---------------------------------------------
+// Defines the ReadAhead class, the sequential
+// access detector of one streamed read (outcp,
+// cp, defrag).
+//
+// The reader reports each range of the file's
+// block list it is about to read. Reads that
+// continue where the last one ended grow the
+// window (doubling up to MAX_WINDOW_BYTES); the
+// physical runs of the window past the current
+// read are handed to BlockDevice::prefetch, which
+// lets the host start loading them while the
+// reader is still busy. A jump elsewhere resets
+// the window.
+//
+// One ReadAhead serves one stream and must not be
+// used by two threads at once.
+// =============================================
+class ReadAhead {
+public:
+    static constexpr long long MAX_WINDOW_BYTES = 4LL * 1024 * 1024; // Largest prefetch window
+
+    // blocks: physical block of every logical block (0 = hole), kept by the caller
+    ReadAhead(BlockDevice& device, long long dataStart, int clusterSize, const std::vector<int>& blocks);
+
+    void access(size_t first, size_t count);      // blocks[first, first + count) are read next
+
+private:
+    void prefetch(size_t first, size_t last);     // Hint the runs of blocks[first, last)
+
+    BlockDevice& device_;
+    long long dataStart_;                         // Byte offset of data block 0
+    int clusterSize_;                             // Bytes per block
+    const std::vector<int>& blocks_;              // Block list of the stream
+    size_t next_ = 0;                             // Logical block after the last access
+    size_t fetched_ = 0;                          // Blocks below this were prefetched
+    size_t window_ = 0;                           // Current window in blocks (0 = not sequential)
+};
@@ -0,0 +1,92 @@
+// =============================================
+// refcount_table.cpp
+// ---------------------------------------------
+// Block share counts for copy-on-write copies
+// Handles:
+//   - Loading the table from the image once
+//   - Counting extra owners of shared data blocks
+//   - Writing back only the dirty pages
+// =============================================
+
+#include "refcount_table.h"
+#include <algorithm>
+
+bool RefcountTable::load(BlockDevice& device, long long offset, int entryCount) {
+    reset();
+    if (entryCount <= 0) return false;
+
+    counts_.assign(static_cast<size_t>(entryCount), 0);
+    if (!device.readAt(offset, counts_.data(), counts_.size())) {
+        reset();
+        return false;
+    }
+
+    offset_ = offset;
+    dirtyPages_.assign((entryCount + PAGE_BYTES - 1) / PAGE_BYTES, false);
+    return true;
+}
+
+// -------------------------------------------------
+// flush
+// -------------------------------------------------
+// Writes every page modified since the last flush.
+// Adjacent dirty pages are merged into one write.
+// -------------------------------------------------
+bool RefcountTable::flush(BlockDevice& device) {
+    const int pageCount = static_cast<int>(dirtyPages_.size());
+    const int size = entries();
+    bool ok = true;
+
+    for (int page = 0; page < pageCount; ++page) {
+        if (!dirtyPages_[page]) continue;
+
+        int last = page;
+        while (last + 1 < pageCount && dirtyPages_[last + 1]) ++last;
+
+        int begin = page * PAGE_BYTES;
+        int end = std::min(size, (last + 1) * PAGE_BYTES);
+        ok = device.writeAt(offset_ + begin, counts_.data() + begin, static_cast<size_t>(end - begin)) && ok;
+
+        for (int p = page; p <= last; ++p) dirtyPages_[p] = false;
+        page = last;
+    }
+    return ok;
+}
+
+void RefcountTable::reset() {
+    counts_.clear();
+    dirtyPages_.clear();
+    offset_ = 0;
+}
+
+int RefcountTable::shares(int blockId) const {
+    if (blockId < 0 || blockId >= entries()) return 0;
+    return counts_[blockId];
+}
+
+bool RefcountTable::canShare(int blockId) const {
+    return blockId > 0 && blockId < entries() && counts_[blockId] < MAX_SHARES;
+}
+
+void RefcountTable::addShare(int blockId) {
+    if (!canShare(blockId)) return;
+    ++counts_[blockId];
+    markDirty(blockId);
+}
+
+bool RefcountTable::dropShare(int blockId) {
+    if (shares(blockId) == 0) return false;
+    --counts_[blockId];
+    markDirty(blockId);
+    return true;
+}
+
+long long RefcountTable::totalShares() const {
+    long long total = 0;
+    for (uint8_t count : counts_) total += count;
+    return total;
+}
+
+void RefcountTable::markDirty(int blockId) {
+    dirtyPages_[blockId / PAGE_BYTES] = true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "block_device.h"
+
+// =============================================
+// refcount_table.h
+// ---------------------------------------------
+// Defines the RefcountTable class, an in-memory
+// copy of the on-disk block share counts used by
+// copy-on-write (reflink) copies and by blocks
+// shared through deduplication.
+//
+// One byte per data block holds the number of
+// *extra* owners of that block: 0 means the block
+// belongs to a single file (the state of every
+// block in a freshly created table), 1 means two
+// files share it, and so on up to MAX_SHARES.
+// Like Bitmap, only the pages touched since the
+// last flush are written back.
+// =============================================
+class RefcountTable {
+public:
+    static constexpr int PAGE_BYTES = 512;        // Write-back granularity
+    static constexpr int MAX_SHARES = 255;        // Saturation limit of one entry
+
+    // ------------------------------------------
+    // Lifecycle
+    // ------------------------------------------
+    bool load(BlockDevice& device, long long offset, int entryCount); // Read table from the image
+    bool flush(BlockDevice& device);              // Write dirty pages back to the image
+    void reset();                                 // Forget the cached table
+    bool attached() const { return !counts_.empty(); } // True if the image has a table
+
+    // ------------------------------------------
+    // Share counts
+    // ------------------------------------------
+    int shares(int blockId) const;                // Extra owners of a block (0 = exclusive)
+    bool canShare(int blockId) const;             // True if one more owner fits
+    void addShare(int blockId);                   // Record one more owner
+    bool dropShare(int blockId);                  // Remove one owner; false if the block was exclusive
+
+    int entries() const { return static_cast<int>(counts_.size()); } // Blocks covered
+    long long totalShares() const;                // Extra owners of all blocks (copies not stored)
+
+private:
+    void markDirty(int blockId);                  // Flag the page containing blockId
+
+    std::vector<uint8_t> counts_;   // Extra owners per data block
+    std::vector<bool> dirtyPages_;  // One flag per PAGE_BYTES of the on-disk table
+    long long offset_ = 0;          // Byte offset of the table in the image
+};
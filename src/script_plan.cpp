@@ -0,0 +1,230 @@
+// =============================================
+// script_plan.cpp
+// ---------------------------------------------
+// Script parsing and dependency analysis for load
+// Handles:
+//   - Splitting a script into commands
+//   - Finding barriers and segments
+//   - Building the dependency graph of a segment
+// =============================================
+
+#include "script_plan.h"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace {
+
+// Prefix that keeps host paths apart from VFS paths
+const char* const HOST_PREFIX = "host:";
+
+std::string joinPath(const std::vector<std::string>& parts) {
+    if (parts.empty()) return "/";
+    std::string path;
+    for (const std::string& part : parts) path += "/" + part;
+    return path;
+}
+
+std::vector<std::string> splitPath(const std::string& path) {
+    std::vector<std::string> parts;
+    std::istringstream stream(path);
+    std::string part;
+    while (std::getline(stream, part, '/')) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+std::string parentPath(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == 0 || slash == std::string::npos ? "/" : path.substr(0, slash);
+}
+
+// True if `path` lies strictly below `ancestor`
+bool isBelow(const std::string& path, const std::string& ancestor) {
+    if (ancestor == "/") return path.size() > 1 && path[0] == '/';
+    return path.size() > ancestor.size() && path.compare(0, ancestor.size(), ancestor) == 0 &&
+           path[ancestor.size()] == '/';
+}
+
+} // namespace
+
+// -------------------------------------------------
+// parse
+// -------------------------------------------------
+// Same rules as the sequential load: empty lines and
+// lines starting with '#' are skipped, a line is a
+// command word and up to three arguments. Nothing
+// after `exit` runs, so parsing stops there.
+// -------------------------------------------------
+void ScriptPlan::parse(const std::string& content) {
+    commands_.clear();
+    orderSensitive_ = false;
+
+    std::istringstream scriptStream(content);
+    std::string line;
+    while (std::getline(scriptStream, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        ScriptCommand command;
+        std::istringstream iss(line);
+        iss >> command.name >> command.arg1 >> command.arg2 >> command.arg3;
+        commands_.push_back(command);
+
+        // Inode and block numbers depend on allocation order
+        if (command.name == "info") orderSensitive_ = true;
+        if (command.name == "exit") break;
+    }
+}
+
+bool ScriptPlan::isBarrier(size_t index) const {
+    static const char* const barriers[] = { "cd", "format", "sync", "statfs", "fsck", "stats", "dedup", "defrag", "load", "exit" };
+    const std::string& name = commands_[index].name;
+    return std::any_of(std::begin(barriers), std::end(barriers),
+                       [&name](const char* barrier) { return name == barrier; });
+}
+
+size_t ScriptPlan::segmentEnd(size_t first) const {
+    size_t end = first;
+    while (end < commands_.size() && !isBarrier(end)) ++end;
+    return end;
+}
+
+// -------------------------------------------------
+// touches
+// -------------------------------------------------
+// Lists the paths a command may touch. Relative
+// paths are made absolute against `cwdPath`; a ".."
+// step also reads the directory it leaves, since
+// that directory's ".." entry is what it follows.
+// -------------------------------------------------
+std::vector<ScriptPlan::Touch> ScriptPlan::touches(const ScriptCommand& command,
+                                                   const std::string& cwdPath) const {
+    std::vector<Touch> result;
+
+    auto absolute = [&](const std::string& path) {
+        std::vector<std::string> parts;
+        if (path.empty() || path[0] != '/') parts = splitPath(cwdPath);
+        for (const std::string& part : splitPath(path)) {
+            if (part == ".") continue;
+            if (part == "..") {
+                result.push_back({ joinPath(parts), Access::Read });
+                if (!parts.empty()) parts.pop_back();
+                continue;
+            }
+            parts.push_back(part);
+        }
+        return joinPath(parts);
+    };
+    auto read = [&](const std::string& path) { std::string p = absolute(path); result.push_back({ p, Access::Read }); };
+    auto write = [&](const std::string& path) { std::string p = absolute(path); result.push_back({ p, Access::Write }); };
+    auto link = [&](const std::string& path) {     // Create, remove or rename a name
+        std::string p = absolute(path);
+        result.push_back({ p, Access::Tree });
+        result.push_back({ parentPath(p), Access::Write });
+    };
+
+    const std::string& name = command.name;
+    if (name == "mkdir" || name == "touch" || name == "rmdir" || name == "rm") link(command.arg1);
+    else if (name == "ls" || name == "pwd") read("");   // load's ls lists the current directory
+    else if (name == "write" || name == "pwrite") write(command.arg1);
+    else if (name == "truncate") write(command.arg1 == "--extend" ? command.arg2 : command.arg1);
+    else if (name == "compress") write(command.arg1 == "--off" ? command.arg2 : command.arg1);
+    else if (name == "cat" || name == "info" || name == "pread") read(command.arg1);
+    else if (name == "cp") {
+        bool reflink = command.arg1 == "--reflink";
+        read(reflink ? command.arg2 : command.arg1);
+        link(reflink ? command.arg3 : command.arg2);
+    }
+    else if (name == "mv") {
+        link(command.arg1);
+        link(command.arg2);
+        write(command.arg2);                          // May be the directory it moves into
+    }
+    else if (name == "incp") {
+        result.push_back({ HOST_PREFIX + command.arg1, Access::Read });
+        link(command.arg2);
+    }
+    else if (name == "outcp") {
+        read(command.arg1);
+        result.push_back({ HOST_PREFIX + command.arg2, Access::Write });
+    }
+    else if (name == "xcp") {
+        read(command.arg1);
+        read(command.arg2);
+        link(command.arg3);
+    }
+    else if (name == "add") {
+        write(command.arg1);
+        read(command.arg2);
+    }
+    return result;
+}
+
+// -------------------------------------------------
+// dependencies
+// -------------------------------------------------
+// One pass over the segment. For every path the
+// last writer and the readers since then are kept;
+// a new access waits for the ones it conflicts
+// with:
+//   - a read waits for the last writer
+//   - a write waits for the last writer and readers
+//   - any access waits for tree changes above it
+//   - a tree change also waits for everything below
+// -------------------------------------------------
+std::vector<std::vector<size_t>> ScriptPlan::dependencies(size_t first, size_t last,
+                                                          const std::string& cwdPath) const {
+    struct PathState {
+        long long lastWriter = -1;
+        long long lastTree = -1;
+        std::vector<size_t> readers;
+    };
+    std::map<std::string, PathState> states;
+    std::vector<std::vector<size_t>> result;
+
+    for (size_t index = first; index < last; ++index) {
+        std::set<size_t> deps;
+        auto waitFor = [&](long long other) { if (other >= 0) deps.insert(static_cast<size_t>(other)); };
+
+        for (const Touch& touch : touches(commands_[index], cwdPath)) {
+            // --- Tree changes above this path ---
+            if (touch.path[0] == '/') {
+                for (std::string up = touch.path; up != "/"; ) {
+                    up = parentPath(up);
+                    auto it = states.find(up);
+                    if (it != states.end()) waitFor(it->second.lastTree);
+                }
+            }
+
+            // --- Tree change: everything below waits too ---
+            if (touch.access == Access::Tree) {
+                std::string prefix = touch.path == "/" ? "/" : touch.path + "/";
+                auto it = states.lower_bound(prefix);
+                if (it != states.end() && it->first == touch.path) ++it;
+                for (; it != states.end() && isBelow(it->first, touch.path); ++it) {
+                    waitFor(it->second.lastWriter);
+                    for (size_t reader : it->second.readers) deps.insert(reader);
+                }
+            }
+
+            // --- The path itself ---
+            PathState& state = states[touch.path];
+            waitFor(state.lastWriter);
+            if (touch.access == Access::Read) {
+                state.readers.push_back(index);
+                continue;
+            }
+            for (size_t reader : state.readers) deps.insert(reader);
+            state.readers.clear();
+            state.lastWriter = static_cast<long long>(index);
+            if (touch.access == Access::Tree) state.lastTree = static_cast<long long>(index);
+        }
+
+        deps.erase(index);
+        result.emplace_back(deps.begin(), deps.end());
+    }
+    return result;
+}
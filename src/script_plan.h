@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// =============================================
+// script_plan.h
+// ---------------------------------------------
+// Defines the ScriptPlan class, which parses a
+// `load` script and works out which of its
+// commands may run at the same time.
+//
+// Each command is described by the paths it
+// touches, made absolute against the working
+// directory of its segment:
+//   Read   the node's content (file data, directory entries)
+//   Write  the same, changed
+//   Tree   the name itself: created, removed or moved,
+//          which affects every path below it too
+// Two commands depend on each other if they touch
+// the same path and one of them writes it, or if
+// one of them changes the tree above the other's
+// path. Host files passed to incp/outcp are paths
+// of their own.
+//
+// Commands that change or report global state
+// (cd, format, sync, statfs, fsck, stats, dedup, defrag,
+// load, exit) are barriers: they split the script into segments
+// and run alone. Inside a segment the working
+// directory is fixed, so relative paths can be
+// resolved before anything runs.
+// =============================================
+struct ScriptCommand {
+    std::string name;               // Command word ("mkdir", "cp", ...)
+    std::string arg1, arg2, arg3;   // Arguments (empty if missing)
+};
+
+class ScriptPlan {
+public:
+    // ------------------------------------------
+    // Parsing
+    // ------------------------------------------
+    void parse(const std::string& content);       // Split into commands (ends after `exit`)
+    const std::vector<ScriptCommand>& commands() const { return commands_; }
+
+    bool isBarrier(size_t index) const;           // Runs alone, between segments
+    bool orderSensitive() const { return orderSensitive_; } // Prints placement (info): run in order
+    size_t segmentEnd(size_t first) const;        // First barrier at or after `first` (or size)
+
+    // ------------------------------------------
+    // Dependency analysis
+    // ------------------------------------------
+    // For commands [first, last) of one segment, whose
+    // relative paths start at `cwdPath`: the earlier
+    // commands each of them has to wait for.
+    std::vector<std::vector<size_t>> dependencies(size_t first, size_t last,
+                                                  const std::string& cwdPath) const;
+
+private:
+    enum class Access { Read, Write, Tree };
+
+    struct Touch {
+        std::string path;
+        Access access;
+    };
+
+    std::vector<Touch> touches(const ScriptCommand& command, const std::string& cwdPath) const;
+
+    std::vector<ScriptCommand> commands_;
+    bool orderSensitive_ = false;
+};
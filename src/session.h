@@ -0,0 +1,26 @@
+#pragma once
+#include <atomic>
+#include <ostream>
+#include "api_types.h"
+
+// =============================================
+// session.h
+// ---------------------------------------------
+// Defines the Session struct, the state one client
+// of a FileSystem keeps for itself. Everything else
+// (image, caches, allocation) is shared by all
+// sessions of the mount.
+//
+// A session is used by one thread at a time: the
+// thread binds it with FileSystem::useSession and
+// relative paths then start at its cwdInode.
+// Command output ("OK", listings) and error
+// messages go to the session's streams; API calls
+// print nothing but diagnostics.
+// =============================================
+struct Session {
+    std::atomic<int> cwdInode{ 0 };   // Current working directory (root = 0)
+    std::ostream* out = nullptr;      // Command output (nullptr = std::cout)
+    std::ostream* err = nullptr;      // Error messages (nullptr = std::cerr)
+    Status failure = Status::Ok;      // Why the last helper failed (see FileSystem::fail)
+};
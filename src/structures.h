@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 
 // =============================================
@@ -24,17 +25,103 @@ struct Superblock {
     int32_t bitmap_start_address;    // Byte offset to the data bitmap
     int32_t inode_start_address;     // Byte offset to the inode table
     int32_t data_start_address;      // Byte offset to the data area
+
+    // Extensions - older images end the superblock above (bitmapi_start_address == 288);
+    // the fields below then read as 0, meaning "feature not present".
+    int32_t refcount_start_block;    // First data block of the block share-count table (0 = none)
+    int32_t refcount_block_count;    // Length of the share-count table in blocks
+    int32_t journal_start_block;     // First data block of the metadata journal (0 = none)
+    int32_t journal_block_count;     // Length of the journal in blocks
+
+    // Format v2 (format_version == 2): metadata regions sized from the disk
+    // size, cluster sizes up to 64 KB and 64-bit offsets. The 32-bit fields
+    // above keep the same values where they fit (disk_size saturates).
+    int32_t format_version;          // 2 (0 on format 1 images)
+    int32_t inode_count;             // Inodes in the inode table
+    int32_t data_block_count;        // Blocks in the data area
+    int32_t reserved;                // Keeps the 64-bit fields aligned
+    int64_t disk_size64;             // Total size of the virtual disk (bytes)
+    int64_t bitmapi_start64;         // Byte offset to the inode bitmap
+    int64_t bitmap_start64;          // Byte offset to the data bitmap
+    int64_t inode_start64;           // Byte offset to the inode table
+    int64_t data_start64;            // Byte offset to the data area (cluster-aligned)
+
+    // Format 3 (format_version == 3): the data area is split into block
+    // groups; a group's slice of the inode table starts at its second
+    // block (inode_start64 is the slice of group 0).
+    int32_t blocks_per_group;        // Data blocks per group
+    int32_t inodes_per_group;        // Inodes per group
+    // Format 4 has the same layout; file inodes use indirect2 as a
+    // double-indirect block.
+
+    // Block checksums: one CRC32C per cluster of the image, kept in a
+    // contiguous run of data blocks (see ChecksumTable). Reads as 0 on
+    // images formatted before them.
+    int32_t checksum_start_block;    // First data block of the checksum table (0 = none)
+    int32_t checksum_block_count;    // Length of the table in blocks
+    int32_t checksum_flags;          // CHECKSUM_DATA if file data is checksummed too
+    int32_t reserved2;
+
+    // Deduplication: a hash -> block index of file data blocks (see
+    // DedupIndex), created by `dedup on` in a contiguous run of data
+    // blocks. Reads as 0 on images formatted before it.
+    int32_t dedup_start_block;       // First data block of the index (0 = none)
+    int32_t dedup_block_count;       // Length of the index in blocks
+    int32_t dedup_flags;             // DEDUP_ACTIVE while new data is deduplicated
+    int32_t reserved3;
 };
 
+// Superblock::checksum_flags
+constexpr int32_t CHECKSUM_DATA = 0x1;
+
+// Superblock::dedup_flags
+constexpr int32_t DEDUP_ACTIVE = 0x1;
+
 // ---------------- Inode ----------------
-// Describes a single file or directory (its metadata only).
+// Describes a single file or directory (its metadata; a small file's content too, see INODE_INLINE).
 struct Inode {
     int32_t id;               // Inode ID (unique identifier)
     bool is_directory;        // True if this inode represents a directory
     int8_t references;        // Number of hard links referencing this inode
+    uint8_t flags;            // INODE_* bits (fills former padding: 0 on older images)
     int32_t file_size;        // File size in bytes (or directory entry count * sizeof(DirectoryItem))
     int32_t direct1, direct2, direct3, direct4, direct5; // Direct data block addresses
-    int32_t indirect1, indirect2; // Indirect block addresses (for larger files)
+    int32_t indirect1, indirect2; // Indirect block addresses (format 4: indirect2 is double-indirect)
+};
+
+// Inode::flags
+constexpr uint8_t INODE_COMPRESSED = 0x1; // Data kept in compressed chunks; on a directory: new items get it too
+constexpr uint8_t INODE_INLINE = 0x2;     // File content kept in the pointer fields (direct1..indirect2)
+
+// An inline file's bytes take the place of its block pointers; bytes
+// past file_size stay zero
+constexpr int INLINE_CAPACITY = static_cast<int>(sizeof(Inode) - offsetof(Inode, direct1));
+
+// ---------------- Compressed chunk ----------------
+// A compressed file is cut into chunks of a fixed number of blocks.
+// A chunk is stored either raw (every block mapped), as a hole (no
+// block mapped) or compressed: its first blocks hold a ChunkHeader and
+// the compressed bytes, the rest of its blocks stay unmapped.
+constexpr uint32_t CHUNK_MAGIC = 0x435A4C43;    // "CLZC"
+constexpr uint32_t CODEC_LZ4 = 1;               // LZ4 block format
+
+struct ChunkHeader {
+    uint32_t magic;           // CHUNK_MAGIC
+    uint32_t codec;           // CODEC_LZ4
+    uint32_t stored_bytes;    // Compressed bytes following the header
+    uint32_t raw_bytes;       // Bytes of the chunk once decompressed
+};
+
+// ---------------- Deduplication index ----------------
+// Buckets of DEDUP_BUCKET_SLOTS entries; a block's XXH64 picks the
+// bucket. An entry with block 0 is free (block 0 is the root
+// directory, never file data).
+constexpr int DEDUP_BUCKET_SLOTS = 4;
+
+struct DedupEntry {
+    uint64_t hash;            // XXH64 of the whole block
+    int32_t block;            // Data block holding those bytes (0 = free)
+    uint32_t reserved;
 };
 
 // ---------------- DirectoryItem ----------------
@@ -43,3 +130,55 @@ struct DirectoryItem {
     int32_t inode;            // ID of the referenced inode
     char item_name[12];       // File or directory name (null-terminated, max 11 chars)
 };
+
+// ---------------- Directory hash index ----------------
+// Directories larger than one block keep a hash index of their entries.
+// The index root (the directory inode's indirect2 block) holds
+// DIR_INDEX_BUCKETS block pointers; each bucket is a chain of
+// DirIndexBucket blocks mapping a name hash to an entry position.
+// With clusters above 1 KB the index uses the first 1 KB of each block.
+constexpr int DIR_INDEX_BUCKETS = 256;
+constexpr int DIR_INDEX_SLOTS = 127;       // Slots per bucket block
+
+struct DirIndexSlot {
+    uint32_t hash;            // Hash of the entry name
+    int32_t entry;            // Position of the entry in the directory
+};
+
+struct DirIndexBucket {
+    int32_t count;            // Slots in use
+    int32_t next;             // Next block of this bucket's chain (0 = none)
+    DirIndexSlot slots[DIR_INDEX_SLOTS]; // Fills the rest of a 1 KB block
+};
+
+// ---------------- Metadata journal ----------------
+// The journal region starts with one header block, followed by
+// transaction records. A record is a JournalRecord, then
+// extent_count (JournalExtent, bytes) pairs, padded to a whole block.
+constexpr uint32_t JOURNAL_MAGIC = 0x4C4E524A;  // "JRNL"
+constexpr uint32_t RECORD_MAGIC = 0x52435852;   // "RXCR"
+
+struct JournalHeader {
+    uint32_t magic;           // JOURNAL_MAGIC
+    uint32_t version;         // Layout version (1)
+    uint32_t sequence;        // Sequence number expected of the first record
+};
+
+struct JournalRecord {
+    uint32_t magic;           // RECORD_MAGIC
+    uint32_t sequence;        // Position in the commit order
+    int32_t extent_count;     // Number of extents that follow
+    int32_t payload_bytes;    // Extent descriptors + data, excluding this header
+    uint32_t checksum;        // FNV-1a of the record with this field zeroed
+    uint32_t flags;           // RECORD_SPILLED (0 on older images)
+};
+
+// JournalRecord::flags: the extents name the image ranges holding the
+// actual record (descriptors only, no data), see Journal::commit
+constexpr uint32_t RECORD_SPILLED = 0x1;
+
+struct JournalExtent {
+    int64_t offset;           // Byte offset in the image
+    uint32_t length;          // Bytes of data following the descriptor
+    uint32_t reserved;
+};
@@ -0,0 +1,103 @@
+// =============================================
+// work_pool.cpp
+// ---------------------------------------------
+// Work-stealing thread pool
+// Handles:
+//   - Starting and stopping the worker threads
+//   - Per-worker task deques (LIFO for the owner)
+//   - Stealing queued tasks from other workers
+// =============================================
+
+#include "work_pool.h"
+#include <algorithm>
+
+namespace {
+
+// Pool and worker index of the calling thread
+thread_local const WorkPool* currentPool = nullptr;
+thread_local int currentWorker = -1;
+
+} // namespace
+
+WorkPool::WorkPool(int workers) {
+    workers = std::max(workers, 1);
+    for (int i = 0; i < workers; ++i) queues_.push_back(std::make_unique<Queue>());
+    for (int i = 0; i < workers; ++i) threads_.emplace_back(&WorkPool::run, this, i);
+}
+
+WorkPool::~WorkPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(idleLock_);
+        stopping_ = true;
+    }
+    work_.notify_all();
+    for (std::thread& t : threads_) t.join();
+}
+
+void WorkPool::submit(Task task) {
+    const int target = currentPool == this
+        ? currentWorker
+        : static_cast<int>(next_++ % static_cast<unsigned>(workers()));
+
+    ++unfinished_;
+    {
+        std::lock_guard<std::mutex> guard(queues_[target]->lock);
+        queues_[target]->tasks.push_back(std::move(task));
+        ++queued_;
+    }
+    { std::lock_guard<std::mutex> guard(idleLock_); }
+    work_.notify_one();
+}
+
+void WorkPool::wait() {
+    std::unique_lock<std::mutex> guard(idleLock_);
+    done_.wait(guard, [this] { return unfinished_ == 0; });
+}
+
+// -------------------------------------------------
+// take
+// -------------------------------------------------
+// Pops the newest task of the worker's own deque, or
+// steals the oldest task of the next non-empty one.
+// -------------------------------------------------
+bool WorkPool::take(int worker, Task& task) {
+    const int count = workers();
+    for (int i = 0; i < count; ++i) {
+        Queue& queue = *queues_[(worker + i) % count];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) continue;
+
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        --queued_;
+        return true;
+    }
+    return false;
+}
+
+void WorkPool::run(int worker) {
+    currentPool = this;
+    currentWorker = worker;
+
+    for (;;) {
+        Task task;
+        if (take(worker, task)) {
+            task(worker);
+            if (--unfinished_ == 0) {
+                { std::lock_guard<std::mutex> guard(idleLock_); }
+                done_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(idleLock_);
+        work_.wait(guard, [this] { return queued_ > 0 || stopping_; });
+        if (stopping_ && queued_ == 0) return;
+    }
+}
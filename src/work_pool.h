@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// =============================================
+// work_pool.h
+// ---------------------------------------------
+// Defines the WorkPool class, a fixed set of
+// worker threads with one task deque each.
+//
+// A task submitted by a worker goes to the back of
+// that worker's own deque and is the next one it
+// runs (tasks unlocked by a finished task stay on
+// the same core). A worker whose deque is empty
+// steals from the front of another worker's deque.
+// Tasks submitted from outside the pool are dealt
+// to the workers in turn.
+//
+// Tasks receive the index of the worker running
+// them (0 .. workers() - 1).
+// =============================================
+class WorkPool {
+public:
+    using Task = std::function<void(int worker)>;
+
+    explicit WorkPool(int workers);               // Start the worker threads (at least one)
+    ~WorkPool();                                  // Finish queued tasks, then stop the workers
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    void submit(Task task);                       // Queue a task (may be called from a task)
+    void wait();                                  // Block until every submitted task has finished
+    int workers() const { return static_cast<int>(queues_.size()); }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void run(int worker);                         // Worker loop
+    bool take(int worker, Task& task);            // Own deque first, then steal
+
+    std::vector<std::unique_ptr<Queue>> queues_;  // One deque per worker
+    std::vector<std::thread> threads_;
+    std::mutex idleLock_;                         // Guards the two condition variables
+    std::condition_variable work_;                // Signalled when a task is queued
+    std::condition_variable done_;                // Signalled when the pool drains
+    std::atomic<int> queued_{ 0 };                // Tasks waiting in some deque
+    std::atomic<int> unfinished_{ 0 };            // Tasks submitted and not yet finished
+    std::atomic<unsigned> next_{ 0 };             // Round-robin target for outside submits
+    bool stopping_ = false;                       // Set by the destructor (under idleLock_)
+};
@@ -0,0 +1,110 @@
+// =============================================
+// xxhash.cpp
+// ---------------------------------------------
+// XXH64 kernel
+// Handles:
+//   - Four-lane 32-byte stripes
+//   - The 8/4/1-byte tail and final avalanche
+// =============================================
+
+#include "xxhash.h"
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+// Little-endian loads (the image format assumes a little-endian host)
+uint64_t read64(const unsigned char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t accumulate(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+uint64_t mergeRound(uint64_t acc, uint64_t lane) {
+    acc ^= accumulate(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+} // namespace
+
+// -------------------------------------------------
+// xxh64
+// -------------------------------------------------
+// Inputs of 32 bytes and more run through four
+// independent accumulators, which are folded into
+// one; the remaining bytes are mixed in 8, 4 and 1
+// at a time, then the result is avalanched.
+// -------------------------------------------------
+uint64_t xxh64(const void* data, size_t length, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* const end = p + length;
+    uint64_t hash;
+
+    // --- Stripes ---
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        const unsigned char* const limit = end - 32;
+        do {
+            v1 = accumulate(v1, read64(p));
+            v2 = accumulate(v2, read64(p + 8));
+            v3 = accumulate(v3, read64(p + 16));
+            v4 = accumulate(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = mergeRound(hash, v1);
+        hash = mergeRound(hash, v2);
+        hash = mergeRound(hash, v3);
+        hash = mergeRound(hash, v4);
+    } else {
+        hash = seed + PRIME5;
+    }
+    hash += static_cast<uint64_t>(length);
+
+    // --- Tail ---
+    for (; end - p >= 8; p += 8) {
+        hash ^= accumulate(0, read64(p));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+    }
+    if (end - p >= 4) {
+        hash ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        hash ^= *p * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+    }
+
+    // --- Avalanche ---
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// =============================================
+// xxhash.h
+// ---------------------------------------------
+// XXH64, the block hash of the deduplication
+// index. Fast (several GB/s in plain C++) and
+// well distributed, but not cryptographic: a
+// match is always confirmed by comparing the
+// bytes before a block is shared.
+// =============================================
+
+// Hashes `length` bytes with `seed` (same value as the reference XXH64)
+uint64_t xxh64(const void* data, size_t length, uint64_t seed = 0);
@@ -0,0 +1,67 @@
+// =============================================
+// batch.cpp
+// ---------------------------------------------
+// The shell in --batch mode (runs the vfs binary)
+// Handles:
+//   - The exit status after a failing command
+//   - Arguments that aren't numbers
+// =============================================
+
+#include "tests.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+namespace {
+
+// Runs `vfs --batch image < script` with its output discarded.
+// Returns the exit status, -1 if it could not be run.
+int runBatch(const std::string& image, const std::string& commands) {
+    const std::string script = testPath("batch.txt");
+    {
+        std::ofstream file(script, std::ios::trunc);
+        file << commands;
+        if (!file) return -1;
+    }
+#ifdef _WIN32
+    const std::string line = "\"\"" + shellBinary() + "\" --batch \"" + image + "\" < \"" + script + "\" > nul 2>&1\"";
+    return std::system(line.c_str());
+#else
+    const std::string line = "'" + shellBinary() + "' --batch '" + image + "' < '" + script + "' > /dev/null 2>&1";
+    const int status = std::system(line.c_str());
+    return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+// -------------------------------------------------
+// batch/exit_status
+// -------------------------------------------------
+// A batch whose commands all succeed exits with 0;
+// one with a failing format, load or defrag exits
+// with 1.
+// -------------------------------------------------
+void exitStatus() {
+    if (shellBinary().empty()) {
+        testSkip("vfs binary not found (pass --vfs PATH)");
+        return;
+    }
+    const std::string image = testPath("batch.dat");
+    const std::string missing = testPath("missing.txt");
+    std::error_code ignored;
+
+    CHECK(runBatch(image, "defrag\n") == 1);                 // Not formatted yet
+    CHECK(runBatch(image, "format 20\nmkdir a\n") == 0);
+    CHECK(runBatch(image, "format 50 3\n") == 1);          // No 3 KB clusters
+    CHECK(runBatch(image, "format 50 x\nformat abc\n") == 1); // Rejected, not thrown
+    CHECK(runBatch(image, "format 20\nload " + missing + "\n") == 1);
+    CHECK(runBatch(image, "format 20\ndefrag --rate 10\nstats reset\n") == 0);
+    std::filesystem::remove(image, ignored);
+}
+
+} // namespace
+
+VFS_TEST("batch/exit_status", exitStatus);
@@ -0,0 +1,155 @@
+// =============================================
+// crash.cpp
+// ---------------------------------------------
+// Crash recovery: a `load` killed part way through
+// Handles:
+//   - Running a script in a child process
+//   - Killing it at points spread over its run
+//   - Checking the remounted image (fsck, checksums)
+// =============================================
+
+#include "tests.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <csignal>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr int IMAGE_MB = 20;
+constexpr int KILL_POINTS = 24;         // Crashes spread over one run of the script
+constexpr long long FILE_BYTES = 900 * 1024; // Far larger than the journal (256 KB)
+
+// -------------------------------------------------
+// writeScript
+// -------------------------------------------------
+// Removes and re-imports large files, so blocks
+// freed by one command are wanted by the next,
+// mixed with directory and small-file updates.
+// -------------------------------------------------
+bool writeScript(const std::string& path, const std::string& first, const std::string& second) {
+    std::ofstream script(path, std::ios::trunc);
+    if (!script.is_open()) return false;
+    script << "mkdir d\n";
+    for (int round = 0; round < 6; ++round) {
+        script << "incp " << first << " /f\n";
+        script << "touch /d/t" << round << "\n";
+        script << "write /d/t" << round << " round" << round << "\n";
+        script << "cp /f /d/c\n";
+        script << "rm /f\n";
+        script << "incp " << second << " /f\n";
+        script << "rm /d/c\n";
+        script << "rm /f\n";
+    }
+    script << "incp " << first << " /f\n";
+    return static_cast<bool>(script);
+}
+
+#ifndef _WIN32
+// Runs `load script` on the image in a child process, killed after
+// `killAfter` (never if negative). Returns how long it ran, -1 on failure.
+long long runLoad(const std::string& image, bool useMmap, const std::string& script, std::chrono::microseconds killAfter) {
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t child = fork();
+    if (child < 0) return -1;
+    if (child == 0) {
+        {
+            std::ostream discard(nullptr);
+            Session session;
+            session.out = &discard;
+            session.err = &discard;
+            FileSystem fs(image, useMmap);
+            fs.attachSession(session);
+            fs.load(script);
+            fs.detachSession(session);
+        }
+        std::_Exit(0);
+    }
+
+    if (killAfter.count() >= 0) {
+        std::this_thread::sleep_for(killAfter);
+        kill(child, SIGKILL);
+    }
+    int status = 0;
+    if (waitpid(child, &status, 0) != child) return -1;
+    if (killAfter.count() < 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) return -1;
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+#endif
+
+// Everything fsck reads must match its checksum and the tree must be intact
+void checkImage(FileSystem& fs) {
+    FsckReport report;
+    CHECK(fs.checkFilesystem(report) == Status::Ok);
+    CHECK(report.remainingErrors() == 0);
+
+    std::vector<char> content;
+    const Status read = fs.readFile("/f", content);
+    CHECK(read == Status::Ok || read == Status::FileNotFound);
+
+    FsStat stat;
+    CHECK(fs.statFilesystem(stat) == Status::Ok);
+    CHECK(stat.checksums);
+    CHECK(stat.badBlocks == 0);
+}
+
+// -------------------------------------------------
+// crash/load
+// -------------------------------------------------
+// Times one full run of the script, then starts
+// over from the freshly formatted image and kills
+// the run at KILL_POINTS points spread over that
+// time. Each time, the remounted image (journal
+// replayed) must pass fsck with no bad blocks.
+// The mmap backend is killed in the middle of its
+// copies, not only between system calls.
+// -------------------------------------------------
+void crashDuringLoad(bool useMmap) {
+#ifdef _WIN32
+    testSkip("needs fork()");
+#else
+    TestImage image(IMAGE_MB);
+    REQUIRE(image.ok());
+    image.close();
+
+    const std::string pristine = testPath("pristine.dat");
+    const std::string first = testPath("first.bin");
+    const std::string second = testPath("second.bin");
+    const std::string script = testPath("crash.txt");
+    std::filesystem::copy_file(image.path(), pristine, std::filesystem::copy_options::overwrite_existing);
+    REQUIRE(writeHostFile(first, randomBytes(FILE_BYTES, 1)));
+    REQUIRE(writeHostFile(second, randomBytes(FILE_BYTES, 2)));
+    REQUIRE(writeScript(script, first, second));
+
+    // --- STEP 1: One uninterrupted run ---
+    const long long full = runLoad(image.path(), useMmap, script, std::chrono::microseconds(-1));
+    REQUIRE(full > 0);
+    image.reopen();
+    checkImage(image.fs());
+    image.close();
+
+    // --- STEP 2: Kill it part way, remount, check ---
+    for (int point = 1; point <= KILL_POINTS; ++point) {
+        std::filesystem::copy_file(pristine, image.path(), std::filesystem::copy_options::overwrite_existing);
+        REQUIRE(runLoad(image.path(), useMmap, script, std::chrono::microseconds(full * point / (KILL_POINTS + 1))) >= 0);
+        image.reopen();
+        checkImage(image.fs());
+        image.close();
+    }
+#endif
+}
+
+void crashDuringLoadPositioned() { crashDuringLoad(false); }
+void crashDuringLoadMapped() { crashDuringLoad(true); }
+
+} // namespace
+
+VFS_TEST("crash/load", crashDuringLoadPositioned);
+VFS_TEST("crash/load_mmap", crashDuringLoadMapped);
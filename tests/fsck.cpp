@@ -0,0 +1,96 @@
+// =============================================
+// fsck.cpp
+// ---------------------------------------------
+// Consistency check
+// Handles:
+//   - Blocks shared by as many files as a share
+//     count allows
+//   - An inode table block failing its checksum
+// =============================================
+
+#include "tests.h"
+#include <cstddef>
+#include <fstream>
+
+namespace {
+
+constexpr int IMAGE_MB = 20;
+
+// -------------------------------------------------
+// fsck/shared_256
+// -------------------------------------------------
+// 300 identical blocks imported with dedup on: the
+// first 256 end up as one block with 256 owners
+// (MAX_SHARES extra ones), a count fsck must accept.
+// -------------------------------------------------
+void sharedByAll() {
+    TestImage image(IMAGE_MB);
+    REQUIRE(image.ok());
+    FileSystem& fs = image.fs();
+    fs.dedup("on");
+
+    FsStat before, after;
+    REQUIRE(fs.statFilesystem(before) == Status::Ok);
+    const std::string host = testPath("same.bin");
+    REQUIRE(writeHostFile(host, std::vector<char>(300 * FileSystem::DEFAULT_CLUSTER_SIZE, 'z')));
+    REQUIRE(fs.importFile(host, "/same") == Status::Ok);
+    REQUIRE(fs.statFilesystem(after) == Status::Ok);
+    CHECK(after.usedBlocks - before.usedBlocks < 300); // Sharing really happened
+
+    FsckReport report;
+    CHECK(fs.checkFilesystem(report) == Status::Ok);
+    CHECK(report.shareMismatches == 0);
+    CHECK(report.crossLinkedBlocks == 0);
+    CHECK(report.remainingErrors() == 0);
+    CHECK(report.files == 1);
+
+    std::vector<char> content;
+    REQUIRE(fs.readFile("/same", content) == Status::Ok);
+    CHECK(content == std::vector<char>(300 * FileSystem::DEFAULT_CLUSTER_SIZE, 'z'));
+}
+
+// -------------------------------------------------
+// fsck/bad_checksum
+// -------------------------------------------------
+// Flips a byte of a free inode in the middle of the
+// table: the check reports that block and still
+// goes through the rest of the image.
+// -------------------------------------------------
+void badTableChecksum() {
+    TestImage image(IMAGE_MB);
+    REQUIRE(image.ok());
+    REQUIRE(image.fs().makeDirectory("/d") == Status::Ok);
+    REQUIRE(image.fs().createFile("/d/a") == Status::Ok);
+    REQUIRE(image.fs().writeFile("/d/a", "alpha", 5) == Status::Ok);
+    image.close();
+
+    {
+        std::fstream file(image.path(), std::ios::in | std::ios::out | std::ios::binary);
+        REQUIRE(file.is_open());
+        Superblock sb{};
+        file.read(reinterpret_cast<char*>(&sb), sizeof(sb));
+        const long long at = sb.inode_start64 + 1000 * static_cast<long long>(sizeof(Inode)) + offsetof(Inode, file_size);
+        char byte = 0;
+        file.seekg(at);
+        file.read(&byte, 1);
+        byte = static_cast<char>(byte ^ 0x5a);
+        file.seekp(at);
+        file.write(&byte, 1);
+        REQUIRE(static_cast<bool>(file));
+    }
+
+    image.reopen();
+    FsckReport report;
+    CHECK(image.fs().checkFilesystem(report) == Status::Ok);
+    CHECK(report.badChecksums == 1);
+    CHECK(!report.problems.empty());
+    CHECK(report.remainingErrors() > 0);
+    CHECK(report.directories == 2);                // The rest was still checked
+    CHECK(report.files == 1);
+    CHECK(report.leakedBlocks == 0);
+}
+
+} // namespace
+
+VFS_TEST("fsck/shared_256", sharedByAll);
+VFS_TEST("fsck/bad_checksum", badTableChecksum);
@@ -0,0 +1,60 @@
+// =============================================
+// inline.cpp
+// ---------------------------------------------
+// Inline files (content kept in the inode)
+// Handles:
+//   - A block-mapped file rewritten with small
+//     content going back inline
+// =============================================
+
+#include "tests.h"
+
+namespace {
+
+constexpr int IMAGE_MB = 20;
+
+// -------------------------------------------------
+// inline/shrink
+// -------------------------------------------------
+// A file of five blocks replaced by 5 bytes keeps
+// them in its inode and gives all its blocks back.
+// -------------------------------------------------
+void shrinkToInline() {
+    TestImage image(IMAGE_MB);
+    REQUIRE(image.ok());
+    FileSystem& fs = image.fs();
+
+    FsStat empty, large, small;
+    REQUIRE(fs.createFile("/m") == Status::Ok);
+    REQUIRE(fs.statFilesystem(empty) == Status::Ok);
+    const std::vector<char> content = randomBytes(5 * FileSystem::DEFAULT_CLUSTER_SIZE, 3);
+    REQUIRE(fs.writeFile("/m", content.data(), static_cast<long long>(content.size())) == Status::Ok);
+
+    FileStat before;
+    REQUIRE(fs.stat("/m", before) == Status::Ok);
+    CHECK(!before.inlined);
+    CHECK(before.directBlocks.size() == 5);
+    REQUIRE(fs.statFilesystem(large) == Status::Ok);
+    CHECK(large.usedBlocks == empty.usedBlocks + 5);
+
+    REQUIRE(fs.writeFile("/m", "small", 5) == Status::Ok);
+    FileStat after;
+    REQUIRE(fs.stat("/m", after) == Status::Ok);
+    CHECK(after.inlined);
+    CHECK(after.size == 5);
+    CHECK(after.directBlocks.empty());
+    REQUIRE(fs.statFilesystem(small) == Status::Ok);
+    CHECK(small.usedBlocks == empty.usedBlocks);
+
+    std::vector<char> read;
+    REQUIRE(fs.readFile("/m", read) == Status::Ok);
+    CHECK(std::string(read.begin(), read.end()) == "small");
+
+    FsckReport report;
+    CHECK(fs.checkFilesystem(report) == Status::Ok);
+    CHECK(report.remainingErrors() == 0);
+}
+
+} // namespace
+
+VFS_TEST("inline/shrink", shrinkToInline);
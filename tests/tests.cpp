@@ -0,0 +1,178 @@
+// =============================================
+// tests.cpp
+// ---------------------------------------------
+// vfs_tests: runs the registered tests
+// Handles:
+//   - Registration, CHECK / REQUIRE bookkeeping
+//   - Test images and host files
+//   - Filtering, the summary and the exit code
+// =============================================
+
+#include "tests.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+namespace {
+
+struct TestRun {
+    int failures = 0;
+    std::string skipped;
+};
+
+TestRun* current = nullptr;      // The test being run
+std::string directory;           // Images and host files go here
+std::string shell;               // The vfs binary, for tests of the shell itself
+
+std::ostream& nullStream() {
+    static std::ostream stream(nullptr);
+    return stream;
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [--list] [--filter TEXT] [--dir PATH] [--vfs PATH]\n";
+}
+
+} // namespace
+
+std::vector<TestCase>& testRegistry() {
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+bool registerTest(const std::string& name, TestFunction function) {
+    testRegistry().push_back({ name, function });
+    return true;
+}
+
+bool testCheck(bool passed, const char* expression, const char* file, int line) {
+    if (passed) return true;
+    if (current) ++current->failures;
+    std::cerr << "    " << std::filesystem::path(file).filename().string() << ":" << line
+              << ": CHECK failed: " << expression << "\n";
+    return false;
+}
+
+void testSkip(const std::string& reason) {
+    if (current) current->skipped = reason;
+}
+
+std::string testPath(const std::string& name) {
+    return (std::filesystem::path(directory) / name).string();
+}
+
+std::string shellBinary() {
+    std::error_code error;
+    return std::filesystem::is_regular_file(shell, error) ? shell : "";
+}
+
+bool writeHostFile(const std::string& path, const std::vector<char>& content) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    file.write(content.data(), static_cast<std::streamsize>(content.size()));
+    return static_cast<bool>(file);
+}
+
+std::vector<char> randomBytes(long long size, uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<char> bytes(static_cast<size_t>(size));
+    for (char& byte : bytes) byte = static_cast<char>(random());
+    return bytes;
+}
+
+// -------------------------------------------------
+// TestImage
+// -------------------------------------------------
+TestImage::TestImage(int sizeMB, int clusterSize) : path_(testPath("test.dat")) {
+    std::error_code ignored;
+    std::filesystem::remove(path_, ignored);
+    session_.out = &nullStream();
+    session_.err = &nullStream();
+    reopen();
+    ok_ = fs_->format(sizeMB, clusterSize) == Status::Ok;
+}
+
+TestImage::~TestImage() {
+    close();
+    std::error_code ignored;
+    std::filesystem::remove(path_, ignored);
+}
+
+void TestImage::close() {
+    if (!fs_) return;
+    fs_->detachSession(session_);
+    fs_.reset();
+}
+
+void TestImage::reopen() {
+    close();
+    fs_ = std::make_unique<FileSystem>(path_);
+    fs_->attachSession(session_);
+}
+
+int main(int argc, char* argv[]) {
+    std::string filter, root;
+    bool list = false;
+
+    // --- STEP 1: Options ---
+    for (int i = 1; i < argc; ++i) {
+        const std::string flag = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (flag == "--list") list = true;
+        else if (flag == "--filter" && hasValue) filter = argv[++i];
+        else if (flag == "--dir" && hasValue) root = argv[++i];
+        else if (flag == "--vfs" && hasValue) shell = argv[++i];
+        else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (list) {
+        for (const TestCase& test : testRegistry()) std::cout << test.name << "\n";
+        return 0;
+    }
+
+    // --- STEP 2: Test directory, vfs next to vfs_tests by default ---
+    std::error_code error;
+    if (shell.empty() && argc > 0) {
+#ifdef _WIN32
+        shell = (std::filesystem::path(argv[0]).parent_path() / "vfs.exe").string();
+#else
+        shell = (std::filesystem::path(argv[0]).parent_path() / "vfs").string();
+#endif
+    }
+    const std::filesystem::path base = root.empty() ? std::filesystem::temp_directory_path(error) : std::filesystem::path(root);
+    directory = (base / "vfs_tests_data").string();
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cerr << "Cannot create " << directory << "\n";
+        return 2;
+    }
+
+    // --- STEP 3: Run ---
+    int passed = 0, failed = 0, skipped = 0;
+    for (const TestCase& test : testRegistry()) {
+        if (test.name.find(filter) == std::string::npos) continue;
+        TestRun run;
+        current = &run;
+        std::cout << "[ RUN  ] " << test.name << std::endl;
+        test.function();
+        current = nullptr;
+
+        if (run.failures > 0) {
+            std::cout << "[ FAIL ] " << test.name << " (" << run.failures << " check(s))\n";
+            ++failed;
+        } else if (!run.skipped.empty()) {
+            std::cout << "[ SKIP ] " << test.name << ": " << run.skipped << "\n";
+            ++skipped;
+        } else {
+            std::cout << "[  OK  ] " << test.name << "\n";
+            ++passed;
+        }
+    }
+
+    std::filesystem::remove_all(directory, error);
+    std::cout << passed << " passed, " << failed << " failed, " << skipped << " skipped\n";
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "../src/filesystem.h"
+
+// =============================================
+// tests.h
+// ---------------------------------------------
+// Defines the harness of vfs_tests:
+//   - VFS_TEST registers a function as a named
+//     test; the runner calls every test whose
+//     name contains the filter
+//   - CHECK records a failed condition and goes
+//     on, REQUIRE also returns from the test
+//   - TestImage: a freshly formatted image in the
+//     test directory, removed again afterwards
+//
+// Tests go through the programmatic API and look
+// at the Status, FsStat and FsckReport values it
+// returns. Each test starts on its own image.
+// =============================================
+
+using TestFunction = void (*)();
+
+struct TestCase {
+    std::string name;
+    TestFunction function;
+};
+
+std::vector<TestCase>& testRegistry();
+bool registerTest(const std::string& name, TestFunction function);
+
+#define VFS_TEST_CONCAT2(a, b) a##b
+#define VFS_TEST_CONCAT(a, b) VFS_TEST_CONCAT2(a, b)
+#define VFS_TEST(name, function) \
+    static const bool VFS_TEST_CONCAT(vfsTest_, __LINE__) = registerTest(name, function)
+
+// Counts a failure of the running test (and prints where) if !passed
+bool testCheck(bool passed, const char* expression, const char* file, int line);
+void testSkip(const std::string& reason);         // Report the running test as skipped
+
+#define CHECK(condition) testCheck(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
+#define REQUIRE(condition) \
+    do { if (!testCheck(static_cast<bool>(condition), #condition, __FILE__, __LINE__)) return; } while (0)
+
+std::string testPath(const std::string& name);   // File in the test directory
+std::string shellBinary();                       // The vfs shell (--vfs), "" if not found
+bool writeHostFile(const std::string& path, const std::vector<char>& content); // False on error
+std::vector<char> randomBytes(long long size, uint64_t seed); // Deterministic content
+
+// -------------------------------------------------
+// TestImage
+// -------------------------------------------------
+// A formatted image used by one test. Output of the
+// commands is discarded; reopen() closes the image
+// and mounts it again, as a new process would.
+// -------------------------------------------------
+class TestImage {
+public:
+    explicit TestImage(int sizeMB, int clusterSize = FileSystem::DEFAULT_CLUSTER_SIZE);
+    ~TestImage();
+    TestImage(const TestImage&) = delete;
+    TestImage& operator=(const TestImage&) = delete;
+
+    FileSystem& fs() { return *fs_; }
+    bool ok() const { return ok_; }
+    const std::string& path() const { return path_; }
+    void close();                                  // Write everything back, unmount
+    void reopen();                                 // Mount the image again
+
+private:
+    std::string path_;
+    std::unique_ptr<FileSystem> fs_;
+    Session session_;
+    bool ok_ = false;
+};